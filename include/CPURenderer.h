@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * CPURenderer.h
+ * MGL
+ *
+ */
+
+#ifndef CPURenderer_h
+#define CPURenderer_h
+
+#ifndef __GLM_CONTEXT_
+#define __GLM_CONTEXT_
+typedef struct GLMContextRec_t *GLMContext;
+#endif
+
+// headless reference backend, fills GLMMetalFuncs with a tile binned software rasterizer
+//
+// shaders are not executed, attribute 0 is taken as the clip space position and attribute 1
+// (when enabled) as a flat color, so the backend is meant for exercising and timing the
+// state tracking / validation paths without a GPU, not for image comparisons against Metal.
+
+typedef struct CPURendererStats_t
+{
+    unsigned long long frames;
+    unsigned long long draws;
+    unsigned long long clears;
+    unsigned long long blits;
+    unsigned long long uploads;
+    unsigned long long triangles;
+    unsigned long long triangles_culled;
+    unsigned long long primitives_skipped;
+    unsigned long long tiles_rasterized;
+    unsigned long long pixels_written;
+} CPURendererStats;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void *createCPURendererAndBindToContext(GLMContext glm_ctx, unsigned width, unsigned height);
+    void destroyCPURenderer(GLMContext glm_ctx);
+
+    void CPURendererGetStats(GLMContext glm_ctx, CPURendererStats *stats);
+    void CPURendererResetStats(GLMContext glm_ctx);
+
+    // direct access to the drawable, BGRA8 rows bottom to top
+    const void *CPURendererDrawable(GLMContext glm_ctx, unsigned *width, unsigned *height, unsigned *pitch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPURenderer_h */
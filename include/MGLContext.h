@@ -22,7 +22,57 @@ enum
     MGL_DEPTH_TYPE,
     MGL_STENCIL_FORMAT,
     MGL_STENCIL_TYPE,
-    MGL_CONTEXT_FLAGS
+    MGL_CONTEXT_FLAGS,
+    MGL_PENDING_RELEASES,
+    MGL_PIPELINE_CACHE_HITS,
+    MGL_PIPELINE_CACHE_MISSES,
+    MGL_PIPELINE_CACHE_EVICTIONS,
+    MGL_RENDER_PASSES,
+    MGL_UNIFORM_UPLOADS,
+    MGL_DIRTY_BYTES,
+    MGL_BUFFER_RENAMES,
+    MGL_BUFFER_RENAME_ALLOCATIONS,
+    MGL_BLIT_ENCODERS,
+    MGL_SHADER_CACHE_HITS,
+    MGL_SHADER_CACHE_MISSES,
+    MGL_SPIRV_OPTIMIZER,
+    MGL_SPIRV_INSTRUCTIONS_IN,
+    MGL_SPIRV_INSTRUCTIONS_OUT,
+    MGL_INDEX_UPLOADS,
+    MGL_UPLOAD_RING_ALLOCATIONS,
+    MGL_VERTEX_LAYOUT_HITS,
+    MGL_VERTEX_LAYOUT_MISSES,
+    MGL_DRAW_BATCHING,
+    MGL_MERGED_DRAWS,
+    MGL_DRAW_BATCHES,
+    MGL_GENERATED_INDEX_HITS,
+    MGL_GENERATED_INDEX_MISSES
+};
+
+// MGL_SPIRV_OPTIMIZER
+enum
+{
+    MGL_SPIRV_OPTIMIZE_NONE,
+    MGL_SPIRV_OPTIMIZE_SIZE,
+    MGL_SPIRV_OPTIMIZE_PERFORMANCE
+};
+
+// MGLgetShaderStats and MGLgetProgramStats, times are in nanoseconds, a program adds up its stages and the
+// shaders attached to it
+enum
+{
+    MGL_STATS_SOURCE_BYTES,
+    MGL_STATS_PREPROCESS_TIME,
+    MGL_STATS_PARSE_TIME,
+    MGL_STATS_LINK_TIME,
+    MGL_STATS_SPIRV_TIME,
+    MGL_STATS_SPIRV_OPT_TIME,
+    MGL_STATS_MSL_TIME,
+    MGL_STATS_LIBRARY_TIME,
+    MGL_STATS_SPIRV_WORDS,
+    MGL_STATS_MSL_BYTES,
+    MGL_STATS_SPIRV_INSTRUCTIONS_IN,
+    MGL_STATS_SPIRV_INSTRUCTIONS_OUT
 };
 
 #ifdef __cplusplus
@@ -45,6 +95,16 @@ extern "C"
     // MGLget can take NULL for the ctx, in this case it will use the current ctx
     void MGLget(GLMContext ctx, GLenum param, GLuint *data);
 
+    // MGLset can take NULL for the ctx, in this case it will use the current ctx
+    void MGLset(GLMContext ctx, GLenum param, GLuint data);
+
+    // compile and link timings and sizes of one shader or program, NULL for the ctx uses the current ctx
+    void MGLgetShaderStats(GLMContext ctx, GLuint shader, GLenum param, GLuint64 *data);
+    void MGLgetProgramStats(GLMContext ctx, GLuint program, GLenum param, GLuint64 *data);
+
+    // writes every shader and program stage as a row of csv, a NULL path writes to stdout
+    bool MGLwriteShaderStats(GLMContext ctx, const char *path = NULL);
+
 #ifdef __cplusplus
 };
 #endif
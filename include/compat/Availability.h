@@ -0,0 +1,16 @@
+//
+//  Availability.h
+//  MGL
+//
+//  Created by Michael Larson on 1/6/25.
+//
+
+#ifndef mgl_compat_Availability_h
+#define mgl_compat_Availability_h
+
+// clang answers true off apple, gcc doesn't know the builtin
+#if !defined(__clang__)
+#define __builtin_available(...) 1
+#endif
+
+#endif /* mgl_compat_Availability_h */
@@ -0,0 +1,13 @@
+//
+//  kern_return.h
+//  MGL
+//
+//  Created by Michael Larson on 1/6/25.
+//
+
+#ifndef mgl_compat_kern_return_h
+#define mgl_compat_kern_return_h
+
+#include <mach/vm_types.h>
+
+#endif /* mgl_compat_kern_return_h */
@@ -0,0 +1,24 @@
+//
+//  mach_init.h
+//  MGL
+//
+//  Created by Michael Larson on 1/6/25.
+//
+
+#ifndef mgl_compat_mach_init_h
+#define mgl_compat_mach_init_h
+
+#include <mach/vm_types.h>
+
+// there is only the one address space, the map argument is ignored
+static inline vm_map_t mach_task_self(void)
+{
+    return 0;
+}
+
+static inline vm_map_t mach_host_self(void)
+{
+    return 0;
+}
+
+#endif /* mgl_compat_mach_init_h */
@@ -0,0 +1,55 @@
+//
+//  mach_vm.h
+//  MGL
+//
+//  Created by Michael Larson on 1/6/25.
+//
+
+#ifndef mgl_compat_mach_vm_h
+#define mgl_compat_mach_vm_h
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <mach/vm_types.h>
+
+#define VM_FLAGS_ANYWHERE 0x0001
+
+// anonymous mappings are page aligned and zero filled like vm_allocate
+static inline kern_return_t vm_allocate(vm_map_t map, vm_address_t *address, vm_size_t size, int flags)
+{
+    void *ptr;
+
+    (void)map;
+
+    if (!(flags & VM_FLAGS_ANYWHERE))
+        return KERN_INVALID_ARGUMENT;
+
+    if (size == 0)
+    {
+        *address = 0;
+        return KERN_SUCCESS;
+    }
+
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return KERN_NO_SPACE;
+
+    *address = (vm_address_t)ptr;
+
+    return KERN_SUCCESS;
+}
+
+static inline kern_return_t vm_deallocate(vm_map_t map, vm_address_t address, vm_size_t size)
+{
+    (void)map;
+
+    if (size == 0)
+        return KERN_SUCCESS;
+
+    if (munmap((void *)address, size))
+        return KERN_INVALID_ARGUMENT;
+
+    return KERN_SUCCESS;
+}
+
+#endif /* mgl_compat_mach_vm_h */
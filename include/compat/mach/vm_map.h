@@ -0,0 +1,13 @@
+//
+//  vm_map.h
+//  MGL
+//
+//  Created by Michael Larson on 1/6/25.
+//
+
+#ifndef mgl_compat_vm_map_h
+#define mgl_compat_vm_map_h
+
+#include <mach/mach_vm.h>
+
+#endif /* mgl_compat_vm_map_h */
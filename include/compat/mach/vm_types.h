@@ -0,0 +1,24 @@
+//
+//  vm_types.h
+//  MGL
+//
+//  Created by Michael Larson on 1/6/25.
+//
+
+// non apple builds only, the bits of mach vm the C core uses mapped onto mmap
+
+#ifndef mgl_compat_vm_types_h
+#define mgl_compat_vm_types_h
+
+#include <stdint.h>
+
+typedef uintptr_t vm_address_t;
+typedef uintptr_t vm_size_t;
+typedef uintptr_t vm_map_t;
+typedef int kern_return_t;
+
+#define KERN_SUCCESS 0
+#define KERN_INVALID_ARGUMENT 4
+#define KERN_NO_SPACE 3
+
+#endif /* mgl_compat_vm_types_h */
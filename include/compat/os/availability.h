@@ -0,0 +1,14 @@
+//
+//  availability.h
+//  MGL
+//
+//  Created by Michael Larson on 1/6/25.
+//
+
+#ifndef mgl_compat_os_availability_h
+#define mgl_compat_os_availability_h
+
+#define API_AVAILABLE(...)
+#define API_UNAVAILABLE(...)
+
+#endif /* mgl_compat_os_availability_h */
@@ -22,6 +22,9 @@
 #define glm_context_h
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <assert.h>
 
 #include <mach/vm_types.h>
@@ -30,7 +33,7 @@
 
 #include "glm_dispatch.h"
 
-#include "hash_table.h"
+#include "slot_map.h"
 
 // defines above set sizes in glm_params
 #include "glm_params.h"
@@ -117,6 +120,7 @@ enum
     _COPY_WRITE_BUFFER,
     _DISPATCH_INDIRECT_BUFFER,
     _DRAW_INDIRECT_BUFFER,
+    _PARAMETER_BUFFER,
     _MAX_BUFFER_TYPES
 };
 
@@ -219,12 +223,29 @@ typedef struct
     unsigned int baseInstance;
 } DrawElementsIndirectCommand;
 
+// dirty byte ranges are kept sorted and coalesced, touching ranges merge and running out of
+// entries collapses the set into a single covering range
+#define MAX_BUFFER_DIRTY_RANGES 16
+
+typedef struct BufferRange_t
+{
+    size_t start;
+    size_t end;
+} BufferRange;
+
 typedef struct BufferData_t
 {
     GLuint dirty_bits;
     size_t buffer_size;
     vm_address_t buffer_data;
     void *mtl_data;
+
+    GLuint dirty_range_count;
+    BufferRange dirty_ranges[MAX_BUFFER_DIRTY_RANGES];
+
+    GLuint generation; // bumped with every dirty range, anything derived from the contents compares it
+
+    GLuint64 gpu_write_serial; // command buffer of a queued gpu copy / shader write, 0 when buffer_data is current
 } BufferData;
 
 #define BUFFER_IMMUTABLE_STORAGE_FLAG 0x1
@@ -398,6 +419,22 @@ typedef struct VertexElementArray_t
     const void *ptr;
 } VertexElementArray;
 
+// which metal vertex buffer each enabled attrib reads from, worked out once per vao and program and kept
+// until either of them changes
+#define VERTEX_LAYOUT_CACHE_SIZE 4
+
+typedef struct VertexLayout_t
+{
+    GLuint vao_generation;
+    GLuint program_generation; // link_generation of the program
+    GLuint start;              // first vertex buffer index, the program's buffers come before it
+    GLuint count;
+    GLuint attribute_mask[MAX_ATTRIBS]; // per vertex buffer
+    Buffer *buffers[MAX_ATTRIBS];
+    GLubyte buffer_index[MAX_ATTRIBS]; // per attrib
+    void *mtl_vertex_descriptor;
+} VertexLayout;
+
 typedef struct VertexArray_t
 {
     GLuint dirty_bits;
@@ -406,8 +443,19 @@ typedef struct VertexArray_t
     VertexAttrib attrib[MAX_ATTRIBS];
     VertexElementArray element_array;
     void *mtl_data;
+    GLuint generation; // changes whenever the attribs do
+    GLuint next_layout;
+    VertexLayout layouts[VERTEX_LAYOUT_CACHE_SIZE];
 } VertexArray;
 
+// where a shader's compile time went, written by whichever thread compiled it, times are in nanoseconds
+typedef struct ShaderStats_t
+{
+    GLuint64 preprocess_ns;
+    GLuint64 parse_ns;
+    GLuint source_bytes;
+} ShaderStats;
+
 typedef struct Shader_t
 {
     GLuint dirty_bits;
@@ -418,23 +466,30 @@ typedef struct Shader_t
     size_t src_len;
     const char *src;
     glslang_shader_t *compiled_glsl_shader;
-    const char *entry_point;
     char *log;
     struct
     {
         void *function;
         void *library;
     } mtl_data;
+    // ARB_gl_spirv, a module from glShaderBinary replaces the glsl source and is translated without glslang
+    struct
+    {
+        unsigned int *ir;
+        size_t size;
+        char *entry_point; // module entry point picked by glSpecializeShader
+        GLuint num_constants;
+        GLuint *constant_ids;
+        GLuint *constant_values;
+        GLboolean specialized;
+    } spirv_module;
+    // background work on this shader, guarded by the compile queue lock
+    GLuint pending_compile;
+    GLuint pending_links;  // queued links that read this shader
+    GLboolean linking;     // held by a glslang link
+    ShaderStats stats;
 } Shader;
 
-typedef struct Spirv_t
-{
-    GLuint stage;
-    size_t size;
-    unsigned int *ir;
-    char *msl_str;
-} Spirv;
-
 typedef struct SpirvResource_t
 {
     GLuint _id;
@@ -446,16 +501,62 @@ typedef struct SpirvResource_t
     GLuint location;
 } SpirvResource;
 
-typedef struct SpirvResourceList_t
+// one stage's reflection while its program links, a single block with the resources grouped by type and the
+// names after them, commitProgramReflection folds every stage into the program's arena
+typedef struct SpirvReflection_t
 {
-    GLuint count;
-    SpirvResource *list;
-} SpirvResourceList;
+    GLuint count[_MAX_SPIRV_RES];
+    SpirvResource *resources;
+    char *names;
+    size_t names_len;
+} SpirvReflection;
+
+typedef struct Spirv_t
+{
+    GLuint stage;
+    size_t size;
+    unsigned int *ir;
+    char *msl_str;
+    char *entry_point; // metal function name for this program stage
+    SpirvReflection *reflection;
+} Spirv;
+
+// every stage's resources in one flat array, each (stage, type) run starts at its offset and ends at the next
+typedef struct ProgramReflection_t
+{
+    SpirvResource *resources; // the arena, the interned names follow the resources
+    GLuint offsets[_MAX_SHADER_TYPES * _MAX_SPIRV_RES + 1];
+} ProgramReflection;
+
+#define PROGRAM_RESOURCE_RUN(_STAGE_, _TYPE_) ((_STAGE_) * _MAX_SPIRV_RES + (_TYPE_))
+#define PROGRAM_RESOURCE_COUNT(_PTR_, _STAGE_, _TYPE_)                                                                 \
+    ((_PTR_)->reflection.offsets[PROGRAM_RESOURCE_RUN(_STAGE_, _TYPE_) + 1] -                                          \
+     (_PTR_)->reflection.offsets[PROGRAM_RESOURCE_RUN(_STAGE_, _TYPE_)])
+#define PROGRAM_RESOURCES(_PTR_, _STAGE_, _TYPE_)                                                                      \
+    ((_PTR_)->reflection.resources + (_PTR_)->reflection.offsets[PROGRAM_RESOURCE_RUN(_STAGE_, _TYPE_)])
+
+// name lookups for a linked program, open addressed and built once per link
+typedef struct ProgramResourceName_t
+{
+    GLuint hash;
+    GLenum interface; // GL_UNIFORM, GL_UNIFORM_BLOCK...
+    const char *name; // points into the program's reflection, NULL for an empty slot
+    GLuint index;
+    GLint location;
+} ProgramResourceName;
+
+typedef struct ProgramResourceIndex_t
+{
+    GLuint mask; // slot count - 1
+    ProgramResourceName *slots;
+} ProgramResourceIndex;
 
 typedef struct BufferMap_t
 {
     GLuint buffer_base_index;
     GLuint attribute_mask;
+    GLboolean uniform_constant; // buf is NULL, bound from the program's uniform block at buffer_base_index
+    GLboolean writable;         // storage and atomic counter buffers, the shader can change buf
     Buffer *buf;
     GLintptr offset;
 } BufferMap;
@@ -466,21 +567,84 @@ typedef struct BufferMapList_t
     BufferMap buffers[MAX_ATTRIBS];
 } BufferMapList;
 
+// default block uniforms of a program packed into one block, the renderer uploads the whole block once per
+// draw when it is dirty and binds each location at its offset, metal wants constant buffer offsets on 256 bytes
+#define UNIFORM_CONSTANT_ALIGNMENT 256
+
+typedef struct UniformConstants_t
+{
+    GLuint dirty;
+    GLuint size;
+    GLuint capacity;
+    GLubyte *data;
+    GLuint offset[MAX_BINDABLE_BUFFERS];
+    GLuint length[MAX_BINDABLE_BUFFERS]; // 0 until the location is first set
+} UniformConstants;
+
+// where a program's link time went, per stage except for the one glslang link, times are in nanoseconds
+typedef struct ProgramStageStats_t
+{
+    GLuint64 spirv_ns;     // glslang spirv generation
+    GLuint64 spirv_opt_ns; // spirv-opt
+    GLuint64 msl_ns;       // spirv-cross
+    GLuint64 library_ns;   // the metal library compile, done when the program is first bound
+    GLuint spirv_words;
+    GLuint msl_bytes;
+    GLuint instructions_in;  // spirv instructions handed to spirv-opt
+    GLuint instructions_out; // what spirv-opt left of them, the same as instructions_in when it's off
+    GLboolean cached;        // the msl came from the shader cache
+} ProgramStageStats;
+
+typedef struct ProgramStats_t
+{
+    GLuint64 link_ns;
+    ProgramStageStats stages[_MAX_SHADER_TYPES];
+} ProgramStats;
+
 typedef struct Program_t
 {
     GLuint dirty_bits;
     GLuint name;
     Shader *shader_slots[_MAX_SHADER_TYPES];
-    glslang_program_t *linked_glsl_program;
+    Shader *attached_slots[_MAX_SHADER_TYPES]; // the app's shaders while shader_slots holds glProgramBinary stages
+    GLboolean binary;                          // shader_slots came from glProgramBinary
+    GLboolean linked;
     Spirv spirv[_MAX_SHADER_TYPES];
-    SpirvResourceList spirv_resources_list[_MAX_SHADER_TYPES][_MAX_SPIRV_RES];
+    ProgramReflection reflection;
+    GLboolean draw_parameters; // a stage reads gl_DrawID or the base vertex/instance, its draws aren't batched
     struct
     {
         unsigned x, y, z;
     } local_workgroup_size;
+    UniformConstants uniform_constants;
+    ProgramResourceIndex resource_index;
     void *mtl_data;
+    // background link, pending_link is guarded by the compile queue lock, the rest is only touched by the
+    // context's thread or the worker running the link
+    GLuint pending_link;
+    GLboolean link_queued;  // not joined yet
+    GLenum link_error;      // raised on the thread that joins the link
+    GLboolean separable;    // GL_PROGRAM_SEPARABLE
+    GLuint link_generation; // changes every time the link is joined, see ProgramPipeline
+    GLboolean delete_pending; // GL_DELETE_STATUS, freed once it isn't current or used by a pipeline stage
+    GLuint pipeline_refs;     // pipeline stages using the program
+    ProgramStats stats;
 } Program;
 
+// glUseProgramStages picks a program per stage, the stages are combined into a program of their own that
+// borrows each stage program's translated module and reflection, so binding a pipeline never translates
+typedef struct ProgramPipeline_t
+{
+    GLuint name;
+    GLuint programs[_MAX_SHADER_TYPES];         // 0 for an empty stage
+    GLuint link_generations[_MAX_SHADER_TYPES]; // of each stage program when the stages were combined
+    GLuint active_program;                      // GL_ACTIVE_PROGRAM
+    GLboolean dirty;                            // a stage changed since the stages were combined
+    GLboolean valid;                            // the stage interfaces matched
+    char *info_log;
+    Program program; // the combined stages, what the renderer sees while the pipeline is in use
+} ProgramPipeline;
+
 typedef struct Renderbuffer_t
 {
     GLuint dirty_bits;
@@ -625,17 +789,19 @@ typedef struct
 
     GLsizei sync_name;
 
-    HashTable vao_table;
-    HashTable buffer_table;
-    HashTable texture_table;
-    HashTable shader_table;
-    HashTable program_table;
-    HashTable renderbuffer_table;
-    HashTable framebuffer_table;
-    HashTable sampler_table;
+    SlotMap vao_table;
+    SlotMap buffer_table;
+    SlotMap texture_table;
+    SlotMap shader_table;
+    SlotMap program_table;
+    SlotMap renderbuffer_table;
+    SlotMap framebuffer_table;
+    SlotMap sampler_table;
+    SlotMap program_pipeline_table;
 
     Shader *shaders[_MAX_SHADER_TYPES];
-    Program *program;
+    Program *program; // the current program or the bound pipeline's combined stages
+    ProgramPipeline *program_pipeline;
 
     BufferBase buffer_base[_MAX_BUFFER_TYPES];
 
@@ -689,6 +855,10 @@ struct GLMMetalFuncs
     void (*mtlBufferSubData)(GLMContext glm_ctx, Buffer *buf, size_t offset, size_t size, const void *ptr);
     void *(*mtlMapUnmapBuffer)(GLMContext glm_ctx, Buffer *buf, size_t offset, size_t size, GLenum access, bool map);
     void (*mtlFlushBufferRange)(GLMContext glm_ctx, Buffer *buf, GLintptr offset, GLsizeiptr length);
+    bool (*mtlRenameBuffer)(GLMContext glm_ctx, Buffer *buf, size_t size);
+    void (*mtlCopyBufferSubData)(GLMContext glm_ctx, Buffer *src, Buffer *dst, size_t read_offset,
+                                 size_t write_offset, size_t size);
+    void (*mtlWaitForBufferWrites)(GLMContext glm_ctx, Buffer *buf);
 
     void (*mtlReadDrawable)(GLMContext glm_ctx, void *pixelBytes, GLuint bytesPerRow, GLuint bytesPerImage, GLint x,
                             GLint y, GLsizei width, GLsizei height);
@@ -699,6 +869,8 @@ struct GLMMetalFuncs
     void (*mtlTexSubImage)(GLMContext glm_ctx, Texture *tex, Buffer *buf, size_t src_offset, size_t src_pitch,
                            size_t src_image_size, size_t src_size, GLuint slice, GLuint level, size_t width,
                            size_t height, size_t depth, size_t xoffset, size_t yoffset, size_t zoffset);
+    void (*mtlTexSubImageData)(GLMContext glm_ctx, Texture *tex, const void *pixels, size_t src_pitch, GLuint level,
+                               size_t width, size_t height, size_t xoffset, size_t yoffset);
 
     // draw arrays / elements
     void (*mtlDrawArrays)(GLMContext ctx, GLenum mode, GLint first, GLsizei count);
@@ -745,10 +917,102 @@ struct GLMMetalFuncs
     void (*mtlMultiDrawElementsIndirect)(GLMContext ctx, GLenum mode, GLenum type, const void *indirect,
                                          GLsizei drawcount, GLsizei stride);
 
+    // drawcount is an offset into the parameter buffer, the count is read on the gpu
+    void (*mtlMultiDrawArraysIndirectCount)(GLMContext ctx, GLenum mode, const void *indirect, GLintptr drawcount,
+                                            GLsizei maxdrawcount, GLsizei stride);
+    void (*mtlMultiDrawElementsIndirectCount)(GLMContext ctx, GLenum mode, GLenum type, const void *indirect,
+                                              GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
+
     void (*mtlDispatchCompute)(GLMContext ctx, GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
     void (*mtlDispatchComputeIndirect)(GLMContext ctx, GLintptr indirect);
 };
 
+typedef struct GLMStats_t
+{
+    GLuint pending_releases; // deleted backend objects waiting on command buffer completion
+
+    GLuint pipeline_cache_hits;
+    GLuint pipeline_cache_misses;
+    GLuint pipeline_cache_evictions;
+
+    GLuint render_passes; // render passes used by the last swapped frame
+
+    GLuint uniform_uploads; // default uniform blocks copied into the uniform ring
+
+    GLuint dirty_bytes; // buffer bytes synced to the gpu by the last swapped frame
+
+    GLuint buffer_renames;            // respecified buffers handed a recycled backing store
+    GLuint buffer_rename_allocations; // renames that found nothing retired in the pool
+
+    GLuint blit_encoders; // blit encoders used by the last swapped frame
+
+    GLuint shader_cache_hits;   // program stages linked from the shader cache
+    GLuint shader_cache_misses; // program stages translated by glslang and spirv-cross
+
+    GLuint spirv_instructions_in;  // spirv instructions handed to spirv-opt
+    GLuint spirv_instructions_out; // what spirv-opt left of them
+
+    GLuint index_uploads;           // element buffers without a backing store copied into the upload ring
+    GLuint upload_ring_allocations; // backing stores created for the upload ring
+
+    GLuint vertex_layout_hits;   // vao and program pairs bound again with their attrib mapping intact
+    GLuint vertex_layout_misses; // attrib mappings worked out from scratch
+
+    GLuint merged_draws; // draws the last swapped frame submitted along with the draw before them
+    GLuint draw_batches; // submissions of more than one draw in the last swapped frame
+
+    GLuint generated_index_hits;   // fan, loop and quad draws that reused their converted indices
+    GLuint generated_index_misses; // conversions done from scratch
+} GLMStats;
+
+// consecutive glDrawArrays / glDrawElements with nothing called in between share one backend submission,
+// see draw_buffers.c
+#define DRAW_BATCH_SIZE 256
+
+typedef struct DrawBatch_t
+{
+    GLuint count;
+    GLenum mode;
+    GLenum type; // 0 for glDrawArrays
+    GLint first[DRAW_BATCH_SIZE];
+    GLsizei counts[DRAW_BATCH_SIZE];
+    const void *indices[DRAW_BATCH_SIZE];
+
+    GLuint merged_draws; // this frame, moved to the stats on a swap
+    GLuint batches;
+} DrawBatch;
+
+// primitives metal can't draw are converted to triangle and line lists, the results are kept in a bounded lru so
+// repeated draws convert once, see index_gen.c
+#define GENERATED_INDEX_CACHE_SIZE 64
+#define GENERATED_INDEX_CACHE_BYTES (16 * 1024 * 1024)
+
+typedef struct GeneratedIndices_t
+{
+    // key, an entry with no data is empty
+    GLenum mode;
+    GLint first;         // first vertex for arrays, byte offset into the element buffer for elements
+    GLsizei count;
+    GLenum type;         // 0 for arrays
+    GLuint buffer;       // element buffer name
+    GLuint generation;   // of the element buffer the indices came from
+    GLuint restart;      // restart index in effect, 0 when restart is off
+    GLboolean restart_on;
+
+    GLenum out_mode;     // GL_POINTS, GL_LINES or GL_TRIANGLES
+    GLsizei out_count;
+    GLuint *data;
+    void *mtl_data;      // backend copy, released with the entry
+    GLuint64 last_used;
+} GeneratedIndices;
+
+typedef struct GeneratedIndexCache_t
+{
+    GLuint64 clock;
+    size_t bytes;
+    GeneratedIndices entries[GENERATED_INDEX_CACHE_SIZE];
+} GeneratedIndexCache;
+
 typedef struct GLMContextRec_t
 {
     GLuint context_flags;
@@ -763,7 +1027,16 @@ typedef struct GLMContextRec_t
     PixelFormat depth_format;
     PixelFormat stencil_format;
 
-    BufferData *temp_element_buffer;
+    GLMStats stats;
+
+    struct CompileQueue_t *compile_queue;
+    GLuint spirv_optimizer; // MGL_SPIRV_OPTIMIZE_NONE...
+    GLuint link_generation; // last handed to a program
+
+    GLboolean draw_batching; // MGL_DRAW_BATCHING
+    DrawBatch draw_batch;
+
+    GeneratedIndexCache generated_indices;
 
     void (*error_func)(GLMContext ctx, const char *func, GLenum type);
 } GLMContextRec;
@@ -781,7 +1054,57 @@ enum
     MGL_DEPTH_TYPE,
     MGL_STENCIL_FORMAT,
     MGL_STENCIL_TYPE,
-    MGL_CONTEXT_FLAGS
+    MGL_CONTEXT_FLAGS,
+    MGL_PENDING_RELEASES,
+    MGL_PIPELINE_CACHE_HITS,
+    MGL_PIPELINE_CACHE_MISSES,
+    MGL_PIPELINE_CACHE_EVICTIONS,
+    MGL_RENDER_PASSES,
+    MGL_UNIFORM_UPLOADS,
+    MGL_DIRTY_BYTES,
+    MGL_BUFFER_RENAMES,
+    MGL_BUFFER_RENAME_ALLOCATIONS,
+    MGL_BLIT_ENCODERS,
+    MGL_SHADER_CACHE_HITS,
+    MGL_SHADER_CACHE_MISSES,
+    MGL_SPIRV_OPTIMIZER,
+    MGL_SPIRV_INSTRUCTIONS_IN,
+    MGL_SPIRV_INSTRUCTIONS_OUT,
+    MGL_INDEX_UPLOADS,
+    MGL_UPLOAD_RING_ALLOCATIONS,
+    MGL_VERTEX_LAYOUT_HITS,
+    MGL_VERTEX_LAYOUT_MISSES,
+    MGL_DRAW_BATCHING,
+    MGL_MERGED_DRAWS,
+    MGL_DRAW_BATCHES,
+    MGL_GENERATED_INDEX_HITS,
+    MGL_GENERATED_INDEX_MISSES
+};
+
+// MGL_SPIRV_OPTIMIZER
+enum
+{
+    MGL_SPIRV_OPTIMIZE_NONE,
+    MGL_SPIRV_OPTIMIZE_SIZE,
+    MGL_SPIRV_OPTIMIZE_PERFORMANCE
+};
+
+// MGLgetShaderStats and MGLgetProgramStats, times are in nanoseconds, a program adds up its stages and the
+// shaders attached to it
+enum
+{
+    MGL_STATS_SOURCE_BYTES,
+    MGL_STATS_PREPROCESS_TIME,
+    MGL_STATS_PARSE_TIME,
+    MGL_STATS_LINK_TIME,
+    MGL_STATS_SPIRV_TIME,
+    MGL_STATS_SPIRV_OPT_TIME,
+    MGL_STATS_MSL_TIME,
+    MGL_STATS_LIBRARY_TIME,
+    MGL_STATS_SPIRV_WORDS,
+    MGL_STATS_MSL_BYTES,
+    MGL_STATS_SPIRV_INSTRUCTIONS_IN,
+    MGL_STATS_SPIRV_INSTRUCTIONS_OUT
 };
 
 #ifdef __cplusplus
@@ -793,6 +1116,10 @@ extern "C"
     GLuint bicountForFormatType(GLenum format, GLenum type, GLenum component);
     GLMContext MGLgetCurrentContext(void);
     void MGLget(GLMContext ctx, GLenum param, GLuint *data);
+    void MGLset(GLMContext ctx, GLenum param, GLuint data);
+    void MGLgetShaderStats(GLMContext ctx, GLuint shader, GLenum param, GLuint64 *data);
+    void MGLgetProgramStats(GLMContext ctx, GLuint program, GLenum param, GLuint64 *data);
+    bool MGLwriteShaderStats(GLMContext ctx, const char *path);
     bool pixelConvertToInternalFormat(GLMContext ctx, GLenum internalformat, GLenum format, GLenum type,
                                       const void *src, void *dst, size_t len);
 
@@ -1270,6 +1270,7 @@ struct GLMDispatchTable
     void (*multi_draw_elements_indirect_count)(GLMContext ctx, GLenum mode, GLenum type, const void *indirect,
                                                GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
     void (*polygon_offset_clamp)(GLMContext ctx, GLfloat factor, GLfloat units, GLfloat clamp);
+    void (*max_shader_compiler_threads)(GLMContext ctx, GLuint count);
 };
 
 #endif // #ifndef glm_dispatch_h
@@ -1234,5 +1234,6 @@ void mglMultiDrawArraysIndirectCount(GLMContext ctx, GLenum mode, const void *in
 void mglMultiDrawElementsIndirectCount(GLMContext ctx, GLenum mode, GLenum type, const void *indirect,
                                        GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
 void mglPolygonOffsetClamp(GLMContext ctx, GLfloat factor, GLfloat units, GLfloat clamp);
+void mglMaxShaderCompilerThreadsKHR(GLMContext ctx, GLuint count);
 
 #endif /* mgl_h */
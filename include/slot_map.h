@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * slot_map.h
+ * MGL
+ *
+ */
+
+#ifndef slot_map_h
+#define slot_map_h
+
+#include <stdbool.h>
+
+#include "glcorearb.h"
+
+// object names are a slot index tagged with a generation in the upper bits, deleting an object
+// bumps the generation so the slot can be recycled without stale names finding the new object
+//
+// slot 0 is never handed out so name 0 stays the default object
+#define SLOT_MAP_INDEX_BITS 22
+#define SLOT_MAP_INDEX_MASK ((0x1u << SLOT_MAP_INDEX_BITS) - 1)
+#define SLOT_MAP_GENERATION_MASK (0xffffffffu >> SLOT_MAP_INDEX_BITS)
+#define SLOT_MAP_FREE 0xffffffffu
+
+typedef struct SlotMapObj_t
+{
+    GLuint name;
+    void *data;
+} SlotMapObj;
+
+typedef struct SlotMapSlot_t
+{
+    GLuint generation;
+    GLuint dense; // index into dense or SLOT_MAP_FREE
+} SlotMapSlot;
+
+typedef struct SlotMap_t
+{
+    // allocated names packed together, data is NULL until the object is created on first bind
+    GLuint count;
+    GLuint dense_size;
+    SlotMapObj *dense;
+
+    GLuint slot_count;
+    GLuint slot_size;
+    SlotMapSlot *slots;
+
+    // recycled slot indices
+    GLuint free_count;
+    GLuint free_size;
+    GLuint *free_list;
+} SlotMap;
+
+void initSlotMap(SlotMap *map, GLuint size);
+void freeSlotMap(SlotMap *map);
+GLuint getNewName(SlotMap *map);
+bool isStaleSlotMapName(SlotMap *map, GLuint name);
+bool insertSlotMapElement(SlotMap *map, GLuint name, void *data);
+void *searchSlotMap(SlotMap *map, GLuint name);
+void deleteSlotMapElement(SlotMap *map, GLuint name);
+
+#endif /* slot_map_h */
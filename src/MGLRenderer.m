@@ -34,10 +34,14 @@
 
 #import "MGLRenderer.h"
 #import "glm_context.h"
+#import "shader_stats.h"
+#import "index_gen.h"
 
 #define TRACE_FUNCTION() DEBUG_PRINT("%s\n", __FUNCTION__);
 
 extern void mglDrawBuffer(GLMContext ctx, GLenum buf);
+extern GLubyte *getUniformConstantStorage(GLMContext ctx, Program *program, GLint location, GLsizei size);
+extern void addBufferDirtyRange(BufferData *data, size_t offset, size_t length);
 
 // for resource types SPVC_RESOURCE_TYPE_UNIFORM_BUFFER..
 #import "spirv_cross_c.h"
@@ -49,6 +53,124 @@ typedef struct SyncList_t
     Sync **list;
 } SyncList;
 
+typedef struct ReleaseEntry_t
+{
+    void *obj;
+    uint64_t serial;
+} ReleaseEntry;
+
+typedef struct ReleaseList_t
+{
+    GLuint count;
+    GLuint size;
+    ReleaseEntry *list;
+} ReleaseList;
+
+// copies and uploads are queued and emitted together in one blit encoder at the next pass boundary
+enum
+{
+    PENDING_BLIT_COPY_BUFFER,
+    PENDING_BLIT_BUFFER_TO_TEXTURE,
+    PENDING_BLIT_COPY_TEXTURE,
+    PENDING_BLIT_GENERATE_MIPMAPS
+};
+
+typedef struct PendingBlit_t
+{
+    GLuint type;
+    void *src; // retained, NULL when the source bytes are in the staging area
+    void *dst; // retained
+    NSUInteger src_offset;
+    NSUInteger src_pitch;
+    NSUInteger src_image_size;
+    NSUInteger src_slice;
+    NSUInteger src_level;
+    MTLOrigin src_origin;
+    MTLSize src_size;
+    NSUInteger dst_offset;
+    NSUInteger dst_slice;
+    NSUInteger dst_level;
+    MTLOrigin dst_origin;
+    NSUInteger size;
+    bool synchronize;
+} PendingBlit;
+
+typedef struct PendingBlitList_t
+{
+    GLuint count;
+    GLuint size;
+    PendingBlit *list;
+
+    // client bytes copied at queue time, uploaded in one shared buffer when the batch goes out
+    size_t staging_used;
+    size_t staging_size;
+    GLubyte *staging;
+} PendingBlitList;
+
+#define PENDING_BLIT_STAGING_ALIGNMENT 16
+
+// retired backing stores waiting to be handed to a respecified buffer of the same size
+#define RENAME_POOL_SIZE 32
+
+// per frame linear allocator for default block uniforms, a frame's ring is reused once the gpu is done with it
+#define UNIFORM_RING_FRAMES 3
+#define UNIFORM_RING_SIZE (1024 * 1024)
+#define UNIFORM_RING_ALIGNMENT UNIFORM_CONSTANT_ALIGNMENT // locations are bound at block offsets, keep them aligned
+
+#define UPLOAD_RING_FRAMES 3
+#define UPLOAD_RING_SIZE (256 * 1024)
+#define UPLOAD_RING_ALIGNMENT 4 // indexBufferOffset has to be a multiple of the index size
+
+// multi draw indirect count, a compute pre-pass turns the indirect commands into an indirect command buffer so the
+// count never comes back to the cpu
+#define INDIRECT_COUNT_COMMANDS 1024
+#define INDIRECT_COUNT_THREADS 64
+
+// pipeline state cache, set associative so a lookup touches at most PIPELINE_CACHE_WAYS entries
+#define PIPELINE_CACHE_SETS 64
+#define PIPELINE_CACHE_WAYS 4
+
+// everything that goes into a MTLRenderPipelineDescriptor, bzero'd so it can be hashed and compared as bytes
+typedef struct PipelineKey_t
+{
+    void *vertex_function;
+    void *fragment_function;
+
+    uint32_t color_format[MAX_COLOR_ATTACHMENTS];
+    uint32_t depth_format;
+    uint32_t stencil_format;
+    uint32_t indirect_commands;
+
+    struct
+    {
+        uint8_t enabled;
+        uint8_t src_rgb, dst_rgb;
+        uint8_t src_alpha, dst_alpha;
+        uint8_t rgb_op, alpha_op;
+        uint8_t write_mask;
+    } blend[MAX_COLOR_ATTACHMENTS];
+
+    struct
+    {
+        uint32_t format;
+        uint32_t offset;
+        uint32_t buffer_index;
+        uint32_t stride;
+        uint32_t step_function;
+        uint32_t step_rate;
+    } attrib[MAX_ATTRIBS];
+} PipelineKey;
+
+typedef struct PipelineCacheEntry_t
+{
+    uint64_t hash;
+    uint64_t last_used;
+    PipelineKey key;
+    void *pipeline;          // retained id<MTLRenderPipelineState>, NULL if the entry is empty
+    void *vertex_function;   // retained so the key's function pointers can't be recycled
+    void *fragment_function; // while the entry is alive
+} PipelineCacheEntry;
+
 MTLPixelFormat mtlPixelFormatForGLTex(Texture *gl_tex);
 
 typedef struct MGLDrawable_t
@@ -98,6 +220,7 @@ enum
 
     // The render pipeline generated from the vertex and fragment shaders in the .metal shader file.
     id<MTLRenderPipelineState> _pipelineState;
+    VertexLayout *_vertexLayout; // of the bound vao and program, set when the vertex buffers are mapped
 
     // render pass descriptor containts the binding information for VAO's and such
     MTLRenderPassDescriptor *_renderPassDescriptor;
@@ -112,6 +235,46 @@ enum
 
     id<MTLEvent> _currentEvent;
     GLsizei _currentSyncName;
+
+    // deleted objects are held until the command buffer they were last seen in completes
+    uint64_t _submissionSerial;
+    uint64_t _completedSerial;
+    ReleaseList _releaseList;
+    ReleaseList _renamePool;
+
+    PipelineCacheEntry *_pipelineCache;
+    uint64_t _pipelineCacheClock;
+
+    // what the current render pass attachments were built from
+    Framebuffer *_renderPassFramebuffer;
+    GLenum _renderPassDrawBuffer;
+    bool _renderPassDepth;
+    bool _renderPassStencil;
+    GLuint _renderPassCount;
+
+    GLuint _dirtyBytes; // buffer bytes synced with didModifyRange this frame
+
+    PendingBlitList _pendingBlits;
+    GLuint _blitEncoderCount;
+
+    id<MTLBuffer> _uniformRing[UNIFORM_RING_FRAMES];
+    uint64_t _uniformRingSerial[UNIFORM_RING_FRAMES]; // last submission that read each ring
+    GLuint _uniformRingFrame;
+    NSUInteger _uniformRingHead;
+    NSUInteger _uniformRingOffset; // where _uniformRingProgram's block was last uploaded
+    Program *_uniformRingProgram;
+
+    id<MTLBuffer> _uploadRing[UPLOAD_RING_FRAMES];
+    uint64_t _uploadRingSerial[UPLOAD_RING_FRAMES]; // last submission that read each ring
+    GLuint _uploadRingFrame;
+    NSUInteger _uploadRingHead;
+
+    id<MTLComputePipelineState> _indirectCountPipelines[2]; // arrays, elements
+    id<MTLArgumentEncoder> _indirectCountArgumentEncoder;
+    bool _indirectCountDraw; // pipelines built while set can be inherited by an indirect command buffer
+    id<MTLIndirectCommandBuffer> _indirectCommands[UPLOAD_RING_FRAMES]; // follows the upload ring's frames
+    id<MTLBuffer> _indirectCommandsArguments[UPLOAD_RING_FRAMES];
+    NSUInteger _indirectCommandsHead;
 }
 
 MTLVertexFormat glTypeSizeToMtlType(GLuint type, GLuint size, bool normalized)
@@ -420,10 +583,108 @@ void logDirtyBits(GLMContext ctx)
     }
 }
 
+#pragma mark vertex layouts
+- (void)buildVertexLayout:(VertexLayout *)layout start:(GLuint)start
+{
+    VertexArray *vao;
+
+    vao = ctx->state.vao;
+
+    layout->start = start;
+    layout->count = 0;
+
+    for (int att = 0; att < ctx->state.max_vertex_attribs; att++)
+    {
+        if (vao->enabled_attribs & (0x1 << att))
+        {
+            Buffer *gl_buffer;
+            GLuint slot;
+
+            // shouldn't get here, validateVAO should have failed
+            gl_buffer = vao->attrib[att].buffer;
+            assert(gl_buffer);
+
+            // attribs reading the same buffer share a metal vertex buffer, check name and target, not pointers..
+            for (slot = 0; slot < layout->count; slot++)
+            {
+                if ((layout->buffers[slot]->name == gl_buffer->name) &&
+                    (layout->buffers[slot]->target == gl_buffer->target))
+                    break;
+            }
+
+            if (slot == layout->count)
+            {
+                layout->buffers[slot] = gl_buffer;
+                layout->attribute_mask[slot] = 0;
+                layout->count++;
+            }
+
+            layout->attribute_mask[slot] |= (0x1 << att);
+            layout->buffer_index[att] = start + slot;
+        }
+
+        if ((vao->enabled_attribs >> (att + 1)) == 0)
+            break;
+    }
+
+    // the vertex descriptor goes with the mapping, generateVertexDescriptor builds it again
+    if (layout->mtl_vertex_descriptor)
+    {
+        CFBridgingRelease(layout->mtl_vertex_descriptor);
+        layout->mtl_vertex_descriptor = NULL;
+    }
+}
+
+- (VertexLayout *)vertexLayoutWithStart:(GLuint)start
+{
+    VertexArray *vao;
+    Program *program;
+    VertexLayout *layout;
+
+    vao = ctx->state.vao;
+    program = ctx->state.program;
+
+    if ((vao == NULL) || (program == NULL))
+        return NULL;
+
+    layout = NULL;
+
+    for (int i = 0; i < VERTEX_LAYOUT_CACHE_SIZE; i++)
+    {
+        if (vao->layouts[i].program_generation == program->link_generation)
+        {
+            layout = &vao->layouts[i];
+            break;
+        }
+    }
+
+    if (layout && layout->vao_generation == vao->generation && layout->start == start)
+    {
+        ctx->stats.vertex_layout_hits++;
+
+        return layout;
+    }
+
+    // the vao or the program changed since, rebuild it in place, otherwise take the oldest one
+    if (layout == NULL)
+    {
+        layout = &vao->layouts[vao->next_layout];
+        vao->next_layout = (vao->next_layout + 1) % VERTEX_LAYOUT_CACHE_SIZE;
+    }
+
+    [self buildVertexLayout:layout start:start];
+
+    layout->vao_generation = vao->generation;
+    layout->program_generation = program->link_generation;
+
+    ctx->stats.vertex_layout_misses++;
+
+    return layout;
+}
+
 - (bool)mapGLBuffersToMTLBufferMap:(BufferMapList *)buffer_map stage:(int)stage
 {
     int count;
-    int mapped_buffers;
     struct
     {
         int spvc_type;
@@ -472,12 +733,42 @@ void logDirtyBits(GLMContext ctx)
                 // get the ubo binding from spirv
                 spirv_binding = [self getProgramBinding:stage type:spvc_type index:i];
 
+                // default block uniforms come from the program's uniform block, not a gl buffer
+                if (spvc_type == SPVC_RESOURCE_TYPE_UNIFORM_CONSTANT)
+                {
+                    Program *program;
+
+                    program = ctx->state.program;
+                    RETURN_FALSE_ON_FAILURE(spirv_binding < MAX_BINDABLE_BUFFERS);
+
+                    // unset uniforms read as zero, reserve enough for a mat4
+                    if (program->uniform_constants.length[spirv_binding] == 0)
+                        getUniformConstantStorage(ctx, program, spirv_binding, 16 * sizeof(GLfloat));
+
+                    buffer_map->buffers[buffer_map->count].attribute_mask = 0;
+                    buffer_map->buffers[buffer_map->count].buffer_base_index = spirv_binding;
+                    buffer_map->buffers[buffer_map->count].uniform_constant = GL_TRUE;
+                    buffer_map->buffers[buffer_map->count].writable = GL_FALSE;
+                    buffer_map->buffers[buffer_map->count].buf = NULL;
+                    buffer_map->buffers[buffer_map->count].offset = 0;
+                    buffer_map->count++;
+                    buffers_to_be_mapped--;
+
+                    // endless loop
+                    RETURN_FALSE_ON_FAILURE(i < MAX_ATTRIBS);
+
+                    continue;
+                }
+
                 buf = buffers[spirv_binding].buf;
 
                 if (buf)
                 {
                     buffer_map->buffers[buffer_map->count].attribute_mask = 0; // non attribute.. no bits set
                     buffer_map->buffers[buffer_map->count].buffer_base_index = spirv_binding;
+                    buffer_map->buffers[buffer_map->count].uniform_constant = GL_FALSE;
+                    buffer_map->buffers[buffer_map->count].writable =
+                        (gl_buffer_type == _SHADER_STORAGE_BUFFER || gl_buffer_type == _ATOMIC_COUNTER_BUFFER);
                     buffer_map->buffers[buffer_map->count].buf = buf;
                     buffer_map->buffers[buffer_map->count].offset = buffers[spirv_binding].offset;
                     buffer_map->count++;
@@ -502,84 +793,31 @@ void logDirtyBits(GLMContext ctx)
     // bind vao attribs to buffers (attribs can share the same buffer)
     if (stage == _VERTEX_SHADER)
     {
-        int vao_buffer_start;
-
-        count = [self getProgramBindingCount:stage type:SPVC_RESOURCE_TYPE_STAGE_INPUT];
-        mapped_buffers = 0;
+        VertexLayout *layout;
 
         // vao buffers start after the uniforms and shader buffers
-        vao_buffer_start = buffer_map->count;
-        assert(buffer_map->count < ctx->state.max_vertex_attribs);
-        buffer_map->buffers[vao_buffer_start].buf = NULL;
-
-        // create attribute map
-        //
-        // we need to cache this mapping, its called on each draw command
-        //
-        for (int att = 0; att < ctx->state.max_vertex_attribs; att++)
-        {
-            if (VAO_STATE(enabled_attribs) & (0x1 << att))
-            {
-                // shouldn't get here, validateVAO should have failed
-                assert(VAO_ATTRIB_STATE(att).buffer);
-
-                // check all the buffers for metal objects
-                Buffer *gl_buffer;
-                Buffer *map_buffer;
-
-                gl_buffer = VAO_ATTRIB_STATE(att).buffer;
-
-                // check start for map... then check
-                map_buffer = buffer_map->buffers[vao_buffer_start].buf;
-
-                // empty slot map it here, only works on first buffer..
-                if (map_buffer == NULL)
-                {
-                    // map the buffer object to a metal vertex index
-                    assert(buffer_map->count < ctx->state.max_vertex_attribs);
-                    buffer_map->buffers[vao_buffer_start].attribute_mask |= (0x1 << att);
-                    buffer_map->buffers[vao_buffer_start].buf = gl_buffer;
-                    buffer_map->count++;
-
-                    mapped_buffers++;
-                }
-                else
-                {
-                    bool found_buffer = false;
+        layout = [self vertexLayoutWithStart:buffer_map->count];
+        RETURN_FALSE_ON_NULL(layout);
 
-                    // find vao attrib with same buffer
-                    for (int map = vao_buffer_start; (found_buffer == false) && map < buffer_map->count; map++)
-                    {
-                        // we need to check name and target, not pointers..
-                        // FIX ME: I think we don't need a target as all attribs should be an array_buffer
-                        if ((map_buffer->name == gl_buffer->name) && (map_buffer->target == gl_buffer->target))
-                        {
-                            // include it the list of attributes
-                            buffer_map->buffers[map].attribute_mask |= (0x1 << att);
-                            found_buffer = true;
-                            mapped_buffers++;
-                            break;
-                        }
-                    }
+        assert([self getProgramBindingCount:stage type:SPVC_RESOURCE_TYPE_STAGE_INPUT] ==
+               __builtin_popcount(VAO_STATE(enabled_attribs)));
+        assert(buffer_map->count + layout->count <= ctx->state.max_vertex_attribs);
 
-                    if (found_buffer == false)
-                    {
-                        // map the next buffer object to a metal vertex index
-                        assert(buffer_map->count < ctx->state.max_vertex_attribs);
-                        buffer_map->buffers[buffer_map->count].attribute_mask = (0x1 << att);
-                        buffer_map->buffers[buffer_map->count].buf = gl_buffer;
-                        buffer_map->count++;
+        for (int i = 0; i < layout->count; i++)
+        {
+            BufferMap *map;
 
-                        mapped_buffers++;
-                    }
-                }
-            }
+            map = &buffer_map->buffers[buffer_map->count++];
 
-            if ((VAO_STATE(enabled_attribs) >> (att + 1)) == 0)
-                break;
+            map->buffer_base_index = 0;
+            map->attribute_mask = layout->attribute_mask[i];
+            map->uniform_constant = GL_FALSE;
+            map->writable = GL_FALSE;
+            map->buf = layout->buffers[i];
+            map->offset = 0;
         }
 
-        assert(mapped_buffers == count);
+        _vertexLayout = layout;
     }
     else if (stage == _COMPUTE_SHADER)
     {
@@ -599,6 +837,36 @@ void logDirtyBits(GLMContext ctx)
     return true;
 }
 
+- (void)syncDirtyRanges:(Buffer *)ptr buffer:(id<MTLBuffer>)buffer
+{
+    BufferData *data;
+
+    data = &ptr->data;
+
+    // dirty data nobody recorded a range for, sync all of it
+    if (data->dirty_range_count == 0)
+    {
+        addBufferDirtyRange(data, 0, buffer.length);
+    }
+
+    for (GLuint i = 0; i < data->dirty_range_count; i++)
+    {
+        NSUInteger start, end;
+
+        start = data->dirty_ranges[i].start;
+        end = MIN(data->dirty_ranges[i].end, buffer.length);
+
+        if (start >= end)
+            break;
+
+        [buffer didModifyRange:NSMakeRange(start, end - start)];
+
+        _dirtyBytes += end - start;
+    }
+
+    data->dirty_range_count = 0;
+}
+
 - (bool)updateDirtyBuffer:(Buffer *)ptr
 {
     // buffers less than 4k will be uploaded using setVertexBytes
@@ -618,6 +886,7 @@ void logDirtyBits(GLMContext ctx)
 
             // clear dirty bits
             ptr->data.dirty_bits = 0;
+            ptr->data.dirty_range_count = 0;
         }
     }
     else if (ptr->data.dirty_bits & DIRTY_BUFFER_DATA)
@@ -629,6 +898,7 @@ void logDirtyBits(GLMContext ctx)
 
             // clear dirty bits
             ptr->data.dirty_bits = 0;
+            ptr->data.dirty_range_count = 0;
 
             // we had to create a buffer so no need to update data
             return true;
@@ -642,13 +912,14 @@ void logDirtyBits(GLMContext ctx)
         // contents in check for EVERY drawing operation
         if (ptr->access & GL_MAP_COHERENT_BIT)
         {
-            [buffer didModifyRange:NSMakeRange(ptr->mapped_offset, ptr->mapped_length)];
+            addBufferDirtyRange(&ptr->data, ptr->mapped_offset, ptr->mapped_length);
+            [self syncDirtyRanges:ptr buffer:buffer];
 
             ptr->data.dirty_bits = DIRTY_BUFFER_DATA;
         }
         else
         {
-            [buffer didModifyRange:NSMakeRange(0, ptr->data.buffer_size)];
+            [self syncDirtyRanges:ptr buffer:buffer];
 
             ptr->data.dirty_bits = 0;
         }
@@ -703,6 +974,201 @@ void logDirtyBits(GLMContext ctx)
     return true;
 }
 
+#pragma mark uniform ring
+- (bool)uploadUniformConstants
+{
+    Program *program;
+    UniformConstants *uniforms;
+    id<MTLBuffer> ring;
+    NSUInteger size;
+
+    program = ctx->state.program;
+    assert(program);
+
+    uniforms = &program->uniform_constants;
+
+    ring = _uniformRing[_uniformRingFrame];
+
+    // the block is already in this frame's ring
+    if (ring && uniforms->dirty == false && _uniformRingProgram == program)
+        return true;
+
+    size = (uniforms->size + UNIFORM_RING_ALIGNMENT - 1) & ~(UNIFORM_RING_ALIGNMENT - 1);
+
+    if (ring == NULL || _uniformRingHead + size > ring.length)
+    {
+        NSUInteger length;
+
+        // the frame outgrew its ring, command buffers retain the old one until they are done with it
+        length = ring ? ring.length * 2 : UNIFORM_RING_SIZE;
+        while (length < size)
+            length *= 2;
+
+        ring = [_device newBufferWithLength:length options:MTLResourceStorageModeShared];
+        RETURN_FALSE_ON_NULL(ring);
+        ring.label = @"Uniform Ring";
+
+        _uniformRing[_uniformRingFrame] = ring;
+        _uniformRingHead = 0;
+    }
+
+    memcpy((GLubyte *)ring.contents + _uniformRingHead, uniforms->data, uniforms->size);
+
+    _uniformRingOffset = _uniformRingHead;
+    _uniformRingHead += size;
+    _uniformRingProgram = program;
+
+    uniforms->dirty = false;
+
+    ctx->stats.uniform_uploads++;
+
+    return true;
+}
+
+- (bool)bindUniformConstant:(BufferMap *)map stage:(int)stage index:(int)index
+{
+    NSUInteger offset;
+
+    RETURN_FALSE_ON_FAILURE([self uploadUniformConstants]);
+
+    offset = _uniformRingOffset + ctx->state.program->uniform_constants.offset[map->buffer_base_index];
+
+    if (stage == _VERTEX_SHADER)
+    {
+        [_currentRenderEncoder setVertexBuffer:_uniformRing[_uniformRingFrame] offset:offset atIndex:index];
+    }
+    else
+    {
+        [_currentRenderEncoder setFragmentBuffer:_uniformRing[_uniformRingFrame] offset:offset atIndex:index];
+    }
+
+    return true;
+}
+
+- (bool)bindUniformConstantsToCurrentRenderEncoder
+{
+    BufferMapList *lists[] = {&ctx->state.vertex_buffer_map_list, &ctx->state.fragment_buffer_map_list};
+    int stages[] = {_VERTEX_SHADER, _FRAGMENT_SHADER};
+
+    // one upload for the whole block, then only the offsets change
+    RETURN_FALSE_ON_FAILURE([self uploadUniformConstants]);
+
+    for (int list = 0; list < 2; list++)
+    {
+        for (int i = 0; i < lists[list]->count; i++)
+        {
+            if (lists[list]->buffers[i].uniform_constant)
+            {
+                RETURN_FALSE_ON_FAILURE([self bindUniformConstant:&lists[list]->buffers[i]
+                                                            stage:stages[list]
+                                                            index:i]);
+            }
+        }
+    }
+
+    return true;
+}
+
+- (void)advanceUniformRing
+{
+    // everything submitted so far may read the ring of the frame that just ended
+    _uniformRingSerial[_uniformRingFrame] = _submissionSerial;
+
+    _uniformRingFrame = (_uniformRingFrame + 1) % UNIFORM_RING_FRAMES;
+    _uniformRingHead = 0;
+    _uniformRingProgram = NULL;
+
+    // still in flight, let the command buffers holding it release it and start a fresh one
+    if (__atomic_load_n(&_completedSerial, __ATOMIC_ACQUIRE) < _uniformRingSerial[_uniformRingFrame])
+    {
+        _uniformRing[_uniformRingFrame] = NULL;
+    }
+}
+
+#pragma mark upload ring
+- (id<MTLBuffer>)uploadToRing:(const void *)data length:(NSUInteger)length offset:(NSUInteger *)offset
+{
+    id<MTLBuffer> ring;
+    NSUInteger size;
+
+    ring = _uploadRing[_uploadRingFrame];
+
+    size = (length + UPLOAD_RING_ALIGNMENT - 1) & ~(UPLOAD_RING_ALIGNMENT - 1);
+
+    if (ring == NULL || _uploadRingHead + size > ring.length)
+    {
+        NSUInteger ring_length;
+
+        // same as the uniform ring, command buffers retain the old one until they are done with it
+        ring_length = ring ? ring.length * 2 : UPLOAD_RING_SIZE;
+        while (ring_length < size)
+            ring_length *= 2;
+
+        ring = [_device newBufferWithLength:ring_length options:MTLResourceStorageModeShared];
+        if (ring == NULL)
+            return NULL;
+        ring.label = @"Upload Ring";
+
+        _uploadRing[_uploadRingFrame] = ring;
+        _uploadRingHead = 0;
+
+        ctx->stats.upload_ring_allocations++;
+    }
+
+    memcpy((GLubyte *)ring.contents + _uploadRingHead, data, length);
+
+    *offset = _uploadRingHead;
+    _uploadRingHead += size;
+
+    return ring;
+}
+
+- (id<MTLBuffer>)indexBufferForElementBuffer:(Buffer *)ptr offset:(NSUInteger *)offset
+{
+    *offset = 0;
+
+    if (ptr->data.mtl_data)
+        return (__bridge id<MTLBuffer>)(ptr->data.mtl_data);
+
+    // small element buffers never get a backing store, copy them into this frame's ring
+    if (ptr->data.buffer_data == 0)
+        return NULL;
+
+    ctx->stats.index_uploads++;
+
+    return [self uploadToRing:(const void *)ptr->data.buffer_data length:ptr->size offset:offset];
+}
+
+- (id<MTLBuffer>)mtlBufferForBuffer:(Buffer *)ptr offset:(NSUInteger *)offset
+{
+    *offset = 0;
+
+    if (ptr->data.mtl_data)
+        return (__bridge id<MTLBuffer>)(ptr->data.mtl_data);
+
+    // same as an element buffer, a small indirect or parameter buffer is read from the ring
+    if (ptr->data.buffer_data == 0)
+        return NULL;
+
+    return [self uploadToRing:(const void *)ptr->data.buffer_data length:ptr->size offset:offset];
+}
+
+- (void)advanceUploadRing
+{
+    _uploadRingSerial[_uploadRingFrame] = _submissionSerial;
+
+    _uploadRingFrame = (_uploadRingFrame + 1) % UPLOAD_RING_FRAMES;
+    _uploadRingHead = 0;
+    _indirectCommandsHead = 0;
+
+    if (__atomic_load_n(&_completedSerial, __ATOMIC_ACQUIRE) < _uploadRingSerial[_uploadRingFrame])
+    {
+        _uploadRing[_uploadRingFrame] = NULL;
+        _indirectCommands[_uploadRingFrame] = NULL;
+        _indirectCommandsArguments[_uploadRingFrame] = NULL;
+    }
+}
+
 - (bool)bindVertexBuffersToCurrentRenderEncoder
 {
     BufferMap *map;
@@ -715,6 +1181,12 @@ void logDirtyBits(GLMContext ctx)
     {
         map = &ctx->state.vertex_buffer_map_list.buffers[i];
 
+        if (map->uniform_constant)
+        {
+            RETURN_FALSE_ON_FAILURE([self bindUniformConstant:map stage:_VERTEX_SHADER index:i]);
+            continue;
+        }
+
         ptr = map->buf;
         offset = map->offset;
 
@@ -729,6 +1201,7 @@ void logDirtyBits(GLMContext ctx)
 
             // clear buffer data dirty bits
             ptr->data.dirty_bits &= ~DIRTY_BUFFER_DATA;
+            ptr->data.dirty_range_count = 0;
         }
         else
         {
@@ -756,6 +1229,12 @@ void logDirtyBits(GLMContext ctx)
     {
         map = &ctx->state.fragment_buffer_map_list.buffers[i];
 
+        if (map->uniform_constant)
+        {
+            RETURN_FALSE_ON_FAILURE([self bindUniformConstant:map stage:_FRAGMENT_SHADER index:i]);
+            continue;
+        }
+
         ptr = map->buf;
         offset = map->offset;
 
@@ -769,6 +1248,7 @@ void logDirtyBits(GLMContext ctx)
 
             // clear buffer data dirty bits
             ptr->data.dirty_bits &= ~DIRTY_BUFFER_DATA;
+            ptr->data.dirty_range_count = 0;
         }
         else
         {
@@ -784,19 +1264,6 @@ void logDirtyBits(GLMContext ctx)
     return true;
 }
 
-- (int)getVertexBufferIndexWithAttributeSet:(int)attribute
-{
-    for (int i = 0; i < ctx->state.vertex_buffer_map_list.count; i++)
-    {
-        if (ctx->state.vertex_buffer_map_list.buffers[i].attribute_mask & (0x1 << attribute))
-            return i;
-    }
-
-    assert(0);
-
-    return 0;
-}
-
 #pragma mark textures
 
 - (void)swizzleTexDesc:(MTLTextureDescriptor *)tex_desc forTex:(Texture *)tex
@@ -1515,23 +1982,14 @@ extern FBOAttachment *getFBOAttachment(GLMContext ctx, Framebuffer *fbo, GLenum
         assert(drawtexid);
     }
 
-    // end encoding on current render encoder
-    [self endRenderEncoding];
+    // queued behind earlier uploads, draws after this see it because a draw emits the queue first
+    PendingBlit *blit = [self queueBlit:PENDING_BLIT_COPY_TEXTURE];
 
-    // start blit encoder
-    id<MTLBlitCommandEncoder> blitCommandEncoder;
-    blitCommandEncoder = [_currentCommandBuffer blitCommandEncoder];
-    [blitCommandEncoder
-          copyFromTexture:readtexid
-              sourceSlice:0
-              sourceLevel:0
-             sourceOrigin:MTLOriginMake(srcX0, srcY0, 0)
-               sourceSize:MTLSizeMake(srcX1 - srcX0, srcY1 - srcY0, 1)
-                toTexture:drawtexid
-         destinationSlice:0
-         destinationLevel:0
-        destinationOrigin:MTLOriginMake(dstX0, dstY0, 0) /*destinationSize:MTLSizeMake(dstX1, dstY1, 0)*/];
-    [blitCommandEncoder endEncoding];
+    blit->src = (void *)CFBridgingRetain(readtexid);
+    blit->src_origin = MTLOriginMake(srcX0, srcY0, 0);
+    blit->src_size = MTLSizeMake(srcX1 - srcX0, srcY1 - srcY0, 1);
+    blit->dst = (void *)CFBridgingRetain(drawtexid);
+    blit->dst_origin = MTLOriginMake(dstX0, dstY0, 0); /*destinationSize:MTLSizeMake(dstX1, dstY1, 0)*/
 }
 
 void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0,
@@ -1669,7 +2127,7 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
     if (ptr == NULL)
         return 0;
 
-    return ptr->spirv_resources_list[stage][type].count;
+    return PROGRAM_RESOURCE_COUNT(ptr, stage, type);
 }
 
 - (int)getProgramBinding:(int)stage type:(int)type index:(int)index
@@ -1695,9 +2153,9 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
     ptr = ctx->state.program;
     assert(ptr);
 
-    assert(index < ptr->spirv_resources_list[stage][type].count);
+    assert(index < PROGRAM_RESOURCE_COUNT(ptr, stage, type));
 
-    return ptr->spirv_resources_list[stage][type].list[index].binding;
+    return PROGRAM_RESOURCES(ptr, stage, type)[index].binding;
 }
 
 - (int)getProgramLocation:(int)stage type:(int)type index:(int)index
@@ -1722,9 +2180,9 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
     ptr = ctx->state.program;
     assert(ptr);
 
-    assert(index < ptr->spirv_resources_list[stage][type].count);
+    assert(index < PROGRAM_RESOURCE_COUNT(ptr, stage, type));
 
-    return ptr->spirv_resources_list[stage][type].list[index].location;
+    return PROGRAM_RESOURCES(ptr, stage, type)[index].location;
 }
 
 - (id<MTLLibrary>)compileShader:(const char *)str
@@ -1777,13 +2235,18 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
             {
                 id<MTLLibrary> library;
                 id<MTLFunction> function;
+                GLuint64 start;
+
+                start = shaderStatsClock();
 
                 library = [self compileShader:ptr->spirv[i].msl_str];
                 assert(library);
-                function = [library newFunctionWithName:[NSString stringWithUTF8String:shader->entry_point]];
+                function = [library newFunctionWithName:[NSString stringWithUTF8String:ptr->spirv[i].entry_point]];
                 assert(function);
                 shader->mtl_data.library = (void *)CFBridgingRetain(library);
                 shader->mtl_data.function = (void *)CFBridgingRetain(function);
+
+                ptr->stats.stages[i].library_ns = shaderStatsClock() - start;
             }
         }
     }
@@ -2260,6 +2723,13 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
         assert(_currentRenderEncoder);
         _currentRenderEncoder.label = @"GL Render Encoder";
 
+        // remember what the attachments were built from so draws can tell if they need a new pass
+        _renderPassFramebuffer = ctx->state.framebuffer;
+        _renderPassDrawBuffer = ctx->state.draw_buffer;
+        _renderPassDepth = (ctx->depth_format.mtl_pixel_format && ctx->state.caps.depth_test);
+        _renderPassStencil = (ctx->stencil_format.mtl_pixel_format && ctx->state.caps.stencil_test);
+        _renderPassCount++;
+
         // apply all state that isn't included in a renderPassDescriptor into the render encoder
         [self updateCurrentRenderEncoder];
 
@@ -2327,6 +2797,22 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
     _currentCommandBuffer = [_commandQueue commandBuffer];
     assert(_currentCommandBuffer);
 
+    // tag the new command buffer, a dropped (never committed) one is covered by any later completion
+    uint64_t serial = ++_submissionSerial;
+    uint64_t *completed = &_completedSerial;
+
+    [_currentCommandBuffer addCompletedHandler:^(id<MTLCommandBuffer> commandBuffer) {
+      uint64_t current = __atomic_load_n(completed, __ATOMIC_ACQUIRE);
+
+      while (current < serial)
+      {
+          if (__atomic_compare_exchange_n(completed, &current, serial, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+              break;
+      }
+    }];
+
+    [self retireReleaseList];
+
     return true;
 }
 
@@ -2381,6 +2867,10 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
     pipelineStateDescriptor.vertexFunction = vertexFunction;
     pipelineStateDescriptor.fragmentFunction = fragmentFunction;
 
+    // glMultiDraw*IndirectCount executes its draws from an indirect command buffer with this pipeline inherited,
+    // other pipelines don't pay for the support
+    pipelineStateDescriptor.supportIndirectCommandBuffers = _indirectCountDraw;
+
     if (ctx->state.framebuffer)
     {
         Framebuffer *fbo;
@@ -2457,6 +2947,17 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
 #pragma mark vertex descriptor
 - (MTLVertexDescriptor *)generateVertexDescriptor
 {
+    VertexLayout *layout;
+
+    layout = _vertexLayout;
+
+    if (layout == NULL)
+        return NULL;
+
+    // built once per vertex layout
+    if (layout->mtl_vertex_descriptor)
+        return (__bridge MTLVertexDescriptor *)(layout->mtl_vertex_descriptor);
+
     MTLVertexDescriptor *vertexDescriptor = [[MTLVertexDescriptor alloc] init];
     assert(vertexDescriptor);
 
@@ -2486,7 +2987,7 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
 
             int mapped_buffer_index;
 
-            mapped_buffer_index = [self getVertexBufferIndexWithAttributeSet:i];
+            mapped_buffer_index = layout->buffer_index[i];
 
             vertexDescriptor.attributes[i].bufferIndex = mapped_buffer_index;
             vertexDescriptor.attributes[i].offset = ctx->state.vao->attrib[i].relativeoffset;
@@ -2511,8 +3012,7 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
             break;
     }
 
-    // clear all dirty bits as they have been translated into a vertex descriptor
-    ctx->state.vao->dirty_bits = 0;
+    layout->mtl_vertex_descriptor = (void *)CFBridgingRetain(vertexDescriptor);
 
     return vertexDescriptor;
 }
@@ -2661,6 +3161,159 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
     }
 }
 
+#pragma mark pipeline cache
+- (void)buildPipelineKey:(PipelineKey *)key fromDescriptor:(MTLRenderPipelineDescriptor *)pipelineStateDescriptor
+{
+    MTLVertexDescriptor *vertexDescriptor;
+
+    bzero(key, sizeof(PipelineKey));
+
+    key->vertex_function = (__bridge void *)pipelineStateDescriptor.vertexFunction;
+    key->fragment_function = (__bridge void *)pipelineStateDescriptor.fragmentFunction;
+
+    for (int i = 0; i < MAX_COLOR_ATTACHMENTS; i++)
+    {
+        MTLRenderPipelineColorAttachmentDescriptor *attachment;
+
+        attachment = pipelineStateDescriptor.colorAttachments[i];
+
+        key->color_format[i] = (uint32_t)attachment.pixelFormat;
+
+        if (attachment.pixelFormat == MTLPixelFormatInvalid)
+            continue;
+
+        key->blend[i].enabled = attachment.blendingEnabled;
+        key->blend[i].write_mask = attachment.writeMask;
+
+        if (attachment.blendingEnabled)
+        {
+            key->blend[i].src_rgb = attachment.sourceRGBBlendFactor;
+            key->blend[i].dst_rgb = attachment.destinationRGBBlendFactor;
+            key->blend[i].src_alpha = attachment.sourceAlphaBlendFactor;
+            key->blend[i].dst_alpha = attachment.destinationAlphaBlendFactor;
+            key->blend[i].rgb_op = attachment.rgbBlendOperation;
+            key->blend[i].alpha_op = attachment.alphaBlendOperation;
+        }
+    }
+
+    key->depth_format = (uint32_t)pipelineStateDescriptor.depthAttachmentPixelFormat;
+    key->stencil_format = (uint32_t)pipelineStateDescriptor.stencilAttachmentPixelFormat;
+    key->indirect_commands = pipelineStateDescriptor.supportIndirectCommandBuffers;
+
+    vertexDescriptor = pipelineStateDescriptor.vertexDescriptor;
+
+    for (int i = 0; i < MAX_ATTRIBS; i++)
+    {
+        MTLVertexAttributeDescriptor *attribute;
+        MTLVertexBufferLayoutDescriptor *layout;
+
+        attribute = vertexDescriptor.attributes[i];
+
+        if (attribute.format == MTLVertexFormatInvalid)
+            continue;
+
+        layout = vertexDescriptor.layouts[attribute.bufferIndex];
+
+        key->attrib[i].format = (uint32_t)attribute.format;
+        key->attrib[i].offset = (uint32_t)attribute.offset;
+        key->attrib[i].buffer_index = (uint32_t)attribute.bufferIndex;
+        key->attrib[i].stride = (uint32_t)layout.stride;
+        key->attrib[i].step_function = (uint32_t)layout.stepFunction;
+        key->attrib[i].step_rate = (uint32_t)layout.stepRate;
+    }
+}
+
+static uint64_t hashPipelineKey(const PipelineKey *key)
+{
+    const uint8_t *ptr;
+    uint64_t hash;
+
+    // fnv-1a
+    ptr = (const uint8_t *)key;
+    hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(PipelineKey); i++)
+    {
+        hash ^= ptr[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+- (id<MTLRenderPipelineState>)pipelineStateForDescriptor:(MTLRenderPipelineDescriptor *)pipelineStateDescriptor
+{
+    PipelineKey key;
+    PipelineCacheEntry *set, *victim;
+    uint64_t hash;
+    id<MTLRenderPipelineState> pipelineState;
+
+    if (_pipelineCache == NULL)
+    {
+        _pipelineCache =
+            (PipelineCacheEntry *)calloc(PIPELINE_CACHE_SETS * PIPELINE_CACHE_WAYS, sizeof(PipelineCacheEntry));
+        assert(_pipelineCache);
+    }
+
+    [self buildPipelineKey:&key fromDescriptor:pipelineStateDescriptor];
+
+    hash = hashPipelineKey(&key);
+    set = &_pipelineCache[(hash % PIPELINE_CACHE_SETS) * PIPELINE_CACHE_WAYS];
+
+    _pipelineCacheClock++;
+
+    victim = &set[0];
+    for (int i = 0; i < PIPELINE_CACHE_WAYS; i++)
+    {
+        PipelineCacheEntry *entry;
+
+        entry = &set[i];
+
+        if (entry->pipeline && entry->hash == hash && memcmp(&entry->key, &key, sizeof(PipelineKey)) == 0)
+        {
+            entry->last_used = _pipelineCacheClock;
+
+            ctx->stats.pipeline_cache_hits++;
+
+            return (__bridge id<MTLRenderPipelineState>)entry->pipeline;
+        }
+
+        // prefer an empty way, otherwise the least recently used one
+        if (victim->pipeline && (entry->pipeline == NULL || entry->last_used < victim->last_used))
+            victim = entry;
+    }
+
+    ctx->stats.pipeline_cache_misses++;
+
+    NSError *error;
+    pipelineState = [_device newRenderPipelineStateWithDescriptor:pipelineStateDescriptor error:&error];
+
+    // Pipeline State creation could fail if the pipeline descriptor isn't set up properly.
+    //  If the Metal API validation is enabled, you can find out more information about what
+    //  went wrong.  (Metal API validation is enabled by default when a debug build is run
+    //  from Xcode.)
+    NSAssert(pipelineState, @"Failed to created pipeline state: %@", error);
+    if (pipelineState == NULL)
+        return NULL;
+
+    if (victim->pipeline)
+    {
+        ctx->stats.pipeline_cache_evictions++;
+
+        CFBridgingRelease(victim->pipeline);
+        CFBridgingRelease(victim->vertex_function);
+        CFBridgingRelease(victim->fragment_function);
+    }
+
+    victim->hash = hash;
+    victim->last_used = _pipelineCacheClock;
+    victim->key = key;
+    victim->pipeline = (void *)CFBridgingRetain(pipelineState);
+    victim->vertex_function = (void *)CFBridgingRetain(pipelineStateDescriptor.vertexFunction);
+    victim->fragment_function = (void *)CFBridgingRetain(pipelineStateDescriptor.fragmentFunction);
+
+    return pipelineState;
+}
+
 - (bool)bindFramebufferAttachmentTextures
 {
     Framebuffer *fbo;
@@ -2707,6 +3360,41 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
     return true;
 }
 
+- (bool)renderPassAttachmentsChanged
+{
+    if (_currentRenderEncoder == NULL)
+        return true;
+
+    // clears are load actions on the render pass
+    if (ctx->state.clear_bitmask)
+        return true;
+
+    // a new framebuffer binding or new attachments on the bound one
+    if (ctx->state.dirty_bits & DIRTY_FBO)
+        return true;
+
+    if (ctx->state.framebuffer != _renderPassFramebuffer)
+        return true;
+
+    if (ctx->state.framebuffer && (ctx->state.framebuffer->dirty_bits & DIRTY_FBO_BINDING))
+        return true;
+
+    // the default framebuffer picks its attachments from the draw buffer and depth / stencil enables
+    if (ctx->state.framebuffer == NULL)
+    {
+        if (ctx->state.draw_buffer != _renderPassDrawBuffer)
+            return true;
+
+        if ((ctx->depth_format.mtl_pixel_format && ctx->state.caps.depth_test) != _renderPassDepth)
+            return true;
+
+        if ((ctx->stencil_format.mtl_pixel_format && ctx->state.caps.stencil_test) != _renderPassStencil)
+            return true;
+    }
+
+    return false;
+}
+
 - (void)endRenderEncoding
 {
     if (_currentRenderEncoder)
@@ -2714,6 +3402,162 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
         [_currentRenderEncoder endEncoding];
         _currentRenderEncoder = NULL;
     }
+
+    // every other encoder and every commit comes through here, queued blits go out ahead of them
+    [self encodePendingBlits];
+}
+
+#pragma mark pending blits
+- (PendingBlit *)queueBlit:(GLuint)type
+{
+    PendingBlit *blit;
+
+    if (_pendingBlits.count >= _pendingBlits.size)
+    {
+        _pendingBlits.size = _pendingBlits.size ? _pendingBlits.size * 2 : 64;
+        _pendingBlits.list = (PendingBlit *)realloc(_pendingBlits.list, sizeof(PendingBlit) * _pendingBlits.size);
+        assert(_pendingBlits.list);
+    }
+
+    blit = &_pendingBlits.list[_pendingBlits.count++];
+    bzero(blit, sizeof(PendingBlit));
+
+    blit->type = type;
+
+    return blit;
+}
+
+- (NSUInteger)stageBytes:(const void *)bytes pitch:(size_t)pitch rowSize:(size_t)row_size rows:(size_t)rows
+{
+    NSUInteger offset;
+    size_t size;
+
+    offset = (_pendingBlits.staging_used + PENDING_BLIT_STAGING_ALIGNMENT - 1) & ~(PENDING_BLIT_STAGING_ALIGNMENT - 1);
+    size = row_size * rows;
+
+    if (offset + size > _pendingBlits.staging_size)
+    {
+        _pendingBlits.staging_size = _pendingBlits.staging_size ? _pendingBlits.staging_size : 64 * 1024;
+
+        while (offset + size > _pendingBlits.staging_size)
+            _pendingBlits.staging_size *= 2;
+
+        _pendingBlits.staging = (GLubyte *)realloc(_pendingBlits.staging, _pendingBlits.staging_size);
+        assert(_pendingBlits.staging);
+    }
+
+    // pack the rows tightly
+    for (size_t row = 0; row < rows; row++)
+    {
+        memcpy(_pendingBlits.staging + offset + row * row_size, (const GLubyte *)bytes + row * pitch, row_size);
+    }
+
+    _pendingBlits.staging_used = offset + size;
+
+    return offset;
+}
+
+- (void)encodePendingBlits
+{
+    id<MTLBlitCommandEncoder> blitCommandEncoder;
+    id<MTLBuffer> staging;
+
+    if (_pendingBlits.count == 0)
+        return;
+
+    assert(_currentRenderEncoder == NULL);
+
+    staging = nil;
+    if (_pendingBlits.staging_used)
+    {
+        staging = [_device newBufferWithBytes:_pendingBlits.staging
+                                       length:_pendingBlits.staging_used
+                                      options:MTLResourceStorageModeShared];
+        assert(staging);
+    }
+
+    blitCommandEncoder = [_currentCommandBuffer blitCommandEncoder];
+    assert(blitCommandEncoder);
+    blitCommandEncoder.label = @"GL Blit Batch";
+
+    // issue order is kept, everything lands before the next pass reads it
+    for (GLuint i = 0; i < _pendingBlits.count; i++)
+    {
+        PendingBlit *blit;
+
+        blit = &_pendingBlits.list[i];
+
+        switch (blit->type)
+        {
+        case PENDING_BLIT_COPY_BUFFER: {
+            id<MTLBuffer> src = blit->src ? (__bridge id<MTLBuffer>)(blit->src) : staging;
+            id<MTLBuffer> dst = (__bridge id<MTLBuffer>)(blit->dst);
+
+            [blitCommandEncoder copyFromBuffer:src
+                                  sourceOffset:blit->src_offset
+                                      toBuffer:dst
+                             destinationOffset:blit->dst_offset
+                                          size:blit->size];
+
+            // keep the cpu side of managed buffers in step for reads and later partial updates
+            if (blit->synchronize)
+            {
+                [blitCommandEncoder synchronizeResource:dst];
+            }
+            break;
+        }
+
+        case PENDING_BLIT_BUFFER_TO_TEXTURE: {
+            id<MTLBuffer> src = blit->src ? (__bridge id<MTLBuffer>)(blit->src) : staging;
+
+            [blitCommandEncoder copyFromBuffer:src
+                                  sourceOffset:blit->src_offset
+                             sourceBytesPerRow:blit->src_pitch
+                           sourceBytesPerImage:blit->src_image_size
+                                    sourceSize:blit->src_size
+                                     toTexture:(__bridge id<MTLTexture>)(blit->dst)
+                              destinationSlice:blit->dst_slice
+                              destinationLevel:blit->dst_level
+                             destinationOrigin:blit->dst_origin
+                                       options:MTLBlitOptionNone];
+            break;
+        }
+
+        case PENDING_BLIT_COPY_TEXTURE:
+            [blitCommandEncoder copyFromTexture:(__bridge id<MTLTexture>)(blit->src)
+                                    sourceSlice:blit->src_slice
+                                    sourceLevel:blit->src_level
+                                   sourceOrigin:blit->src_origin
+                                     sourceSize:blit->src_size
+                                      toTexture:(__bridge id<MTLTexture>)(blit->dst)
+                               destinationSlice:blit->dst_slice
+                               destinationLevel:blit->dst_level
+                              destinationOrigin:blit->dst_origin];
+            break;
+
+        case PENDING_BLIT_GENERATE_MIPMAPS:
+            [blitCommandEncoder generateMipmapsForTexture:(__bridge id<MTLTexture>)(blit->dst)];
+            break;
+
+        default:
+            assert(0);
+        }
+
+        // the command buffer holds its own references from here
+        if (blit->src)
+        {
+            CFBridgingRelease(blit->src);
+        }
+
+        CFBridgingRelease(blit->dst);
+    }
+
+    [blitCommandEncoder endEncoding];
+
+    _pendingBlits.count = 0;
+    _pendingBlits.staging_used = 0;
+
+    _blitEncoderCount++;
 }
 
 #pragma mark------------------------------------------------------------------------------------------
@@ -2725,6 +3569,12 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
     assert(_device);
     assert(_commandQueue);
 
+    // queued uploads and copies land between the draws issued before and after them
+    if (draw_command && _pendingBlits.count)
+    {
+        [self endRenderEncoding];
+    }
+
     // logDirtyBits(ctx);
 
     // since a clear is embedded into a render encoder
@@ -2810,25 +3660,47 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
             ctx->state.dirty_bits &= ~(DIRTY_TEX | DIRTY_TEX_BINDING | DIRTY_SAMPLER);
         }
 
-        // a dirty vao needs to update the render encoder and buffer list
-        if (ctx->state.dirty_bits & DIRTY_VAO)
+        // only a change of attachments (or a pending clear) needs a new render pass, everything else can be
+        // rebound on the current encoder without storing and reloading the attachments
+        if ([self renderPassAttachmentsChanged])
         {
-            // we have a dirty VAO, all the renderbuffer bindings are invalid so we need a new renderbuffer
-            // with new renderbuffer bindings
+            // updateDirtyBaseBufferList binds new mtl buffers or updates old ones
+            RETURN_FALSE_ON_FAILURE([self updateDirtyBaseBufferList:&ctx->state.vertex_buffer_map_list]);
+            RETURN_FALSE_ON_FAILURE([self updateDirtyBaseBufferList:&ctx->state.fragment_buffer_map_list]);
 
-            // always end encoding and start a new encoder and bind new vertex buffers
-            // end encoding on current render encoder
-            [self endRenderEncoding];
+            // attachments can change on a bound framebuffer without a rebind
+            if (ctx->state.framebuffer && (ctx->state.framebuffer->dirty_bits & DIRTY_FBO_BINDING))
+            {
+                RETURN_FALSE_ON_FAILURE([self bindFramebufferAttachmentTextures]);
+
+                ctx->state.framebuffer->dirty_bits &= ~DIRTY_FBO_BINDING;
+            }
+
+            // get a new renderer encoder, this binds the buffers and render state
+            RETURN_FALSE_ON_FAILURE([self newRenderEncoder]);
+
+            // clear dirty render state
+            ctx->state.dirty_bits &= ~(DIRTY_RENDER_STATE | DIRTY_BUFFER);
+        }
+        else if (ctx->state.dirty_bits & DIRTY_VAO)
+        {
+            // we have a dirty VAO, the vertex buffer bindings are invalid but the attachments are the same
+            // so rebind within the current encoder, the vertex descriptor goes through the pipeline state below
 
             // updateDirtyBaseBufferList binds new mtl buffers or updates old ones
             RETURN_FALSE_ON_FAILURE([self updateDirtyBaseBufferList:&ctx->state.vertex_buffer_map_list]);
             RETURN_FALSE_ON_FAILURE([self updateDirtyBaseBufferList:&ctx->state.fragment_buffer_map_list]);
 
-            // get a new renderer encoder
-            RETURN_FALSE_ON_FAILURE([self newRenderEncoder]);
+            RETURN_FALSE_ON_FAILURE([self bindVertexBuffersToCurrentRenderEncoder]);
+            RETURN_FALSE_ON_FAILURE([self bindFragmentBuffersToCurrentRenderEncoder]);
+
+            if (ctx->state.dirty_bits & DIRTY_RENDER_STATE)
+            {
+                [self updateCurrentRenderEncoder];
+            }
 
             // clear dirty render state
-            ctx->state.dirty_bits &= ~DIRTY_RENDER_STATE;
+            ctx->state.dirty_bits &= ~(DIRTY_RENDER_STATE | DIRTY_BUFFER);
         }
         else if (ctx->state.dirty_bits & DIRTY_BUFFER)
         {
@@ -2836,6 +3708,10 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
             RETURN_FALSE_ON_FAILURE([self updateDirtyBaseBufferList:&ctx->state.vertex_buffer_map_list]);
             RETURN_FALSE_ON_FAILURE([self updateDirtyBaseBufferList:&ctx->state.fragment_buffer_map_list]);
 
+            // a renamed buffer has a new backing store, small buffers need their bytes copied again
+            RETURN_FALSE_ON_FAILURE([self bindVertexBuffersToCurrentRenderEncoder]);
+            RETURN_FALSE_ON_FAILURE([self bindFragmentBuffersToCurrentRenderEncoder]);
+
             ctx->state.dirty_bits &= ~DIRTY_BUFFER;
         }
         else if (ctx->state.dirty_bits & DIRTY_RENDER_STATE)
@@ -2884,14 +3760,8 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
 
             pipelineStateDescriptor.vertexDescriptor = vertexDescriptor;
 
-            NSError *error;
-            _pipelineState = [_device newRenderPipelineStateWithDescriptor:pipelineStateDescriptor error:&error];
-
-            // Pipeline State creation could fail if the pipeline descriptor isn't set up properly.
-            //  If the Metal API validation is enabled, you can find out more information about what
-            //  went wrong.  (Metal API validation is enabled by default when a debug build is run
-            //  from Xcode.)
-            NSAssert(_pipelineState, @"Failed to created pipeline state: %@", error);
+            // repeated state combinations reuse an already compiled pipeline
+            _pipelineState = [self pipelineStateForDescriptor:pipelineStateDescriptor];
             RETURN_FALSE_ON_NULL(_pipelineState);
 
             ctx->state.dirty_bits &= ~(DIRTY_PROGRAM | DIRTY_VAO | DIRTY_FBO);
@@ -2928,6 +3798,13 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
         }
     }
 
+    // glUniform* since the last draw or a program switch, upload the block once and move the offsets
+    if (ctx->state.program && ctx->state.program->uniform_constants.size &&
+        (ctx->state.program->uniform_constants.dirty || _uniformRingProgram != ctx->state.program))
+    {
+        RETURN_FALSE_ON_FAILURE([self bindUniformConstantsToCurrentRenderEncoder]);
+    }
+
     // Create a render command encoder.
     [_currentRenderEncoder setRenderPipelineState:_pipelineState];
 
@@ -2956,6 +3833,21 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
     {
         Buffer *ptr;
 
+        if (ctx->state.compute_buffer_map_list.buffers[i].uniform_constant)
+        {
+            GLuint location;
+
+            RETURN_FALSE_ON_FAILURE([self uploadUniformConstants]);
+
+            location = ctx->state.compute_buffer_map_list.buffers[i].buffer_base_index;
+
+            [computeCommandEncoder
+                setBuffer:_uniformRing[_uniformRingFrame]
+                   offset:_uniformRingOffset + ctx->state.program->uniform_constants.offset[location]
+                  atIndex:i];
+            continue;
+        }
+
         ptr = ctx->state.compute_buffer_map_list.buffers[i].buf;
 
         RETURN_FALSE_ON_NULL(ptr);
@@ -3204,6 +4096,15 @@ void mtlBlitFramebuffer(GLMContext glm_ctx, GLint srcX0, GLint srcY0, GLint srcX
 
     [computeCommandEncoder endEncoding];
 
+    // storage and atomic counter buffers now hold the dispatch's results
+    for (int i = 0; i < glm_ctx->state.compute_buffer_map_list.count; i++)
+    {
+        if (glm_ctx->state.compute_buffer_map_list.buffers[i].writable)
+        {
+            [self markBufferWrite:glm_ctx->state.compute_buffer_map_list.buffers[i].buf];
+        }
+    }
+
     glm_ctx->state.dirty_bits = DIRTY_ALL;
 
     //[self newRenderEncoder];
@@ -3275,6 +4176,9 @@ void mtlDispatchComputeIndirect(GLMContext glm_ctx, GLintptr indirect)
         {
             [_currentCommandBuffer waitUntilCompleted];
         }
+
+        // completed handlers can run after the wait returns, everything up to here is retired
+        __atomic_store_n(&_completedSerial, _submissionSerial, __ATOMIC_RELEASE);
     }
     else
     {
@@ -3309,15 +4213,58 @@ void mtlBindProgram(GLMContext glm_ctx, Program *ptr)
     [(__bridge id)glm_ctx->mtl_funcs.mtlObj bindMTLProgram:ptr];
 }
 
+#pragma mark deferred release
+- (void)retireReleaseList
+{
+    uint64_t completed;
+    GLuint kept;
+
+    if (_releaseList.count == 0)
+        return;
+
+    completed = __atomic_load_n(&_completedSerial, __ATOMIC_ACQUIRE);
+
+    kept = 0;
+    for (GLuint i = 0; i < _releaseList.count; i++)
+    {
+        ReleaseEntry *entry;
+
+        entry = &_releaseList.list[i];
+
+        if (entry->serial <= completed)
+        {
+            // this should release it to the GC
+            CFBridgingRelease(entry->obj);
+        }
+        else
+        {
+            _releaseList.list[kept++] = *entry;
+        }
+    }
+
+    _releaseList.count = kept;
+
+    ctx->stats.pending_releases = kept;
+}
+
 #pragma mark C interface to mtlDeleteMTLObj
 - (void)mtlDeleteMTLObj:(GLMContext)glm_ctx buffer:(void *)obj
 {
     assert(obj);
 
-    [self flushCommandBuffer:false];
+    // the current command buffer may still reference obj, hold it until that buffer completes
+    if (_releaseList.count >= _releaseList.size)
+    {
+        _releaseList.size = _releaseList.size ? _releaseList.size * 2 : 64;
+        _releaseList.list = (ReleaseEntry *)realloc(_releaseList.list, sizeof(ReleaseEntry) * _releaseList.size);
+        assert(_releaseList.list);
+    }
 
-    // this should release it to the GC
-    CFBridgingRelease(obj);
+    _releaseList.list[_releaseList.count].obj = obj;
+    _releaseList.list[_releaseList.count].serial = _submissionSerial;
+    _releaseList.count++;
+
+    ctx->stats.pending_releases = _releaseList.count;
 }
 
 void mtlDeleteMTLObj(GLMContext glm_ctx, void *obj)
@@ -3326,44 +4273,129 @@ void mtlDeleteMTLObj(GLMContext glm_ctx, void *obj)
     [(__bridge id)glm_ctx->mtl_funcs.mtlObj mtlDeleteMTLObj:glm_ctx buffer:obj];
 }
 
-#pragma mark C interface to mtlGetSync
-- (void)mtlGetSync:(GLMContext)glm_ctx sync:(Sync *)sync
+#pragma mark C interface to mtlRenameBuffer
+- (bool)mtlRenameBuffer:(GLMContext)glm_ctx buf:(Buffer *)buf size:(size_t)size
 {
-    RETURN_ON_FAILURE([self processGLState:false]);
+    id<MTLBuffer> old_buffer, buffer;
+    uint64_t completed;
+    void *obj;
 
-    if (_currentEvent == NULL)
-    {
-        _currentEvent = [_device newEvent];
-        assert(_currentEvent);
-    }
+    assert(buf->data.mtl_data);
 
-    _currentSyncName = sync->name;
+    old_buffer = (__bridge id<MTLBuffer>)(buf->data.mtl_data);
 
-    sync->mtl_event = (void *)CFBridgingRetain(_currentEvent);
+    if (old_buffer.length < size)
+        return false;
 
-    if (_currentCommandBufferSyncList == NULL)
+    completed = __atomic_load_n(&_completedSerial, __ATOMIC_ACQUIRE);
+
+    // oldest entries come first and are the most likely to have retired
+    obj = NULL;
+    for (GLuint i = 0; i < _renamePool.count; i++)
     {
-        _currentCommandBufferSyncList = (SyncList *)malloc(sizeof(SyncList));
-        assert(_currentCommandBufferSyncList);
+        ReleaseEntry *entry;
 
-        _currentCommandBufferSyncList->size = 8;
-        _currentCommandBufferSyncList->list = (Sync **)malloc(sizeof(Sync *) * 8);
-        assert(_currentCommandBufferSyncList->list);
+        entry = &_renamePool.list[i];
 
-        _currentCommandBufferSyncList->count = 0;
-    }
+        if (entry->serial > completed)
+            continue;
 
-    _currentCommandBufferSyncList->list[_currentCommandBufferSyncList->count] = sync;
-    _currentCommandBufferSyncList->count++;
+        buffer = (__bridge id<MTLBuffer>)(entry->obj);
 
-    if (_currentCommandBufferSyncList->count >= _currentCommandBufferSyncList->size)
-    {
-        _currentCommandBufferSyncList->size *= 2;
-        _currentCommandBufferSyncList->list =
-            (Sync **)realloc(_currentCommandBufferSyncList->list, sizeof(Sync *) * _currentCommandBufferSyncList->size);
-        assert(_currentCommandBufferSyncList->list);
+        if ((buffer.length == old_buffer.length) && (buffer.resourceOptions == old_buffer.resourceOptions))
+        {
+            obj = entry->obj;
+
+            memmove(entry, entry + 1, sizeof(ReleaseEntry) * (_renamePool.count - i - 1));
+            _renamePool.count--;
+            break;
+        }
     }
-}
+
+    if (obj == NULL)
+    {
+        buffer = [_device newBufferWithLength:old_buffer.length options:old_buffer.resourceOptions];
+        RETURN_FALSE_ON_NULL(buffer);
+
+        obj = (void *)CFBridgingRetain(buffer);
+
+        ctx->stats.buffer_rename_allocations++;
+    }
+
+    // park the old store until the current command buffer is done with it
+    if (_renamePool.count == RENAME_POOL_SIZE)
+    {
+        [self mtlDeleteMTLObj:glm_ctx buffer:_renamePool.list[0].obj];
+
+        memmove(&_renamePool.list[0], &_renamePool.list[1], sizeof(ReleaseEntry) * (_renamePool.count - 1));
+        _renamePool.count--;
+    }
+
+    if (_renamePool.count >= _renamePool.size)
+    {
+        _renamePool.size = _renamePool.size ? _renamePool.size * 2 : RENAME_POOL_SIZE;
+        _renamePool.list = (ReleaseEntry *)realloc(_renamePool.list, sizeof(ReleaseEntry) * _renamePool.size);
+        assert(_renamePool.list);
+    }
+
+    _renamePool.list[_renamePool.count].obj = buf->data.mtl_data;
+    _renamePool.list[_renamePool.count].serial = _submissionSerial;
+    _renamePool.count++;
+
+    buffer = (__bridge id<MTLBuffer>)obj;
+
+    buf->data.mtl_data = obj;
+    buf->data.buffer_data = (vm_address_t)buffer.contents;
+
+    ctx->stats.buffer_renames++;
+
+    return true;
+}
+
+bool mtlRenameBuffer(GLMContext glm_ctx, Buffer *buf, size_t size)
+{
+    // Call the Objective-C method using Objective-C syntax
+    return [(__bridge id)glm_ctx->mtl_funcs.mtlObj mtlRenameBuffer:glm_ctx buf:buf size:size];
+}
+
+#pragma mark C interface to mtlGetSync
+- (void)mtlGetSync:(GLMContext)glm_ctx sync:(Sync *)sync
+{
+    RETURN_ON_FAILURE([self processGLState:false]);
+
+    if (_currentEvent == NULL)
+    {
+        _currentEvent = [_device newEvent];
+        assert(_currentEvent);
+    }
+
+    _currentSyncName = sync->name;
+
+    sync->mtl_event = (void *)CFBridgingRetain(_currentEvent);
+
+    if (_currentCommandBufferSyncList == NULL)
+    {
+        _currentCommandBufferSyncList = (SyncList *)malloc(sizeof(SyncList));
+        assert(_currentCommandBufferSyncList);
+
+        _currentCommandBufferSyncList->size = 8;
+        _currentCommandBufferSyncList->list = (Sync **)malloc(sizeof(Sync *) * 8);
+        assert(_currentCommandBufferSyncList->list);
+
+        _currentCommandBufferSyncList->count = 0;
+    }
+
+    _currentCommandBufferSyncList->list[_currentCommandBufferSyncList->count] = sync;
+    _currentCommandBufferSyncList->count++;
+
+    if (_currentCommandBufferSyncList->count >= _currentCommandBufferSyncList->size)
+    {
+        _currentCommandBufferSyncList->size *= 2;
+        _currentCommandBufferSyncList->list =
+            (Sync **)realloc(_currentCommandBufferSyncList->list, sizeof(Sync *) * _currentCommandBufferSyncList->size);
+        assert(_currentCommandBufferSyncList->list);
+    }
+}
 
 void mtlGetSync(GLMContext glm_ctx, Sync *sync)
 {
@@ -3425,6 +4457,18 @@ void mtlFlush(GLMContext glm_ctx, bool finish)
         _drawable = [_layer nextDrawable];
         assert(_drawable);
 
+        ctx->stats.render_passes = _renderPassCount;
+        _renderPassCount = 0;
+
+        ctx->stats.dirty_bytes = _dirtyBytes;
+        _dirtyBytes = 0;
+
+        ctx->stats.blit_encoders = _blitEncoderCount;
+        _blitEncoderCount = 0;
+
+        [self advanceUniformRing];
+        [self advanceUploadRing];
+
         [self newCommandBufferAndRenderEncoder];
     }
 }
@@ -3474,6 +4518,7 @@ void mtlClearBuffer(GLMContext glm_ctx, GLuint type, GLbitfield mask)
         if (buf->data.buffer_data)
         {
             memcpy((void *)(buf->data.buffer_data + offset), ptr, size);
+            buf->data.generation++;
         }
         return;
     }
@@ -3484,7 +4529,8 @@ void mtlClearBuffer(GLMContext glm_ctx, GLuint type, GLbitfield mask)
     data = mtl_buffer.contents;
     memcpy(data + offset, ptr, size);
 
-    [mtl_buffer didModifyRange:NSMakeRange(offset, size)];
+    addBufferDirtyRange(&buf->data, offset, size);
+    [self syncDirtyRanges:buf buffer:mtl_buffer];
 }
 
 void mtlBufferSubData(GLMContext glm_ctx, Buffer *buf, size_t offset, size_t size, const void *ptr)
@@ -3493,6 +4539,144 @@ void mtlBufferSubData(GLMContext glm_ctx, Buffer *buf, size_t offset, size_t siz
     [(__bridge id)glm_ctx->mtl_funcs.mtlObj mtlBufferSubData:glm_ctx buf:buf offset:offset size:size ptr:ptr];
 }
 
+#pragma mark C interface to mtlWaitForBufferWrites
+- (void)mtlWaitForBufferWrites:(GLMContext)glm_ctx buf:(Buffer *)buf
+{
+    // the command buffer with the write is still queued or running
+    if (buf->data.gpu_write_serial > __atomic_load_n(&_completedSerial, __ATOMIC_ACQUIRE))
+    {
+        [self flushCommandBuffer:true];
+    }
+
+    buf->data.gpu_write_serial = 0;
+}
+
+void mtlWaitForBufferWrites(GLMContext glm_ctx, Buffer *buf)
+{
+    // Call the Objective-C method using Objective-C syntax
+    [(__bridge id)glm_ctx->mtl_funcs.mtlObj mtlWaitForBufferWrites:glm_ctx buf:buf];
+}
+
+- (void)markBufferWrite:(Buffer *)buf
+{
+    // managed buffers only see the result in contents once the command buffer is done
+    buf->data.gpu_write_serial = _submissionSerial;
+
+    // not a dirty range, what the gpu wrote is newer than buffer_data
+    buf->data.generation++;
+}
+
+#pragma mark C interface to mtlCopyBufferSubData
+- (void)copyBufferOnCPU:(Buffer *)src
+                    dst:(Buffer *)dst
+             readOffset:(size_t)readOffset
+            writeOffset:(size_t)writeOffset
+                   size:(size_t)size
+{
+    // queued gpu writes to either side have to land before the cpu copy
+    [self mtlWaitForBufferWrites:ctx buf:src];
+    [self mtlWaitForBufferWrites:ctx buf:dst];
+
+    // libc memcpy is already vectorized and switches to non temporal stores for large copies
+    memcpy((void *)(dst->data.buffer_data + writeOffset), (void *)(src->data.buffer_data + readOffset), size);
+
+    addBufferDirtyRange(&dst->data, writeOffset, size);
+    dst->data.dirty_bits |= DIRTY_BUFFER_DATA;
+
+    ctx->state.dirty_bits |= DIRTY_BUFFER;
+}
+
+- (void)mtlCopyBufferSubData:(GLMContext)glm_ctx
+                         src:(Buffer *)src
+                         dst:(Buffer *)dst
+                  readOffset:(size_t)readOffset
+                 writeOffset:(size_t)writeOffset
+                        size:(size_t)size
+{
+    id<MTLBuffer> src_buffer, dst_buffer;
+
+    // both only live in buffer_data
+    if ((src->data.mtl_data == NULL) && (dst->data.mtl_data == NULL))
+    {
+        [self copyBufferOnCPU:src dst:dst readOffset:readOffset writeOffset:writeOffset size:size];
+        return;
+    }
+
+    if (dst->data.mtl_data == NULL)
+    {
+        [self bindMTLBuffer:dst];
+    }
+
+    // small destinations are read from buffer_data by set*Bytes, blits need 4 byte alignment on macOS
+    if ((dst->data.mtl_data == NULL) || ((readOffset | writeOffset | size) & 3))
+    {
+        [self copyBufferOnCPU:src dst:dst readOffset:readOffset writeOffset:writeOffset size:size];
+        return;
+    }
+
+    // pending cpu writes are older than the copy, push them first
+    if (dst->data.dirty_bits)
+    {
+        [self updateDirtyBuffer:dst];
+    }
+
+    dst_buffer = (__bridge id<MTLBuffer>)(dst->data.mtl_data);
+
+    if (src->data.mtl_data == NULL)
+    {
+        [self bindMTLBuffer:src];
+    }
+
+    if (src->data.mtl_data)
+    {
+        if (src->data.dirty_bits)
+        {
+            [self updateDirtyBuffer:src];
+        }
+
+        src_buffer = (__bridge id<MTLBuffer>)(src->data.mtl_data);
+    }
+    else
+    {
+        src_buffer = nil;
+    }
+
+    PendingBlit *blit = [self queueBlit:PENDING_BLIT_COPY_BUFFER];
+
+    if (src_buffer)
+    {
+        blit->src = (void *)CFBridgingRetain(src_buffer);
+        blit->src_offset = readOffset;
+    }
+    else
+    {
+        // small source, its bytes go through the staging area
+        blit->src_offset = [self stageBytes:(void *)(src->data.buffer_data + readOffset)
+                                      pitch:size
+                                    rowSize:size
+                                       rows:1];
+    }
+
+    blit->dst = (void *)CFBridgingRetain(dst_buffer);
+    blit->dst_offset = writeOffset;
+    blit->size = size;
+    blit->synchronize = (dst_buffer.storageMode == MTLStorageModeManaged);
+
+    [self markBufferWrite:dst];
+}
+
+void mtlCopyBufferSubData(GLMContext glm_ctx, Buffer *src, Buffer *dst, size_t read_offset, size_t write_offset,
+                          size_t size)
+{
+    // Call the Objective-C method using Objective-C syntax
+    [(__bridge id)glm_ctx->mtl_funcs.mtlObj mtlCopyBufferSubData:glm_ctx
+                                                             src:src
+                                                             dst:dst
+                                                      readOffset:read_offset
+                                                     writeOffset:write_offset
+                                                            size:size];
+}
+
 #pragma mark C interface to mtlMapUnmapBuffer
 - (void *)mtlMapUnmapBuffer:(GLMContext)glm_ctx
                         buf:(Buffer *)buf
@@ -3515,7 +4699,11 @@ void mtlBufferSubData(GLMContext glm_ctx, Buffer *buf, size_t offset, size_t siz
         return mtl_buffer.contents + offset;
     }
 
-    [mtl_buffer didModifyRange:NSMakeRange(offset, size)];
+    // the caller recorded the written range, read only maps have nothing to sync
+    if (buf->data.dirty_range_count)
+    {
+        [self syncDirtyRanges:buf buffer:mtl_buffer];
+    }
 
     return NULL;
 }
@@ -3538,7 +4726,8 @@ void *mtlMapUnmapBuffer(GLMContext glm_ctx, Buffer *buf, size_t offset, size_t s
 
     mtl_buffer = (__bridge id<MTLBuffer>)(buf->data.mtl_data);
 
-    [mtl_buffer didModifyRange:NSMakeRange(offset, length)];
+    // the flushed range was recorded by the caller along with anything still pending
+    [self syncDirtyRanges:buf buffer:mtl_buffer];
 }
 
 void mtlFlushBufferRange(GLMContext glm_ctx, Buffer *buf, GLintptr offset, GLsizeiptr length)
@@ -3755,9 +4944,6 @@ void mtlGetTexImage(GLMContext glm_ctx, Texture *tex, void *pixelBytes, GLuint b
 {
     RETURN_ON_FAILURE([self processGLState:false]);
 
-    // end encoding on current render encoder
-    [self endRenderEncoding];
-
     // no failure path..?
     RETURN_ON_FAILURE([self bindMTLTexture:tex]);
     assert(tex->mtl_data);
@@ -3767,12 +4953,9 @@ void mtlGetTexImage(GLMContext glm_ctx, Texture *tex, void *pixelBytes, GLuint b
     texture = (__bridge id<MTLTexture>)(tex->mtl_data);
     assert(texture);
 
-    // start blit encoder
-    id<MTLBlitCommandEncoder> blitCommandEncoder;
-    blitCommandEncoder = [_currentCommandBuffer blitCommandEncoder];
-
-    [blitCommandEncoder generateMipmapsForTexture:texture];
-    [blitCommandEncoder endEncoding];
+    // runs after any uploads queued ahead of it
+    PendingBlit *blit = [self queueBlit:PENDING_BLIT_GENERATE_MIPMAPS];
+    blit->dst = (void *)CFBridgingRetain(texture);
 }
 
 void mtlGenerateMipmaps(GLMContext glm_ctx, Texture *tex)
@@ -3798,17 +4981,13 @@ void mtlGenerateMipmaps(GLMContext glm_ctx, Texture *tex)
                yoffset:(size_t)yoffset
                zoffset:(size_t)zoffset
 {
-    // we can deal with a null buffer but we need a texture
+    PendingBlit *blit;
+
     if (buf->data.mtl_data == NULL)
     {
         [self bindMTLBuffer:buf];
-        RETURN_ON_NULL(buf->data.mtl_data);
     }
 
-    id<MTLBuffer> buffer;
-    buffer = (__bridge id<MTLBuffer>)(buf->data.mtl_data);
-    assert(buffer);
-
     if (tex->mtl_data == NULL)
     {
         [self bindMTLTexture:tex];
@@ -3819,25 +4998,37 @@ void mtlGenerateMipmaps(GLMContext glm_ctx, Texture *tex)
     texture = (__bridge id<MTLTexture>)(tex->mtl_data);
     assert(texture);
 
-    // end encoding on current render encoder
-    [self endRenderEncoding];
+    blit = [self queueBlit:PENDING_BLIT_BUFFER_TO_TEXTURE];
 
-    // start blit encoder
-    id<MTLBlitCommandEncoder> blitCommandEncoder;
-    blitCommandEncoder = [_currentCommandBuffer blitCommandEncoder];
+    if (buf->data.mtl_data)
+    {
+        // pending cpu writes to the pixel buffer are older than the upload
+        if (buf->data.dirty_bits)
+        {
+            [self updateDirtyBuffer:buf];
+        }
 
-    [blitCommandEncoder copyFromBuffer:buffer
-                          sourceOffset:src_offset
-                     sourceBytesPerRow:src_pitch
-                   sourceBytesPerImage:src_image_size
-                            sourceSize:MTLSizeMake(width, height, depth)
-                             toTexture:texture
-                      destinationSlice:zoffset
-                      destinationLevel:level
-                     destinationOrigin:MTLOriginMake(xoffset, yoffset, 0)
-                               options:MTLBlitOptionNone];
+        blit->src = (void *)CFBridgingRetain((__bridge id<MTLBuffer>)(buf->data.mtl_data));
+        blit->src_offset = src_offset;
+        blit->src_pitch = src_pitch;
+        blit->src_image_size = src_image_size;
+    }
+    else
+    {
+        // small pixel buffers only live in buffer_data
+        blit->src_offset = [self stageBytes:(void *)(buf->data.buffer_data + src_offset)
+                                      pitch:src_image_size
+                                    rowSize:src_image_size
+                                       rows:depth];
+        blit->src_pitch = src_pitch;
+        blit->src_image_size = src_image_size;
+    }
 
-    [blitCommandEncoder endEncoding];
+    blit->src_size = MTLSizeMake(width, height, depth);
+    blit->dst = (void *)CFBridgingRetain(texture);
+    blit->dst_slice = zoffset;
+    blit->dst_level = level;
+    blit->dst_origin = MTLOriginMake(xoffset, yoffset, 0);
 }
 
 void mtlTexSubImage(GLMContext glm_ctx, Texture *tex, Buffer *buf, size_t src_offset, size_t src_pitch,
@@ -3861,6 +5052,53 @@ void mtlTexSubImage(GLMContext glm_ctx, Texture *tex, Buffer *buf, size_t src_of
                                                    zoffset:zoffset];
 }
 
+#pragma mark C interface to mtlTexSubImageData
+- (void)mtlTexSubImageData:(GLMContext)glm_ctx
+                       tex:(Texture *)tex
+                    pixels:(const void *)pixels
+                 src_pitch:(size_t)src_pitch
+                     level:(GLuint)level
+                     width:(size_t)width
+                    height:(size_t)height
+                   xoffset:(size_t)xoffset
+                   yoffset:(size_t)yoffset
+{
+    id<MTLTexture> texture;
+    PendingBlit *blit;
+    size_t row_size;
+
+    texture = (__bridge id<MTLTexture>)(tex->mtl_data);
+    assert(texture);
+
+    // the level pitch matches the client layout, so the row size is the level's pixel size times width
+    row_size = width * (tex->faces[0].levels[level].pitch / tex->faces[0].levels[level].width);
+
+    blit = [self queueBlit:PENDING_BLIT_BUFFER_TO_TEXTURE];
+
+    blit->src_offset = [self stageBytes:pixels pitch:src_pitch rowSize:row_size rows:height];
+    blit->src_pitch = row_size;
+    blit->src_image_size = row_size * height;
+    blit->src_size = MTLSizeMake(width, height, 1);
+    blit->dst = (void *)CFBridgingRetain(texture);
+    blit->dst_slice = 0;
+    blit->dst_level = level;
+    blit->dst_origin = MTLOriginMake(xoffset, yoffset, 0);
+}
+
+void mtlTexSubImageData(GLMContext glm_ctx, Texture *tex, const void *pixels, size_t src_pitch, GLuint level,
+                        size_t width, size_t height, size_t xoffset, size_t yoffset)
+{
+    [(__bridge id)glm_ctx->mtl_funcs.mtlObj mtlTexSubImageData:glm_ctx
+                                                           tex:tex
+                                                        pixels:pixels
+                                                     src_pitch:src_pitch
+                                                         level:level
+                                                         width:width
+                                                        height:height
+                                                       xoffset:xoffset
+                                                       yoffset:yoffset];
+}
+
 #pragma mark utility functions for draw commands
 MTLPrimitiveType getMTLPrimitiveType(GLenum mode)
 {
@@ -3883,10 +5121,13 @@ MTLPrimitiveType getMTLPrimitiveType(GLenum mode)
     case GL_TRIANGLE_STRIP:
         return MTLPrimitiveTypeTriangleStrip;
 
+    // drawn from generated indices, needsGeneratedIndices keeps them from getting here
     case GL_LINE_LOOP:
+    case GL_TRIANGLE_FAN:
+    case GL_QUADS:
+
     case GL_LINE_STRIP_ADJACENCY:
     case GL_LINES_ADJACENCY:
-    case GL_TRIANGLE_FAN:
     case GL_TRIANGLE_STRIP_ADJACENCY:
     case GL_PATCHES:
         assert(0);
@@ -3926,6 +5167,47 @@ Buffer *getIndirectBuffer(GLMContext ctx)
     return gl_indirect_buffer;
 }
 
+#pragma mark generated indices
+- (void)drawGeneratedIndices:(GLenum)mode
+                       first:(GLint)first
+                       count:(GLsizei)count
+                        type:(GLenum)type
+                     indices:(const void *)indices
+               instanceCount:(GLsizei)instancecount
+                  baseVertex:(GLint)basevertex
+                baseInstance:(GLuint)baseinstance
+{
+    GeneratedIndices *entry;
+
+    entry = getGeneratedIndices(ctx, mode, first, count, type, indices);
+    RETURN_ON_NULL(entry);
+
+    if (entry->out_count == 0)
+        return;
+
+    // made once per cache entry, it goes away with the entry
+    if (entry->mtl_data == NULL)
+    {
+        id<MTLBuffer> buffer = [_device newBufferWithBytes:entry->data
+                                                    length:entry->out_count * sizeof(GLuint)
+                                                   options:MTLResourceStorageModeShared];
+        RETURN_ON_NULL(buffer);
+        buffer.label = @"Generated Indices";
+
+        entry->mtl_data = (void *)CFBridgingRetain(buffer);
+    }
+
+    // arrays get absolute indices, elements keep their values so basevertex still applies
+    [_currentRenderEncoder drawIndexedPrimitives:getMTLPrimitiveType(entry->out_mode)
+                                      indexCount:entry->out_count
+                                       indexType:MTLIndexTypeUInt32
+                                     indexBuffer:(__bridge id<MTLBuffer>)(entry->mtl_data)
+                               indexBufferOffset:0
+                                   instanceCount:instancecount
+                                      baseVertex:basevertex
+                                    baseInstance:baseinstance];
+}
+
 #pragma mark C interface to mtlDrawArrays
 - (void)mtlDrawArrays:(GLMContext)ctx mode:(GLenum)mode first:(GLint)first count:(GLsizei)count
 {
@@ -3933,6 +5215,19 @@ Buffer *getIndirectBuffer(GLMContext ctx)
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, 0))
+    {
+        [self drawGeneratedIndices:mode
+                             first:first
+                             count:count
+                              type:0
+                           indices:NULL
+                     instanceCount:1
+                        baseVertex:0
+                      baseInstance:0];
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -3957,6 +5252,19 @@ void mtlDrawArrays(GLMContext glm_ctx, GLenum mode, GLint first, GLsizei count)
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, type))
+    {
+        [self drawGeneratedIndices:mode
+                             first:0
+                             count:count
+                              type:type
+                           indices:indices
+                     instanceCount:1
+                        baseVertex:0
+                      baseInstance:0];
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -3969,25 +5277,17 @@ void mtlDrawArrays(GLMContext glm_ctx, GLenum mode, GLint first, GLsizei count)
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer;
-    if (gl_element_buffer->data.mtl_data != NULL)
-    {
-        indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    }
-    else
-    {
-        // For small buffers, create a temporary MTL buffer from buffer_data
-        indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                           length:gl_element_buffer->size
-                                          options:MTLResourceCPUCacheModeDefaultCache | MTLResourceStorageModeManaged];
-    }
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
+
+    size_t offset = (char *)indices - (char *)NULL;
 
     [_currentRenderEncoder drawIndexedPrimitives:primitiveType
                                       indexCount:count
                                        indexType:indexType
                                      indexBuffer:indexBuffer
-                               indexBufferOffset:0
+                               indexBufferOffset:indexRingOffset + offset
                                    instanceCount:1];
 }
 
@@ -4011,6 +5311,19 @@ void mtlDrawElements(GLMContext glm_ctx, GLenum mode, GLsizei count, GLenum type
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, type))
+    {
+        [self drawGeneratedIndices:mode
+                             first:0
+                             count:count
+                              type:type
+                           indices:indices
+                     instanceCount:1
+                        baseVertex:0
+                      baseInstance:0];
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -4023,16 +5336,9 @@ void mtlDrawElements(GLMContext glm_ctx, GLenum mode, GLsizei count, GLenum type
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer;
-    if (gl_element_buffer->data.mtl_data != NULL) {
-        indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    } else {
-        // For small buffers, create a temporary MTL buffer from buffer_data
-        indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                           length:gl_element_buffer->size
-                                          options:MTLResourceCPUCacheModeDefaultCache | MTLResourceStorageModeManaged];
-    }
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
 
     size_t offset = (char *)indices - (char *)NULL;
 
@@ -4053,7 +5359,7 @@ void mtlDrawElements(GLMContext glm_ctx, GLenum mode, GLsizei count, GLenum type
                                       indexCount:count
                                        indexType:indexType
                                      indexBuffer:indexBuffer
-                               indexBufferOffset:offset
+                               indexBufferOffset:indexRingOffset + offset
                                    instanceCount:1];
 }
 
@@ -4080,6 +5386,19 @@ void mtlDrawRangeElements(GLMContext glm_ctx, GLenum mode, GLuint start, GLuint
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, 0))
+    {
+        [self drawGeneratedIndices:mode
+                             first:first
+                             count:count
+                              type:0
+                           indices:NULL
+                     instanceCount:instancecount
+                        baseVertex:0
+                      baseInstance:0];
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -4111,6 +5430,19 @@ void mtlDrawArraysInstanced(GLMContext glm_ctx, GLenum mode, GLint first, GLsize
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, type))
+    {
+        [self drawGeneratedIndices:mode
+                             first:0
+                             count:count
+                              type:type
+                           indices:indices
+                     instanceCount:instancecount
+                        baseVertex:0
+                      baseInstance:0];
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -4123,21 +5455,9 @@ void mtlDrawArraysInstanced(GLMContext glm_ctx, GLenum mode, GLint first, GLsize
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    
-    // Handle small buffers (size <= 4095) that don't have MTL buffer objects
-    if (indexBuffer == nil && gl_element_buffer->size <= 4095)
-    {
-        // For small buffers, create a temporary Metal buffer from buffer_data
-        if (gl_element_buffer->data.buffer_data)
-        {
-            indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                               length:gl_element_buffer->size
-                                              options:MTLResourceStorageModeManaged];
-        }
-    }
-    
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
 
     size_t offset = (char *)indices - (char *)NULL;
 
@@ -4150,7 +5470,7 @@ void mtlDrawArraysInstanced(GLMContext glm_ctx, GLenum mode, GLint first, GLsize
                                       indexCount:count
                                        indexType:indexType
                                      indexBuffer:indexBuffer
-                               indexBufferOffset:offset
+                               indexBufferOffset:indexRingOffset + offset
                                    instanceCount:instancecount];
 }
 
@@ -4178,6 +5498,19 @@ void mtlDrawElementsInstanced(GLMContext glm_ctx, GLenum mode, GLsizei count, GL
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, type))
+    {
+        [self drawGeneratedIndices:mode
+                             first:0
+                             count:count
+                              type:type
+                           indices:indices
+                     instanceCount:1
+                        baseVertex:basevertex
+                      baseInstance:0];
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -4190,21 +5523,9 @@ void mtlDrawElementsInstanced(GLMContext glm_ctx, GLenum mode, GLsizei count, GL
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    
-    // Handle small buffers (size <= 4095) that don't have MTL buffer objects
-    if (indexBuffer == nil && gl_element_buffer->size <= 4095)
-    {
-        // For small buffers, create a temporary Metal buffer from buffer_data
-        if (gl_element_buffer->data.buffer_data)
-        {
-            indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                               length:gl_element_buffer->size
-                                              options:MTLResourceStorageModeManaged];
-        }
-    }
-    
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
 
     size_t offset = (char *)indices - (char *)NULL;
 
@@ -4212,7 +5533,7 @@ void mtlDrawElementsInstanced(GLMContext glm_ctx, GLenum mode, GLsizei count, GL
                                       indexCount:count
                                        indexType:indexType
                                      indexBuffer:indexBuffer
-                               indexBufferOffset:offset
+                               indexBufferOffset:indexRingOffset + offset
                                    instanceCount:1
                                       baseVertex:basevertex
                                     baseInstance:0];
@@ -4255,21 +5576,9 @@ void mtlDrawElementsBaseVertex(GLMContext glm_ctx, GLenum mode, GLsizei count, G
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    
-    // Handle small buffers (size <= 4095) that don't have MTL buffer objects
-    if (indexBuffer == nil && gl_element_buffer->size <= 4095)
-    {
-        // For small buffers, create a temporary Metal buffer from buffer_data
-        if (gl_element_buffer->data.buffer_data)
-        {
-            indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                               length:gl_element_buffer->size
-                                              options:MTLResourceStorageModeManaged];
-        }
-    }
-    
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
 
     size_t offset = (char *)indices - (char *)NULL;
 
@@ -4288,7 +5597,7 @@ void mtlDrawElementsBaseVertex(GLMContext glm_ctx, GLenum mode, GLsizei count, G
                                       indexCount:end - start
                                        indexType:indexType
                                      indexBuffer:indexBuffer
-                               indexBufferOffset:offset + start
+                               indexBufferOffset:indexRingOffset + offset + start
                                    instanceCount:1
                                       baseVertex:basevertex
                                     baseInstance:0];
@@ -4320,6 +5629,19 @@ void mtlDrawRangeElementsBaseVertex(GLMContext glm_ctx, GLenum mode, GLuint star
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, type))
+    {
+        [self drawGeneratedIndices:mode
+                             first:0
+                             count:count
+                              type:type
+                           indices:indices
+                     instanceCount:instancecount
+                        baseVertex:basevertex
+                      baseInstance:0];
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -4332,21 +5654,9 @@ void mtlDrawRangeElementsBaseVertex(GLMContext glm_ctx, GLenum mode, GLuint star
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    
-    // Handle small buffers (size <= 4095) that don't have MTL buffer objects
-    if (indexBuffer == nil && gl_element_buffer->size <= 4095)
-    {
-        // For small buffers, create a temporary Metal buffer from buffer_data
-        if (gl_element_buffer->data.buffer_data)
-        {
-            indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                               length:gl_element_buffer->size
-                                              options:MTLResourceStorageModeManaged];
-        }
-    }
-    
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
 
     size_t offset = (char *)indices - (char *)NULL;
 
@@ -4354,7 +5664,7 @@ void mtlDrawRangeElementsBaseVertex(GLMContext glm_ctx, GLenum mode, GLuint star
                                       indexCount:count
                                        indexType:indexType
                                      indexBuffer:indexBuffer
-                               indexBufferOffset:offset
+                               indexBufferOffset:indexRingOffset + offset
                                    instanceCount:instancecount
                                       baseVertex:basevertex
                                     baseInstance:0];
@@ -4393,7 +5703,7 @@ void mtlDrawElementsInstancedBaseVertex(GLMContext glm_ctx, GLenum mode, GLsizei
 
     [_currentRenderEncoder drawPrimitives:primitiveType
                            indirectBuffer:indirectBuffer
-                     indirectBufferOffset:(DrawArraysIndirectCommand *)indirect - (DrawArraysIndirectCommand *)NULL];
+                     indirectBufferOffset:(uintptr_t)indirect];
 }
 
 void mtlDrawArraysIndirect(GLMContext glm_ctx, GLenum mode, const void *indirect)
@@ -4422,21 +5732,9 @@ void mtlDrawArraysIndirect(GLMContext glm_ctx, GLenum mode, const void *indirect
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    
-    // Handle small buffers (size <= 4095) that don't have MTL buffer objects
-    if (indexBuffer == nil && gl_element_buffer->size <= 4095)
-    {
-        // For small buffers, create a temporary Metal buffer from buffer_data
-        if (gl_element_buffer->data.buffer_data)
-        {
-            indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                               length:gl_element_buffer->size
-                                              options:MTLResourceStorageModeManaged];
-        }
-    }
-    
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
 
     // get indirect buffer
     Buffer *gl_indirect_buffer = getIndirectBuffer(ctx);
@@ -4453,9 +5751,9 @@ void mtlDrawArraysIndirect(GLMContext glm_ctx, GLenum mode, const void *indirect
         drawIndexedPrimitives:primitiveType
                     indexType:indexType
                   indexBuffer:indexBuffer
-            indexBufferOffset:0
+            indexBufferOffset:indexRingOffset
                indirectBuffer:indirectBuffer
-         indirectBufferOffset:(DrawElementsIndirectCommand *)indirect - (DrawElementsIndirectCommand *)NULL];
+         indirectBufferOffset:(uintptr_t)indirect];
 }
 
 void mtlDrawElementsIndirect(GLMContext glm_ctx, GLenum mode, GLenum type, const void *indirect)
@@ -4475,6 +5773,19 @@ void mtlDrawElementsIndirect(GLMContext glm_ctx, GLenum mode, GLenum type, const
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, 0))
+    {
+        [self drawGeneratedIndices:mode
+                             first:first
+                             count:count
+                              type:0
+                           indices:NULL
+                     instanceCount:instancecount
+                        baseVertex:0
+                      baseInstance:baseinstance];
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -4510,6 +5821,19 @@ void mtlDrawArraysInstancedBaseInstance(GLMContext glm_ctx, GLenum mode, GLint f
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, type))
+    {
+        [self drawGeneratedIndices:mode
+                             first:0
+                             count:count
+                              type:type
+                           indices:indices
+                     instanceCount:instancecount
+                        baseVertex:0
+                      baseInstance:baseinstance];
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -4522,21 +5846,9 @@ void mtlDrawArraysInstancedBaseInstance(GLMContext glm_ctx, GLenum mode, GLint f
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    
-    // Handle small buffers (size <= 4095) that don't have MTL buffer objects
-    if (indexBuffer == nil && gl_element_buffer->size <= 4095)
-    {
-        // For small buffers, create a temporary Metal buffer from buffer_data
-        if (gl_element_buffer->data.buffer_data)
-        {
-            indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                               length:gl_element_buffer->size
-                                              options:MTLResourceStorageModeManaged];
-        }
-    }
-    
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
 
     size_t offset = (char *)indices - (char *)NULL;
 
@@ -4549,7 +5861,7 @@ void mtlDrawArraysInstancedBaseInstance(GLMContext glm_ctx, GLenum mode, GLint f
                                       indexCount:count
                                        indexType:indexType
                                      indexBuffer:indexBuffer
-                               indexBufferOffset:offset
+                               indexBufferOffset:indexRingOffset + offset
                                    instanceCount:instancecount
                                       baseVertex:0
                                     baseInstance:baseinstance];
@@ -4582,6 +5894,19 @@ void mtlDrawElementsInstancedBaseInstance(GLMContext glm_ctx, GLenum mode, GLsiz
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, type))
+    {
+        [self drawGeneratedIndices:mode
+                             first:0
+                             count:count
+                              type:type
+                           indices:indices
+                     instanceCount:instancecount
+                        baseVertex:basevertex
+                      baseInstance:baseinstance];
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -4594,21 +5919,9 @@ void mtlDrawElementsInstancedBaseInstance(GLMContext glm_ctx, GLenum mode, GLsiz
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    
-    // Handle small buffers (size <= 4095) that don't have MTL buffer objects
-    if (indexBuffer == nil && gl_element_buffer->size <= 4095)
-    {
-        // For small buffers, create a temporary Metal buffer from buffer_data
-        if (gl_element_buffer->data.buffer_data)
-        {
-            indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                               length:gl_element_buffer->size
-                                              options:MTLResourceStorageModeManaged];
-        }
-    }
-    
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
 
     size_t offset = (char *)indices - (char *)NULL;
 
@@ -4621,7 +5934,7 @@ void mtlDrawElementsInstancedBaseInstance(GLMContext glm_ctx, GLenum mode, GLsiz
                                       indexCount:count
                                        indexType:indexType
                                      indexBuffer:indexBuffer
-                               indexBufferOffset:offset
+                               indexBufferOffset:indexRingOffset + offset
                                    instanceCount:instancecount
                                       baseVertex:basevertex
                                     baseInstance:baseinstance];
@@ -4652,6 +5965,23 @@ void mtlDrawElementsInstancedBaseVertexBaseInstance(GLMContext glm_ctx, GLenum m
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, 0))
+    {
+        for (int i = 0; i < drawcount; i++)
+        {
+            [self drawGeneratedIndices:mode
+                                 first:first[i]
+                                 count:count[i]
+                                  type:0
+                               indices:NULL
+                         instanceCount:1
+                            baseVertex:0
+                          baseInstance:0];
+        }
+
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -4683,6 +6013,23 @@ void mtlMultiDrawArrays(GLMContext glm_ctx, GLenum mode, const GLint *first, con
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, type))
+    {
+        for (int i = 0; i < drawcount; i++)
+        {
+            [self drawGeneratedIndices:mode
+                                 first:0
+                                 count:count[i]
+                                  type:type
+                               indices:indices[i]
+                         instanceCount:1
+                            baseVertex:0
+                          baseInstance:0];
+        }
+
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -4695,21 +6042,9 @@ void mtlMultiDrawArrays(GLMContext glm_ctx, GLenum mode, const GLint *first, con
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    
-    // Handle small buffers (size <= 4095) that don't have MTL buffer objects
-    if (indexBuffer == nil && gl_element_buffer->size <= 4095)
-    {
-        // For small buffers, create a temporary Metal buffer from buffer_data
-        if (gl_element_buffer->data.buffer_data)
-        {
-            indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                               length:gl_element_buffer->size
-                                              options:MTLResourceStorageModeManaged];
-        }
-    }
-    
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
 
     for (int i = 0; i < drawcount; i++)
     {
@@ -4721,7 +6056,7 @@ void mtlMultiDrawArrays(GLMContext glm_ctx, GLenum mode, const GLint *first, con
                                           indexCount:count[i]
                                            indexType:indexType
                                          indexBuffer:indexBuffer
-                                   indexBufferOffset:offset
+                                   indexBufferOffset:indexRingOffset + offset
                                        instanceCount:1];
     }
 }
@@ -4752,6 +6087,23 @@ void mtlMultiDrawElements(GLMContext glm_ctx, GLenum mode, const GLsizei *count,
 
     RETURN_ON_FAILURE([self processGLState:true]);
 
+    if (needsGeneratedIndices(ctx, mode, type))
+    {
+        for (int i = 0; i < drawcount; i++)
+        {
+            [self drawGeneratedIndices:mode
+                                 first:0
+                                 count:count[i]
+                                  type:type
+                               indices:indices[i]
+                         instanceCount:1
+                            baseVertex:basevertex[i]
+                          baseInstance:0];
+        }
+
+        return;
+    }
+
     primitiveType = getMTLPrimitiveType(mode);
     assert(primitiveType != 0xFFFFFFFF);
 
@@ -4765,21 +6117,9 @@ void mtlMultiDrawElements(GLMContext glm_ctx, GLenum mode, const GLsizei *count,
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    
-    // Handle small buffers (size <= 4095) that don't have MTL buffer objects
-    if (indexBuffer == nil && gl_element_buffer->size <= 4095)
-    {
-        // For small buffers, create a temporary Metal buffer from buffer_data
-        if (gl_element_buffer->data.buffer_data)
-        {
-            indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                               length:gl_element_buffer->size
-                                              options:MTLResourceStorageModeManaged];
-        }
-    }
-    
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
 
     for (int i = 0; i < drawcount; i++)
     {
@@ -4791,7 +6131,7 @@ void mtlMultiDrawElements(GLMContext glm_ctx, GLenum mode, const GLsizei *count,
                                           indexCount:count[i]
                                            indexType:indexType
                                          indexBuffer:indexBuffer
-                                   indexBufferOffset:offset
+                                   indexBufferOffset:indexRingOffset + offset
                                        instanceCount:count[i]
                                           baseVertex:basevertex[i]
                                         baseInstance:1];
@@ -4836,14 +6176,7 @@ void mtlMultiDrawElementsBaseVertex(GLMContext glm_ctx, GLenum mode, const GLsiz
     {
         size_t offset;
 
-        if (stride)
-        {
-            offset = (char *)((char *)indirect + i * stride) - (char *)NULL;
-        }
-        else
-        {
-            offset = (char *)indirect + i - (char *)NULL;
-        }
+        offset = (uintptr_t)indirect + i * (stride ? stride : sizeof(DrawArraysIndirectCommand));
 
         [_currentRenderEncoder drawPrimitives:primitiveType indirectBuffer:indirectBuffer indirectBufferOffset:offset];
     }
@@ -4884,21 +6217,9 @@ void mtlMultiDrawArraysIndirect(GLMContext glm_ctx, GLenum mode, const void *ind
     if ([self processBuffer:gl_element_buffer] == false)
         return;
 
-    id<MTLBuffer> indexBuffer = (__bridge id<MTLBuffer>)(gl_element_buffer->data.mtl_data);
-    
-    // Handle small buffers (size <= 4095) that don't have MTL buffer objects
-    if (indexBuffer == nil && gl_element_buffer->size <= 4095)
-    {
-        // For small buffers, create a temporary Metal buffer from buffer_data
-        if (gl_element_buffer->data.buffer_data)
-        {
-            indexBuffer = [_device newBufferWithBytes:(void *)gl_element_buffer->data.buffer_data
-                                               length:gl_element_buffer->size
-                                              options:MTLResourceStorageModeManaged];
-        }
-    }
-    
-    assert(indexBuffer);
+    NSUInteger indexRingOffset;
+    id<MTLBuffer> indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+    RETURN_ON_NULL(indexBuffer);
 
     // get indirect buffer
     Buffer *gl_indirect_buffer = getIndirectBuffer(ctx);
@@ -4914,20 +6235,13 @@ void mtlMultiDrawArraysIndirect(GLMContext glm_ctx, GLenum mode, const void *ind
     {
         size_t offset;
 
-        if (stride)
-        {
-            offset = (char *)((char *)indirect + i * stride) - (char *)NULL;
-        }
-        else
-        {
-            offset = (char *)indirect + i - (char *)NULL;
-        }
+        offset = (uintptr_t)indirect + i * (stride ? stride : sizeof(DrawElementsIndirectCommand));
 
         // draw indexed primitive
         [_currentRenderEncoder drawIndexedPrimitives:primitiveType
                                            indexType:indexType
                                          indexBuffer:indexBuffer
-                                   indexBufferOffset:0
+                                   indexBufferOffset:indexRingOffset
                                       indirectBuffer:indirectBuffer
                                 indirectBufferOffset:offset];
     }
@@ -4944,6 +6258,285 @@ void mtlMultiDrawElementsIndirect(GLMContext glm_ctx, GLenum mode, GLenum type,
                                                                   stride:stride];
 }
 
+#pragma mark multi draw indirect count
+// one thread per command up to maxdrawcount, the ones past the count in the parameter buffer are reset to no-ops
+static const char *indirect_count_source =
+    "#include <metal_stdlib>\n"
+    "using namespace metal;\n"
+    "struct IndirectCountParams { uint max_draw_count; uint stride; uint primitive_type; uint index_size; "
+    "uint command_base; };\n"
+    "struct IndirectCommands { command_buffer commands [[id(0)]]; };\n"
+    "struct DrawArraysCommand { uint count; uint instance_count; uint first; uint base_instance; };\n"
+    "struct DrawElementsCommand { uint count; uint instance_count; uint first; int base_vertex; uint base_instance; "
+    "};\n"
+    "kernel void encodeDrawArrays(device const uchar *indirect [[buffer(0)]],\n"
+    "                             device const uint *draw_count [[buffer(1)]],\n"
+    "                             constant IndirectCountParams &params [[buffer(2)]],\n"
+    "                             device IndirectCommands &icb [[buffer(3)]],\n"
+    "                             uint i [[thread_position_in_grid]])\n"
+    "{\n"
+    "    if (i >= params.max_draw_count) return;\n"
+    "    render_command cmd(icb.commands, params.command_base + i);\n"
+    "    if (i >= *draw_count) { cmd.reset(); return; }\n"
+    "    device const DrawArraysCommand *draw = (device const DrawArraysCommand *)(indirect + i * params.stride);\n"
+    "    cmd.draw_primitives(primitive_type(params.primitive_type), draw->first, draw->count,\n"
+    "                        draw->instance_count, draw->base_instance);\n"
+    "}\n"
+    "kernel void encodeDrawElements(device const uchar *indirect [[buffer(0)]],\n"
+    "                               device const uint *draw_count [[buffer(1)]],\n"
+    "                               constant IndirectCountParams &params [[buffer(2)]],\n"
+    "                               device IndirectCommands &icb [[buffer(3)]],\n"
+    "                               device const uchar *indices [[buffer(4)]],\n"
+    "                               uint i [[thread_position_in_grid]])\n"
+    "{\n"
+    "    if (i >= params.max_draw_count) return;\n"
+    "    render_command cmd(icb.commands, params.command_base + i);\n"
+    "    if (i >= *draw_count) { cmd.reset(); return; }\n"
+    "    device const DrawElementsCommand *draw = (device const DrawElementsCommand *)(indirect + i * params.stride);\n"
+    "    if (params.index_size == 2)\n"
+    "        cmd.draw_indexed_primitives(primitive_type(params.primitive_type), draw->count,\n"
+    "                                    (device const ushort *)indices + draw->first, draw->instance_count,\n"
+    "                                    draw->base_vertex, draw->base_instance);\n"
+    "    else\n"
+    "        cmd.draw_indexed_primitives(primitive_type(params.primitive_type), draw->count,\n"
+    "                                    (device const uint *)indices + draw->first, draw->instance_count,\n"
+    "                                    draw->base_vertex, draw->base_instance);\n"
+    "}\n";
+
+typedef struct IndirectCountParams_t
+{
+    uint32_t max_draw_count;
+    uint32_t stride;
+    uint32_t primitive_type;
+    uint32_t index_size;
+    uint32_t command_base;
+} IndirectCountParams;
+
+- (bool)newIndirectCountPipelines
+{
+    id<MTLLibrary> library;
+    id<MTLFunction> arrays, elements;
+    __autoreleasing NSError *error = nil;
+
+    library = [_device newLibraryWithSource:[NSString stringWithUTF8String:indirect_count_source]
+                                    options:nil
+                                      error:&error];
+    if (library == NULL)
+    {
+        NSLog(@"Error: indirect count library failed to compile %@\n", [error localizedDescription]);
+        return false;
+    }
+
+    arrays = [library newFunctionWithName:@"encodeDrawArrays"];
+    RETURN_FALSE_ON_NULL(arrays);
+
+    elements = [library newFunctionWithName:@"encodeDrawElements"];
+    RETURN_FALSE_ON_NULL(elements);
+
+    _indirectCountPipelines[0] = [_device newComputePipelineStateWithFunction:arrays error:&error];
+    RETURN_FALSE_ON_NULL(_indirectCountPipelines[0]);
+
+    _indirectCountPipelines[1] = [_device newComputePipelineStateWithFunction:elements error:&error];
+    RETURN_FALSE_ON_NULL(_indirectCountPipelines[1]);
+
+    // both kernels take the command buffer at the same index, one encoder fills in the arguments for either
+    _indirectCountArgumentEncoder = [arrays newArgumentEncoderWithBufferIndex:3];
+    RETURN_FALSE_ON_NULL(_indirectCountArgumentEncoder);
+
+    return true;
+}
+
+- (id<MTLIndirectCommandBuffer>)indirectCommands:(NSUInteger)count
+                                            base:(NSUInteger *)base
+                                       arguments:(id<MTLBuffer> *)arguments
+{
+    id<MTLIndirectCommandBuffer> commands;
+
+    commands = _indirectCommands[_uploadRingFrame];
+
+    if (commands == NULL || _indirectCommandsHead + count > commands.size)
+    {
+        MTLIndirectCommandBufferDescriptor *descriptor;
+        id<MTLBuffer> buffer;
+        NSUInteger size;
+
+        // grows like the upload ring, command buffers retain the old one until they are done with it
+        size = commands ? commands.size * 2 : INDIRECT_COUNT_COMMANDS;
+        while (size < count)
+            size *= 2;
+
+        descriptor = [[MTLIndirectCommandBufferDescriptor alloc] init];
+        descriptor.commandTypes = MTLIndirectCommandTypeDraw | MTLIndirectCommandTypeDrawIndexed;
+        descriptor.inheritBuffers = YES;
+        descriptor.inheritPipelineState = YES;
+        descriptor.maxVertexBufferBindCount = 0;
+        descriptor.maxFragmentBufferBindCount = 0;
+
+        commands = [_device newIndirectCommandBufferWithDescriptor:descriptor
+                                                   maxCommandCount:size
+                                                           options:MTLResourceStorageModePrivate];
+        if (commands == NULL)
+            return NULL;
+        commands.label = @"Indirect Count Commands";
+
+        buffer = [_device newBufferWithLength:_indirectCountArgumentEncoder.encodedLength
+                                      options:MTLResourceStorageModeShared];
+        if (buffer == NULL)
+            return NULL;
+
+        [_indirectCountArgumentEncoder setArgumentBuffer:buffer offset:0];
+        [_indirectCountArgumentEncoder setIndirectCommandBuffer:commands atIndex:0];
+
+        _indirectCommands[_uploadRingFrame] = commands;
+        _indirectCommandsArguments[_uploadRingFrame] = buffer;
+        _indirectCommandsHead = 0;
+    }
+
+    *base = _indirectCommandsHead;
+    *arguments = _indirectCommandsArguments[_uploadRingFrame];
+
+    _indirectCommandsHead += count;
+
+    return commands;
+}
+
+- (void)mtlMultiDrawIndirectCount:(GLMContext)glm_ctx
+                             mode:(GLenum)mode
+                             type:(GLenum)type
+                         indirect:(const void *)indirect
+                        drawcount:(GLintptr)drawcount
+                     maxdrawcount:(GLsizei)maxdrawcount
+                           stride:(GLsizei)stride
+{
+    MTLPrimitiveType primitiveType;
+    IndirectCountParams params;
+    bool indexed;
+
+    primitiveType = getMTLPrimitiveType(mode);
+    assert(primitiveType != 0xFFFFFFFF);
+
+    // arrays come through with no index type
+    indexed = (type != 0);
+
+    if (_indirectCountPipelines[0] == NULL)
+    {
+        RETURN_ON_FAILURE([self newIndirectCountPipelines]);
+    }
+
+    NSUInteger indexRingOffset = 0;
+    id<MTLBuffer> indexBuffer = NULL;
+
+    if (indexed)
+    {
+        Buffer *gl_element_buffer = getElementBuffer(ctx);
+        assert(gl_element_buffer);
+
+        if ([self processBuffer:gl_element_buffer] == false)
+            return;
+
+        indexBuffer = [self indexBufferForElementBuffer:gl_element_buffer offset:&indexRingOffset];
+        RETURN_ON_NULL(indexBuffer);
+    }
+
+    Buffer *gl_indirect_buffer = getIndirectBuffer(ctx);
+    assert(gl_indirect_buffer);
+
+    Buffer *gl_parameter_buffer = STATE(buffers[_PARAMETER_BUFFER]);
+    assert(gl_parameter_buffer);
+
+    if ([self processBuffer:gl_indirect_buffer] == false)
+        return;
+
+    if ([self processBuffer:gl_parameter_buffer] == false)
+        return;
+
+    NSUInteger indirectRingOffset, parameterRingOffset;
+
+    id<MTLBuffer> indirectBuffer = [self mtlBufferForBuffer:gl_indirect_buffer offset:&indirectRingOffset];
+    RETURN_ON_NULL(indirectBuffer);
+
+    id<MTLBuffer> parameterBuffer = [self mtlBufferForBuffer:gl_parameter_buffer offset:&parameterRingOffset];
+    RETURN_ON_NULL(parameterBuffer);
+
+    NSUInteger commandBase;
+    id<MTLBuffer> commandArguments;
+
+    id<MTLIndirectCommandBuffer> commands = [self indirectCommands:maxdrawcount
+                                                              base:&commandBase
+                                                         arguments:&commandArguments];
+    RETURN_ON_NULL(commands);
+
+    if (stride == 0)
+        stride = indexed ? sizeof(DrawElementsIndirectCommand) : sizeof(DrawArraysIndirectCommand);
+
+    params.max_draw_count = maxdrawcount;
+    params.stride = stride;
+    params.primitive_type = (uint32_t)primitiveType;
+    params.index_size = (type == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(uint32_t);
+    params.command_base = (uint32_t)commandBase;
+
+    // the pre-pass runs between render encoders, the same way a dispatch does
+    [self endRenderEncoding];
+
+    id<MTLComputeCommandEncoder> computeCommandEncoder = [_currentCommandBuffer computeCommandEncoder];
+    assert(computeCommandEncoder);
+
+    [computeCommandEncoder setComputePipelineState:_indirectCountPipelines[indexed]];
+    [computeCommandEncoder setBuffer:indirectBuffer offset:indirectRingOffset + (uintptr_t)indirect atIndex:0];
+    [computeCommandEncoder setBuffer:parameterBuffer offset:parameterRingOffset + drawcount atIndex:1];
+    [computeCommandEncoder setBytes:&params length:sizeof(params) atIndex:2];
+    [computeCommandEncoder setBuffer:commandArguments offset:0 atIndex:3];
+
+    if (indexed)
+        [computeCommandEncoder setBuffer:indexBuffer offset:indexRingOffset atIndex:4];
+
+    [computeCommandEncoder useResource:commands usage:MTLResourceUsageWrite];
+
+    [computeCommandEncoder
+         dispatchThreadgroups:MTLSizeMake((maxdrawcount + INDIRECT_COUNT_THREADS - 1) / INDIRECT_COUNT_THREADS, 1, 1)
+        threadsPerThreadgroup:MTLSizeMake(INDIRECT_COUNT_THREADS, 1, 1)];
+
+    [computeCommandEncoder endEncoding];
+
+    glm_ctx->state.dirty_bits = DIRTY_ALL;
+
+    _indirectCountDraw = true;
+    bool processed = [self processGLState:true];
+    _indirectCountDraw = false;
+
+    RETURN_ON_FAILURE(processed);
+
+    // the encoded draws point at the index buffer, the render encoder doesn't know about it otherwise
+    if (indexed)
+        [_currentRenderEncoder useResource:indexBuffer usage:MTLResourceUsageRead];
+
+    [_currentRenderEncoder executeCommandsInBuffer:commands withRange:NSMakeRange(commandBase, maxdrawcount)];
+}
+
+void mtlMultiDrawArraysIndirectCount(GLMContext glm_ctx, GLenum mode, const void *indirect, GLintptr drawcount,
+                                     GLsizei maxdrawcount, GLsizei stride)
+{
+    [(__bridge id)glm_ctx->mtl_funcs.mtlObj mtlMultiDrawIndirectCount:glm_ctx
+                                                                 mode:mode
+                                                                 type:0
+                                                             indirect:indirect
+                                                            drawcount:drawcount
+                                                         maxdrawcount:maxdrawcount
+                                                               stride:stride];
+}
+
+void mtlMultiDrawElementsIndirectCount(GLMContext glm_ctx, GLenum mode, GLenum type, const void *indirect,
+                                       GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride)
+{
+    [(__bridge id)glm_ctx->mtl_funcs.mtlObj mtlMultiDrawIndirectCount:glm_ctx
+                                                                 mode:mode
+                                                                 type:type
+                                                             indirect:indirect
+                                                            drawcount:drawcount
+                                                         maxdrawcount:maxdrawcount
+                                                               stride:stride];
+}
+
 #pragma mark C interface to context functions
 
 - (void)bindObjFuncsToGLMContext:(GLMContext)glm_ctx
@@ -4966,12 +6559,16 @@ void mtlMultiDrawElementsIndirect(GLMContext glm_ctx, GLenum mode, GLenum type,
     glm_ctx->mtl_funcs.mtlBufferSubData = mtlBufferSubData;
     glm_ctx->mtl_funcs.mtlMapUnmapBuffer = mtlMapUnmapBuffer;
     glm_ctx->mtl_funcs.mtlFlushBufferRange = mtlFlushBufferRange;
+    glm_ctx->mtl_funcs.mtlRenameBuffer = mtlRenameBuffer;
+    glm_ctx->mtl_funcs.mtlCopyBufferSubData = mtlCopyBufferSubData;
+    glm_ctx->mtl_funcs.mtlWaitForBufferWrites = mtlWaitForBufferWrites;
 
     glm_ctx->mtl_funcs.mtlReadDrawable = mtlReadDrawable;
     glm_ctx->mtl_funcs.mtlGetTexImage = mtlGetTexImage;
 
     glm_ctx->mtl_funcs.mtlGenerateMipmaps = mtlGenerateMipmaps;
     glm_ctx->mtl_funcs.mtlTexSubImage = mtlTexSubImage;
+    glm_ctx->mtl_funcs.mtlTexSubImageData = mtlTexSubImageData;
 
     glm_ctx->mtl_funcs.mtlDrawArrays = mtlDrawArrays;
     glm_ctx->mtl_funcs.mtlDrawElements = mtlDrawElements;
@@ -4993,6 +6590,8 @@ void mtlMultiDrawElementsIndirect(GLMContext glm_ctx, GLenum mode, GLenum type,
     glm_ctx->mtl_funcs.mtlMultiDrawElementsBaseVertex = mtlMultiDrawElementsBaseVertex;
     glm_ctx->mtl_funcs.mtlMultiDrawArraysIndirect = mtlMultiDrawArraysIndirect;
     glm_ctx->mtl_funcs.mtlMultiDrawElementsIndirect = mtlMultiDrawElementsIndirect;
+    glm_ctx->mtl_funcs.mtlMultiDrawArraysIndirectCount = mtlMultiDrawArraysIndirectCount;
+    glm_ctx->mtl_funcs.mtlMultiDrawElementsIndirectCount = mtlMultiDrawElementsIndirectCount;
 
     glm_ctx->mtl_funcs.mtlDispatchCompute = mtlDispatchCompute;
     glm_ctx->mtl_funcs.mtlDispatchComputeIndirect = mtlDispatchComputeIndirect;
@@ -25,6 +25,7 @@
 
 #include "glm_context.h"
 #include "buffers.h"
+#include "index_gen.h"
 #include "pixel_utils.h"
 
 #pragma mark Utility Functions
@@ -59,6 +60,8 @@ GLuint bufferIndexFromTarget(GLMContext ctx, GLenum target)
         return _DISPATCH_INDIRECT_BUFFER;
     case GL_DRAW_INDIRECT_BUFFER:
         return _DRAW_INDIRECT_BUFFER;
+    case GL_PARAMETER_BUFFER:
+        return _PARAMETER_BUFFER;
     case GL_SHADER_STORAGE_BUFFER:
         return _SHADER_STORAGE_BUFFER;
 
@@ -96,13 +99,19 @@ Buffer *getBuffer(GLMContext ctx, GLenum target, GLuint buffer)
 {
     Buffer *ptr;
 
-    ptr = (Buffer *)searchHashTable(&STATE(buffer_table), buffer);
+    ptr = (Buffer *)searchSlotMap(&STATE(buffer_table), buffer);
 
     if (!ptr)
     {
+        // a deleted name whose slot went to another object
+        if (isStaleSlotMapName(&STATE(buffer_table), buffer))
+        {
+            ERROR_RETURN_VALUE(GL_INVALID_OPERATION, NULL);
+        }
+
         ptr = newBuffer(ctx, target, buffer);
 
-        insertHashElement(&STATE(buffer_table), buffer, ptr);
+        insertSlotMapElement(&STATE(buffer_table), buffer, ptr);
     }
 
     return ptr;
@@ -112,7 +121,7 @@ bool isBuffer(GLMContext ctx, GLuint buffer)
 {
     Buffer *ptr;
 
-    ptr = (Buffer *)searchHashTable(&STATE(buffer_table), buffer);
+    ptr = (Buffer *)searchSlotMap(&STATE(buffer_table), buffer);
 
     if (ptr)
         return true;
@@ -124,7 +133,7 @@ Buffer *findBuffer(GLMContext ctx, GLuint buffer)
 {
     Buffer *ptr;
 
-    ptr = (Buffer *)searchHashTable(&STATE(buffer_table), buffer);
+    ptr = (Buffer *)searchSlotMap(&STATE(buffer_table), buffer);
 
     return ptr;
 }
@@ -146,6 +155,7 @@ bool checkTarget(GLMContext ctx, GLenum target)
     case GL_COPY_WRITE_BUFFER:
     case GL_DISPATCH_INDIRECT_BUFFER:
     case GL_DRAW_INDIRECT_BUFFER:
+    case GL_PARAMETER_BUFFER:
     case GL_SHADER_STORAGE_BUFFER:
         return true;
     }
@@ -194,6 +204,8 @@ void *getBufferData(GLMContext ctx, Buffer *ptr)
 
     ERROR_CHECK_RETURN(ptr->mapped == false, GL_INVALID_OPERATION);
 
+    waitForBufferGPUWrites(ctx, ptr);
+
     buffer_data = (void *)ptr->data.buffer_data;
 
     ERROR_CHECK_RETURN(buffer_data, GL_INVALID_OPERATION);
@@ -219,11 +231,14 @@ void bufferStorage(GLMContext ctx, Buffer *ptr, GLenum target, GLuint index, GLs
 
     ptr->data.buffer_data = buffer_data;
 
+    ptr->data.dirty_range_count = 0;
+
     // copy to new buffer
     if (data)
     {
         memcpy((void *)ptr->data.buffer_data, data, size);
 
+        addBufferDirtyRange(&ptr->data, 0, size);
         ptr->data.dirty_bits |= DIRTY_BUFFER_DATA;
     }
 
@@ -331,6 +346,75 @@ bool clearBufferData(GLMContext ctx, Buffer *ptr, GLenum internalformat, GLintpt
     assert(0);
 }
 
+#pragma mark Dirty Ranges
+void addBufferDirtyRange(BufferData *data, size_t offset, size_t length)
+{
+    BufferRange *ranges;
+    GLuint count, first, last;
+    size_t start, end;
+
+    if (length == 0)
+        return;
+
+    data->generation++;
+
+    ranges = data->dirty_ranges;
+    count = data->dirty_range_count;
+    start = offset;
+    end = offset + length;
+
+    // first range that ends at or after start, touching ranges are merged
+    first = 0;
+    last = count;
+    while (first < last)
+    {
+        GLuint mid = (first + last) / 2;
+
+        if (ranges[mid].end < start)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+
+    // swallow every range that overlaps or touches the new one
+    last = first;
+    while (last < count && ranges[last].start <= end)
+    {
+        if (ranges[last].start < start)
+            start = ranges[last].start;
+
+        if (ranges[last].end > end)
+            end = ranges[last].end;
+
+        last++;
+    }
+
+    if (first == last)
+    {
+        if (count == MAX_BUFFER_DIRTY_RANGES)
+        {
+            // out of entries, collapse into one covering range
+            ranges[0].start = (start < ranges[0].start) ? start : ranges[0].start;
+            ranges[0].end = (end > ranges[count - 1].end) ? end : ranges[count - 1].end;
+            data->dirty_range_count = 1;
+
+            return;
+        }
+
+        memmove(&ranges[first + 1], &ranges[first], sizeof(BufferRange) * (count - first));
+        count++;
+    }
+    else if (last - first > 1)
+    {
+        memmove(&ranges[first + 1], &ranges[last], sizeof(BufferRange) * (count - last));
+        count -= last - first - 1;
+    }
+
+    ranges[first].start = start;
+    ranges[first].end = end;
+    data->dirty_range_count = count;
+}
+
 #pragma mark GL Buffer Functions
 void mglGenBuffers(GLMContext ctx, GLsizei n, GLuint *buffers)
 {
@@ -372,7 +456,7 @@ void mglDeleteBuffers(GLMContext ctx, GLsizei n, const GLuint *buffers)
         if (isBuffer(ctx, buffer))
         {
             Buffer *ptr;
-            ptr = (Buffer *)searchHashTable(&STATE(buffer_table), buffer);
+            ptr = (Buffer *)searchSlotMap(&STATE(buffer_table), buffer);
             if (ptr->data.buffer_data)
             {
                 if (ptr->storage_flags & GL_CLIENT_STORAGE_BIT)
@@ -398,7 +482,9 @@ void mglDeleteBuffers(GLMContext ctx, GLsizei n, const GLuint *buffers)
                 ptr->data.buffer_data = 0;
             }
 
-            deleteHashElement(&STATE(buffer_table), buffer);
+            invalidateGeneratedIndices(ctx, buffer);
+
+            deleteSlotMapElement(&STATE(buffer_table), buffer);
 
             // remove any dangling references
             const GLuint target = ptr->target;
@@ -445,6 +531,11 @@ void mglDeleteBuffers(GLMContext ctx, GLsizei n, const GLuint *buffers)
 
             free(ptr);
         } // if (isBuffer(ctx, buffer))
+        else
+        {
+            // generated but never bound, release the reserved name
+            deleteSlotMapElement(&STATE(buffer_table), buffer);
+        }
     } // while(--n)
 }
 
@@ -469,7 +560,9 @@ void mglBindBuffer(GLMContext ctx, GLenum target, GLuint buffer)
     if (buffer)
     {
         ptr = getBuffer(ctx, target, buffer);
-        ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
+
+        if (ptr == NULL)
+            return;
     }
     else
     {
@@ -512,7 +605,8 @@ void mglBindBufferBase(GLMContext ctx, GLenum target, GLuint index, GLuint buffe
     if (buffer)
     {
         ptr = getBuffer(ctx, target, buffer);
-        assert(ptr);
+        if (ptr == NULL)
+            return;
 
         ERROR_CHECK_RETURN(ptr->data.buffer_size, GL_INVALID_VALUE);
         ERROR_CHECK_RETURN(ptr->data.buffer_data, GL_INVALID_VALUE);
@@ -570,7 +664,8 @@ void mglBindBufferRange(GLMContext ctx, GLenum target, GLuint index, GLuint buff
     if (buffer)
     {
         ptr = getBuffer(ctx, target, buffer);
-        assert(ptr);
+        if (ptr == NULL)
+            return;
 
         ERROR_CHECK_RETURN(ptr->data.buffer_data, GL_INVALID_VALUE);
         ERROR_CHECK_RETURN(offset + size <= ptr->data.buffer_size, GL_INVALID_VALUE);
@@ -589,6 +684,37 @@ void mglBindBufferRange(GLMContext ctx, GLenum target, GLuint index, GLuint buff
 }
 
 #pragma mark GL Buffer Data Functions
+static bool renameBufferData(GLMContext ctx, Buffer *ptr, GLsizeiptr size)
+{
+    // client storage wraps the application's allocation, it can't be swapped out
+    if (ptr->storage_flags & GL_CLIENT_STORAGE_BIT)
+        return false;
+
+    if (page_size_align(size) != ptr->data.buffer_size)
+        return false;
+
+    if (ptr->data.mtl_data)
+    {
+        // the gpu may still be reading the current store, the backend swaps in a retired one
+        if (ctx->mtl_funcs.mtlRenameBuffer(ctx, ptr, size) == false)
+            return false;
+    }
+
+    // small buffers are copied into the encoder and unbound ones were never seen by the gpu,
+    // either way the backing can be reused in place
+
+    ptr->data.dirty_range_count = 0;
+    ptr->data.dirty_bits &= ~DIRTY_BUFFER_DATA;
+
+    // queued gpu writes land in the old store
+    ptr->data.gpu_write_serial = 0;
+
+    // the encoder has to pick up the new store
+    ctx->state.dirty_bits |= DIRTY_BUFFER;
+
+    return true;
+}
+
 kern_return_t initBufferData(GLMContext ctx, Buffer *ptr, GLsizeiptr size, const void *data, bool isUniformConstant)
 {
     kern_return_t err;
@@ -605,14 +731,32 @@ kern_return_t initBufferData(GLMContext ctx, Buffer *ptr, GLsizeiptr size, const
             {
                 if (data)
                 {
+                    waitForBufferGPUWrites(ctx, ptr);
+
                     memcpy((void *)ptr->data.buffer_data, data, size);
 
+                    addBufferDirtyRange(&ptr->data, 0, size);
                     ptr->data.dirty_bits |= DIRTY_BUFFER_DATA;
                 }
 
                 return 0;
             }
         }
+        else if (renameBufferData(ctx, ptr, size))
+        {
+            // same size respecification, the old contents are gone and nothing was reallocated
+            ptr->size = size;
+
+            if (data)
+            {
+                memcpy((void *)ptr->data.buffer_data, data, size);
+
+                addBufferDirtyRange(&ptr->data, 0, size);
+                ptr->data.dirty_bits |= DIRTY_BUFFER_DATA;
+            }
+
+            return 0;
+        }
 
         if (ptr->storage_flags & GL_CLIENT_STORAGE_BIT)
         {
@@ -620,35 +764,30 @@ kern_return_t initBufferData(GLMContext ctx, Buffer *ptr, GLsizeiptr size, const
             {
                 // the mtl buffer has a deallocator for the vm allocate
                 ctx->mtl_funcs.mtlDeleteMTLObj(ctx, ptr->data.mtl_data);
-
-                if (isUniformConstant)
-                {
-                    ptr->data.mtl_data = NULL;
-                }
             }
             else
             {
                 vm_deallocate(mach_host_self(), ptr->data.buffer_data, ptr->data.buffer_size);
             }
-
-            ptr->data.buffer_data = 0;
-            ptr->data.buffer_size = 0;
         }
         else
         {
             if (ptr->data.mtl_data)
             {
+                // buffer_data points into the mtl buffer
                 ctx->mtl_funcs.mtlDeleteMTLObj(ctx, ptr->data.mtl_data);
             }
-
-            if (isUniformConstant)
+            else
             {
-                ptr->data.mtl_data = NULL;
+                vm_deallocate(mach_task_self(), ptr->data.buffer_data, ptr->data.buffer_size);
             }
-
-            ptr->data.buffer_data = 0;
-            ptr->data.buffer_size = 0;
         }
+
+        // a stale mtl_data would be bound again once the release retires
+        ptr->data.mtl_data = NULL;
+        ptr->data.buffer_data = 0;
+        ptr->data.buffer_size = 0;
+        ptr->data.gpu_write_serial = 0;
     }
 
     buffer_size = page_size_align(size);
@@ -663,6 +802,7 @@ kern_return_t initBufferData(GLMContext ctx, Buffer *ptr, GLsizeiptr size, const
     ptr->size = size;
     ptr->data.buffer_data = buffer_data;
     ptr->data.buffer_size = buffer_size;
+    ptr->data.dirty_range_count = 0;
 
     ptr->data.dirty_bits |= DIRTY_BUFFER_ADDR;
 
@@ -671,6 +811,7 @@ kern_return_t initBufferData(GLMContext ctx, Buffer *ptr, GLsizeiptr size, const
     {
         memcpy((void *)ptr->data.buffer_data, data, size);
 
+        addBufferDirtyRange(&ptr->data, 0, size);
         ptr->data.dirty_bits |= DIRTY_BUFFER_DATA;
     }
 
@@ -789,11 +930,15 @@ void mglBufferSubData(GLMContext ctx, GLenum target, GLintptr offset, GLsizeiptr
         ERROR_RETURN(GL_INVALID_OPERATION);
     }
 
+    // a queued copy into the buffer would land on top of the new data
+    waitForBufferGPUWrites(ctx, ptr);
+
     if (ptr->storage_flags & (GL_CLIENT_STORAGE_BIT | GL_DYNAMIC_STORAGE_BIT))
     {
         // copy it to the backing and use processGLState to upload new data
         memcpy((char *)ptr->data.buffer_data + offset, data, size);
 
+        addBufferDirtyRange(&ptr->data, offset, size);
         ptr->data.dirty_bits |= DIRTY_BUFFER_DATA;
         ctx->state.dirty_bits |= DIRTY_BUFFER;
     }
@@ -840,6 +985,9 @@ void mglNamedBufferSubData(GLMContext ctx, GLuint buffer, GLintptr offset, GLsiz
         ERROR_RETURN(GL_INVALID_OPERATION);
     }
 
+    // a queued copy into the buffer would land on top of the new data
+    waitForBufferGPUWrites(ctx, ptr);
+
     if (ptr->storage_flags & (GL_CLIENT_STORAGE_BIT | GL_DYNAMIC_STORAGE_BIT))
     {
         // copy it to the backing and use processGLState to upload new data
@@ -852,6 +1000,7 @@ void mglNamedBufferSubData(GLMContext ctx, GLuint buffer, GLintptr offset, GLsiz
         }
         else
         {
+            addBufferDirtyRange(&ptr->data, offset, size);
             ptr->data.dirty_bits |= DIRTY_BUFFER_DATA;
 
             // probably shouldn't have to do this... if its not bound its an excess
@@ -868,8 +1017,6 @@ void mglNamedBufferSubData(GLMContext ctx, GLuint buffer, GLintptr offset, GLsiz
 void copyBufferSubData(GLMContext ctx, Buffer *src_buf, Buffer *dst_buf, GLintptr readOffset, GLintptr writeOffset,
                        GLsizeiptr size)
 {
-    GLuint *src_data, *dst_data;
-
     if (size < 0)
     {
         ERROR_RETURN(GL_INVALID_VALUE);
@@ -918,15 +1065,8 @@ void copyBufferSubData(GLMContext ctx, Buffer *src_buf, Buffer *dst_buf, GLintpt
         ERROR_RETURN(GL_INVALID_OPERATION);
     }
 
-    src_data = ctx->mtl_funcs.mtlMapUnmapBuffer(ctx, src_buf, readOffset, size, GL_READ_ONLY, true);
-    assert(src_data);
-
-    dst_data = ctx->mtl_funcs.mtlMapUnmapBuffer(ctx, dst_buf, writeOffset, size, GL_WRITE_ONLY, true);
-    assert(dst_data);
-
-    memcpy(dst_data, src_data, size);
-
-    ctx->mtl_funcs.mtlMapUnmapBuffer(ctx, dst_buf, writeOffset, size, GL_WRITE_ONLY, false);
+    // the backend records the copy in the command stream, no map or cpu round trip
+    ctx->mtl_funcs.mtlCopyBufferSubData(ctx, src_buf, dst_buf, readOffset, writeOffset, size);
 }
 
 void mglCopyBufferSubData(GLMContext ctx, GLenum readTarget, GLenum writeTarget, GLintptr readOffset,
@@ -1107,6 +1247,8 @@ void *mglMapBuffer(GLMContext ctx, GLenum target, GLenum access)
     ptr->mapped_offset = 0;
     ptr->mapped_length = ptr->size;
 
+    waitForBufferGPUWrites(ctx, ptr);
+
     return ctx->mtl_funcs.mtlMapUnmapBuffer(ctx, ptr, 0, ptr->size, access, true);
 }
 
@@ -1132,6 +1274,7 @@ GLboolean mglUnmapBuffer(GLMContext ctx, GLenum target)
     if ((ptr->storage_flags & GL_MAP_PERSISTENT_BIT) && (ptr->access & GL_MAP_PERSISTENT_BIT))
     {
         // this will cause the buffer to be flushed on next draw command
+        addBufferDirtyRange(&ptr->data, ptr->mapped_offset, ptr->mapped_length);
         ptr->data.dirty_bits |= DIRTY_BUFFER_DATA;
 
         assert(ptr->mapped == GL_FALSE);
@@ -1140,13 +1283,21 @@ GLboolean mglUnmapBuffer(GLMContext ctx, GLenum target)
         return GL_TRUE;
     }
 
+    // only the written part of the mapping needs to reach the gpu, explicit flushes were recorded as they happened
+    bool written = (ptr->access == GL_WRITE_ONLY) || (ptr->access == GL_READ_WRITE) ||
+                   ((ptr->access_flags & GL_MAP_WRITE_BIT) && !(ptr->access_flags & GL_MAP_FLUSH_EXPLICIT_BIT));
+    size_t offset = ptr->mapped_offset;
+    size_t length = written ? ptr->mapped_length : 0;
+
+    addBufferDirtyRange(&ptr->data, offset, length);
+
     ptr->mapped = GL_FALSE;
     ptr->access = 0;
     ptr->access_flags = 0;
     ptr->mapped_offset = 0;
     ptr->mapped_length = 0;
 
-    ctx->mtl_funcs.mtlMapUnmapBuffer(ctx, ptr, 0, ptr->size, 0, false);
+    ctx->mtl_funcs.mtlMapUnmapBuffer(ctx, ptr, offset, length, 0, false);
 
     return GL_TRUE;
 }
@@ -1204,12 +1355,16 @@ void *mglMapBufferRange(GLMContext ctx, GLenum target, GLintptr offset, GLsizeip
     ptr->mapped_offset = offset;
     ptr->mapped_length = length;
 
+    // the application reads and writes the returned pointer directly
+    waitForBufferGPUWrites(ctx, ptr);
+
     if (access_flags & GL_MAP_PERSISTENT_BIT)
     {
         if (ptr->storage_flags & GL_MAP_PERSISTENT_BIT)
         {
             ptr->access_flags = access_flags;
 
+            addBufferDirtyRange(&ptr->data, offset, length);
             ptr->data.dirty_bits |= DIRTY_BUFFER_DATA;
 
             // return a pointer to the backing data without marking it as mapped
@@ -1269,11 +1424,7 @@ void mglFlushMappedBufferRange(GLMContext ctx, GLenum target, GLintptr offset, G
         ERROR_RETURN(GL_INVALID_OPERATION);
     }
 
-    if (offset < ptr->mapped_offset)
-    {
-        ERROR_RETURN(GL_INVALID_VALUE);
-    }
-
+    // offset is relative to the start of the mapped range
     if (offset + length > ptr->mapped_length)
     {
         ERROR_RETURN(GL_INVALID_VALUE);
@@ -1281,7 +1432,9 @@ void mglFlushMappedBufferRange(GLMContext ctx, GLenum target, GLintptr offset, G
 
     if (ptr->access_flags & GL_MAP_FLUSH_EXPLICIT_BIT)
     {
-        ctx->mtl_funcs.mtlFlushBufferRange(ctx, ptr, offset, length);
+        addBufferDirtyRange(&ptr->data, ptr->mapped_offset + offset, length);
+
+        ctx->mtl_funcs.mtlFlushBufferRange(ctx, ptr, ptr->mapped_offset + offset, length);
     }
     else
     {
@@ -1355,8 +1508,28 @@ void mglNamedBufferStorage(GLMContext ctx, GLuint buffer, GLsizeiptr size, const
 
 void mglInvalidateBufferData(GLMContext ctx, GLuint buffer)
 {
-    // Unimplemented function
-    assert(0);
+    Buffer *ptr;
+
+    ptr = findBuffer(ctx, buffer);
+
+    if (ptr == NULL)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (ptr->mapped)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    // a persistent mapping keeps pointing at the current store
+    if ((ptr->data.buffer_data == 0) || (ptr->access_flags & GL_MAP_PERSISTENT_BIT))
+        return;
+
+    // the contents are undefined from here on, swap in a store the gpu is done with
+    renameBufferData(ctx, ptr, ptr->size);
 }
 
 void mglInvalidateBufferSubData(GLMContext ctx, GLuint buffer, GLintptr offset, GLsizeiptr length)
@@ -1498,8 +1671,10 @@ void mglGetBufferSubData(GLMContext ctx, GLenum target, GLintptr offset, GLsizei
         ERROR_RETURN(GL_INVALID_OPERATION);
     }
 
+    waitForBufferGPUWrites(ctx, ptr);
+
     // copy to data at offset
-    memcpy(data, &((void *)ptr->data.buffer_data)[offset], ptr->data.buffer_size);
+    memcpy(data, &((void *)ptr->data.buffer_data)[offset], size);
 }
 
 void mglGetNamedBufferParameteriv(GLMContext ctx, GLuint buffer, GLenum pname, GLint *params)
@@ -16,5 +16,13 @@
 
 kern_return_t initBufferData(GLMContext ctx, Buffer *ptr, GLsizeiptr size, const void *data, bool isUniformConstant);
 Buffer *newBuffer(GLMContext ctx, GLenum target, GLuint name);
+void addBufferDirtyRange(BufferData *data, size_t offset, size_t length);
+
+// a queued gpu copy or shader write hasn't landed in buffer_data yet, cpu reads and writes wait for it
+static inline void waitForBufferGPUWrites(GLMContext ctx, Buffer *ptr)
+{
+    if (ptr->data.gpu_write_serial)
+        ctx->mtl_funcs.mtlWaitForBufferWrites(ctx, ptr);
+}
 
 #endif /* buffers_h */
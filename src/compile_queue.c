@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * compile_queue.c
+ * MGL
+ *
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "compile_queue.h"
+#include "shaders.h"
+#include "programs.h"
+
+#define COMPILE_MAX_THREADS 32
+
+typedef struct CompileJob_t
+{
+    struct CompileJob_t *next;
+    Shader *shader;                     // compile this shader...
+    Program *program;                   // ...or link this program
+    Shader *shaders[_MAX_SHADER_TYPES]; // attached when the link was queued
+} CompileJob;
+
+typedef struct CompileQueue_t
+{
+    GLMContext ctx;
+    GLuint num_threads;
+    pthread_t threads[COMPILE_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond; // any job finished or link shaders released
+    CompileJob *head;
+    CompileJob *tail;
+    GLboolean quit;
+} CompileQueue;
+
+#pragma mark workers
+static bool linkShadersCompiled(CompileJob *job)
+{
+    for (int i = 0; i < _MAX_SHADER_TYPES; i++)
+    {
+        if (job->shaders[i] && job->shaders[i]->pending_compile)
+            return false;
+    }
+
+    return true;
+}
+
+static void retireCompileJob(CompileJob *job)
+{
+    if (job->shader)
+    {
+        job->shader->pending_compile--;
+        return;
+    }
+
+    job->program->pending_link--;
+
+    for (int i = 0; i < _MAX_SHADER_TYPES; i++)
+    {
+        if (job->shaders[i])
+            job->shaders[i]->pending_links--;
+    }
+}
+
+static void *compileWorkerThread(void *arg)
+{
+    CompileQueue *queue = (CompileQueue *)arg;
+    CompileJob *job;
+
+    pthread_mutex_lock(&queue->lock);
+
+    for (;;)
+    {
+        while (queue->head == NULL && queue->quit == false)
+        {
+            pthread_cond_wait(&queue->work_cond, &queue->lock);
+        }
+
+        // the queue drains before the workers quit
+        if (queue->head == NULL)
+            break;
+
+        job = queue->head;
+        queue->head = job->next;
+        if (queue->head == NULL)
+            queue->tail = NULL;
+
+        // compiles of the attached shaders were queued ahead of the link so they are already running
+        if (job->program)
+        {
+            while (linkShadersCompiled(job) == false)
+            {
+                pthread_cond_wait(&queue->done_cond, &queue->lock);
+            }
+        }
+
+        pthread_mutex_unlock(&queue->lock);
+
+        if (job->shader)
+        {
+            compileShader(queue->ctx, job->shader);
+        }
+        else
+        {
+            linkProgram(queue->ctx, job->program);
+        }
+
+        pthread_mutex_lock(&queue->lock);
+
+        retireCompileJob(job);
+        pthread_cond_broadcast(&queue->done_cond);
+
+        free(job);
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+#pragma mark compile queue
+static CompileQueue *getCompileQueue(GLMContext ctx)
+{
+    CompileQueue *queue;
+    GLuint count;
+    long cpus;
+
+    if (ctx->compile_queue)
+        return ctx->compile_queue;
+
+    // GL_MAX_SHADER_COMPILER_THREADS_KHR of 0 compiles on the calling thread
+    count = STATE_VAR(max_shader_compiler_threads);
+    if (count == 0)
+        return NULL;
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+    if (count > cpus)
+        count = (GLuint)cpus;
+    if (count > COMPILE_MAX_THREADS)
+        count = COMPILE_MAX_THREADS;
+
+    queue = (CompileQueue *)malloc(sizeof(CompileQueue));
+    assert(queue);
+
+    bzero(queue, sizeof(CompileQueue));
+
+    queue->ctx = ctx;
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->work_cond, NULL);
+    pthread_cond_init(&queue->done_cond, NULL);
+
+    for (GLuint i = 0; i < count; i++)
+    {
+        if (pthread_create(&queue->threads[queue->num_threads], NULL, compileWorkerThread, queue))
+            break;
+
+        queue->num_threads++;
+    }
+
+    ctx->compile_queue = queue;
+
+    if (queue->num_threads == 0)
+    {
+        finishCompileQueue(ctx);
+        return NULL;
+    }
+
+    return queue;
+}
+
+static void pushCompileJob(CompileQueue *queue, CompileJob *job)
+{
+    if (queue->tail)
+    {
+        queue->tail->next = job;
+    }
+    else
+    {
+        queue->head = job;
+    }
+
+    queue->tail = job;
+
+    pthread_cond_signal(&queue->work_cond);
+}
+
+static CompileJob *newCompileJob(void)
+{
+    CompileJob *job;
+
+    job = (CompileJob *)malloc(sizeof(CompileJob));
+    assert(job);
+
+    bzero(job, sizeof(CompileJob));
+
+    return job;
+}
+
+bool queueShaderCompile(GLMContext ctx, Shader *ptr)
+{
+    CompileQueue *queue;
+    CompileJob *job;
+
+    queue = getCompileQueue(ctx);
+
+    if (queue == NULL)
+        return false;
+
+    job = newCompileJob();
+    job->shader = ptr;
+
+    pthread_mutex_lock(&queue->lock);
+    ptr->pending_compile++;
+    pushCompileJob(queue, job);
+    pthread_mutex_unlock(&queue->lock);
+
+    return true;
+}
+
+bool queueProgramLink(GLMContext ctx, Program *ptr)
+{
+    CompileQueue *queue;
+    CompileJob *job;
+
+    queue = getCompileQueue(ctx);
+
+    if (queue == NULL)
+        return false;
+
+    job = newCompileJob();
+    job->program = ptr;
+
+    // the shaders can't change until the link is done, see waitForShaderIdle
+    pthread_mutex_lock(&queue->lock);
+
+    for (int i = 0; i < _MAX_SHADER_TYPES; i++)
+    {
+        job->shaders[i] = ptr->shader_slots[i];
+
+        if (job->shaders[i])
+            job->shaders[i]->pending_links++;
+    }
+
+    ptr->pending_link++;
+    pushCompileJob(queue, job);
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return true;
+}
+
+void finishCompileQueue(GLMContext ctx)
+{
+    CompileQueue *queue;
+
+    queue = ctx->compile_queue;
+
+    RETURN_ON_NULL(queue);
+
+    pthread_mutex_lock(&queue->lock);
+    queue->quit = true;
+    pthread_cond_broadcast(&queue->work_cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (GLuint i = 0; i < queue->num_threads; i++)
+    {
+        pthread_join(queue->threads[i], NULL);
+    }
+
+    assert(queue->head == NULL);
+
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->work_cond);
+    pthread_cond_destroy(&queue->done_cond);
+
+    free(queue);
+
+    ctx->compile_queue = NULL;
+}
+
+#pragma mark completion
+bool isShaderCompileComplete(GLMContext ctx, Shader *ptr)
+{
+    CompileQueue *queue;
+    bool complete;
+
+    queue = ctx->compile_queue;
+
+    if (queue == NULL)
+        return true;
+
+    pthread_mutex_lock(&queue->lock);
+    complete = (ptr->pending_compile == 0);
+    pthread_mutex_unlock(&queue->lock);
+
+    return complete;
+}
+
+bool isProgramLinkComplete(GLMContext ctx, Program *ptr)
+{
+    CompileQueue *queue;
+    bool complete;
+
+    queue = ctx->compile_queue;
+
+    if (queue == NULL)
+        return true;
+
+    pthread_mutex_lock(&queue->lock);
+    complete = (ptr->pending_link == 0);
+    pthread_mutex_unlock(&queue->lock);
+
+    return complete;
+}
+
+void waitForShaderCompile(GLMContext ctx, Shader *ptr)
+{
+    CompileQueue *queue;
+
+    queue = ctx->compile_queue;
+
+    RETURN_ON_NULL(queue);
+
+    pthread_mutex_lock(&queue->lock);
+    while (ptr->pending_compile)
+    {
+        pthread_cond_wait(&queue->done_cond, &queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void waitForShaderIdle(GLMContext ctx, Shader *ptr)
+{
+    CompileQueue *queue;
+
+    queue = ctx->compile_queue;
+
+    RETURN_ON_NULL(queue);
+
+    // queued links read the source and the compiled shader
+    pthread_mutex_lock(&queue->lock);
+    while (ptr->pending_compile || ptr->pending_links)
+    {
+        pthread_cond_wait(&queue->done_cond, &queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void waitForProgramLink(GLMContext ctx, Program *ptr)
+{
+    CompileQueue *queue;
+
+    queue = ctx->compile_queue;
+
+    RETURN_ON_NULL(queue);
+
+    pthread_mutex_lock(&queue->lock);
+    while (ptr->pending_link)
+    {
+        pthread_cond_wait(&queue->done_cond, &queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+#pragma mark link shaders
+static bool linkShadersAvailable(Program *ptr)
+{
+    for (int i = 0; i < _MAX_SHADER_TYPES; i++)
+    {
+        if (ptr->shader_slots[i] && ptr->shader_slots[i]->linking)
+            return false;
+    }
+
+    return true;
+}
+
+void acquireLinkShaders(GLMContext ctx, Program *ptr)
+{
+    CompileQueue *queue;
+
+    queue = ctx->compile_queue;
+
+    RETURN_ON_NULL(queue);
+
+    // all or nothing so two links can't each hold a shader the other one wants
+    pthread_mutex_lock(&queue->lock);
+
+    while (linkShadersAvailable(ptr) == false)
+    {
+        pthread_cond_wait(&queue->done_cond, &queue->lock);
+    }
+
+    for (int i = 0; i < _MAX_SHADER_TYPES; i++)
+    {
+        if (ptr->shader_slots[i])
+            ptr->shader_slots[i]->linking = GL_TRUE;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void releaseLinkShaders(GLMContext ctx, Program *ptr)
+{
+    CompileQueue *queue;
+
+    queue = ctx->compile_queue;
+
+    RETURN_ON_NULL(queue);
+
+    pthread_mutex_lock(&queue->lock);
+
+    for (int i = 0; i < _MAX_SHADER_TYPES; i++)
+    {
+        if (ptr->shader_slots[i])
+            ptr->shader_slots[i]->linking = GL_FALSE;
+    }
+
+    pthread_cond_broadcast(&queue->done_cond);
+    pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * compile_queue.h
+ * MGL
+ *
+ */
+
+#ifndef compile_queue_h
+#define compile_queue_h
+
+#include "glcorearb.h"
+#include "glm_context.h"
+
+// shader compiles and program links run on a per context pool of up to GL_MAX_SHADER_COMPILER_THREADS_KHR
+// workers, jobs are taken in order and anything that reads a result waits for its job first
+bool queueShaderCompile(GLMContext ctx, Shader *ptr);
+bool queueProgramLink(GLMContext ctx, Program *ptr);
+
+// waits for every queued job and stops the workers, the next queued job starts them again
+void finishCompileQueue(GLMContext ctx);
+
+bool isShaderCompileComplete(GLMContext ctx, Shader *ptr);
+bool isProgramLinkComplete(GLMContext ctx, Program *ptr);
+
+void waitForShaderCompile(GLMContext ctx, Shader *ptr);
+void waitForShaderIdle(GLMContext ctx, Shader *ptr);
+void waitForProgramLink(GLMContext ctx, Program *ptr);
+
+// a glslang link finalizes the compiled shaders it's given, links sharing a shader take turns
+void acquireLinkShaders(GLMContext ctx, Program *ptr);
+void releaseLinkShaders(GLMContext ctx, Program *ptr);
+
+#endif /* compile_queue_h */
@@ -19,6 +19,7 @@
  */
 
 #include "glm_context.h"
+#include "programs.h"
 
 void mglDispatchCompute(GLMContext ctx, GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z)
 {
@@ -26,6 +27,12 @@ void mglDispatchCompute(GLMContext ctx, GLuint num_groups_x, GLuint num_groups_y
     ERROR_CHECK_RETURN(num_groups_y < ctx->state.var.max_compute_work_group_size[1], GL_INVALID_VALUE);
     ERROR_CHECK_RETURN(num_groups_z < ctx->state.var.max_compute_work_group_size[2], GL_INVALID_VALUE);
 
+    if (refreshProgramPipeline(ctx) == false)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
     ctx->mtl_funcs.mtlDispatchCompute(ctx, num_groups_x, num_groups_y, num_groups_z);
 }
 
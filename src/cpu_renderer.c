@@ -0,0 +1,1796 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * cpu_renderer.c
+ * MGL
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "glm_context.h"
+#include "CPURenderer.h"
+
+extern void mglDrawBuffer(GLMContext ctx, GLenum buf);
+
+#define CPU_TILE_SHIFT 6
+#define CPU_TILE_SIZE (1 << CPU_TILE_SHIFT)
+#define CPU_MAX_THREADS 16
+
+// below this many triangles the pool wakeup costs more than it saves
+#define CPU_MIN_THREADED_TRIANGLES 16
+
+typedef uint32_t cpu_u32x4 __attribute__((vector_size(16)));
+
+typedef struct CPUSurface_t
+{
+    uint8_t *data;
+    size_t pitch;
+    GLuint width;
+    GLuint height;
+    GLboolean bgra;
+} CPUSurface;
+
+typedef struct CPUVertex_t
+{
+    float x, y, z;
+    float color[4];
+} CPUVertex;
+
+typedef struct CPUTriangle_t
+{
+    // edge equations, pixel is inside when a * x + b * y + c >= 0 for all three,
+    // > 0 for edges that lose the tie so shared edges are only hit once
+    float a[3];
+    float b[3];
+    float c[3];
+    bool inclusive[3];
+    float z0, dzdx, dzdy;
+    uint32_t color;
+    int min_x, min_y, max_x, max_y;
+} CPUTriangle;
+
+typedef struct CPUTileBin_t
+{
+    GLuint count;
+    GLuint size;
+    GLuint *list;
+} CPUTileBin;
+
+typedef struct CPURenderer_t
+{
+    GLMContext ctx;
+
+    // drawable
+    GLuint width;
+    GLuint height;
+    uint32_t *color_buffer;
+    float *depth_buffer;
+
+    // targets and raster state for the current draw
+    CPUSurface color;
+    CPUSurface depth;
+    GLboolean depth_test;
+    GLboolean depth_write;
+    GLenum depth_func;
+    int clip[4]; // x0, y0, x1, y1, max is exclusive
+
+    GLuint tri_count;
+    GLuint tri_size;
+    CPUTriangle *tris;
+
+    GLuint tiles_x;
+    GLuint tiles_y;
+    GLuint bin_count;
+    GLuint bin_size;
+    CPUTileBin *bins;
+
+    // worker pool, the calling thread always takes tiles as well
+    GLuint num_threads;
+    pthread_t threads[CPU_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    GLuint generation;
+    GLuint busy;
+    GLuint next_tile;
+    GLboolean quit;
+
+    CPURendererStats stats;
+} CPURenderer;
+
+// tex->mtl_data for textures that live in their level data, anything else is a malloc'd private store
+static int cpu_resident;
+
+#define CPU_RENDERER(_ctx_) ((CPURenderer *)(_ctx_)->mtl_funcs.mtlObj)
+
+#pragma mark span fill
+static void cpuSpanFill(uint32_t *dst, uint32_t value, GLuint count)
+{
+    cpu_u32x4 v = {value, value, value, value};
+
+    // align to 16 bytes, then 4 pixels per store
+    while (count && ((uintptr_t)dst & 0xf))
+    {
+        *dst++ = value;
+        count--;
+    }
+
+    while (count >= 16)
+    {
+        ((cpu_u32x4 *)dst)[0] = v;
+        ((cpu_u32x4 *)dst)[1] = v;
+        ((cpu_u32x4 *)dst)[2] = v;
+        ((cpu_u32x4 *)dst)[3] = v;
+        dst += 16;
+        count -= 16;
+    }
+
+    while (count >= 4)
+    {
+        *(cpu_u32x4 *)dst = v;
+        dst += 4;
+        count -= 4;
+    }
+
+    while (count--)
+    {
+        *dst++ = value;
+    }
+}
+
+static void cpuSpanFillf(float *dst, float value, GLuint count)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    cpuSpanFill((uint32_t *)dst, bits, count);
+}
+
+static uint32_t cpuPackColor(const float *color, GLboolean bgra)
+{
+    uint32_t c[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        float f = color[i];
+
+        if (f < 0.0f)
+            f = 0.0f;
+        else if (f > 1.0f)
+            f = 1.0f;
+
+        c[i] = (uint32_t)(f * 255.0f + 0.5f);
+    }
+
+    if (bgra)
+        return (c[3] << 24) | (c[0] << 16) | (c[1] << 8) | c[2];
+
+    return (c[3] << 24) | (c[2] << 16) | (c[1] << 8) | c[0];
+}
+
+#pragma mark surfaces
+static Texture *cpuAttachmentTexture(FBOAttachment *fboa)
+{
+    if (fboa->textarget == GL_RENDERBUFFER)
+    {
+        if (fboa->buf.rbo == NULL)
+            return NULL;
+
+        return fboa->buf.rbo->tex;
+    }
+
+    return fboa->buf.tex;
+}
+
+static void cpuBindTexture(GLMContext ctx, Texture *tex)
+{
+    if (tex->mtl_data)
+        return;
+
+    if (tex->mtl_requires_private_storage)
+    {
+        size_t size;
+
+        // depth formats have no level data, keep a float per texel
+        size = (size_t)tex->width * (tex->height ? tex->height : 1) * (tex->depth ? tex->depth : 1) * sizeof(float);
+
+        tex->mtl_data = calloc(1, size);
+        assert(tex->mtl_data);
+    }
+    else
+    {
+        tex->mtl_data = &cpu_resident;
+    }
+
+    // level data is what we sample and render to, nothing to upload
+    tex->dirty_bits = 0;
+}
+
+static bool cpuTextureSurface(GLMContext ctx, Texture *tex, GLuint level, GLuint layer, CPUSurface *surface)
+{
+    TextureLevel *tex_level;
+    GLuint face;
+
+    RETURN_FALSE_ON_NULL(tex);
+
+    cpuBindTexture(ctx, tex);
+
+    face = 0;
+    if (tex->target == GL_TEXTURE_CUBE_MAP)
+    {
+        face = layer;
+        layer = 0;
+    }
+
+    RETURN_FALSE_ON_NULL(tex->faces[face].levels);
+
+    tex_level = &tex->faces[face].levels[level];
+
+    surface->width = tex_level->width;
+    surface->height = tex_level->height ? tex_level->height : 1;
+    surface->bgra = (tex->internalformat == GL_BGRA);
+
+    if (tex_level->data)
+    {
+        surface->pitch = tex_level->pitch;
+        surface->data = (uint8_t *)tex_level->data + layer * surface->pitch * surface->height;
+
+        // the rasterizer only writes 32 bit texels
+        return (surface->pitch == surface->width * 4);
+    }
+
+    if (tex->mtl_data != &cpu_resident && level == 0)
+    {
+        surface->pitch = surface->width * sizeof(float);
+        surface->data = (uint8_t *)tex->mtl_data + layer * surface->pitch * surface->height;
+
+        return true;
+    }
+
+    return false;
+}
+
+static bool cpuDrawableSurface(CPURenderer *renderer, bool depth, CPUSurface *surface)
+{
+    surface->width = renderer->width;
+    surface->height = renderer->height;
+    surface->bgra = true;
+
+    if (depth)
+    {
+        surface->data = (uint8_t *)renderer->depth_buffer;
+        surface->pitch = renderer->width * sizeof(float);
+    }
+    else
+    {
+        surface->data = (uint8_t *)renderer->color_buffer;
+        surface->pitch = renderer->width * sizeof(uint32_t);
+    }
+
+    return (surface->data != NULL);
+}
+
+static bool cpuColorSurface(CPURenderer *renderer, Framebuffer *fbo, GLuint drawbuffer, CPUSurface *surface)
+{
+    FBOAttachment *fboa;
+
+    if (fbo == NULL)
+        return cpuDrawableSurface(renderer, false, surface);
+
+    if (drawbuffer >= MAX_COLOR_ATTACHMENTS)
+        return false;
+
+    fboa = &fbo->color_attachments[drawbuffer];
+
+    return cpuTextureSurface(renderer->ctx, cpuAttachmentTexture(fboa), fboa->level, fboa->layer, surface);
+}
+
+static bool cpuDepthSurface(CPURenderer *renderer, Framebuffer *fbo, CPUSurface *surface)
+{
+    Texture *tex;
+
+    if (fbo == NULL)
+        return cpuDrawableSurface(renderer, true, surface);
+
+    tex = cpuAttachmentTexture(&fbo->depth);
+    if (tex == NULL)
+        return false;
+
+    cpuBindTexture(renderer->ctx, tex);
+
+    // only private storage depth textures carry float texels
+    if (tex->mtl_data == &cpu_resident)
+        return false;
+
+    return cpuTextureSurface(renderer->ctx, tex, 0, fbo->depth.layer, surface);
+}
+
+static void cpuFillSurface(CPUSurface *surface, uint32_t value)
+{
+    for (GLuint y = 0; y < surface->height; y++)
+    {
+        cpuSpanFill((uint32_t *)(surface->data + y * surface->pitch), value, surface->width);
+    }
+}
+
+#pragma mark clears
+// glClear only records the mask, like the Metal backend we resolve it when the next pass starts
+static void cpuProcessClear(CPURenderer *renderer)
+{
+    GLMContext ctx = renderer->ctx;
+    Framebuffer *fbo;
+    CPUSurface surface;
+    GLbitfield mask;
+    float depth;
+
+    fbo = STATE(framebuffer);
+    mask = STATE(clear_bitmask);
+
+    if (mask & GL_COLOR_BUFFER_BIT)
+    {
+        if (cpuColorSurface(renderer, fbo, 0, &surface))
+        {
+            cpuFillSurface(&surface, cpuPackColor(STATE(color_clear_value), surface.bgra));
+        }
+    }
+
+    if (fbo)
+    {
+        for (int i = 0; i < STATE(max_color_attachments); i++)
+        {
+            FBOAttachment *fboa;
+
+            fboa = &fbo->color_attachments[i];
+
+            if ((fboa->clear_bitmask & GL_COLOR_BUFFER_BIT) == 0)
+                continue;
+
+            if (cpuColorSurface(renderer, fbo, i, &surface))
+            {
+                cpuFillSurface(&surface, cpuPackColor(fboa->clear_color, surface.bgra));
+            }
+
+            fboa->clear_bitmask &= ~GL_COLOR_BUFFER_BIT;
+        }
+
+        if (fbo->depth.clear_bitmask & GL_DEPTH_BUFFER_BIT)
+        {
+            mask |= GL_DEPTH_BUFFER_BIT;
+            fbo->depth.clear_bitmask &= ~GL_DEPTH_BUFFER_BIT;
+        }
+    }
+
+    if (mask & GL_DEPTH_BUFFER_BIT)
+    {
+        if (cpuDepthSurface(renderer, fbo, &surface))
+        {
+            depth = (float)STATE_VAR(depth_clear_value);
+
+            for (GLuint y = 0; y < surface.height; y++)
+            {
+                cpuSpanFillf((float *)(surface.data + y * surface.pitch), depth, surface.width);
+            }
+        }
+    }
+
+    if (mask)
+    {
+        renderer->stats.clears++;
+    }
+
+    STATE(clear_bitmask) = 0;
+}
+
+#pragma mark tile rasterizer
+static void cpuRasterizeTile(CPURenderer *renderer, GLuint tile)
+{
+    CPUTileBin *bin;
+    int tx0, ty0, tx1, ty1;
+    unsigned long long pixels;
+
+    bin = &renderer->bins[tile];
+
+    if (bin->count == 0)
+        return;
+
+    tx0 = (tile % renderer->tiles_x) << CPU_TILE_SHIFT;
+    ty0 = (tile / renderer->tiles_x) << CPU_TILE_SHIFT;
+    tx1 = tx0 + CPU_TILE_SIZE;
+    ty1 = ty0 + CPU_TILE_SIZE;
+
+    if (tx0 < renderer->clip[0])
+        tx0 = renderer->clip[0];
+    if (ty0 < renderer->clip[1])
+        ty0 = renderer->clip[1];
+    if (tx1 > renderer->clip[2])
+        tx1 = renderer->clip[2];
+    if (ty1 > renderer->clip[3])
+        ty1 = renderer->clip[3];
+
+    pixels = 0;
+
+    // bins hold triangles in submission order so later draws land on top
+    for (GLuint i = 0; i < bin->count; i++)
+    {
+        CPUTriangle *tri;
+        int y0, y1;
+
+        tri = &renderer->tris[bin->list[i]];
+
+        y0 = (tri->min_y > ty0) ? tri->min_y : ty0;
+        y1 = (tri->max_y + 1 < ty1) ? tri->max_y + 1 : ty1;
+
+        for (int y = y0; y < y1; y++)
+        {
+            float py, lo, hi;
+            int xs, xe;
+            uint32_t *dst;
+
+            py = (float)y + 0.5f;
+            lo = (float)((tri->min_x > tx0) ? tri->min_x : tx0);
+            hi = (float)((tri->max_x + 1 < tx1) ? tri->max_x + 1 : tx1);
+
+            // solve each edge for the covered span on this row
+            for (int e = 0; e < 3; e++)
+            {
+                float a, v;
+
+                a = tri->a[e];
+                v = tri->b[e] * py + tri->c[e];
+
+                if (a > 0.0f)
+                {
+                    float t = -v / a - 0.5f;
+                    float x = tri->inclusive[e] ? ceilf(t) : floorf(t) + 1.0f;
+                    if (x > lo)
+                        lo = x;
+                }
+                else if (a < 0.0f)
+                {
+                    float t = -v / a - 0.5f;
+                    float x = tri->inclusive[e] ? floorf(t) + 1.0f : ceilf(t);
+                    if (x < hi)
+                        hi = x;
+                }
+                else if (v < 0.0f || (v == 0.0f && tri->inclusive[e] == false))
+                {
+                    hi = lo;
+                }
+            }
+
+            if (lo >= hi)
+                continue;
+
+            xs = (int)lo;
+            xe = (int)hi;
+
+            dst = (uint32_t *)(renderer->color.data + y * renderer->color.pitch) + xs;
+
+            if (renderer->depth_test == false)
+            {
+                cpuSpanFill(dst, tri->color, xe - xs);
+                pixels += xe - xs;
+                continue;
+            }
+
+            float *depth_row;
+            float z;
+
+            depth_row = (float *)(renderer->depth.data + y * renderer->depth.pitch) + xs;
+            z = tri->z0 + tri->dzdx * ((float)xs + 0.5f) + tri->dzdy * py;
+
+            for (int x = xs; x < xe; x++, dst++, depth_row++, z += tri->dzdx)
+            {
+                bool pass;
+
+                switch (renderer->depth_func)
+                {
+                case GL_NEVER:
+                    pass = false;
+                    break;
+                case GL_LESS:
+                    pass = z < *depth_row;
+                    break;
+                case GL_EQUAL:
+                    pass = z == *depth_row;
+                    break;
+                case GL_LEQUAL:
+                    pass = z <= *depth_row;
+                    break;
+                case GL_GREATER:
+                    pass = z > *depth_row;
+                    break;
+                case GL_NOTEQUAL:
+                    pass = z != *depth_row;
+                    break;
+                case GL_GEQUAL:
+                    pass = z >= *depth_row;
+                    break;
+                default:
+                    pass = true;
+                    break;
+                }
+
+                if (pass == false)
+                    continue;
+
+                *dst = tri->color;
+
+                if (renderer->depth_write)
+                    *depth_row = z;
+
+                pixels++;
+            }
+        }
+    }
+
+    __atomic_fetch_add(&renderer->stats.tiles_rasterized, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&renderer->stats.pixels_written, pixels, __ATOMIC_RELAXED);
+}
+
+static void cpuRasterizeTiles(CPURenderer *renderer)
+{
+    GLuint tile;
+
+    while ((tile = __atomic_fetch_add(&renderer->next_tile, 1, __ATOMIC_RELAXED)) < renderer->bin_count)
+    {
+        cpuRasterizeTile(renderer, tile);
+    }
+}
+
+static void *cpuWorkerThread(void *arg)
+{
+    CPURenderer *renderer = (CPURenderer *)arg;
+    GLuint generation = 0;
+
+    pthread_mutex_lock(&renderer->lock);
+
+    for (;;)
+    {
+        while (renderer->generation == generation && renderer->quit == false)
+        {
+            pthread_cond_wait(&renderer->work_cond, &renderer->lock);
+        }
+
+        if (renderer->quit)
+            break;
+
+        generation = renderer->generation;
+
+        pthread_mutex_unlock(&renderer->lock);
+
+        cpuRasterizeTiles(renderer);
+
+        pthread_mutex_lock(&renderer->lock);
+
+        renderer->busy--;
+        if (renderer->busy == 0)
+        {
+            pthread_cond_signal(&renderer->done_cond);
+        }
+    }
+
+    pthread_mutex_unlock(&renderer->lock);
+
+    return NULL;
+}
+
+static void cpuDispatchTiles(CPURenderer *renderer)
+{
+    renderer->next_tile = 0;
+
+    if (renderer->num_threads == 0 || renderer->tri_count < CPU_MIN_THREADED_TRIANGLES)
+    {
+        cpuRasterizeTiles(renderer);
+        return;
+    }
+
+    pthread_mutex_lock(&renderer->lock);
+    renderer->busy = renderer->num_threads;
+    renderer->generation++;
+    pthread_cond_broadcast(&renderer->work_cond);
+    pthread_mutex_unlock(&renderer->lock);
+
+    cpuRasterizeTiles(renderer);
+
+    pthread_mutex_lock(&renderer->lock);
+    while (renderer->busy)
+    {
+        pthread_cond_wait(&renderer->done_cond, &renderer->lock);
+    }
+    pthread_mutex_unlock(&renderer->lock);
+}
+
+#pragma mark binning
+static void cpuResetBins(CPURenderer *renderer)
+{
+    renderer->tiles_x = (renderer->color.width + CPU_TILE_SIZE - 1) >> CPU_TILE_SHIFT;
+    renderer->tiles_y = (renderer->color.height + CPU_TILE_SIZE - 1) >> CPU_TILE_SHIFT;
+    renderer->bin_count = renderer->tiles_x * renderer->tiles_y;
+
+    if (renderer->bin_count > renderer->bin_size)
+    {
+        renderer->bins = (CPUTileBin *)realloc(renderer->bins, renderer->bin_count * sizeof(CPUTileBin));
+        assert(renderer->bins);
+
+        bzero(&renderer->bins[renderer->bin_size], (renderer->bin_count - renderer->bin_size) * sizeof(CPUTileBin));
+        renderer->bin_size = renderer->bin_count;
+    }
+
+    for (GLuint i = 0; i < renderer->bin_count; i++)
+    {
+        renderer->bins[i].count = 0;
+    }
+
+    renderer->tri_count = 0;
+}
+
+static void cpuBinTriangle(CPURenderer *renderer, GLuint index)
+{
+    CPUTriangle *tri;
+
+    tri = &renderer->tris[index];
+
+    for (int ty = tri->min_y >> CPU_TILE_SHIFT; ty <= tri->max_y >> CPU_TILE_SHIFT; ty++)
+    {
+        for (int tx = tri->min_x >> CPU_TILE_SHIFT; tx <= tri->max_x >> CPU_TILE_SHIFT; tx++)
+        {
+            CPUTileBin *bin;
+
+            bin = &renderer->bins[ty * renderer->tiles_x + tx];
+
+            if (bin->count >= bin->size)
+            {
+                bin->size = bin->size ? bin->size * 2 : 64;
+                bin->list = (GLuint *)realloc(bin->list, bin->size * sizeof(GLuint));
+                assert(bin->list);
+            }
+
+            bin->list[bin->count++] = index;
+        }
+    }
+}
+
+static void cpuSetupTriangle(CPURenderer *renderer, CPUVertex *v0, CPUVertex *v1, CPUVertex *v2)
+{
+    GLMContext ctx = renderer->ctx;
+    CPUTriangle *tri;
+    CPUVertex *v[3];
+    float area;
+    bool front;
+
+    area = (v1->x - v0->x) * (v2->y - v0->y) - (v2->x - v0->x) * (v1->y - v0->y);
+
+    if (area == 0.0f)
+    {
+        renderer->stats.triangles_culled++;
+        return;
+    }
+
+    front = (area > 0.0f) == (STATE_VAR(front_face) == GL_CCW);
+
+    if (STATE(caps.cull_face))
+    {
+        GLenum mode = STATE_VAR(cull_face_mode);
+
+        if ((mode == GL_FRONT_AND_BACK) || (front && mode == GL_FRONT) || (!front && mode == GL_BACK))
+        {
+            renderer->stats.triangles_culled++;
+            return;
+        }
+    }
+
+    // wind everything counter clockwise so the edge tests share a sign
+    v[0] = v0;
+    v[1] = (area > 0.0f) ? v1 : v2;
+    v[2] = (area > 0.0f) ? v2 : v1;
+    if (area < 0.0f)
+        area = -area;
+
+    if (renderer->tri_count >= renderer->tri_size)
+    {
+        renderer->tri_size = renderer->tri_size ? renderer->tri_size * 2 : 256;
+        renderer->tris = (CPUTriangle *)realloc(renderer->tris, renderer->tri_size * sizeof(CPUTriangle));
+        assert(renderer->tris);
+    }
+
+    tri = &renderer->tris[renderer->tri_count];
+
+    float min_x = fminf(v[0]->x, fminf(v[1]->x, v[2]->x));
+    float min_y = fminf(v[0]->y, fminf(v[1]->y, v[2]->y));
+    float max_x = fmaxf(v[0]->x, fmaxf(v[1]->x, v[2]->x));
+    float max_y = fmaxf(v[0]->y, fmaxf(v[1]->y, v[2]->y));
+
+    tri->min_x = (min_x > renderer->clip[0]) ? (int)floorf(min_x) : renderer->clip[0];
+    tri->min_y = (min_y > renderer->clip[1]) ? (int)floorf(min_y) : renderer->clip[1];
+    tri->max_x = (max_x < renderer->clip[2] - 1) ? (int)ceilf(max_x) : renderer->clip[2] - 1;
+    tri->max_y = (max_y < renderer->clip[3] - 1) ? (int)ceilf(max_y) : renderer->clip[3] - 1;
+
+    if (tri->min_x > tri->max_x || tri->min_y > tri->max_y)
+    {
+        renderer->stats.triangles_culled++;
+        return;
+    }
+
+    for (int e = 0; e < 3; e++)
+    {
+        CPUVertex *vi = v[e];
+        CPUVertex *vj = v[(e + 1) % 3];
+
+        tri->a[e] = vi->y - vj->y;
+        tri->b[e] = vj->x - vi->x;
+        tri->c[e] = vi->x * vj->y - vj->x * vi->y;
+
+        // a shared edge flips sign between its two triangles, exactly one side keeps it
+        tri->inclusive[e] = (tri->a[e] > 0.0f) || (tri->a[e] == 0.0f && tri->b[e] < 0.0f);
+    }
+
+    tri->dzdx = ((v[1]->z - v[0]->z) * (v[2]->y - v[0]->y) - (v[2]->z - v[0]->z) * (v[1]->y - v[0]->y)) / area;
+    tri->dzdy = ((v[2]->z - v[0]->z) * (v[1]->x - v[0]->x) - (v[1]->z - v[0]->z) * (v[2]->x - v[0]->x)) / area;
+    tri->z0 = v[0]->z - tri->dzdx * v[0]->x - tri->dzdy * v[0]->y;
+
+    // flat shaded with the GL provoking vertex
+    tri->color = cpuPackColor(v2->color, renderer->color.bgra);
+
+    cpuBinTriangle(renderer, renderer->tri_count);
+
+    renderer->tri_count++;
+    renderer->stats.triangles++;
+}
+
+#pragma mark vertex fetch
+static bool cpuFetchAttrib(GLMContext ctx, GLuint index, GLuint vertex, GLuint instance, float *v)
+{
+    VertexAttrib *attrib;
+    Buffer *buf;
+    const uint8_t *src;
+    size_t offset;
+    GLuint element;
+
+    v[0] = 0.0f;
+    v[1] = 0.0f;
+    v[2] = 0.0f;
+    v[3] = 1.0f;
+
+    if ((VAO_STATE(enabled_attribs) & (0x1 << index)) == 0)
+        return false;
+
+    attrib = &VAO_ATTRIB_STATE(index);
+    buf = attrib->buffer;
+
+    if (buf == NULL || buf->data.buffer_data == 0)
+        return false;
+
+    element = attrib->divisor ? instance / attrib->divisor : vertex;
+    offset = attrib->relativeoffset + (size_t)element * attrib->stride;
+
+    if (offset + attrib->size * 4 > buf->data.buffer_size)
+        return false;
+
+    src = (const uint8_t *)buf->data.buffer_data + offset;
+
+    for (GLuint i = 0; i < attrib->size && i < 4; i++)
+    {
+        switch (attrib->type)
+        {
+        case GL_FLOAT:
+            v[i] = ((const float *)src)[i];
+            break;
+        case GL_DOUBLE:
+            v[i] = (float)((const double *)src)[i];
+            break;
+        case GL_UNSIGNED_BYTE:
+            v[i] = attrib->normalized ? src[i] / 255.0f : src[i];
+            break;
+        case GL_BYTE:
+            v[i] = attrib->normalized ? ((const int8_t *)src)[i] / 127.0f : ((const int8_t *)src)[i];
+            break;
+        case GL_UNSIGNED_SHORT:
+            v[i] = attrib->normalized ? ((const uint16_t *)src)[i] / 65535.0f : ((const uint16_t *)src)[i];
+            break;
+        case GL_SHORT:
+            v[i] = attrib->normalized ? ((const int16_t *)src)[i] / 32767.0f : ((const int16_t *)src)[i];
+            break;
+        case GL_UNSIGNED_INT:
+            v[i] = (float)((const uint32_t *)src)[i];
+            break;
+        case GL_INT:
+            v[i] = (float)((const int32_t *)src)[i];
+            break;
+        default:
+            // packed and half formats aren't needed for positions
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool cpuTransformVertex(CPURenderer *renderer, GLuint vertex, GLuint instance, CPUVertex *out)
+{
+    GLMContext ctx = renderer->ctx;
+    float pos[4];
+    float inv_w;
+
+    if (cpuFetchAttrib(ctx, 0, vertex, instance, pos) == false)
+        return false;
+
+    // no near plane clipping, primitives crossing w = 0 are dropped
+    if (pos[3] <= 0.0f)
+        return false;
+
+    inv_w = 1.0f / pos[3];
+
+    out->x = STATE(viewport[0]) + (pos[0] * inv_w + 1.0f) * 0.5f * STATE(viewport[2]);
+    out->y = STATE(viewport[1]) + (pos[1] * inv_w + 1.0f) * 0.5f * STATE(viewport[3]);
+    out->z = (pos[2] * inv_w + 1.0f) * 0.5f;
+
+    if (cpuFetchAttrib(ctx, 1, vertex, instance, out->color) == false)
+    {
+        out->color[0] = 1.0f;
+        out->color[1] = 1.0f;
+        out->color[2] = 1.0f;
+        out->color[3] = 1.0f;
+    }
+
+    return true;
+}
+
+#pragma mark draw
+static bool cpuBeginDraw(CPURenderer *renderer)
+{
+    GLMContext ctx = renderer->ctx;
+    Framebuffer *fbo;
+    GLuint drawbuffer;
+
+    cpuProcessClear(renderer);
+
+    fbo = STATE(framebuffer);
+
+    drawbuffer = 0;
+    if (fbo && STATE(draw_buffer) >= GL_COLOR_ATTACHMENT0)
+    {
+        drawbuffer = STATE(draw_buffer) - GL_COLOR_ATTACHMENT0;
+    }
+
+    RETURN_FALSE_ON_FAILURE(cpuColorSurface(renderer, fbo, drawbuffer, &renderer->color));
+
+    renderer->depth_test = false;
+    if (STATE(caps.depth_test))
+    {
+        renderer->depth_test = cpuDepthSurface(renderer, fbo, &renderer->depth);
+
+        // mismatched attachment sizes would walk off the depth rows
+        if (renderer->depth.width < renderer->color.width || renderer->depth.height < renderer->color.height)
+        {
+            renderer->depth_test = false;
+        }
+    }
+
+    renderer->depth_func = STATE_VAR(depth_func);
+    renderer->depth_write = STATE_VAR(depth_writemask);
+
+    renderer->clip[0] = 0;
+    renderer->clip[1] = 0;
+    renderer->clip[2] = renderer->color.width;
+    renderer->clip[3] = renderer->color.height;
+
+    if (STATE(caps.scissor_test))
+    {
+        int x0, y0, x1, y1;
+
+        x0 = STATE_VAR(scissor_box[0]);
+        y0 = STATE_VAR(scissor_box[1]);
+        x1 = x0 + STATE_VAR(scissor_box[2]);
+        y1 = y0 + STATE_VAR(scissor_box[3]);
+
+        renderer->clip[0] = (x0 > 0) ? x0 : 0;
+        renderer->clip[1] = (y0 > 0) ? y0 : 0;
+        renderer->clip[2] = (x1 < renderer->clip[2]) ? x1 : renderer->clip[2];
+        renderer->clip[3] = (y1 < renderer->clip[3]) ? y1 : renderer->clip[3];
+    }
+
+    if (renderer->clip[0] >= renderer->clip[2] || renderer->clip[1] >= renderer->clip[3])
+        return false;
+
+    cpuResetBins(renderer);
+
+    return true;
+}
+
+static bool cpuVertexIndex(GLMContext ctx, GLenum type, const void *indices, GLint first, GLsizei i, GLint basevertex,
+                           GLuint *vertex)
+{
+    const uint8_t *base;
+    Buffer *buf;
+
+    if (type == 0)
+    {
+        *vertex = first + i;
+        return true;
+    }
+
+    buf = VAO_STATE(element_array.buffer);
+    if (buf == NULL || buf->data.buffer_data == 0)
+        return false;
+
+    base = (const uint8_t *)buf->data.buffer_data + (uintptr_t)indices;
+
+    switch (type)
+    {
+    case GL_UNSIGNED_BYTE:
+        *vertex = base[i] + basevertex;
+        break;
+    case GL_UNSIGNED_SHORT:
+        *vertex = ((const uint16_t *)base)[i] + basevertex;
+        break;
+    case GL_UNSIGNED_INT:
+        *vertex = ((const uint32_t *)base)[i] + basevertex;
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+static void cpuAssembleTriangle(CPURenderer *renderer, GLenum type, const void *indices, GLint first, GLint basevertex,
+                                GLuint instance, GLsizei i0, GLsizei i1, GLsizei i2)
+{
+    GLMContext ctx = renderer->ctx;
+    GLuint vertex[3];
+    CPUVertex v[3];
+    GLsizei index[3] = {i0, i1, i2};
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (cpuVertexIndex(ctx, type, indices, first, index[i], basevertex, &vertex[i]) == false)
+            return;
+
+        if (cpuTransformVertex(renderer, vertex[i], instance, &v[i]) == false)
+        {
+            renderer->stats.triangles_culled++;
+            return;
+        }
+    }
+
+    cpuSetupTriangle(renderer, &v[0], &v[1], &v[2]);
+}
+
+static void cpuDraw(GLMContext ctx, GLenum mode, GLint first, GLsizei count, GLenum type, const void *indices,
+                    GLsizei instancecount, GLint basevertex, GLuint baseinstance)
+{
+    CPURenderer *renderer = CPU_RENDERER(ctx);
+
+    renderer->stats.draws++;
+
+    switch (mode)
+    {
+    case GL_TRIANGLES:
+    case GL_TRIANGLE_STRIP:
+    case GL_TRIANGLE_FAN:
+        break;
+
+    default:
+        // points, lines, adjacency and patches have no reference path
+        renderer->stats.primitives_skipped += count;
+        return;
+    }
+
+    RETURN_ON_FAILURE(cpuBeginDraw(renderer));
+
+    for (GLuint instance = baseinstance; instance < baseinstance + instancecount; instance++)
+    {
+        switch (mode)
+        {
+        case GL_TRIANGLES:
+            for (GLsizei i = 0; i + 2 < count; i += 3)
+                cpuAssembleTriangle(renderer, type, indices, first, basevertex, instance, i, i + 1, i + 2);
+            break;
+
+        case GL_TRIANGLE_STRIP:
+            for (GLsizei i = 0; i + 2 < count; i++)
+            {
+                if (i & 0x1)
+                    cpuAssembleTriangle(renderer, type, indices, first, basevertex, instance, i + 1, i, i + 2);
+                else
+                    cpuAssembleTriangle(renderer, type, indices, first, basevertex, instance, i, i + 1, i + 2);
+            }
+            break;
+
+        case GL_TRIANGLE_FAN:
+            for (GLsizei i = 1; i + 1 < count; i++)
+                cpuAssembleTriangle(renderer, type, indices, first, basevertex, instance, 0, i, i + 1);
+            break;
+        }
+    }
+
+    cpuDispatchTiles(renderer);
+}
+
+#pragma mark C interface to draw commands
+void cpuDrawArrays(GLMContext ctx, GLenum mode, GLint first, GLsizei count)
+{
+    cpuDraw(ctx, mode, first, count, 0, NULL, 1, 0, 0);
+}
+
+void cpuDrawElements(GLMContext ctx, GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+    cpuDraw(ctx, mode, 0, count, type, indices, 1, 0, 0);
+}
+
+void cpuDrawRangeElements(GLMContext ctx, GLenum mode, GLuint start, GLuint end, GLsizei count, GLenum type,
+                          const void *indices)
+{
+    cpuDraw(ctx, mode, 0, count, type, indices, 1, 0, 0);
+}
+
+void cpuDrawArraysInstanced(GLMContext ctx, GLenum mode, GLint first, GLsizei count, GLsizei instancecount)
+{
+    cpuDraw(ctx, mode, first, count, 0, NULL, instancecount, 0, 0);
+}
+
+void cpuDrawElementsInstanced(GLMContext ctx, GLenum mode, GLsizei count, GLenum type, const void *indices,
+                              GLsizei instancecount)
+{
+    cpuDraw(ctx, mode, 0, count, type, indices, instancecount, 0, 0);
+}
+
+void cpuDrawElementsBaseVertex(GLMContext ctx, GLenum mode, GLsizei count, GLenum type, const void *indices,
+                               GLint basevertex)
+{
+    cpuDraw(ctx, mode, 0, count, type, indices, 1, basevertex, 0);
+}
+
+void cpuDrawRangeElementsBaseVertex(GLMContext ctx, GLenum mode, GLuint start, GLuint end, GLsizei count, GLenum type,
+                                    const void *indices, GLint basevertex)
+{
+    cpuDraw(ctx, mode, 0, count, type, indices, 1, basevertex, 0);
+}
+
+void cpuDrawElementsInstancedBaseVertex(GLMContext ctx, GLenum mode, GLsizei count, GLenum type, const void *indices,
+                                        GLsizei instancecount, GLint basevertex)
+{
+    cpuDraw(ctx, mode, 0, count, type, indices, instancecount, basevertex, 0);
+}
+
+void cpuDrawArraysInstancedBaseInstance(GLMContext ctx, GLenum mode, GLint first, GLsizei count,
+                                        GLsizei instancecount, GLuint baseinstance)
+{
+    cpuDraw(ctx, mode, first, count, 0, NULL, instancecount, 0, baseinstance);
+}
+
+void cpuDrawElementsInstancedBaseInstance(GLMContext ctx, GLenum mode, GLsizei count, GLenum type, const void *indices,
+                                          GLsizei instancecount, GLuint baseinstance)
+{
+    cpuDraw(ctx, mode, 0, count, type, indices, instancecount, 0, baseinstance);
+}
+
+void cpuDrawElementsInstancedBaseVertexBaseInstance(GLMContext ctx, GLenum mode, GLsizei count, GLenum type,
+                                                    const void *indices, GLsizei instancecount, GLint basevertex,
+                                                    GLuint baseinstance)
+{
+    cpuDraw(ctx, mode, 0, count, type, indices, instancecount, basevertex, baseinstance);
+}
+
+static const uint8_t *cpuIndirectData(GLMContext ctx, const void *indirect)
+{
+    Buffer *buf;
+
+    buf = STATE(buffers[_DRAW_INDIRECT_BUFFER]);
+    if (buf == NULL || buf->data.buffer_data == 0)
+        return NULL;
+
+    return (const uint8_t *)buf->data.buffer_data + (uintptr_t)indirect;
+}
+
+void cpuMultiDrawArraysIndirect(GLMContext ctx, GLenum mode, const void *indirect, GLsizei drawcount, GLsizei stride)
+{
+    const uint8_t *data;
+
+    data = cpuIndirectData(ctx, indirect);
+    RETURN_ON_NULL(data);
+
+    if (stride == 0)
+        stride = sizeof(DrawArraysIndirectCommand);
+
+    for (GLsizei i = 0; i < drawcount; i++)
+    {
+        const DrawArraysIndirectCommand *cmd = (const DrawArraysIndirectCommand *)(data + i * stride);
+
+        cpuDraw(ctx, mode, cmd->first, cmd->count, 0, NULL, cmd->instanceCount, 0, cmd->baseInstance);
+    }
+}
+
+void cpuMultiDrawElementsIndirect(GLMContext ctx, GLenum mode, GLenum type, const void *indirect, GLsizei drawcount,
+                                  GLsizei stride)
+{
+    const uint8_t *data;
+    GLuint type_size;
+
+    data = cpuIndirectData(ctx, indirect);
+    RETURN_ON_NULL(data);
+
+    if (stride == 0)
+        stride = sizeof(DrawElementsIndirectCommand);
+
+    type_size = (type == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(uint32_t);
+
+    for (GLsizei i = 0; i < drawcount; i++)
+    {
+        const DrawElementsIndirectCommand *cmd = (const DrawElementsIndirectCommand *)(data + i * stride);
+
+        cpuDraw(ctx, mode, 0, cmd->count, type, (const void *)(uintptr_t)(cmd->first * type_size), cmd->instanceCount,
+                cmd->baseVertex, cmd->baseInstance);
+    }
+}
+
+static GLsizei cpuIndirectCount(GLMContext ctx, GLintptr drawcount, GLsizei maxdrawcount)
+{
+    Buffer *buf;
+    GLsizei count;
+
+    buf = STATE(buffers[_PARAMETER_BUFFER]);
+    if (buf == NULL || buf->data.buffer_data == 0)
+        return 0;
+
+    memcpy(&count, (const uint8_t *)buf->data.buffer_data + drawcount, sizeof(count));
+
+    // the count is unsigned in the buffer
+    if ((GLuint)count > (GLuint)maxdrawcount)
+        count = maxdrawcount;
+
+    return count;
+}
+
+void cpuMultiDrawArraysIndirectCount(GLMContext ctx, GLenum mode, const void *indirect, GLintptr drawcount,
+                                     GLsizei maxdrawcount, GLsizei stride)
+{
+    cpuMultiDrawArraysIndirect(ctx, mode, indirect, cpuIndirectCount(ctx, drawcount, maxdrawcount), stride);
+}
+
+void cpuMultiDrawElementsIndirectCount(GLMContext ctx, GLenum mode, GLenum type, const void *indirect,
+                                       GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride)
+{
+    cpuMultiDrawElementsIndirect(ctx, mode, type, indirect, cpuIndirectCount(ctx, drawcount, maxdrawcount), stride);
+}
+
+void cpuDrawArraysIndirect(GLMContext ctx, GLenum mode, const void *indirect)
+{
+    cpuMultiDrawArraysIndirect(ctx, mode, indirect, 1, 0);
+}
+
+void cpuDrawElementsIndirect(GLMContext ctx, GLenum mode, GLenum type, const void *indirect)
+{
+    cpuMultiDrawElementsIndirect(ctx, mode, type, indirect, 1, 0);
+}
+
+void cpuMultiDrawArrays(GLMContext ctx, GLenum mode, const GLint *first, const GLsizei *count, GLsizei drawcount)
+{
+    for (GLsizei i = 0; i < drawcount; i++)
+    {
+        cpuDraw(ctx, mode, first[i], count[i], 0, NULL, 1, 0, 0);
+    }
+}
+
+void cpuMultiDrawElements(GLMContext ctx, GLenum mode, const GLsizei *count, GLenum type, const void *const *indices,
+                          GLsizei drawcount)
+{
+    for (GLsizei i = 0; i < drawcount; i++)
+    {
+        cpuDraw(ctx, mode, 0, count[i], type, indices[i], 1, 0, 0);
+    }
+}
+
+void cpuMultiDrawElementsBaseVertex(GLMContext ctx, GLenum mode, const GLsizei *count, GLenum type,
+                                    const void *const *indices, GLsizei drawcount, const GLint *basevertex)
+{
+    for (GLsizei i = 0; i < drawcount; i++)
+    {
+        cpuDraw(ctx, mode, 0, count[i], type, indices[i], 1, basevertex[i], 0);
+    }
+}
+
+void cpuDispatchCompute(GLMContext ctx, GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z)
+{
+    // no shader execution on the reference path
+    DEBUG_PRINT("compute dispatch %d %d %d ignored\n", num_groups_x, num_groups_y, num_groups_z);
+}
+
+void cpuDispatchComputeIndirect(GLMContext ctx, GLintptr indirect)
+{
+    DEBUG_PRINT("compute dispatch indirect ignored\n");
+}
+
+#pragma mark C interface to objects
+void cpuBindBuffer(GLMContext ctx, Buffer *ptr)
+{
+    // buffers are consumed straight from buffer_data
+    ptr->data.dirty_bits = 0;
+}
+
+void cpuBindTextureFunc(GLMContext ctx, Texture *ptr)
+{
+    cpuBindTexture(ctx, ptr);
+}
+
+void cpuBindProgram(GLMContext ctx, Program *ptr)
+{
+    // nothing to compile, msl is generated by the front end and left unused
+}
+
+void cpuDeleteObj(GLMContext ctx, void *obj)
+{
+    assert(obj);
+
+    // work is retired synchronously, private stores can go right away
+    if (obj != &cpu_resident)
+    {
+        free(obj);
+    }
+}
+
+void cpuGetSync(GLMContext ctx, Sync *sync)
+{
+    cpuProcessClear(CPU_RENDERER(ctx));
+
+    // everything before the fence has already executed
+    sync->mtl_event = NULL;
+}
+
+void cpuWaitForSync(GLMContext ctx, Sync *sync)
+{
+    sync->mtl_event = NULL;
+}
+
+void cpuFlush(GLMContext ctx, bool finish)
+{
+    cpuProcessClear(CPU_RENDERER(ctx));
+}
+
+void cpuSwapBuffers(GLMContext ctx)
+{
+    CPURenderer *renderer = CPU_RENDERER(ctx);
+
+    cpuProcessClear(renderer);
+
+    renderer->stats.frames++;
+}
+
+void cpuClearBuffer(GLMContext ctx, GLuint type, GLbitfield mask)
+{
+    cpuProcessClear(CPU_RENDERER(ctx));
+}
+
+#pragma mark C interface to buffer data
+void cpuBufferSubData(GLMContext ctx, Buffer *buf, size_t offset, size_t size, const void *ptr)
+{
+    RETURN_ON_FAILURE(buf->data.buffer_data);
+
+    memcpy((void *)(buf->data.buffer_data + offset), ptr, size);
+    buf->data.generation++;
+
+    CPU_RENDERER(ctx)->stats.uploads++;
+}
+
+void *cpuMapUnmapBuffer(GLMContext ctx, Buffer *buf, size_t offset, size_t size, GLenum access, bool map)
+{
+    if (map)
+    {
+        return (void *)(buf->data.buffer_data + offset);
+    }
+
+    // coherent by construction, the recorded dirty ranges have nowhere to go
+    buf->data.dirty_range_count = 0;
+
+    return NULL;
+}
+
+void cpuFlushBufferRange(GLMContext ctx, Buffer *buf, GLintptr offset, GLsizeiptr length)
+{
+    // coherent by construction
+    buf->data.dirty_range_count = 0;
+}
+
+bool cpuRenameBuffer(GLMContext ctx, Buffer *buf, size_t size)
+{
+    // buffers never get backend storage, respecification reuses buffer_data in place
+    return false;
+}
+
+void cpuCopyBufferSubData(GLMContext ctx, Buffer *src, Buffer *dst, size_t read_offset, size_t write_offset,
+                          size_t size)
+{
+    RETURN_ON_FAILURE(src->data.buffer_data && dst->data.buffer_data);
+
+    memmove((void *)(dst->data.buffer_data + write_offset), (void *)(src->data.buffer_data + read_offset), size);
+
+    // nothing to upload, but generated indices read from dst are stale
+    dst->data.generation++;
+}
+
+void cpuWaitForBufferWrites(GLMContext ctx, Buffer *buf)
+{
+    // copies run synchronously, buffer_data is always current
+    buf->data.gpu_write_serial = 0;
+}
+
+#pragma mark C interface to blits and readback
+static void cpuCopyRows(uint8_t *dst, size_t dst_pitch, const uint8_t *src, size_t src_pitch, size_t row_size,
+                        GLuint rows)
+{
+    for (GLuint y = 0; y < rows; y++)
+    {
+        memcpy(dst + y * dst_pitch, src + y * src_pitch, row_size);
+    }
+}
+
+void cpuReadDrawable(GLMContext ctx, void *pixelBytes, GLuint bytesPerRow, GLuint bytesPerImage, GLint x, GLint y,
+                     GLsizei width, GLsizei height)
+{
+    CPURenderer *renderer = CPU_RENDERER(ctx);
+    CPUSurface surface;
+    Framebuffer *fbo;
+    GLuint readbuffer;
+    size_t row_size;
+
+    cpuProcessClear(renderer);
+
+    fbo = STATE(readbuffer);
+
+    readbuffer = 0;
+    if (fbo && STATE(read_buffer) >= GL_COLOR_ATTACHMENT0)
+    {
+        readbuffer = STATE(read_buffer) - GL_COLOR_ATTACHMENT0;
+    }
+
+    RETURN_ON_FAILURE(cpuColorSurface(renderer, fbo, readbuffer, &surface));
+
+    // same region semantics as the Metal path, clamp to the surface
+    if (x < 0 || y < 0 || x >= surface.width || y >= surface.height)
+        return;
+
+    if (x + width > surface.width)
+        width = surface.width - x;
+
+    if (y + height > surface.height)
+        height = surface.height - y;
+
+    row_size = width * sizeof(uint32_t);
+    if (row_size > bytesPerRow)
+        row_size = bytesPerRow;
+
+    cpuCopyRows((uint8_t *)pixelBytes, bytesPerRow, surface.data + y * surface.pitch + x * sizeof(uint32_t),
+                surface.pitch, row_size, height);
+}
+
+void cpuGetTexImage(GLMContext ctx, Texture *tex, void *pixelBytes, GLuint bytesPerRow, GLuint bytesPerImage, GLint x,
+                    GLint y, GLsizei width, GLsizei height, GLuint level, GLuint slice)
+{
+    TextureLevel *tex_level;
+    GLuint face;
+    size_t pixel_size;
+    const uint8_t *src;
+
+    RETURN_ON_NULL(tex);
+
+    face = 0;
+    if (tex->target == GL_TEXTURE_CUBE_MAP)
+    {
+        face = slice;
+        slice = 0;
+    }
+
+    RETURN_ON_NULL(tex->faces[face].levels);
+
+    tex_level = &tex->faces[face].levels[level];
+    RETURN_ON_FAILURE(tex_level->data);
+
+    pixel_size = tex_level->pitch / tex_level->width;
+
+    src = (const uint8_t *)tex_level->data + slice * tex_level->pitch * (tex_level->height ? tex_level->height : 1) +
+          y * tex_level->pitch + x * pixel_size;
+
+    cpuCopyRows((uint8_t *)pixelBytes, bytesPerRow, src, tex_level->pitch, width * pixel_size, height);
+}
+
+void cpuTexSubImage(GLMContext ctx, Texture *tex, Buffer *buf, size_t src_offset, size_t src_pitch,
+                    size_t src_image_size, size_t src_size, GLuint slice, GLuint level, size_t width, size_t height,
+                    size_t depth, size_t xoffset, size_t yoffset, size_t zoffset)
+{
+    TextureLevel *tex_level;
+    size_t pixel_size;
+    size_t image_size;
+    GLuint face;
+
+    RETURN_ON_FAILURE(buf->data.buffer_data);
+
+    cpuBindTexture(ctx, tex);
+
+    face = 0;
+    if (tex->target == GL_TEXTURE_CUBE_MAP)
+    {
+        face = zoffset;
+        zoffset = 0;
+    }
+
+    RETURN_ON_NULL(tex->faces[face].levels);
+
+    tex_level = &tex->faces[face].levels[level];
+    RETURN_ON_FAILURE(tex_level->data);
+
+    pixel_size = tex_level->pitch / tex_level->width;
+    image_size = tex_level->pitch * (tex_level->height ? tex_level->height : 1);
+
+    // matches the Metal path, buffer rows are tightly described by src_pitch / src_image_size
+    for (size_t z = 0; z < depth; z++)
+    {
+        uint8_t *dst;
+        const uint8_t *src;
+
+        dst = (uint8_t *)tex_level->data + (zoffset + z) * image_size + yoffset * tex_level->pitch +
+              xoffset * pixel_size;
+        src = (const uint8_t *)buf->data.buffer_data + src_offset + z * src_image_size;
+
+        cpuCopyRows(dst, tex_level->pitch, src, src_pitch, width * pixel_size, (GLuint)height);
+    }
+
+    CPU_RENDERER(ctx)->stats.uploads++;
+}
+
+void cpuTexSubImageData(GLMContext ctx, Texture *tex, const void *pixels, size_t src_pitch, GLuint level,
+                        size_t width, size_t height, size_t xoffset, size_t yoffset)
+{
+    // the level data was already unpacked and is what we sample
+    CPU_RENDERER(ctx)->stats.uploads++;
+}
+
+static bool cpuIsUnorm8Format(GLenum internalformat, GLuint *channels)
+{
+    switch (internalformat)
+    {
+    case GL_R8:
+    case GL_RED:
+        *channels = 1;
+        return true;
+    case GL_RG8:
+    case GL_RG:
+        *channels = 2;
+        return true;
+    case GL_RGB8:
+    case GL_RGB:
+        *channels = 3;
+        return true;
+    case GL_RGBA8:
+    case GL_RGBA:
+    case GL_BGRA:
+    case GL_SRGB8_ALPHA8:
+        *channels = 4;
+        return true;
+    }
+
+    return false;
+}
+
+void cpuGenerateMipmaps(GLMContext ctx, Texture *tex)
+{
+    GLuint channels;
+
+    cpuProcessClear(CPU_RENDERER(ctx));
+
+    // box filter, 8 bit unorm 2d levels only
+    if (cpuIsUnorm8Format(tex->internalformat, &channels) == false)
+    {
+        DEBUG_PRINT("mipmap generation unsupported for format 0x%x\n", tex->internalformat);
+        return;
+    }
+
+    for (int face = 0; face < _CUBE_MAP_MAX_FACE; face++)
+    {
+        if (tex->faces[face].levels == NULL)
+            continue;
+
+        for (GLuint level = 1; level < tex->mipmap_levels; level++)
+        {
+            TextureLevel *src, *dst;
+
+            src = &tex->faces[face].levels[level - 1];
+            dst = &tex->faces[face].levels[level];
+
+            if (src->data == 0 || dst->data == 0)
+                break;
+
+            for (GLuint y = 0; y < dst->height; y++)
+            {
+                const uint8_t *row0, *row1;
+                uint8_t *out;
+
+                row0 = (const uint8_t *)src->data + (y * 2) * src->pitch;
+                row1 = (src->height > 1) ? row0 + src->pitch : row0;
+                out = (uint8_t *)dst->data + y * dst->pitch;
+
+                for (GLuint x = 0; x < dst->width; x++)
+                {
+                    GLuint x0 = x * 2 * channels;
+                    GLuint x1 = (src->width > 1) ? x0 + channels : x0;
+
+                    for (GLuint c = 0; c < channels; c++)
+                    {
+                        out[x * channels + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void cpuBlitFramebuffer(GLMContext ctx, GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0,
+                        GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter)
+{
+    CPURenderer *renderer = CPU_RENDERER(ctx);
+    CPUSurface src, dst;
+    GLuint readbuffer, drawbuffer;
+    GLint src_w, src_h, dst_w, dst_h;
+
+    cpuProcessClear(renderer);
+
+    // nearest only, linear would need per format filtering
+    if ((mask & GL_COLOR_BUFFER_BIT) == 0)
+        return;
+
+    readbuffer = 0;
+    if (STATE(readbuffer) && STATE(read_buffer) >= GL_COLOR_ATTACHMENT0)
+        readbuffer = STATE(read_buffer) - GL_COLOR_ATTACHMENT0;
+
+    drawbuffer = 0;
+    if (STATE(framebuffer) && STATE(draw_buffer) >= GL_COLOR_ATTACHMENT0)
+        drawbuffer = STATE(draw_buffer) - GL_COLOR_ATTACHMENT0;
+
+    RETURN_ON_FAILURE(cpuColorSurface(renderer, STATE(readbuffer), readbuffer, &src));
+    RETURN_ON_FAILURE(cpuColorSurface(renderer, STATE(framebuffer), drawbuffer, &dst));
+
+    src_w = srcX1 - srcX0;
+    src_h = srcY1 - srcY0;
+    dst_w = dstX1 - dstX0;
+    dst_h = dstY1 - dstY0;
+
+    if (src_w == 0 || src_h == 0 || dst_w == 0 || dst_h == 0)
+        return;
+
+    for (GLint y = 0; y < abs(dst_h); y++)
+    {
+        GLint dy, sy;
+        uint32_t *out;
+        const uint32_t *in;
+
+        dy = (dst_h > 0) ? dstY0 + y : dstY0 - 1 - y;
+        sy = srcY0 + (GLint)(((float)y + 0.5f) * src_h / abs(dst_h));
+        if (src_h < 0)
+            sy--;
+
+        if (dy < 0 || dy >= dst.height || sy < 0 || sy >= src.height)
+            continue;
+
+        out = (uint32_t *)(dst.data + dy * dst.pitch);
+        in = (const uint32_t *)(src.data + sy * src.pitch);
+
+        for (GLint x = 0; x < abs(dst_w); x++)
+        {
+            GLint dx, sx;
+            uint32_t texel;
+
+            dx = (dst_w > 0) ? dstX0 + x : dstX0 - 1 - x;
+            sx = srcX0 + (GLint)(((float)x + 0.5f) * src_w / abs(dst_w));
+            if (src_w < 0)
+                sx--;
+
+            if (dx < 0 || dx >= dst.width || sx < 0 || sx >= src.width)
+                continue;
+
+            texel = in[sx];
+
+            // swap red and blue between BGRA and RGBA surfaces
+            if (src.bgra != dst.bgra)
+                texel = (texel & 0xff00ff00) | ((texel >> 16) & 0xff) | ((texel & 0xff) << 16);
+
+            out[dx] = texel;
+        }
+    }
+
+    renderer->stats.blits++;
+}
+
+#pragma mark stats
+void CPURendererGetStats(GLMContext glm_ctx, CPURendererStats *stats)
+{
+    *stats = CPU_RENDERER(glm_ctx)->stats;
+}
+
+void CPURendererResetStats(GLMContext glm_ctx)
+{
+    bzero(&CPU_RENDERER(glm_ctx)->stats, sizeof(CPURendererStats));
+}
+
+const void *CPURendererDrawable(GLMContext glm_ctx, unsigned *width, unsigned *height, unsigned *pitch)
+{
+    CPURenderer *renderer = CPU_RENDERER(glm_ctx);
+
+    cpuProcessClear(renderer);
+
+    *width = renderer->width;
+    *height = renderer->height;
+    *pitch = renderer->width * sizeof(uint32_t);
+
+    return renderer->color_buffer;
+}
+
+#pragma mark C interface to context functions
+static void cpuBindFuncsToGLMContext(GLMContext glm_ctx, CPURenderer *renderer)
+{
+    glm_ctx->mtl_funcs.mtlObj = (void *)renderer;
+    glm_ctx->mtl_funcs.mtlView = NULL;
+
+    glm_ctx->mtl_funcs.mtlBindBuffer = cpuBindBuffer;
+    glm_ctx->mtl_funcs.mtlBindTexture = cpuBindTextureFunc;
+    glm_ctx->mtl_funcs.mtlBindProgram = cpuBindProgram;
+
+    glm_ctx->mtl_funcs.mtlDeleteMTLObj = cpuDeleteObj;
+
+    glm_ctx->mtl_funcs.mtlGetSync = cpuGetSync;
+    glm_ctx->mtl_funcs.mtlWaitForSync = cpuWaitForSync;
+    glm_ctx->mtl_funcs.mtlFlush = cpuFlush;
+    glm_ctx->mtl_funcs.mtlSwapBuffers = cpuSwapBuffers;
+    glm_ctx->mtl_funcs.mtlClearBuffer = cpuClearBuffer;
+    glm_ctx->mtl_funcs.mtlBlitFramebuffer = cpuBlitFramebuffer;
+
+    glm_ctx->mtl_funcs.mtlBufferSubData = cpuBufferSubData;
+    glm_ctx->mtl_funcs.mtlMapUnmapBuffer = cpuMapUnmapBuffer;
+    glm_ctx->mtl_funcs.mtlFlushBufferRange = cpuFlushBufferRange;
+    glm_ctx->mtl_funcs.mtlRenameBuffer = cpuRenameBuffer;
+    glm_ctx->mtl_funcs.mtlCopyBufferSubData = cpuCopyBufferSubData;
+    glm_ctx->mtl_funcs.mtlWaitForBufferWrites = cpuWaitForBufferWrites;
+
+    glm_ctx->mtl_funcs.mtlReadDrawable = cpuReadDrawable;
+    glm_ctx->mtl_funcs.mtlGetTexImage = cpuGetTexImage;
+
+    glm_ctx->mtl_funcs.mtlGenerateMipmaps = cpuGenerateMipmaps;
+    glm_ctx->mtl_funcs.mtlTexSubImage = cpuTexSubImage;
+    glm_ctx->mtl_funcs.mtlTexSubImageData = cpuTexSubImageData;
+
+    glm_ctx->mtl_funcs.mtlDrawArrays = cpuDrawArrays;
+    glm_ctx->mtl_funcs.mtlDrawElements = cpuDrawElements;
+    glm_ctx->mtl_funcs.mtlDrawRangeElements = cpuDrawRangeElements;
+    glm_ctx->mtl_funcs.mtlDrawArraysInstanced = cpuDrawArraysInstanced;
+    glm_ctx->mtl_funcs.mtlDrawElementsInstanced = cpuDrawElementsInstanced;
+    glm_ctx->mtl_funcs.mtlDrawElementsBaseVertex = cpuDrawElementsBaseVertex;
+    glm_ctx->mtl_funcs.mtlDrawRangeElementsBaseVertex = cpuDrawRangeElementsBaseVertex;
+    glm_ctx->mtl_funcs.mtlDrawElementsInstancedBaseVertex = cpuDrawElementsInstancedBaseVertex;
+    glm_ctx->mtl_funcs.mtlDrawArraysIndirect = cpuDrawArraysIndirect;
+    glm_ctx->mtl_funcs.mtlDrawElementsIndirect = cpuDrawElementsIndirect;
+    glm_ctx->mtl_funcs.mtlDrawArraysInstancedBaseInstance = cpuDrawArraysInstancedBaseInstance;
+    glm_ctx->mtl_funcs.mtlDrawElementsInstancedBaseInstance = cpuDrawElementsInstancedBaseInstance;
+    glm_ctx->mtl_funcs.mtlDrawElementsInstancedBaseVertexBaseInstance = cpuDrawElementsInstancedBaseVertexBaseInstance;
+
+    glm_ctx->mtl_funcs.mtlMultiDrawArrays = cpuMultiDrawArrays;
+    glm_ctx->mtl_funcs.mtlMultiDrawElements = cpuMultiDrawElements;
+    glm_ctx->mtl_funcs.mtlMultiDrawElementsBaseVertex = cpuMultiDrawElementsBaseVertex;
+    glm_ctx->mtl_funcs.mtlMultiDrawArraysIndirect = cpuMultiDrawArraysIndirect;
+    glm_ctx->mtl_funcs.mtlMultiDrawElementsIndirect = cpuMultiDrawElementsIndirect;
+    glm_ctx->mtl_funcs.mtlMultiDrawArraysIndirectCount = cpuMultiDrawArraysIndirectCount;
+    glm_ctx->mtl_funcs.mtlMultiDrawElementsIndirectCount = cpuMultiDrawElementsIndirectCount;
+
+    glm_ctx->mtl_funcs.mtlDispatchCompute = cpuDispatchCompute;
+    glm_ctx->mtl_funcs.mtlDispatchComputeIndirect = cpuDispatchComputeIndirect;
+}
+
+void *createCPURendererAndBindToContext(GLMContext glm_ctx, unsigned width, unsigned height)
+{
+    CPURenderer *renderer;
+    long cpus;
+
+    assert(glm_ctx);
+    assert(width && height);
+
+    renderer = (CPURenderer *)malloc(sizeof(CPURenderer));
+    assert(renderer);
+
+    bzero(renderer, sizeof(CPURenderer));
+
+    renderer->ctx = glm_ctx;
+    renderer->width = width;
+    renderer->height = height;
+
+    renderer->color_buffer = (uint32_t *)calloc((size_t)width * height, sizeof(uint32_t));
+    assert(renderer->color_buffer);
+
+    renderer->depth_buffer = (float *)calloc((size_t)width * height, sizeof(float));
+    assert(renderer->depth_buffer);
+
+    pthread_mutex_init(&renderer->lock, NULL);
+    pthread_cond_init(&renderer->work_cond, NULL);
+    pthread_cond_init(&renderer->done_cond, NULL);
+
+    // one worker per extra core, the caller is the last one
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+    if (cpus > CPU_MAX_THREADS + 1)
+        cpus = CPU_MAX_THREADS + 1;
+
+    for (long i = 0; i < cpus - 1; i++)
+    {
+        if (pthread_create(&renderer->threads[renderer->num_threads], NULL, cpuWorkerThread, renderer))
+            break;
+
+        renderer->num_threads++;
+    }
+
+    cpuBindFuncsToGLMContext(glm_ctx, renderer);
+
+    // same defaults the Metal renderer sets when binding to a view
+    mglDrawBuffer(glm_ctx, GL_FRONT);
+
+    glm_ctx->state.viewport[0] = 0;
+    glm_ctx->state.viewport[1] = 0;
+    glm_ctx->state.viewport[2] = width;
+    glm_ctx->state.viewport[3] = height;
+
+    glm_ctx->state.var.scissor_box[2] = width;
+    glm_ctx->state.var.scissor_box[3] = height;
+
+    return renderer;
+}
+
+void destroyCPURenderer(GLMContext glm_ctx)
+{
+    CPURenderer *renderer = CPU_RENDERER(glm_ctx);
+
+    RETURN_ON_NULL(renderer);
+
+    pthread_mutex_lock(&renderer->lock);
+    renderer->quit = true;
+    pthread_cond_broadcast(&renderer->work_cond);
+    pthread_mutex_unlock(&renderer->lock);
+
+    for (GLuint i = 0; i < renderer->num_threads; i++)
+    {
+        pthread_join(renderer->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&renderer->lock);
+    pthread_cond_destroy(&renderer->work_cond);
+    pthread_cond_destroy(&renderer->done_cond);
+
+    for (GLuint i = 0; i < renderer->bin_size; i++)
+    {
+        free(renderer->bins[i].list);
+    }
+
+    free(renderer->bins);
+    free(renderer->tris);
+    free(renderer->color_buffer);
+    free(renderer->depth_buffer);
+    free(renderer);
+
+    glm_ctx->mtl_funcs.mtlObj = NULL;
+}
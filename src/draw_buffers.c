@@ -23,6 +23,8 @@
 #include <mach/vm_map.h>
 
 #include "glm_context.h"
+#include "programs.h"
+#include "draw_buffers.h"
 
 bool check_draw_modes(GLenum mode)
 {
@@ -104,6 +106,12 @@ bool validate_vao(GLMContext ctx, bool uses_elements)
     if (ctx->state.vao->dirty_bits)
     {
         RETURN_FALSE_ON_FAILURE(processVAO(ctx));
+
+        // the renderer's cached vertex layouts for this vao are stale now
+        ctx->state.vao->generation++;
+        ctx->state.vao->dirty_bits = 0;
+
+        ctx->state.dirty_bits |= DIRTY_VAO;
     }
 
     unsigned int enabled_attribs;
@@ -136,6 +144,9 @@ bool validate_program(GLMContext ctx)
 {
     RETURN_FALSE_ON_NULL(ctx->state.program);
 
+    if (refreshProgramPipeline(ctx) == false)
+        return false;
+
     if (ctx->state.program->shader_slots[_GEOMETRY_SHADER])
     {
         return false;
@@ -160,6 +171,102 @@ GLsizei getTypeSize(GLenum type)
     return 0;
 }
 
+#pragma mark draw batching
+void flushDrawBatch(GLMContext ctx)
+{
+    DrawBatch *batch;
+    GLuint count;
+
+    batch = &ctx->draw_batch;
+
+    // emptied before the backend runs in case it ends up back here
+    count = batch->count;
+    batch->count = 0;
+
+    if (count == 0)
+        return;
+
+    if (count > 1)
+        batch->batches++;
+
+    if (batch->type == 0)
+    {
+        if (count == 1)
+            ctx->mtl_funcs.mtlDrawArrays(ctx, batch->mode, batch->first[0], batch->counts[0]);
+        else
+            ctx->mtl_funcs.mtlMultiDrawArrays(ctx, batch->mode, batch->first, batch->counts, count);
+    }
+    else
+    {
+        if (count == 1)
+            ctx->mtl_funcs.mtlDrawElements(ctx, batch->mode, batch->counts[0], batch->type, batch->indices[0]);
+        else
+            ctx->mtl_funcs.mtlMultiDrawElements(ctx, batch->mode, batch->counts, batch->type, batch->indices, count);
+    }
+}
+
+// vertices per primitive for the modes where two back to back ranges can be drawn as one
+static GLsizei listPrimitiveSize(GLenum mode)
+{
+    switch (mode)
+    {
+    case GL_POINTS:
+        return 1;
+    case GL_LINES:
+        return 2;
+    case GL_TRIANGLES:
+        return 3;
+    }
+
+    return 0;
+}
+
+// nothing was called since the last draw, or the batch would have been flushed, so a draw with the same mode and
+// index type sees the same state and can go out with it
+static void batchDraw(GLMContext ctx, GLenum mode, GLenum type, GLint first, GLsizei count, const void *indices)
+{
+    DrawBatch *batch;
+    GLuint last;
+    GLsizei primitive_size;
+
+    batch = &ctx->draw_batch;
+
+    if (batch->count && ((batch->mode != mode) || (batch->type != type) || (batch->count == DRAW_BATCH_SIZE)))
+        flushDrawBatch(ctx);
+
+    if (batch->count)
+    {
+        last = batch->count - 1;
+        primitive_size = listPrimitiveSize(mode);
+
+        batch->merged_draws++;
+
+        // a range that starts where the last one ended extends it, as long as that ended on a whole primitive
+        if (primitive_size && (batch->counts[last] % primitive_size) == 0)
+        {
+            if (type == 0 && first == batch->first[last] + batch->counts[last])
+            {
+                batch->counts[last] += count;
+                return;
+            }
+
+            if (type && (const GLubyte *)indices == (const GLubyte *)batch->indices[last] +
+                                                        batch->counts[last] * getTypeSize(type))
+            {
+                batch->counts[last] += count;
+                return;
+            }
+        }
+    }
+
+    batch->mode = mode;
+    batch->type = type;
+    batch->first[batch->count] = first;
+    batch->counts[batch->count] = count;
+    batch->indices[batch->count] = indices;
+    batch->count++;
+}
+
 void mglDrawArrays(GLMContext ctx, GLenum mode, GLint first, GLsizei count)
 {
     ERROR_CHECK_RETURN(check_draw_modes(mode), GL_INVALID_ENUM);
@@ -175,6 +282,12 @@ void mglDrawArrays(GLMContext ctx, GLenum mode, GLint first, GLsizei count)
 
     ERROR_CHECK_RETURN(validate_program(ctx), GL_INVALID_OPERATION);
 
+    if (ctx->draw_batching && (ctx->state.program->draw_parameters == GL_FALSE))
+    {
+        batchDraw(ctx, mode, 0, first, count, NULL);
+        return;
+    }
+
     ctx->mtl_funcs.mtlDrawArrays(ctx, mode, first, count);
 }
 
@@ -193,6 +306,12 @@ void mglDrawElements(GLMContext ctx, GLenum mode, GLsizei count, GLenum type, co
 
     ERROR_CHECK_RETURN(validate_program(ctx), GL_INVALID_OPERATION);
 
+    if (ctx->draw_batching && (ctx->state.program->draw_parameters == GL_FALSE))
+    {
+        batchDraw(ctx, mode, type, 0, count, indices);
+        return;
+    }
+
     ctx->mtl_funcs.mtlDrawElements(ctx, mode, count, type, indices);
 }
 
@@ -520,3 +639,125 @@ void mglMultiDrawElementsIndirect(GLMContext ctx, GLenum mode, GLenum type, cons
 
     ctx->mtl_funcs.mtlMultiDrawElementsIndirect(ctx, mode, type, indirect, drawcount, stride);
 }
+
+static bool check_parameter_buffer(GLMContext ctx, GLintptr drawcount)
+{
+    Buffer *ptr;
+
+    ptr = STATE(buffers[_PARAMETER_BUFFER]);
+
+    if (ptr == NULL)
+        return false;
+
+    return drawcount + sizeof(GLsizei) <= ptr->size;
+}
+
+void mglMultiDrawArraysIndirectCount(GLMContext ctx, GLenum mode, const void *indirect, GLintptr drawcount,
+                                     GLsizei maxdrawcount, GLsizei stride)
+{
+    // the backends read both buffers, none of these can fall through to them
+    if (check_draw_modes(mode) == false)
+    {
+        ERROR_RETURN(GL_INVALID_ENUM);
+        return;
+    }
+
+    if ((drawcount < 0) || (drawcount % 4 != 0))
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (maxdrawcount < 0)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (stride % 4 != 0)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (validate_vao(ctx, false) == false)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    if (validate_program(ctx) == false)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    if (STATE(buffers[_DRAW_INDIRECT_BUFFER]) == NULL || check_parameter_buffer(ctx, drawcount) == false)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    if (maxdrawcount <= 0)
+        return;
+
+    ctx->mtl_funcs.mtlMultiDrawArraysIndirectCount(ctx, mode, indirect, drawcount, maxdrawcount, stride);
+}
+
+void mglMultiDrawElementsIndirectCount(GLMContext ctx, GLenum mode, GLenum type, const void *indirect,
+                                       GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride)
+{
+    // the backends read both buffers, none of these can fall through to them
+    if (check_draw_modes(mode) == false)
+    {
+        ERROR_RETURN(GL_INVALID_ENUM);
+        return;
+    }
+
+    if ((drawcount < 0) || (drawcount % 4 != 0))
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (maxdrawcount < 0)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (stride % 4 != 0)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (check_element_type(type) == false)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (validate_vao(ctx, true) == false)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    if (validate_program(ctx) == false)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    if (STATE(buffers[_DRAW_INDIRECT_BUFFER]) == NULL || check_parameter_buffer(ctx, drawcount) == false)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    if (maxdrawcount <= 0)
+        return;
+
+    ctx->mtl_funcs.mtlMultiDrawElementsIndirectCount(ctx, mode, type, indirect, drawcount, maxdrawcount, stride);
+}
@@ -0,0 +1,25 @@
+//
+//  draw_buffers.h
+//  MGL
+//
+//  Created by Michael Larson on 1/6/25.
+//
+
+#ifndef draw_buffers_h
+#define draw_buffers_h
+
+#include "glm_context.h"
+
+// submits the draws held back by the batcher, every gl entry point other than the batched draws calls it first
+// so the state they were issued with is still current
+void flushDrawBatch(GLMContext ctx);
+
+static inline GLMContext flushDrawBatchContext(GLMContext ctx)
+{
+    if (ctx->draw_batch.count)
+        flushDrawBatch(ctx);
+
+    return ctx;
+}
+
+#endif /* draw_buffers_h */
@@ -51,13 +51,19 @@ static Renderbuffer *getRenderbuffer(GLMContext ctx, GLuint renderbuffer)
 {
     Renderbuffer *ptr;
 
-    ptr = (Renderbuffer *)searchHashTable(&STATE(renderbuffer_table), renderbuffer);
+    ptr = (Renderbuffer *)searchSlotMap(&STATE(renderbuffer_table), renderbuffer);
 
     if (!ptr)
     {
+        // a deleted name whose slot went to another object
+        if (isStaleSlotMapName(&STATE(renderbuffer_table), renderbuffer))
+        {
+            ERROR_RETURN_VALUE(GL_INVALID_OPERATION, NULL);
+        }
+
         ptr = newRenderbuffer(ctx, renderbuffer);
 
-        insertHashElement(&STATE(renderbuffer_table), renderbuffer, ptr);
+        insertSlotMapElement(&STATE(renderbuffer_table), renderbuffer, ptr);
     }
 
     return ptr;
@@ -67,7 +73,7 @@ static int isRenderBuffer(GLMContext ctx, GLuint renderbuffer)
 {
     Renderbuffer *ptr;
 
-    ptr = (Renderbuffer *)searchHashTable(&STATE(renderbuffer_table), renderbuffer);
+    ptr = (Renderbuffer *)searchSlotMap(&STATE(renderbuffer_table), renderbuffer);
 
     if (ptr)
         return 1;
@@ -79,7 +85,7 @@ Renderbuffer *findRenderbuffer(GLMContext ctx, GLuint renderbuffer)
 {
     Renderbuffer *ptr;
 
-    ptr = (Renderbuffer *)searchHashTable(&STATE(renderbuffer_table), renderbuffer);
+    ptr = (Renderbuffer *)searchSlotMap(&STATE(renderbuffer_table), renderbuffer);
 
     return ptr;
 }
@@ -122,13 +128,19 @@ static Framebuffer *getFramebuffer(GLMContext ctx, GLuint framebuffer)
 {
     Framebuffer *ptr;
 
-    ptr = (Framebuffer *)searchHashTable(&STATE(framebuffer_table), framebuffer);
+    ptr = (Framebuffer *)searchSlotMap(&STATE(framebuffer_table), framebuffer);
 
     if (!ptr)
     {
+        // a deleted name whose slot went to another object
+        if (isStaleSlotMapName(&STATE(framebuffer_table), framebuffer))
+        {
+            ERROR_RETURN_VALUE(GL_INVALID_OPERATION, NULL);
+        }
+
         ptr = newFramebuffer(ctx, framebuffer);
 
-        insertHashElement(&STATE(framebuffer_table), framebuffer, ptr);
+        insertSlotMapElement(&STATE(framebuffer_table), framebuffer, ptr);
     }
 
     return ptr;
@@ -138,7 +150,7 @@ static int isFramebuffer(GLMContext ctx, GLuint framebuffer)
 {
     Framebuffer *ptr;
 
-    ptr = (Framebuffer *)searchHashTable(&STATE(framebuffer_table), framebuffer);
+    ptr = (Framebuffer *)searchSlotMap(&STATE(framebuffer_table), framebuffer);
 
     if (ptr)
         return 1;
@@ -150,7 +162,7 @@ Framebuffer *findFrameBuffer(GLMContext ctx, GLuint framebuffer)
 {
     Framebuffer *ptr;
 
-    ptr = (Framebuffer *)searchHashTable(&STATE(framebuffer_table), framebuffer);
+    ptr = (Framebuffer *)searchSlotMap(&STATE(framebuffer_table), framebuffer);
 
     return ptr;
 }
@@ -178,6 +190,9 @@ void mglBindFramebuffer(GLMContext ctx, GLenum target, GLuint framebuffer)
     if (framebuffer)
     {
         ptr = getFramebuffer(ctx, framebuffer);
+
+        if (ptr == NULL)
+            return;
     }
     else
     {
@@ -287,7 +302,9 @@ void mglBindRenderbuffer(GLMContext ctx, GLenum target, GLuint renderbuffer)
     if (renderbuffer)
     {
         ptr = getRenderbuffer(ctx, renderbuffer);
-        assert(ptr);
+
+        if (ptr == NULL)
+            return;
     }
     else
     {
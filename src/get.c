@@ -956,6 +956,9 @@ static void mglGet(GLMContext ctx, GLenum pname, GLuint type, void *data)
     case 0x82DA:
         RET_TYPE_VAR(type, max_vertex_attrib_bindings);
         break; // GL_MAX_VERTEX_ATTRIB_BINDINGS
+    case 0x91B0:
+        RET_TYPE_VAR(type, max_shader_compiler_threads);
+        break; // GL_MAX_SHADER_COMPILER_THREADS_KHR
     }
 }
 
@@ -11,10 +11,15 @@
 #include "glcorearb.h"
 
 #include "glm_context.h"
+#include "draw_buffers.h"
 
 extern GLMContext _ctx;
 
-#define GET_CONTEXT() _ctx
+// draws held back by the batcher go out before anything else touches the context
+#define GET_CONTEXT() flushDrawBatchContext(_ctx)
+
+// only the draws that can be batched skip the flush
+#define GET_DRAW_CONTEXT() _ctx
 
 void glCullFace(GLenum mode)
 {
@@ -2165,14 +2170,14 @@ void glTranslatef(GLfloat x, GLfloat y, GLfloat z)
 
 void glDrawArrays(GLenum mode, GLint first, GLsizei count)
 {
-    GLMContext ctx = GET_CONTEXT();
+    GLMContext ctx = GET_DRAW_CONTEXT();
 
     ctx->dispatch.draw_arrays(ctx, mode, first, count);
 }
 
 void glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
 {
-    GLMContext ctx = GET_CONTEXT();
+    GLMContext ctx = GET_DRAW_CONTEXT();
 
     ctx->dispatch.draw_elements(ctx, mode, count, type, indices);
 }
@@ -7471,3 +7476,17 @@ void glPolygonOffsetClamp(GLfloat factor, GLfloat units, GLfloat clamp)
 
     ctx->dispatch.polygon_offset_clamp(ctx, factor, units, clamp);
 }
+
+void glMaxShaderCompilerThreadsKHR(GLuint count)
+{
+    GLMContext ctx = GET_CONTEXT();
+
+    ctx->dispatch.max_shader_compiler_threads(ctx, count);
+}
+
+void glMaxShaderCompilerThreadsARB(GLuint count)
+{
+    GLMContext ctx = GET_CONTEXT();
+
+    ctx->dispatch.max_shader_compiler_threads(ctx, count);
+}
@@ -27,6 +27,11 @@
 #include "vertex_arrays.h"
 #include "MGLRenderer.h"
 #include "error.h"
+#include "shader_cache.h"
+#include "programs.h"
+#include "compile_queue.h"
+#include "spirv_opt.h"
+#include "draw_buffers.h"
 
 extern void getMacOSDefaults(GLMContext glm_ctx);
 extern void init_dispatch(GLMContext ctx);
@@ -193,6 +198,21 @@ GLMContext createGLMContext(GLenum format, GLenum type, GLenum depth_format, GLe
     STATE(var.max_compute_work_group_size[1]) = 1024;
     STATE(var.max_compute_work_group_size[2]) = 256;
 
+    // program binaries hold our own translation, not what the installed GPU driver would take
+    STATE(var.num_program_binary_formats) = 1;
+    STATE(var.program_binary_formats) = MGL_PROGRAM_BINARY_FORMAT;
+
+    // ARB_gl_spirv modules are the only shader binaries
+    STATE(var.num_shader_binary_formats) = 1;
+    STATE(var.shader_binary_formats) = GL_SHADER_BINARY_FORMAT_SPIR_V;
+
+    // KHR_parallel_shader_compile starts out at the implementation's limit, one worker per core
+    STATE(var.max_shader_compiler_threads) = 0xFFFFFFFF;
+
+    ctx->spirv_optimizer = defaultSPIRVOptimizer();
+
+    ctx->draw_batching = GL_TRUE;
+
     for (int attachment = 0; attachment < MAX_COLOR_ATTACHMENTS; attachment++)
     {
         STATE(caps.use_color_mask[attachment]) = false;
@@ -207,23 +227,22 @@ GLMContext createGLMContext(GLenum format, GLenum type, GLenum depth_format, GLe
 
     STATE(dirty_bits) = DIRTY_ALL;
 
-    const int hash_table_size = 128;
-    initHashTable(&STATE(vao_table), hash_table_size);
-    initHashTable(&STATE(buffer_table), hash_table_size);
-    initHashTable(&STATE(texture_table), hash_table_size);
-    initHashTable(&STATE(shader_table), hash_table_size);
-    initHashTable(&STATE(program_table), hash_table_size);
-    initHashTable(&STATE(renderbuffer_table), hash_table_size);
-    initHashTable(&STATE(framebuffer_table), hash_table_size);
-    initHashTable(&STATE(sampler_table), hash_table_size);
+    const int slot_map_size = 128;
+    initSlotMap(&STATE(vao_table), slot_map_size);
+    initSlotMap(&STATE(buffer_table), slot_map_size);
+    initSlotMap(&STATE(texture_table), slot_map_size);
+    initSlotMap(&STATE(shader_table), slot_map_size);
+    initSlotMap(&STATE(program_table), slot_map_size);
+    initSlotMap(&STATE(renderbuffer_table), slot_map_size);
+    initSlotMap(&STATE(framebuffer_table), slot_map_size);
+    initSlotMap(&STATE(sampler_table), slot_map_size);
+    initSlotMap(&STATE(program_pipeline_table), slot_map_size);
 
     init_dispatch(ctx);
 
     ctx->assert_on_error = GL_TRUE;
     ctx->error_func = error_func;
 
-    ctx->temp_element_buffer = NULL;
-
     err = glslang_initialize_process();
     assert(err);
 
@@ -234,6 +253,10 @@ GLMContext createGLMContext(GLenum format, GLenum type, GLenum depth_format, GLe
 
 void MGLsetCurrentContext(GLMContext ctx)
 {
+    // the old context's held back draws belong to it
+    if (_ctx && _ctx != ctx)
+        flushDrawBatch(_ctx);
+
     _ctx = ctx;
 }
 
@@ -250,6 +273,9 @@ void MGLget(GLMContext ctx, GLenum param, GLuint *data)
     if (ctx == NULL)
         return;
 
+    // the counters should include draws still held back
+    flushDrawBatch(ctx);
+
     switch (param)
     {
     case MGL_PIXEL_FORMAT:
@@ -273,6 +299,106 @@ void MGLget(GLMContext ctx, GLenum param, GLuint *data)
     case MGL_CONTEXT_FLAGS:
         *data = ctx->context_flags;
         break;
+    case MGL_PENDING_RELEASES:
+        *data = ctx->stats.pending_releases;
+        break;
+    case MGL_PIPELINE_CACHE_HITS:
+        *data = ctx->stats.pipeline_cache_hits;
+        break;
+    case MGL_PIPELINE_CACHE_MISSES:
+        *data = ctx->stats.pipeline_cache_misses;
+        break;
+    case MGL_PIPELINE_CACHE_EVICTIONS:
+        *data = ctx->stats.pipeline_cache_evictions;
+        break;
+    case MGL_RENDER_PASSES:
+        *data = ctx->stats.render_passes;
+        break;
+    case MGL_UNIFORM_UPLOADS:
+        *data = ctx->stats.uniform_uploads;
+        break;
+    case MGL_DIRTY_BYTES:
+        *data = ctx->stats.dirty_bytes;
+        break;
+    case MGL_BUFFER_RENAMES:
+        *data = ctx->stats.buffer_renames;
+        break;
+    case MGL_BUFFER_RENAME_ALLOCATIONS:
+        *data = ctx->stats.buffer_rename_allocations;
+        break;
+    case MGL_BLIT_ENCODERS:
+        *data = ctx->stats.blit_encoders;
+        break;
+    case MGL_SHADER_CACHE_HITS:
+        *data = ctx->stats.shader_cache_hits;
+        break;
+    case MGL_SHADER_CACHE_MISSES:
+        *data = ctx->stats.shader_cache_misses;
+        break;
+    case MGL_SPIRV_OPTIMIZER:
+        *data = ctx->spirv_optimizer;
+        break;
+    case MGL_SPIRV_INSTRUCTIONS_IN:
+        *data = ctx->stats.spirv_instructions_in;
+        break;
+    case MGL_SPIRV_INSTRUCTIONS_OUT:
+        *data = ctx->stats.spirv_instructions_out;
+        break;
+    case MGL_INDEX_UPLOADS:
+        *data = ctx->stats.index_uploads;
+        break;
+    case MGL_UPLOAD_RING_ALLOCATIONS:
+        *data = ctx->stats.upload_ring_allocations;
+        break;
+    case MGL_VERTEX_LAYOUT_HITS:
+        *data = ctx->stats.vertex_layout_hits;
+        break;
+    case MGL_VERTEX_LAYOUT_MISSES:
+        *data = ctx->stats.vertex_layout_misses;
+        break;
+    case MGL_DRAW_BATCHING:
+        *data = ctx->draw_batching;
+        break;
+    case MGL_MERGED_DRAWS:
+        *data = ctx->stats.merged_draws;
+        break;
+    case MGL_DRAW_BATCHES:
+        *data = ctx->stats.draw_batches;
+        break;
+    case MGL_GENERATED_INDEX_HITS:
+        *data = ctx->stats.generated_index_hits;
+        break;
+    case MGL_GENERATED_INDEX_MISSES:
+        *data = ctx->stats.generated_index_misses;
+        break;
+    default:
+        assert(0);
+    }
+}
+
+void MGLset(GLMContext ctx, GLenum param, GLuint data)
+{
+    if (ctx == NULL)
+        ctx = _ctx;
+
+    if (ctx == NULL)
+        return;
+
+    switch (param)
+    {
+    case MGL_SPIRV_OPTIMIZER:
+        assert(data <= MGL_SPIRV_OPTIMIZE_PERFORMANCE);
+
+        // links already queued finish with the recipe they were queued with
+        finishCompileQueue(ctx);
+
+        ctx->spirv_optimizer = data;
+        break;
+    case MGL_DRAW_BATCHING:
+        flushDrawBatch(ctx);
+
+        ctx->draw_batching = data ? GL_TRUE : GL_FALSE;
+        break;
     default:
         assert(0);
     }
@@ -286,5 +412,15 @@ void MGLswapBuffers(GLMContext ctx)
     if (ctx == NULL)
         return;
 
+    flushDrawBatch(ctx);
+
+    ctx->stats.merged_draws = ctx->draw_batch.merged_draws;
+    ctx->stats.draw_batches = ctx->draw_batch.batches;
+    ctx->draw_batch.merged_draws = 0;
+    ctx->draw_batch.batches = 0;
+
     ctx->mtl_funcs.mtlSwapBuffers(ctx);
+
+    // translations added while loading get written out once the app starts presenting
+    flushShaderCache(false);
 }
@@ -1065,4 +1065,5 @@ void init_dispatch(GLMContext ctx)
     ctx->dispatch.multi_draw_arrays_indirect_count = mglMultiDrawArraysIndirectCount;
     ctx->dispatch.multi_draw_elements_indirect_count = mglMultiDrawElementsIndirectCount;
     ctx->dispatch.polygon_offset_clamp = mglPolygonOffsetClamp;
+    ctx->dispatch.max_shader_compiler_threads = mglMaxShaderCompilerThreadsKHR;
 };
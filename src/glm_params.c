@@ -24,11 +24,13 @@
 #include "glm_context.h"
 
 #include <unistd.h>
-#include <dlfcn.h>
-#include <OpenGL/OpenGL.h>
 
 typedef struct GLMContextRec_t *GLMContext;
 
+#ifdef __APPLE__
+#include <dlfcn.h>
+#include <OpenGL/OpenGL.h>
+
 void getMacOSDefaults(GLMContext glm_ctx)
 {
     void *OpenGL, *libGL;
@@ -327,3 +329,80 @@ void getMacOSDefaults(GLMContext glm_ctx)
     dlclose(OpenGL);
     dlclose(libGL);
 }
+#else
+// no CGL off apple, use the limits the macOS 4.1 core driver reports, 4.3+ limits stay 0 like they do there
+void getMacOSDefaults(GLMContext glm_ctx)
+{
+    glm_ctx->state.var.point_size = 1.0f;
+    glm_ctx->state.var.line_width = 1.0f;
+    glm_ctx->state.var.polygon_mode = GL_FILL;
+    glm_ctx->state.var.cull_face_mode = GL_BACK;
+    glm_ctx->state.var.front_face = GL_CCW;
+    glm_ctx->state.var.depth_range[0] = 0.0;
+    glm_ctx->state.var.depth_range[1] = 1.0;
+    glm_ctx->state.var.depth_writemask = GL_TRUE;
+    glm_ctx->state.var.depth_clear_value = 1.0;
+    glm_ctx->state.var.depth_func = GL_LESS;
+    glm_ctx->state.var.stencil_value_mask = 0xFFFFFFFF;
+    glm_ctx->state.var.stencil_back_value_mask = 0xFFFFFFFF;
+    glm_ctx->state.var.logic_op_mode = GL_COPY;
+    glm_ctx->state.var.provoking_vertex = GL_LAST_VERTEX_CONVENTION;
+    glm_ctx->state.var.subpixel_bits = 8;
+
+    glm_ctx->state.var.max_texture_size = 16384;
+    glm_ctx->state.var.max_viewport_dims = 16384;
+    glm_ctx->state.var.max_3d_texture_size = 2048;
+    glm_ctx->state.var.max_cube_map_texture_size = 16384;
+    glm_ctx->state.var.max_rectangle_texture_size = 16384;
+    glm_ctx->state.var.max_renderbuffer_size = 16384;
+    glm_ctx->state.var.max_array_texture_layers = 2048;
+    glm_ctx->state.var.max_texture_buffer_size = 268435456;
+    glm_ctx->state.var.max_texture_lod_bias = 16;
+    glm_ctx->state.var.max_elements_vertices = 1048575;
+    glm_ctx->state.var.max_elements_indices = 150000;
+
+    glm_ctx->state.var.max_draw_buffers = 8;
+    glm_ctx->state.max_color_attachments = 8;
+    glm_ctx->state.max_vertex_attribs = 16;
+    glm_ctx->state.var.max_texture_image_units = 16;
+    glm_ctx->state.var.max_vertex_texture_image_units = 16;
+    glm_ctx->state.var.max_geometry_texture_image_units = 16;
+    glm_ctx->state.var.max_combined_texture_image_units = 80;
+    glm_ctx->state.var.max_clip_distances = 8;
+    glm_ctx->state.var.max_viewports = 16;
+
+    glm_ctx->state.var.max_vertex_uniform_components = 4096;
+    glm_ctx->state.var.max_fragment_uniform_components = 4096;
+    glm_ctx->state.var.max_geometry_uniform_components = 4096;
+    glm_ctx->state.var.max_vertex_uniform_vectors = 1024;
+    glm_ctx->state.var.max_fragment_uniform_vectors = 1024;
+    glm_ctx->state.var.max_varying_floats = 124;
+    glm_ctx->state.var.max_varying_components = 124;
+    glm_ctx->state.var.max_varying_vectors = 31;
+    glm_ctx->state.var.max_vertex_output_components = 128;
+    glm_ctx->state.var.max_geometry_input_components = 128;
+    glm_ctx->state.var.max_geometry_output_components = 128;
+    glm_ctx->state.var.max_fragment_input_components = 128;
+    glm_ctx->state.var.min_program_texel_offset = -8;
+    glm_ctx->state.var.max_program_texel_offset = 7;
+
+    glm_ctx->state.var.max_vertex_uniform_blocks = 14;
+    glm_ctx->state.var.max_geometry_uniform_blocks = 14;
+    glm_ctx->state.var.max_fragment_uniform_blocks = 14;
+    glm_ctx->state.var.max_combined_uniform_blocks = 70;
+    glm_ctx->state.var.max_uniform_buffer_bindings = 70;
+    glm_ctx->state.var.max_uniform_block_size = 65536;
+    glm_ctx->state.var.uniform_buffer_offset_alignment = 256;
+
+    glm_ctx->state.var.max_sample_mask_words = 1;
+    glm_ctx->state.var.max_color_texture_samples = 4;
+    glm_ctx->state.var.max_depth_texture_samples = 4;
+    glm_ctx->state.var.max_integer_samples = 4;
+    glm_ctx->state.var.max_dual_source_draw_buffers = 1;
+
+    glm_ctx->state.var.major_version = 4;
+    glm_ctx->state.var.minor_version = 6;
+    glm_ctx->state.var.num_extensions = 0;
+    glm_ctx->state.var.context_profile_mask = GL_CONTEXT_CORE_PROFILE_BIT;
+}
+#endif
@@ -0,0 +1,566 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * index_gen.c
+ * MGL
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "index_gen.h"
+#include "buffers.h"
+
+// four indices per store, clang and gcc both keep these in one vector register
+typedef GLuint IndexVec __attribute__((vector_size(16)));
+
+static inline void storeIndexVec(GLuint *dst, IndexVec v)
+{
+    memcpy(dst, &v, sizeof(v));
+}
+
+static GLuint indexTypeSize(GLenum type)
+{
+    switch (type)
+    {
+    case GL_UNSIGNED_BYTE:
+        return sizeof(GLubyte);
+    case GL_UNSIGNED_SHORT:
+        return sizeof(GLushort);
+    }
+
+    return sizeof(GLuint);
+}
+
+static bool getRestartIndex(GLMContext ctx, GLenum type, GLuint *restart)
+{
+    if (type == 0)
+        return false;
+
+    if (STATE(caps.primitive_restart_fixed_index))
+    {
+        *restart = 0xFFFFFFFF >> (32 - 8 * indexTypeSize(type));
+        return true;
+    }
+
+    if (STATE(caps.primitive_restart))
+    {
+        *restart = STATE(var.primitive_restart_index);
+        return true;
+    }
+
+    return false;
+}
+
+bool needsGeneratedIndices(GLMContext ctx, GLenum mode, GLenum type)
+{
+    GLuint restart;
+
+    switch (mode)
+    {
+    case GL_LINE_LOOP:
+    case GL_TRIANGLE_FAN:
+    case GL_QUADS:
+        return true;
+
+    case GL_POINTS:
+    case GL_LINES:
+    case GL_TRIANGLES:
+        // metal only restarts strips, in a list the restart index would be drawn as a vertex
+        return getRestartIndex(ctx, type, &restart);
+
+    case GL_LINE_STRIP:
+    case GL_TRIANGLE_STRIP:
+        // and only on all ones
+        if (getRestartIndex(ctx, type, &restart) == false)
+            return false;
+
+        return restart != (0xFFFFFFFF >> (32 - 8 * indexTypeSize(type)));
+    }
+
+    return false;
+}
+
+static GLenum generatedMode(GLenum mode)
+{
+    switch (mode)
+    {
+    case GL_POINTS:
+        return GL_POINTS;
+
+    case GL_LINES:
+    case GL_LINE_STRIP:
+    case GL_LINE_LOOP:
+        return GL_LINES;
+    }
+
+    return GL_TRIANGLES;
+}
+
+// for count source vertices, splitting them up with restarts only ever makes it smaller
+static size_t maxGeneratedCount(GLenum mode, GLsizei count)
+{
+    switch (mode)
+    {
+    case GL_POINTS:
+    case GL_LINES:
+    case GL_TRIANGLES:
+        return count;
+
+    case GL_LINE_STRIP:
+    case GL_LINE_LOOP:
+        return 2 * (size_t)count;
+
+    case GL_QUADS:
+        return (size_t)count / 4 * 6;
+    }
+
+    // strips and fans
+    return 3 * (size_t)count;
+}
+
+#pragma mark arrays
+// (first, first + i + 1, first + i + 2), four triangles a step
+static GLuint *generateArrayFan(GLuint *dst, GLuint first, GLsizei count)
+{
+    const IndexVec step0 = {0, 4, 4, 0};
+    const IndexVec step1 = {4, 4, 0, 4};
+    const IndexVec step2 = {4, 0, 4, 4};
+    IndexVec v0 = {first, first + 1, first + 2, first};
+    IndexVec v1 = {first + 2, first + 3, first, first + 3};
+    IndexVec v2 = {first + 4, first, first + 4, first + 5};
+    GLsizei triangles, i;
+
+    if (count < 3)
+        return dst;
+
+    triangles = count - 2;
+
+    for (i = 0; i + 4 <= triangles; i += 4)
+    {
+        storeIndexVec(dst, v0);
+        storeIndexVec(dst + 4, v1);
+        storeIndexVec(dst + 8, v2);
+        dst += 12;
+
+        v0 += step0;
+        v1 += step1;
+        v2 += step2;
+    }
+
+    for (; i < triangles; i++)
+    {
+        *dst++ = first;
+        *dst++ = first + i + 1;
+        *dst++ = first + i + 2;
+    }
+
+    return dst;
+}
+
+// (first + i, first + i + 1) two lines a step, then the one closing the loop
+static GLuint *generateArrayLoop(GLuint *dst, GLuint first, GLsizei count)
+{
+    const IndexVec step = {2, 2, 2, 2};
+    IndexVec v = {first, first + 1, first + 1, first + 2};
+    GLsizei lines, i;
+
+    if (count < 2)
+        return dst;
+
+    lines = count - 1;
+
+    for (i = 0; i + 2 <= lines; i += 2)
+    {
+        storeIndexVec(dst, v);
+        dst += 4;
+
+        v += step;
+    }
+
+    for (; i < lines; i++)
+    {
+        *dst++ = first + i;
+        *dst++ = first + i + 1;
+    }
+
+    *dst++ = first + count - 1;
+    *dst++ = first;
+
+    return dst;
+}
+
+// (b, b + 1, b + 2, b, b + 2, b + 3) for b = first + 4 * quad, two quads a step
+static GLuint *generateArrayQuads(GLuint *dst, GLuint first, GLsizei count)
+{
+    const IndexVec step = {8, 8, 8, 8};
+    IndexVec v0 = {first, first + 1, first + 2, first};
+    IndexVec v1 = {first + 2, first + 3, first + 4, first + 5};
+    IndexVec v2 = {first + 6, first + 4, first + 6, first + 7};
+    GLsizei quads, i;
+
+    quads = count / 4;
+
+    for (i = 0; i + 2 <= quads; i += 2)
+    {
+        storeIndexVec(dst, v0);
+        storeIndexVec(dst + 4, v1);
+        storeIndexVec(dst + 8, v2);
+        dst += 12;
+
+        v0 += step;
+        v1 += step;
+        v2 += step;
+    }
+
+    for (; i < quads; i++)
+    {
+        GLuint base = first + 4 * i;
+
+        *dst++ = base;
+        *dst++ = base + 1;
+        *dst++ = base + 2;
+        *dst++ = base;
+        *dst++ = base + 2;
+        *dst++ = base + 3;
+    }
+
+    return dst;
+}
+
+#pragma mark elements
+static inline GLuint readIndex(const GLubyte *src, GLenum type, GLsizei i)
+{
+    switch (type)
+    {
+    case GL_UNSIGNED_BYTE:
+        return src[i];
+    case GL_UNSIGNED_SHORT:
+        return ((const GLushort *)src)[i];
+    }
+
+    return ((const GLuint *)src)[i];
+}
+
+// one run of source indices between restarts
+static GLuint *assembleRun(GLuint *dst, GLenum mode, const GLubyte *src, GLenum type, GLsizei start, GLsizei n)
+{
+#define IDX(_i_) readIndex(src, type, start + (_i_))
+    GLsizei i;
+
+    switch (mode)
+    {
+    case GL_POINTS:
+        for (i = 0; i < n; i++)
+            *dst++ = IDX(i);
+        break;
+
+    case GL_LINES:
+        for (i = 0; i + 1 < n; i += 2)
+        {
+            *dst++ = IDX(i);
+            *dst++ = IDX(i + 1);
+        }
+        break;
+
+    case GL_LINE_STRIP:
+    case GL_LINE_LOOP:
+        for (i = 0; i + 1 < n; i++)
+        {
+            *dst++ = IDX(i);
+            *dst++ = IDX(i + 1);
+        }
+
+        if (mode == GL_LINE_LOOP && n >= 2)
+        {
+            *dst++ = IDX(n - 1);
+            *dst++ = IDX(0);
+        }
+        break;
+
+    case GL_TRIANGLES:
+        for (i = 0; i + 2 < n; i += 3)
+        {
+            *dst++ = IDX(i);
+            *dst++ = IDX(i + 1);
+            *dst++ = IDX(i + 2);
+        }
+        break;
+
+    case GL_TRIANGLE_STRIP:
+        // odd triangles swap their first two to keep the winding
+        for (i = 0; i + 2 < n; i++)
+        {
+            *dst++ = IDX(i + (i & 0x1));
+            *dst++ = IDX(i + 1 - (i & 0x1));
+            *dst++ = IDX(i + 2);
+        }
+        break;
+
+    case GL_TRIANGLE_FAN:
+        for (i = 1; i + 1 < n; i++)
+        {
+            *dst++ = IDX(0);
+            *dst++ = IDX(i);
+            *dst++ = IDX(i + 1);
+        }
+        break;
+
+    case GL_QUADS:
+        for (i = 0; i + 3 < n; i += 4)
+        {
+            *dst++ = IDX(i);
+            *dst++ = IDX(i + 1);
+            *dst++ = IDX(i + 2);
+            *dst++ = IDX(i);
+            *dst++ = IDX(i + 2);
+            *dst++ = IDX(i + 3);
+        }
+        break;
+    }
+#undef IDX
+
+    return dst;
+}
+
+static GLuint *generateElements(GLuint *dst, const GeneratedIndices *entry, const GLubyte *src)
+{
+    GLsizei start;
+
+    start = 0;
+
+    if (entry->restart_on)
+    {
+        for (GLsizei i = 0; i < entry->count; i++)
+        {
+            if (readIndex(src, entry->type, i) != entry->restart)
+                continue;
+
+            dst = assembleRun(dst, entry->mode, src, entry->type, start, i - start);
+            start = i + 1;
+        }
+    }
+
+    return assembleRun(dst, entry->mode, src, entry->type, start, entry->count - start);
+}
+
+#pragma mark cache
+static void releaseGeneratedIndices(GLMContext ctx, GeneratedIndices *entry)
+{
+    if (entry->data == NULL)
+        return;
+
+    ctx->generated_indices.bytes -= entry->out_count * sizeof(GLuint);
+
+    if (entry->mtl_data)
+        ctx->mtl_funcs.mtlDeleteMTLObj(ctx, entry->mtl_data);
+
+    free(entry->data);
+
+    bzero(entry, sizeof(GeneratedIndices));
+}
+
+static bool matchGeneratedIndices(const GeneratedIndices *entry, const GeneratedIndices *key)
+{
+    return entry->mode == key->mode && entry->first == key->first && entry->count == key->count &&
+           entry->type == key->type && entry->buffer == key->buffer && entry->generation == key->generation &&
+           entry->restart_on == key->restart_on && entry->restart == key->restart;
+}
+
+static bool generateIndices(GeneratedIndices *entry, const GLubyte *src)
+{
+    GLuint *data, *dst;
+
+    // room for at least one so an empty result still marks the entry as used
+    data = (GLuint *)malloc((maxGeneratedCount(entry->mode, entry->count) + 1) * sizeof(GLuint));
+    if (data == NULL)
+        return false;
+
+    if (entry->type)
+    {
+        dst = generateElements(data, entry, src);
+    }
+    else
+    {
+        switch (entry->mode)
+        {
+        case GL_TRIANGLE_FAN:
+            dst = generateArrayFan(data, entry->first, entry->count);
+            break;
+        case GL_LINE_LOOP:
+            dst = generateArrayLoop(data, entry->first, entry->count);
+            break;
+        case GL_QUADS:
+            dst = generateArrayQuads(data, entry->first, entry->count);
+            break;
+        default:
+            dst = data;
+            break;
+        }
+    }
+
+    entry->out_mode = generatedMode(entry->mode);
+    entry->out_count = (GLsizei)(dst - data);
+    entry->data = data;
+
+    return true;
+}
+
+GeneratedIndices *getGeneratedIndices(GLMContext ctx, GLenum mode, GLint first, GLsizei count, GLenum type,
+                                      const void *indices)
+{
+    GeneratedIndexCache *cache;
+    GeneratedIndices key, *entry, *empty, *lru;
+    Buffer *elements;
+    const GLubyte *src;
+    bool persistent;
+
+    cache = &ctx->generated_indices;
+
+    bzero(&key, sizeof(key));
+    key.mode = mode;
+    key.first = first;
+    key.count = count;
+    key.type = type;
+
+    elements = NULL;
+    src = NULL;
+    persistent = false;
+
+    if (type)
+    {
+        Buffer *buf;
+
+        buf = VAO_STATE(element_array.buffer);
+        elements = buf;
+        if (buf == NULL || buf->data.buffer_data == 0)
+            return NULL;
+
+        if ((uintptr_t)indices + (size_t)count * indexTypeSize(type) > (size_t)buf->size)
+            return NULL;
+
+        key.first = (GLint)(uintptr_t)indices;
+        key.buffer = buf->name;
+        key.generation = buf->data.generation;
+        key.restart_on = getRestartIndex(ctx, type, &key.restart);
+
+        src = (const GLubyte *)buf->data.buffer_data + (uintptr_t)indices;
+
+        // a persistent mapping is written behind our back, the generation can't be trusted
+        persistent = (buf->storage_flags & GL_MAP_PERSISTENT_BIT) != 0;
+    }
+
+    cache->clock++;
+
+    empty = NULL;
+    lru = NULL;
+    entry = NULL;
+
+    for (int i = 0; i < GENERATED_INDEX_CACHE_SIZE; i++)
+    {
+        GeneratedIndices *ptr;
+
+        ptr = &cache->entries[i];
+
+        if (ptr->data == NULL)
+        {
+            if (empty == NULL)
+                empty = ptr;
+
+            continue;
+        }
+
+        if (matchGeneratedIndices(ptr, &key))
+        {
+            if (persistent == false)
+            {
+                ptr->last_used = cache->clock;
+                ctx->stats.generated_index_hits++;
+
+                return ptr;
+            }
+
+            entry = ptr;
+            break;
+        }
+
+        if (lru == NULL || ptr->last_used < lru->last_used)
+            lru = ptr;
+    }
+
+    if (entry == NULL)
+        entry = empty ? empty : lru;
+
+    releaseGeneratedIndices(ctx, entry);
+
+    *entry = key;
+
+    // a queued copy or shader write to the element buffer has to land before the indices are read
+    if (elements)
+        waitForBufferGPUWrites(ctx, elements);
+
+    if (generateIndices(entry, src) == false)
+    {
+        bzero(entry, sizeof(GeneratedIndices));
+        return NULL;
+    }
+
+    entry->last_used = cache->clock;
+
+    cache->bytes += entry->out_count * sizeof(GLuint);
+    ctx->stats.generated_index_misses++;
+
+    // stay under the byte budget too, the entry just made is needed for the draw even if it's over on its own
+    while (cache->bytes > GENERATED_INDEX_CACHE_BYTES)
+    {
+        lru = NULL;
+
+        for (int i = 0; i < GENERATED_INDEX_CACHE_SIZE; i++)
+        {
+            GeneratedIndices *ptr;
+
+            ptr = &cache->entries[i];
+
+            if (ptr == entry || ptr->data == NULL)
+                continue;
+
+            if (lru == NULL || ptr->last_used < lru->last_used)
+                lru = ptr;
+        }
+
+        if (lru == NULL)
+            break;
+
+        releaseGeneratedIndices(ctx, lru);
+    }
+
+    return entry;
+}
+
+void invalidateGeneratedIndices(GLMContext ctx, GLuint buffer)
+{
+    for (int i = 0; i < GENERATED_INDEX_CACHE_SIZE; i++)
+    {
+        GeneratedIndices *ptr;
+
+        ptr = &ctx->generated_indices.entries[i];
+
+        if (ptr->data && ptr->type && ptr->buffer == buffer)
+            releaseGeneratedIndices(ctx, ptr);
+    }
+}
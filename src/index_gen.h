@@ -0,0 +1,25 @@
+//
+//  index_gen.h
+//  MGL
+//
+//  Created by Michael Larson on 1/6/25.
+//
+
+#ifndef index_gen_h
+#define index_gen_h
+
+#include "glcorearb.h"
+#include "glm_context.h"
+
+// fans, loops and quads, and restarts metal won't do, have to be drawn from generated triangle / line lists
+bool needsGeneratedIndices(GLMContext ctx, GLenum mode, GLenum type);
+
+// arrays pass a zero type and use first, elements read the bound element buffer at indices
+// the result stays owned by the cache, it's good until the next call
+GeneratedIndices *getGeneratedIndices(GLMContext ctx, GLenum mode, GLint first, GLsizei count, GLenum type,
+                                      const void *indices);
+
+// a deleted buffer's name can come back with a new generation count
+void invalidateGeneratedIndices(GLMContext ctx, GLuint buffer);
+
+#endif /* index_gen_h */
@@ -9,11 +9,6 @@
 #include <assert.h>
 
 #include "mgl.h"
-void mglActiveShaderProgram(GLMContext ctx, GLuint pipeline, GLuint program)
-{
-    assert(0);
-}
-
 void mglBeginConditionalRender(GLMContext ctx, GLuint id, GLenum mode)
 {
     assert(0);
@@ -102,11 +97,6 @@ void mglCopyImageSubData(GLMContext ctx, GLuint srcName, GLenum srcTarget, GLint
     assert(0);
 }
 
-void mglCreateProgramPipelines(GLMContext ctx, GLsizei n, GLuint *pipelines)
-{
-    assert(0);
-}
-
 void mglCreateQueries(GLMContext ctx, GLenum target, GLsizei n, GLuint *ids)
 {
     assert(0);
@@ -294,37 +284,11 @@ void mglGetObjectPtrLabel(GLMContext ctx, const void *ptr, GLsizei bufSize, GLsi
     assert(0);
 }
 
-void mglGetProgramBinary(GLMContext ctx, GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat,
-                         void *binary)
-{
-    assert(0);
-}
-
 void mglGetProgramInterfaceiv(GLMContext ctx, GLuint program, GLenum programInterface, GLenum pname, GLint *params)
 {
     assert(0);
 }
 
-void mglGetProgramPipelineInfoLog(GLMContext ctx, GLuint pipeline, GLsizei bufSize, GLsizei *length, GLchar *infoLog)
-{
-    assert(0);
-}
-
-void mglGetProgramPipelineiv(GLMContext ctx, GLuint pipeline, GLenum pname, GLint *params)
-{
-    assert(0);
-}
-
-GLuint mglGetProgramResourceIndex(GLMContext ctx, GLuint program, GLenum programInterface, const GLchar *name)
-{
-    assert(0);
-}
-
-GLint mglGetProgramResourceLocation(GLMContext ctx, GLuint program, GLenum programInterface, const GLchar *name)
-{
-    assert(0);
-}
-
 GLint mglGetProgramResourceLocationIndex(GLMContext ctx, GLuint program, GLenum programInterface, const GLchar *name)
 {
     assert(0);
@@ -534,18 +498,6 @@ void mglMinSampleShading(GLMContext ctx, GLfloat value)
     assert(0);
 }
 
-void mglMultiDrawArraysIndirectCount(GLMContext ctx, GLenum mode, const void *indirect, GLintptr drawcount,
-                                     GLsizei maxdrawcount, GLsizei stride)
-{
-    assert(0);
-}
-
-void mglMultiDrawElementsIndirectCount(GLMContext ctx, GLenum mode, GLenum type, const void *indirect,
-                                       GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride)
-{
-    assert(0);
-}
-
 void mglNormalP3ui(GLMContext ctx, GLenum type, GLuint coords)
 {
     assert(0);
@@ -596,16 +548,6 @@ void mglPrimitiveRestartIndex(GLMContext ctx, GLuint index)
     assert(0);
 }
 
-void mglProgramBinary(GLMContext ctx, GLuint program, GLenum binaryFormat, const void *binary, GLsizei length)
-{
-    assert(0);
-}
-
-void mglProgramParameteri(GLMContext ctx, GLuint program, GLenum pname, GLint value)
-{
-    assert(0);
-}
-
 void mglProgramUniform1d(GLMContext ctx, GLuint program, GLint location, GLdouble v0)
 {
     assert(0);
@@ -936,23 +878,11 @@ void mglSecondaryColorP3uiv(GLMContext ctx, GLenum type, const GLuint *color)
     assert(0);
 }
 
-void mglShaderBinary(GLMContext ctx, GLsizei count, const GLuint *shaders, GLenum binaryFormat, const void *binary,
-                     GLsizei length)
-{
-    assert(0);
-}
-
 void mglShaderStorageBlockBinding(GLMContext ctx, GLuint program, GLuint storageBlockIndex, GLuint storageBlockBinding)
 {
     assert(0);
 }
 
-void mglSpecializeShader(GLMContext ctx, GLuint shader, const GLchar *pEntryPoint, GLuint numSpecializationConstants,
-                         const GLuint *pConstantIndex, const GLuint *pConstantValue)
-{
-    assert(0);
-}
-
 void mglTexBuffer(GLMContext ctx, GLenum target, GLenum internalformat, GLuint buffer)
 {
     assert(0);
@@ -1003,11 +933,6 @@ void mglValidateProgram(GLMContext ctx, GLuint program)
     assert(0);
 }
 
-void mglValidateProgramPipeline(GLMContext ctx, GLuint pipeline)
-{
-    assert(0);
-}
-
 void mglVertexAttrib1d(GLMContext ctx, GLuint index, GLdouble x)
 {
     assert(0);
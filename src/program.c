@@ -20,6 +20,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 #include <glslang/Include/glslang_c_interface.h>
 #include <glslang/Include/glslang_c_shader_types.h>
 #include "spirv-tools/libspirv.h"
@@ -29,6 +30,21 @@
 #include "glm_context.h"
 #include "shaders.h"
 #include "buffers.h"
+#include "shader_cache.h"
+#include "compile_queue.h"
+#include "spirv_opt.h"
+#include "shader_stats.h"
+#include "programs.h"
+
+// spirv-cross msl settings, these are part of the shader cache key
+#define MSL_VERSION SPVC_MAKE_MSL_VERSION(3, 1, 0)
+#define MSL_ARGUMENT_BUFFERS SPVC_FALSE
+#define MSL_DISCRETE_DESCRIPTOR_SET 3
+
+void initGLSLInput(GLMContext ctx, GLuint type, const char *src, glslang_input_t *input);
+static void freeProgramBinaryShader(GLMContext ctx, Shader *ptr);
+static Shader **attachedShaders(Program *ptr);
+static void restoreAttachedShaders(GLMContext ctx, Program *ptr);
 
 Program *newProgram(GLMContext ctx, GLuint program)
 {
@@ -48,13 +64,19 @@ Program *getProgram(GLMContext ctx, GLuint program)
 {
     Program *ptr;
 
-    ptr = (Program *)searchHashTable(&STATE(program_table), program);
+    ptr = (Program *)searchSlotMap(&STATE(program_table), program);
 
     if (!ptr)
     {
+        // a deleted name whose slot went to another object
+        if (isStaleSlotMapName(&STATE(program_table), program))
+        {
+            ERROR_RETURN_VALUE(GL_INVALID_OPERATION, NULL);
+        }
+
         ptr = newProgram(ctx, program);
 
-        insertHashElement(&STATE(program_table), program, ptr);
+        insertSlotMapElement(&STATE(program_table), program, ptr);
     }
 
     return ptr;
@@ -64,7 +86,7 @@ int isProgram(GLMContext ctx, GLuint program)
 {
     Program *ptr;
 
-    ptr = (Program *)searchHashTable(&STATE(program_table), program);
+    ptr = (Program *)searchSlotMap(&STATE(program_table), program);
 
     if (ptr)
         return 1;
@@ -76,7 +98,7 @@ Program *findProgram(GLMContext ctx, GLuint program)
 {
     Program *ptr;
 
-    ptr = (Program *)searchHashTable(&STATE(program_table), program);
+    ptr = (Program *)searchSlotMap(&STATE(program_table), program);
 
     return ptr;
 }
@@ -92,35 +114,70 @@ GLuint mglCreateProgram(GLMContext ctx)
     return program;
 }
 
-void mglDeleteProgram(GLMContext ctx, GLuint program)
+static void destroyProgram(GLMContext ctx, Program *ptr)
 {
-    Program *ptr;
-
-    ptr = findProgram(ctx, program);
+    deleteSlotMapElement(&STATE(program_table), ptr->name);
 
-    if (!ptr)
+    if (ptr->mtl_data)
     {
-        assert(0);
-
-        return;
+        ctx->mtl_funcs.mtlDeleteMTLObj(ctx, ptr->mtl_data);
     }
 
-    deleteHashElement(&STATE(program_table), program);
+    free(ptr->uniform_constants.data);
+    freeProgramResourceIndex(ptr);
+    freeProgramReflection(ptr);
 
-    if (ptr->linked_glsl_program)
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
     {
-        glslang_program_delete(ptr->linked_glsl_program);
+        Shader *sptr;
+
+        free(ptr->spirv[stage].ir);
+        free(ptr->spirv[stage].msl_str);
+        free(ptr->spirv[stage].entry_point);
+
+        // shaders made by glProgramBinary belong to the program
+        sptr = ptr->shader_slots[stage];
+
+        if (sptr && (sptr->name == 0))
+            freeProgramBinaryShader(ctx, sptr);
     }
 
-    if (ptr->mtl_data)
+    free(ptr);
+}
+
+void releaseProgram(GLMContext ctx, Program *ptr)
+{
+    if ((ptr == NULL) || (ptr->delete_pending == GL_FALSE))
+        return;
+
+    if ((ctx->state.program == ptr) || ptr->pipeline_refs)
+        return;
+
+    destroyProgram(ctx, ptr);
+}
+
+void mglDeleteProgram(GLMContext ctx, GLuint program)
+{
+    Program *ptr;
+
+    // zero is silently ignored
+    if (program == 0)
+        return;
+
+    ptr = findProgram(ctx, program);
+
+    if (ptr == NULL)
     {
-        ctx->mtl_funcs.mtlDeleteMTLObj(ctx, ptr->mtl_data);
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
     }
 
-    // ptr->spirv_program and such
-    assert(0);
+    finishProgramLink(ctx, ptr);
 
-    free(ptr);
+    // the current program and pipeline stages keep drawing with it until they let go
+    ptr->delete_pending = GL_TRUE;
+
+    releaseProgram(ctx, ptr);
 }
 
 GLboolean mglIsProgram(GLMContext ctx, GLuint program)
@@ -155,9 +212,12 @@ void mglAttachShader(GLMContext ctx, GLuint program, GLuint shader)
         return;
     }
 
+    // a queued link uses the shaders attached when it was queued
+    finishProgramLink(ctx, pptr);
+
     index = sptr->glm_type;
 
-    pptr->shader_slots[index] = sptr;
+    attachedShaders(pptr)[index] = sptr;
     pptr->dirty_bits |= DIRTY_PROGRAM;
 }
 
@@ -185,9 +245,11 @@ void mglDetachShader(GLMContext ctx, GLuint program, GLuint shader)
         return;
     }
 
+    finishProgramLink(ctx, pptr);
+
     index = sptr->glm_type;
 
-    pptr->shader_slots[index] = NULL;
+    attachedShaders(pptr)[index] = NULL;
     pptr->dirty_bits |= DIRTY_PROGRAM;
 
     assert(0); // need to do something with metal at this point
@@ -244,6 +306,10 @@ char *parseSPIRVShaderToMetal(GLMContext ctx, Program *ptr, int stage)
     spvc_resources resources = NULL;
     const spvc_reflected_resource *list = NULL;
     const char *result = NULL;
+    SpirvReflection *reflection;
+    SpirvResource *res;
+    GLuint counts[_MAX_SPIRV_RES];
+    size_t names_len;
     size_t count;
     size_t i;
 
@@ -266,52 +332,60 @@ char *parseSPIRVShaderToMetal(GLMContext ctx, Program *ptr, int stage)
     // Hand it off to a compiler instance and give it ownership of the IR.
     spvc_context_create_compiler(context, SPVC_BACKEND_MSL, ir, SPVC_CAPTURE_MODE_TAKE_OWNERSHIP, &compiler_msl);
     assert(compiler_msl);
-    ERROR_CHECK_RETURN(spvc_compiler_msl_add_discrete_descriptor_set(compiler_msl, 3) == SPVC_SUCCESS,
-                       GL_INVALID_OPERATION);
-
-    // Modify options.
-    ERROR_CHECK_RETURN(spvc_compiler_create_compiler_options(compiler_msl, &options) == SPVC_SUCCESS,
-                       GL_INVALID_OPERATION);
-    ERROR_CHECK_RETURN(spvc_compiler_options_set_bool(options, SPVC_COMPILER_OPTION_MSL_ARGUMENT_BUFFERS, SPVC_FALSE) ==
-                           SPVC_SUCCESS,
-                       GL_INVALID_OPERATION);
-    ERROR_CHECK_RETURN(spvc_compiler_options_set_uint(options, SPVC_COMPILER_OPTION_MSL_VERSION,
-                                                      SPVC_MAKE_MSL_VERSION(3, 1, 0)) == SPVC_SUCCESS,
-                       GL_INVALID_OPERATION);
-    // ERROR_CHECK_RETURN(spvc_compiler_options_set_uint(options,
-    // SPVC_COMPILER_OPTION_GLSL_VERSION, 4.5) == SPVC_SUCCESS,
-    // GL_INVALID_OPERATION);
-    ERROR_CHECK_RETURN(spvc_compiler_install_compiler_options(compiler_msl, options) == SPVC_SUCCESS,
-                       GL_INVALID_OPERATION);
+    // this runs on a link worker, a failure leaves msl_str NULL and finishProgramLink raises the error
+    if ((spvc_compiler_msl_add_discrete_descriptor_set(compiler_msl, MSL_DISCRETE_DESCRIPTOR_SET) != SPVC_SUCCESS) ||
+        (spvc_compiler_create_compiler_options(compiler_msl, &options) != SPVC_SUCCESS) ||
+        (spvc_compiler_options_set_bool(options, SPVC_COMPILER_OPTION_MSL_ARGUMENT_BUFFERS, MSL_ARGUMENT_BUFFERS) !=
+         SPVC_SUCCESS) ||
+        (spvc_compiler_options_set_uint(options, SPVC_COMPILER_OPTION_MSL_VERSION, MSL_VERSION) != SPVC_SUCCESS) ||
+        (spvc_compiler_install_compiler_options(compiler_msl, options) != SPVC_SUCCESS))
+    {
+        spvc_context_destroy(context);
+        return NULL;
+    }
 
     // create an entry point for metal based on the shader type and name
     GLuint name;
     char entry_point[128];
-    name = ptr->shader_slots[stage]->name;
+    const char *module_entry_point;
+    Shader *shader;
+
+    shader = ptr->shader_slots[stage];
+    name = shader->name;
 
     SpvExecutionModel model;
-    switch (stage)
+    model = getSPIRVExecutionModel(stage);
+
+    // glsl always comes out of glslang as main, spir-v shaders name theirs in glSpecializeShader
+    module_entry_point = "main";
+
+    if (shader->spirv_module.ir)
     {
-    case _VERTEX_SHADER:
-        model = SpvExecutionModelVertex;
-        break;
-    case _TESS_CONTROL_SHADER:
-        model = SpvExecutionModelTessellationControl;
-        break;
-    case _TESS_EVALUATION_SHADER:
-        model = SpvExecutionModelTessellationEvaluation;
-        break;
-    case _GEOMETRY_SHADER:
-        model = SpvExecutionModelGeometry;
-        break;
-    case _FRAGMENT_SHADER:
-        model = SpvExecutionModelFragment;
-        break;
-    case _COMPUTE_SHADER:
-        model = SpvExecutionModelGLCompute;
-        break;
-    default:
-        assert(0);
+        const spvc_specialization_constant *constants;
+        size_t num_constants;
+        spvc_result res;
+
+        // glSpecializeShader checked the entry point exists for this stage
+        module_entry_point = shader->spirv_module.entry_point;
+
+        res = spvc_compiler_set_entry_point(compiler_msl, module_entry_point, model);
+        assert(res == SPVC_SUCCESS);
+
+        if (spvc_compiler_get_specialization_constants(compiler_msl, &constants, &num_constants) != SPVC_SUCCESS)
+            num_constants = 0;
+
+        for (GLuint c = 0; c < shader->spirv_module.num_constants; c++)
+        {
+            for (size_t j = 0; j < num_constants; j++)
+            {
+                if (constants[j].constant_id != shader->spirv_module.constant_ids[c])
+                    continue;
+
+                // spec constants are 32 bit scalars, the value is taken as raw bits
+                spvc_constant_set_scalar_u32(spvc_compiler_get_constant_handle(compiler_msl, constants[j].id), 0, 0,
+                                             shader->spirv_module.constant_values[c]);
+            }
+        }
     }
 
     switch (stage)
@@ -339,14 +413,15 @@ char *parseSPIRVShaderToMetal(GLMContext ctx, Program *ptr, int stage)
     }
 
     const char *cleansed_entry_point;
-    cleansed_entry_point = spvc_compiler_get_cleansed_entry_point_name(compiler_msl, "main", model);
+    cleansed_entry_point = spvc_compiler_get_cleansed_entry_point_name(compiler_msl, module_entry_point, model);
 
     spvc_result err;
     err = spvc_compiler_rename_entry_point(compiler_msl, cleansed_entry_point, entry_point, model);
     assert(err == SPVC_SUCCESS);
 
-    // set the entry point for metal
-    ptr->shader_slots[stage]->entry_point = strdup(entry_point);
+    // the entry point belongs to the program's stage, the shader may be linking into other programs
+    free(ptr->spirv[stage].entry_point);
+    ptr->spirv[stage].entry_point = strdup(entry_point);
 
     // compute shader
     if (stage == _COMPUTE_SHADER)
@@ -356,7 +431,11 @@ char *parseSPIRVShaderToMetal(GLMContext ctx, Program *ptr, int stage)
         size_t num_entry_points;
 
         res = spvc_compiler_get_entry_points(compiler_msl, &entry_points, &num_entry_points);
-        ERROR_CHECK_RETURN(res == SPVC_SUCCESS, GL_INVALID_OPERATION);
+        if (res != SPVC_SUCCESS)
+        {
+            spvc_context_destroy(context);
+            return NULL;
+        }
 
         for (int i = 0; i < num_entry_points; i++)
         {
@@ -373,6 +452,25 @@ char *parseSPIRVShaderToMetal(GLMContext ctx, Program *ptr, int stage)
 
     // Do some basic reflection.
     spvc_compiler_create_shader_resources(compiler_msl, &resources);
+
+    // size it first so the stage's reflection is a single block
+    bzero(counts, sizeof(counts));
+    names_len = 0;
+
+    for (int res_type = SPVC_RESOURCE_TYPE_UNIFORM_BUFFER; res_type < SPVC_RESOURCE_TYPE_ACCELERATION_STRUCTURE;
+         res_type++)
+    {
+        spvc_resources_get_resource_list_for_type(resources, res_type, &list, &count);
+
+        counts[res_type] = (GLuint)count;
+
+        for (i = 0; i < count; i++)
+            names_len += strlen(list[i].name) + 1;
+    }
+
+    reflection = newStageReflection(counts, names_len);
+    res = reflection->resources;
+
     for (int res_type = SPVC_RESOURCE_TYPE_UNIFORM_BUFFER; res_type < SPVC_RESOURCE_TYPE_ACCELERATION_STRUCTURE;
          res_type++)
     {
@@ -385,9 +483,6 @@ char *parseSPIRVShaderToMetal(GLMContext ctx, Program *ptr, int stage)
 
         spvc_resources_get_resource_list_for_type(resources, res_type, &list, &count);
 
-        ptr->spirv_resources_list[stage][res_type].count = (GLuint)count;
-        ptr->spirv_resources_list[stage][res_type].list = (SpirvResource *)malloc(count * sizeof(SpirvResource));
-
         for (i = 0; i < count; i++)
         {
             DEBUG_PRINT("res_type: %s ID: %u, BaseTypeID: %u, TypeID: %u, Name: %s ", res_name[res_type], list[i].id,
@@ -435,23 +530,30 @@ char *parseSPIRVShaderToMetal(GLMContext ctx, Program *ptr, int stage)
                 break;
             }
 
-            ptr->spirv_resources_list[stage][res_type].list[i]._id = list[i].id;
-            ptr->spirv_resources_list[stage][res_type].list[i].base_type_id = list[i].base_type_id;
-            ptr->spirv_resources_list[stage][res_type].list[i].type_id = list[i].type_id;
-            ptr->spirv_resources_list[stage][res_type].list[i].name = strdup(list[i].name);
-            ptr->spirv_resources_list[stage][res_type].list[i].set =
-                spvc_compiler_get_decoration(compiler_msl, list[i].id, SpvDecorationDescriptorSet);
-            ptr->spirv_resources_list[stage][res_type].list[i].binding =
-                spvc_compiler_get_decoration(compiler_msl, list[i].id, SpvDecorationBinding);
-            ptr->spirv_resources_list[stage][res_type].list[i].location =
-                spvc_compiler_get_decoration(compiler_msl, list[i].id, SpvDecorationLocation);
+            res->_id = list[i].id;
+            res->base_type_id = list[i].base_type_id;
+            res->type_id = list[i].type_id;
+            res->name = addStageReflectionName(reflection, list[i].name);
+            res->set = spvc_compiler_get_decoration(compiler_msl, list[i].id, SpvDecorationDescriptorSet);
+            res->binding = spvc_compiler_get_decoration(compiler_msl, list[i].id, SpvDecorationBinding);
+            res->location = spvc_compiler_get_decoration(compiler_msl, list[i].id, SpvDecorationLocation);
+            res++;
         }
     }
 
-    spvc_compiler_compile(compiler_msl, &result);
-    DEBUG_PRINT("\n%s\n", result);
+    // staged until every stage is done, commitProgramReflection moves it into the program
+    free(ptr->spirv[stage].reflection);
+    ptr->spirv[stage].reflection = reflection;
 
-    str_ret = strdup(result);
+    // stages msl can't express (geometry shaders) fail here, the link fails instead of crashing
+    str_ret = NULL;
+
+    if (spvc_compiler_compile(compiler_msl, &result) == SPVC_SUCCESS)
+    {
+        DEBUG_PRINT("\n%s\n", result);
+
+        str_ret = strdup(result);
+    }
 
     // Frees all memory we allocated so far.
     spvc_context_destroy(context);
@@ -459,19 +561,176 @@ char *parseSPIRVShaderToMetal(GLMContext ctx, Program *ptr, int stage)
     return str_ret;
 }
 
-bool linkAndCompileProgramToMetal(GLMContext ctx, Program *pptr, int stage)
+static void hashMSLOptions(ShaderCacheKey *key)
+{
+    GLuint msl_options[3] = {MSL_VERSION, MSL_ARGUMENT_BUFFERS, MSL_DISCRETE_DESCRIPTOR_SET};
+
+    hashShaderCacheKey(key, msl_options, sizeof(msl_options));
+}
+
+static void shaderCacheKeyForStage(GLMContext ctx, Program *pptr, int stage, ShaderCacheKey *key)
+{
+    glslang_version_t glslang_version;
+    int version[3];
+
+    initShaderCacheKey(key);
+
+    // a new glslang can compile the same glsl to different spirv
+    glslang_get_version(&glslang_version);
+    version[0] = glslang_version.major;
+    version[1] = glslang_version.minor;
+    version[2] = glslang_version.patch;
+
+    hashShaderCacheKey(key, version, sizeof(version));
+
+    // every stage is linked against the whole program, so every attached source is part of the key
+    for (int i = 0; i < _MAX_SHADER_TYPES; i++)
+    {
+        Shader *ptr;
+        glslang_input_t input;
+        GLuint settings[11];
+
+        ptr = pptr->shader_slots[i];
+
+        if (ptr == NULL)
+            continue;
+
+        // spir-v shaders are keyed by the module and its specialization instead of the glsl inputs
+        if (ptr->spirv_module.ir)
+        {
+            GLuint module[2];
+
+            module[0] = i;
+            module[1] = ptr->spirv_module.num_constants;
+
+            hashShaderCacheKey(key, module, sizeof(module));
+            hashShaderCacheKey(key, ptr->spirv_module.ir, ptr->spirv_module.size * sizeof(unsigned));
+            hashShaderCacheKey(key, ptr->spirv_module.entry_point, strlen(ptr->spirv_module.entry_point) + 1);
+            hashShaderCacheKey(key, ptr->spirv_module.constant_ids, module[1] * sizeof(GLuint));
+            hashShaderCacheKey(key, ptr->spirv_module.constant_values, module[1] * sizeof(GLuint));
+            continue;
+        }
+
+        initGLSLInput(ctx, ptr->type, ptr->src, &input);
+
+        settings[0] = i;
+        settings[1] = input.language;
+        settings[2] = input.stage;
+        settings[3] = input.client;
+        settings[4] = input.client_version;
+        settings[5] = input.target_language;
+        settings[6] = input.target_language_version;
+        settings[7] = input.default_version;
+        settings[8] = input.default_profile;
+        settings[9] = input.force_default_version_and_profile;
+        settings[10] = input.messages;
+
+        hashShaderCacheKey(key, settings, sizeof(settings));
+        hashShaderCacheKey(key, input.resource, sizeof(glslang_resource_t));
+        hashShaderCacheKey(key, &ptr->src_len, sizeof(ptr->src_len));
+        hashShaderCacheKey(key, ptr->src, ptr->src_len);
+    }
+
+    // the entry point is named after the shader
+    hashShaderCacheKey(key, &stage, sizeof(stage));
+    hashShaderCacheKey(key, &pptr->shader_slots[stage]->name, sizeof(GLuint));
+    hashShaderCacheKey(key, &ctx->spirv_optimizer, sizeof(ctx->spirv_optimizer));
+    hashMSLOptions(key);
+}
+
+typedef struct StageTranslation_t
+{
+    GLMContext ctx;
+    Program *pptr;
+    int stage;
+} StageTranslation;
+
+static void *translateStageToMetal(void *arg)
+{
+    StageTranslation *work;
+    ProgramStageStats *stats;
+    Spirv *spirv;
+    GLuint64 start;
+
+    work = (StageTranslation *)arg;
+    spirv = &work->pptr->spirv[work->stage];
+    stats = &work->pptr->stats.stages[work->stage];
+
+    stats->instructions_in = countSPIRVInstructions(spirv->ir, spirv->size);
+    stats->instructions_out = stats->instructions_in;
+
+    if (work->ctx->spirv_optimizer != MGL_SPIRV_OPTIMIZE_NONE)
+    {
+        start = shaderStatsClock();
+
+        if (optimizeSPIRV(work->ctx->spirv_optimizer, spirv))
+            stats->instructions_out = countSPIRVInstructions(spirv->ir, spirv->size);
+
+        stats->spirv_opt_ns = shaderStatsClock() - start;
+    }
+
+    start = shaderStatsClock();
+
+    // each stage has its own spirv-cross context, it writes its own spirv[] entry and stats and the compute stage
+    // sets local_workgroup_size, the shaders it reads are shared and left untouched
+    spirv->msl_str = parseSPIRVShaderToMetal(work->ctx, work->pptr, work->stage);
+
+    stats->msl_ns = shaderStatsClock() - start;
+
+    return NULL;
+}
+
+static void reportStageTranslations(GLMContext ctx, Program *pptr, StageTranslation *work, int count)
+{
+    GLuint instructions_in, instructions_out;
+    GLuint64 opt_ns, msl_ns;
+
+    instructions_in = instructions_out = 0;
+    opt_ns = msl_ns = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        ProgramStageStats *stats;
+
+        stats = &pptr->stats.stages[work[i].stage];
+
+        instructions_in += stats->instructions_in;
+        instructions_out += stats->instructions_out;
+        opt_ns += stats->spirv_opt_ns;
+        msl_ns += stats->msl_ns;
+    }
+
+    if (ctx->spirv_optimizer != MGL_SPIRV_OPTIMIZE_NONE)
+    {
+        __atomic_fetch_add(&ctx->stats.spirv_instructions_in, instructions_in, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ctx->stats.spirv_instructions_out, instructions_out, __ATOMIC_RELAXED);
+    }
+
+    DEBUG_PRINT("program %d: %u -> %u spirv instructions, spirv-opt %.2f ms, spirv-cross %.2f ms\n", pptr->name,
+                instructions_in, instructions_out, opt_ns / 1e6, msl_ns / 1e6);
+}
+
+// one glslang link for the whole program, then spirv for each pending stage out of it
+static bool generateProgramSPIRV(GLMContext ctx, Program *pptr, GLuint pending)
 {
     glslang_program_t *glsl_program;
+    GLuint64 start;
     int err;
 
+    // glslang links into the compiled shaders, other links sharing one wait until the spirv is out
+    acquireLinkShaders(ctx, pptr);
+
     glsl_program = glslang_program_create();
     assert(glsl_program);
 
     // shaders to glsl program
     addShadersToProgram(ctx, pptr, glsl_program);
 
-    // link
+    // link once for all stages
+    start = shaderStatsClock();
     err = glslang_program_link(glsl_program, GLSLANG_MSG_DEFAULT_BIT);
+    pptr->stats.link_ns = shaderStatsClock() - start;
+
     if (!err)
     {
         // this is useful.. but information after this failure isn't that
@@ -481,35 +740,269 @@ bool linkAndCompileProgramToMetal(GLMContext ctx, Program *pptr, int stage)
         DEBUG_PRINT("glslang_program_get_info_log:\n%s\n", glslang_program_get_info_log(glsl_program));
         DEBUG_PRINT("glslang_program_get_info_debug_log:\n%s\n", glslang_program_get_info_debug_log(glsl_program));
 
-        ERROR_RETURN(GL_INVALID_OPERATION);
+        glslang_program_delete(glsl_program);
+        releaseLinkShaders(ctx, pptr);
+
+        pptr->link_error = GL_INVALID_OPERATION;
+        return false;
     }
 
-    // generate SPIVR
-    glslang_program_SPIRV_generate(glsl_program, stage);
+    // generate SPIVR for each stage from the one linked program
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        unsigned int *spirv;
+        size_t start, size;
+        GLuint64 generate_start;
+
+        if ((pending & SHADER_MASK_BIT(stage)) == 0)
+            continue;
+
+        // glslang appends each stage's module to the program's spirv
+        start = glslang_program_SPIRV_get_size(glsl_program);
+
+        generate_start = shaderStatsClock();
+        glslang_program_SPIRV_generate(glsl_program, stage);
+        pptr->stats.stages[stage].spirv_ns = shaderStatsClock() - generate_start;
+
+        if (glslang_program_SPIRV_get_messages(glsl_program))
+        {
+            DEBUG_PRINT("%s\n", glslang_program_SPIRV_get_messages(glsl_program));
+
+            glslang_program_delete(glsl_program);
+            releaseLinkShaders(ctx, pptr);
+
+            pptr->link_error = GL_INVALID_OPERATION;
+            return false;
+        }
+
+        size = glslang_program_SPIRV_get_size(glsl_program);
+        spirv = (unsigned int *)malloc(size * sizeof(unsigned));
+        assert(spirv);
+        glslang_program_SPIRV_get(glsl_program, spirv);
+
+        if ((start >= size) || (spirv[start] != SpvMagicNumber))
+            start = 0;
 
-    if (glslang_program_SPIRV_get_messages(glsl_program))
+        // save SPIRV code
+        pptr->spirv[stage].size = size - start;
+        pptr->spirv[stage].ir = (unsigned int *)malloc(pptr->spirv[stage].size * sizeof(unsigned));
+        assert(pptr->spirv[stage].ir);
+        memcpy(pptr->spirv[stage].ir, spirv + start, pptr->spirv[stage].size * sizeof(unsigned));
+
+        free(spirv);
+    }
+
+    glslang_program_delete(glsl_program);
+    releaseLinkShaders(ctx, pptr);
+
+    return true;
+}
+
+// spir-v shaders skip glslang, each module already is the stage's spirv
+static void copyProgramSPIRVModules(Program *pptr, GLuint pending)
+{
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
     {
-        DEBUG_PRINT("%s\n", glslang_program_SPIRV_get_messages(glsl_program));
+        Shader *ptr;
 
-        ERROR_RETURN(GL_INVALID_OPERATION);
+        if ((pending & SHADER_MASK_BIT(stage)) == 0)
+            continue;
+
+        ptr = pptr->shader_slots[stage];
+
+        pptr->spirv[stage].size = ptr->spirv_module.size;
+        pptr->spirv[stage].ir = (unsigned int *)malloc(ptr->spirv_module.size * sizeof(unsigned));
+        assert(pptr->spirv[stage].ir);
+        memcpy(pptr->spirv[stage].ir, ptr->spirv_module.ir, ptr->spirv_module.size * sizeof(unsigned));
+    }
+}
+
+bool linkAndCompileProgramToMetal(GLMContext ctx, Program *pptr)
+{
+    ShaderCacheKey keys[_MAX_SHADER_TYPES];
+    StageTranslation work[_MAX_SHADER_TYPES];
+    pthread_t threads[_MAX_SHADER_TYPES];
+    bool started[_MAX_SHADER_TYPES];
+    bool translated;
+    GLuint pending;
+    int count, modules;
+
+    // shaders need to compile before the program can link, cached or not
+    count = 0;
+    modules = 0;
+
+    for (int i = 0; i < _MAX_SHADER_TYPES; i++)
+    {
+        Shader *ptr;
+
+        ptr = pptr->shader_slots[i];
+
+        if (ptr == NULL)
+            continue;
+
+        if (ptr->spirv_module.specialized)
+        {
+            modules++;
+        }
+        else if (!ptr->compiled_glsl_shader)
+        {
+            pptr->link_error = GL_INVALID_OPERATION;
+            return false;
+        }
+
+        count++;
     }
 
-    // save SPIRV code
-    pptr->spirv[stage].size = glslang_program_SPIRV_get_size(glsl_program);
-    pptr->spirv[stage].ir = (unsigned int *)malloc(pptr->spirv[stage].size * sizeof(unsigned));
-    assert(pptr->spirv[stage].ir);
-    glslang_program_SPIRV_get(glsl_program, pptr->spirv[stage].ir);
+    // nothing attached, or glsl mixed with spir-v, links as a failure without raising an error
+    if ((count == 0) || (modules && (modules != count)))
+        return false;
+
+    // stages found in the shader cache skip everything below
+    pending = 0;
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        if (pptr->shader_slots[stage] == NULL)
+            continue;
+
+        shaderCacheKeyForStage(ctx, pptr, stage, &keys[stage]);
 
-    // compile SPIRV to Metal
-    pptr->spirv[stage].msl_str = parseSPIRVShaderToMetal(ctx, pptr, stage);
-    ERROR_CHECK_RETURN(pptr->spirv[stage].msl_str, GL_INVALID_OPERATION);
+        if (loadShaderCacheEntry(&keys[stage], pptr, stage))
+        {
+            __atomic_fetch_add(&ctx->stats.shader_cache_hits, 1, __ATOMIC_RELAXED);
+
+            pptr->stats.stages[stage].cached = GL_TRUE;
+        }
+        else
+        {
+            __atomic_fetch_add(&ctx->stats.shader_cache_misses, 1, __ATOMIC_RELAXED);
+
+            pending |= SHADER_MASK_BIT(stage);
+        }
+    }
 
-    pptr->linked_glsl_program = glsl_program;
     pptr->dirty_bits |= DIRTY_PROGRAM;
 
-    free(glsl_program);
+    if (pending == 0)
+    {
+        commitProgramReflection(pptr);
+        return true;
+    }
 
-    return true;
+    if (modules)
+    {
+        copyProgramSPIRVModules(pptr, pending);
+    }
+    else if (generateProgramSPIRV(ctx, pptr, pending) == false)
+    {
+        commitProgramReflection(pptr);
+        return false;
+    }
+
+    // compile SPIRV to Metal, stages translate in parallel with the calling thread taking the last one
+    count = 0;
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        if (pending & SHADER_MASK_BIT(stage))
+        {
+            bzero(&work[count], sizeof(StageTranslation));
+            work[count].ctx = ctx;
+            work[count].pptr = pptr;
+            work[count].stage = stage;
+            count++;
+        }
+    }
+
+    for (int i = 0; i < count - 1; i++)
+    {
+        started[i] = (pthread_create(&threads[i], NULL, translateStageToMetal, &work[i]) == 0);
+
+        if (started[i] == false)
+            translateStageToMetal(&work[i]);
+    }
+
+    translateStageToMetal(&work[count - 1]);
+
+    for (int i = 0; i < count - 1; i++)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    reportStageTranslations(ctx, pptr, work, count);
+
+    // the cache entries are written from the committed reflection
+    commitProgramReflection(pptr);
+
+    // a stage that didn't translate fails the link, the error waits for finishProgramLink on the context thread
+    translated = true;
+
+    for (int i = 0; i < count; i++)
+    {
+        int stage;
+
+        stage = work[i].stage;
+
+        if (pptr->spirv[stage].msl_str == NULL)
+        {
+            pptr->link_error = GL_INVALID_OPERATION;
+            translated = false;
+            continue;
+        }
+
+        storeShaderCacheEntry(&keys[stage], pptr, stage);
+    }
+
+    return translated;
+}
+
+// runs on a compile queue worker for background links, errors wait in link_error for finishProgramLink
+void linkProgram(GLMContext ctx, Program *pptr)
+{
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        pptr->spirv[stage].msl_str = 0;
+    }
+
+    pptr->link_error = GL_NO_ERROR;
+
+    resetProgramStats(pptr);
+
+    pptr->linked = linkAndCompileProgramToMetal(ctx, pptr) ? GL_TRUE : GL_FALSE;
+
+    recordProgramStageSizes(pptr);
+
+    if (pptr->linked)
+        buildProgramResourceIndex(pptr);
+}
+
+void finishProgramLink(GLMContext ctx, Program *pptr)
+{
+    GLenum error;
+
+    if (pptr->link_queued == GL_FALSE)
+        return;
+
+    waitForProgramLink(ctx, pptr);
+
+    pptr->link_queued = GL_FALSE;
+    pptr->link_generation = ++ctx->link_generation;
+
+    // metal objects are only made on the context's thread
+    if (pptr->linked)
+    {
+        ctx->mtl_funcs.mtlBindProgram(ctx, pptr);
+    }
+
+    error = pptr->link_error;
+    pptr->link_error = GL_NO_ERROR;
+
+    if (error != GL_NO_ERROR)
+    {
+        ERROR_RETURN(error);
+        return;
+    }
 }
 
 void mglLinkProgram(GLMContext ctx, GLuint program)
@@ -525,24 +1018,30 @@ void mglLinkProgram(GLMContext ctx, GLuint program)
         return;
     }
 
-    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
-    {
-        pptr->spirv[stage].msl_str = 0;
+    finishProgramLink(ctx, pptr);
 
-        if (pptr->shader_slots[stage])
-        {
-            linkAndCompileProgramToMetal(ctx, pptr, stage);
-        }
-    }
+    // a link starts over from the attached shaders, not a binary loaded since
+    restoreAttachedShaders(ctx, pptr);
 
-    ctx->mtl_funcs.mtlBindProgram(ctx, pptr);
+    pptr->link_queued = GL_TRUE;
 
-    // ERROR_CHECK_RETURN(pptr->mtl_data, GL_INVALID_OPERATION);
+    if (queueProgramLink(ctx, pptr))
+    {
+        // the current program is used by the next draw, anything else joins when it's needed
+        if (pptr != ctx->state.program)
+            return;
+    }
+    else
+    {
+        linkProgram(ctx, pptr);
+    }
+
+    finishProgramLink(ctx, pptr);
 }
 
 void mglUseProgram(GLMContext ctx, GLuint program)
 {
-    Program *pptr;
+    Program *pptr, *previous;
 
     if (program)
     {
@@ -555,15 +1054,30 @@ void mglUseProgram(GLMContext ctx, GLuint program)
             return;
         }
 
-        ERROR_CHECK_RETURN(pptr->linked_glsl_program, GL_INVALID_OPERATION);
+        finishProgramLink(ctx, pptr);
+
+        ERROR_CHECK_RETURN(pptr->linked, GL_INVALID_OPERATION);
+    }
+    else if (STATE(program_pipeline))
+    {
+        // with no current program the bound pipeline's stages are used
+        pptr = &STATE(program_pipeline)->program;
     }
     else
     {
         pptr = NULL;
     }
 
+    previous = STATE_VAR(current_program) ? ctx->state.program : NULL;
+
+    STATE_VAR(current_program) = program;
+
     ctx->state.program = pptr;
     ctx->state.dirty_bits |= DIRTY_PROGRAM;
+
+    // a program deleted while current goes away now
+    if (previous != pptr)
+        releaseProgram(ctx, previous);
 }
 
 void mglBindAttribLocation(GLMContext ctx, GLuint program, GLuint index, const GLchar *name)
@@ -606,35 +1120,319 @@ GLint mglGetAttribLocation(GLMContext ctx, GLuint program, const GLchar *name)
     ptr = getProgram(ctx, program);
     assert(program);
 
-    if (ptr->linked_glsl_program == NULL)
+    finishProgramLink(ctx, ptr);
+
+    if (ptr->linked == GL_FALSE)
     {
         ERROR_RETURN(GL_INVALID_OPERATION);
 
         return -1;
     }
 
-    for (int stage = _VERTEX_SHADER; stage < _MAX_SHADER_TYPES; stage++)
+    const ProgramResourceName *entry;
+
+    entry = findProgramResource(ptr, GL_PROGRAM_INPUT, name);
+
+    if (entry == NULL)
+        return -1;
+
+    return entry->location;
+}
+
+#pragma mark program binaries
+#define PROGRAM_BINARY_MAGIC 0x42474c4d // "MGLB"
+#define PROGRAM_BINARY_VERSION 1
+#define PROGRAM_BINARY_ALIGN(_size_) (((_size_) + 7) & ~(size_t)7)
+
+// a header followed by one serialized stage for each bit in stage_mask, each padded to 8 bytes
+typedef struct ProgramBinaryHeader_t
+{
+    uint32_t magic;
+    uint32_t version;
+    ShaderCacheKey build;
+    uint32_t stage_mask;
+    uint32_t stage_size[_MAX_SHADER_TYPES];
+} ProgramBinaryHeader;
+
+static const GLenum program_stage_types[_MAX_SHADER_TYPES] = {
+    GL_VERTEX_SHADER,   GL_TESS_CONTROL_SHADER, GL_TESS_EVALUATION_SHADER,
+    GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER,     GL_COMPUTE_SHADER};
+
+static void programBinaryBuildHash(ShaderCacheKey *key)
+{
+    // binaries are only good for the build that wrote them
+    initShaderCacheKey(key);
+    hashShaderCacheKey(key, __DATE__ " " __TIME__, sizeof(__DATE__ " " __TIME__));
+    hashMSLOptions(key);
+}
+
+static void *serializeProgram(Program *ptr, size_t *size)
+{
+    ProgramBinaryHeader *header;
+    void *stages[_MAX_SHADER_TYPES];
+    size_t stage_size[_MAX_SHADER_TYPES];
+    GLubyte *data, *cursor;
+
+    bzero(stages, sizeof(stages));
+
+    *size = sizeof(ProgramBinaryHeader);
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
     {
-        int count;
+        if ((ptr->shader_slots[stage] == NULL) || (ptr->spirv[stage].msl_str == NULL))
+            continue;
 
-        count = ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_STAGE_INPUT].count;
+        stages[stage] = serializeProgramStage(ptr, stage, &stage_size[stage]);
 
-        for (int i = 0; i < count; i++)
+        if (stages[stage] == NULL)
         {
-            const char *str = ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_STAGE_INPUT].list[i].name;
+            for (int i = 0; i < stage; i++)
+                free(stages[i]);
 
-            if (!strcmp(str, name))
-            {
-                GLuint location;
+            return NULL;
+        }
 
-                location = ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_STAGE_INPUT].list[i].location;
+        *size += PROGRAM_BINARY_ALIGN(stage_size[stage]);
+    }
 
-                return location;
-            }
+    data = (GLubyte *)malloc(*size);
+    assert(data);
+    bzero(data, *size);
+
+    header = (ProgramBinaryHeader *)data;
+    header->magic = PROGRAM_BINARY_MAGIC;
+    header->version = PROGRAM_BINARY_VERSION;
+    programBinaryBuildHash(&header->build);
+
+    cursor = data + sizeof(ProgramBinaryHeader);
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        if (stages[stage] == NULL)
+            continue;
+
+        header->stage_mask |= SHADER_MASK_BIT(stage);
+        header->stage_size[stage] = (uint32_t)stage_size[stage];
+
+        memcpy(cursor, stages[stage], stage_size[stage]);
+        cursor += PROGRAM_BINARY_ALIGN(stage_size[stage]);
+
+        free(stages[stage]);
+    }
+
+    return data;
+}
+
+// stages loaded from a binary get shader objects of their own, name 0 is never handed out so it marks them
+static void freeProgramBinaryShader(GLMContext ctx, Shader *ptr)
+{
+    if (ptr->mtl_data.library)
+    {
+        ctx->mtl_funcs.mtlDeleteMTLObj(ctx, ptr->mtl_data.function);
+        ctx->mtl_funcs.mtlDeleteMTLObj(ctx, ptr->mtl_data.library);
+    }
+
+    free((void *)ptr->mtl_shader_type_name);
+    free(ptr);
+}
+
+// attaching and detaching goes to the app's shaders, a loaded binary stays the executable until the next link
+static Shader **attachedShaders(Program *ptr)
+{
+    return ptr->binary ? ptr->attached_slots : ptr->shader_slots;
+}
+
+static void restoreAttachedShaders(GLMContext ctx, Program *ptr)
+{
+    if (ptr->binary == GL_FALSE)
+        return;
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        if (ptr->shader_slots[stage])
+            freeProgramBinaryShader(ctx, ptr->shader_slots[stage]);
+
+        ptr->shader_slots[stage] = ptr->attached_slots[stage];
+        ptr->attached_slots[stage] = NULL;
+    }
+
+    ptr->binary = GL_FALSE;
+}
+
+static bool deserializeProgram(GLMContext ctx, Program *ptr, const GLubyte *data, size_t size)
+{
+    const ProgramBinaryHeader *header;
+    ShaderCacheKey build;
+    size_t offset;
+
+    if (size < sizeof(ProgramBinaryHeader))
+        return false;
+
+    header = (const ProgramBinaryHeader *)data;
+
+    if ((header->magic != PROGRAM_BINARY_MAGIC) || (header->version != PROGRAM_BINARY_VERSION))
+        return false;
+
+    programBinaryBuildHash(&build);
+
+    if (memcmp(&build, &header->build, sizeof(ShaderCacheKey)))
+    {
+        DEBUG_PRINT("program binary was written by a different build\n");
+        return false;
+    }
+
+    // the binary replaces the executable, the app's shaders stay attached for the next link
+    if (ptr->binary == GL_FALSE)
+    {
+        memcpy(ptr->attached_slots, ptr->shader_slots, sizeof(ptr->shader_slots));
+        ptr->binary = GL_TRUE;
+    }
+    else
+    {
+        for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+        {
+            if (ptr->shader_slots[stage])
+                freeProgramBinaryShader(ctx, ptr->shader_slots[stage]);
         }
     }
 
-    return -1;
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        ptr->shader_slots[stage] = NULL;
+
+        free(ptr->spirv[stage].ir);
+        free(ptr->spirv[stage].msl_str);
+        free(ptr->spirv[stage].entry_point);
+
+        ptr->spirv[stage].ir = NULL;
+        ptr->spirv[stage].size = 0;
+        ptr->spirv[stage].msl_str = NULL;
+        ptr->spirv[stage].entry_point = NULL;
+    }
+
+    offset = sizeof(ProgramBinaryHeader);
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        if ((header->stage_mask & SHADER_MASK_BIT(stage)) == 0)
+            continue;
+
+        if (header->stage_size[stage] > size - offset)
+            return false;
+
+        ptr->shader_slots[stage] = newShader(ctx, program_stage_types[stage], 0);
+
+        if (deserializeProgramStage(ptr, stage, data + offset, header->stage_size[stage]) == false)
+            return false;
+
+        offset += PROGRAM_BINARY_ALIGN(header->stage_size[stage]);
+
+        if (offset > size)
+            offset = size;
+    }
+
+    return true;
+}
+
+void mglGetProgramBinary(GLMContext ctx, GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat,
+                         void *binary)
+{
+    Program *ptr;
+    void *data;
+    size_t size;
+
+    ptr = findProgram(ctx, program);
+
+    if (!ptr)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    finishProgramLink(ctx, ptr);
+
+    if (ptr->linked == GL_FALSE)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    data = serializeProgram(ptr, &size);
+
+    if ((data == NULL) || (bufSize < 0) || (size > (size_t)bufSize))
+    {
+        free(data);
+
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    memcpy(binary, data, size);
+    free(data);
+
+    if (length)
+        *length = (GLsizei)size;
+
+    *binaryFormat = MGL_PROGRAM_BINARY_FORMAT;
+}
+
+void mglProgramBinary(GLMContext ctx, GLuint program, GLenum binaryFormat, const void *binary, GLsizei length)
+{
+    Program *ptr;
+    GLubyte *data;
+    bool result;
+
+    ptr = findProgram(ctx, program);
+
+    if (!ptr)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (binaryFormat != MGL_PROGRAM_BINARY_FORMAT)
+    {
+        ERROR_RETURN(GL_INVALID_ENUM);
+        return;
+    }
+
+    finishProgramLink(ctx, ptr);
+
+    // a rejected binary is not an error, it just leaves the program unlinked so the app falls back to source
+    ptr->linked = GL_FALSE;
+
+    if (length <= 0)
+        return;
+
+    // the app's pointer carries no alignment promise
+    data = (GLubyte *)malloc(length);
+    assert(data);
+    memcpy(data, binary, length);
+
+    result = deserializeProgram(ctx, ptr, data, length);
+
+    // a rejected binary leaves an unlinked program with the app's shaders attached again
+    if (result == false)
+        restoreAttachedShaders(ctx, ptr);
+
+    commitProgramReflection(ptr);
+
+    ptr->link_generation = ++ctx->link_generation;
+
+    resetProgramStats(ptr);
+    recordProgramStageSizes(ptr);
+
+    if (result)
+    {
+        ptr->linked = GL_TRUE;
+        ptr->dirty_bits |= DIRTY_PROGRAM;
+
+        buildProgramResourceIndex(ptr);
+
+        ctx->mtl_funcs.mtlBindProgram(ctx, ptr);
+    }
+
+    free(data);
 }
 
 void mglGetProgramiv(GLMContext ctx, GLuint program, GLenum pname, GLint *params)
@@ -645,14 +1443,22 @@ void mglGetProgramiv(GLMContext ctx, GLuint program, GLenum pname, GLint *params
 
     ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
 
+    // everything but the completion status joins the link
+    if (pname != GL_COMPLETION_STATUS_KHR)
+        finishProgramLink(ctx, ptr);
+
     switch (pname)
     {
     case GL_DELETE_STATUS:
-        *params = GL_FALSE;
+        *params = ptr->delete_pending;
+        break;
+
+    case GL_COMPLETION_STATUS_KHR:
+        *params = isProgramLinkComplete(ctx, ptr) ? GL_TRUE : GL_FALSE;
         break;
 
     case GL_LINK_STATUS:
-        if (ptr->linked_glsl_program)
+        if (ptr->linked)
         {
             *params = GL_TRUE;
         }
@@ -666,6 +1472,27 @@ void mglGetProgramiv(GLMContext ctx, GLuint program, GLenum pname, GLint *params
         *params = GL_TRUE;
         break;
 
+    case GL_PROGRAM_SEPARABLE:
+        *params = ptr->separable;
+        break;
+
+    case GL_PROGRAM_BINARY_LENGTH:
+        {
+            void *data;
+            size_t size;
+
+            data = NULL;
+            size = 0;
+
+            if (ptr->linked)
+                data = serializeProgram(ptr, &size);
+
+            *params = data ? (GLint)size : 0;
+
+            free(data);
+        }
+        break;
+
     case GL_INFO_LOG_LENGTH:
         *params = 0;
         break;
@@ -675,7 +1502,7 @@ void mglGetProgramiv(GLMContext ctx, GLuint program, GLenum pname, GLint *params
             GLint count = 0;
             for (int i = 0; i < _MAX_SHADER_TYPES; i++)
             {
-                if (ptr->shader_slots[i])
+                if (attachedShaders(ptr)[i])
                 {
                     count++;
                 }
@@ -689,8 +1516,8 @@ void mglGetProgramiv(GLMContext ctx, GLuint program, GLenum pname, GLint *params
             GLint count = 0;
             for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
             {
-                count += ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_UNIFORM_BUFFER].count;
-                count += ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_UNIFORM_CONSTANT].count;
+                count += PROGRAM_RESOURCE_COUNT(ptr, stage, SPVC_RESOURCE_TYPE_UNIFORM_BUFFER);
+                count += PROGRAM_RESOURCE_COUNT(ptr, stage, SPVC_RESOURCE_TYPE_UNIFORM_CONSTANT);
             }
             *params = count;
         }
@@ -701,7 +1528,7 @@ void mglGetProgramiv(GLMContext ctx, GLuint program, GLenum pname, GLint *params
             GLint count = 0;
             for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
             {
-                count += ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_STAGE_INPUT].count;
+                count += PROGRAM_RESOURCE_COUNT(ptr, stage, SPVC_RESOURCE_TYPE_STAGE_INPUT);
             }
             *params = count;
         }
@@ -713,34 +1540,33 @@ void mglGetProgramiv(GLMContext ctx, GLuint program, GLenum pname, GLint *params
     }
 }
 
-void mglGetProgramInfoLog(GLMContext ctx, GLuint program, GLsizei bufSize, GLsizei *length, GLchar *infoLog)
+void mglProgramParameteri(GLMContext ctx, GLuint program, GLenum pname, GLint value)
 {
-    // Unimplemented function
-    assert(0);
-}
+    Program *ptr;
 
-#pragma mark program pipelines
-void mglGenProgramPipelines(GLMContext ctx, GLsizei n, GLuint *pipelines)
-{
-    assert(0);
-}
+    ptr = findProgram(ctx, program);
 
-GLboolean mglIsProgramPipeline(GLMContext ctx, GLuint pipeline)
-{
-    assert(0);
-}
+    ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
 
-void mglDeleteProgramPipelines(GLMContext ctx, GLsizei n, const GLuint *pipelines)
-{
-    assert(0);
-}
+    switch (pname)
+    {
+    case GL_PROGRAM_SEPARABLE:
+        // takes effect at the next link, separable or not the stages are translated on their own
+        ptr->separable = value ? GL_TRUE : GL_FALSE;
+        break;
 
-void mglBindProgramPipeline(GLMContext ctx, GLuint pipeline)
-{
-    assert(0);
+    case GL_PROGRAM_BINARY_RETRIEVABLE_HINT:
+        // every linked program can be retrieved
+        break;
+
+    default:
+        ERROR_RETURN(GL_INVALID_ENUM);
+        break;
+    }
 }
 
-void mglUseProgramStages(GLMContext ctx, GLuint pipeline, GLbitfield stages, GLuint program)
+void mglGetProgramInfoLog(GLMContext ctx, GLuint program, GLsizei bufSize, GLsizei *length, GLchar *infoLog)
 {
+    // Unimplemented function
     assert(0);
 }
@@ -0,0 +1,634 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * program_pipelines.c
+ * MGL
+ *
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "spirv_cross_c.h"
+
+#include "programs.h"
+#include "glm_context.h"
+
+static const struct
+{
+    GLbitfield bit;
+    GLenum type;
+    const char *name;
+} pipeline_stages[_MAX_SHADER_TYPES] = {
+    {GL_VERTEX_SHADER_BIT, GL_VERTEX_SHADER, "vertex"},
+    {GL_TESS_CONTROL_SHADER_BIT, GL_TESS_CONTROL_SHADER, "tess control"},
+    {GL_TESS_EVALUATION_SHADER_BIT, GL_TESS_EVALUATION_SHADER, "tess evaluation"},
+    {GL_GEOMETRY_SHADER_BIT, GL_GEOMETRY_SHADER, "geometry"},
+    {GL_FRAGMENT_SHADER_BIT, GL_FRAGMENT_SHADER, "fragment"},
+    {GL_COMPUTE_SHADER_BIT, GL_COMPUTE_SHADER, "compute"},
+};
+
+#define PIPELINE_STAGE_BITS                                                                                            \
+    (GL_VERTEX_SHADER_BIT | GL_TESS_CONTROL_SHADER_BIT | GL_TESS_EVALUATION_SHADER_BIT | GL_GEOMETRY_SHADER_BIT |      \
+     GL_FRAGMENT_SHADER_BIT | GL_COMPUTE_SHADER_BIT)
+
+ProgramPipeline *newProgramPipeline(GLMContext ctx, GLuint pipeline)
+{
+    ProgramPipeline *ptr;
+
+    ptr = (ProgramPipeline *)malloc(sizeof(ProgramPipeline));
+    assert(ptr);
+
+    bzero(ptr, sizeof(ProgramPipeline));
+
+    ptr->name = pipeline;
+
+    return ptr;
+}
+
+ProgramPipeline *getProgramPipeline(GLMContext ctx, GLuint pipeline)
+{
+    ProgramPipeline *ptr;
+
+    ptr = (ProgramPipeline *)searchSlotMap(&STATE(program_pipeline_table), pipeline);
+
+    if (!ptr)
+    {
+        // a deleted name whose slot went to another object
+        if (isStaleSlotMapName(&STATE(program_pipeline_table), pipeline))
+        {
+            ERROR_RETURN_VALUE(GL_INVALID_OPERATION, NULL);
+        }
+
+        ptr = newProgramPipeline(ctx, pipeline);
+
+        insertSlotMapElement(&STATE(program_pipeline_table), pipeline, ptr);
+    }
+
+    return ptr;
+}
+
+bool isProgramPipeline(GLMContext ctx, GLuint pipeline)
+{
+    ProgramPipeline *ptr;
+
+    ptr = (ProgramPipeline *)searchSlotMap(&STATE(program_pipeline_table), pipeline);
+
+    if (ptr)
+        return true;
+
+    return false;
+}
+
+ProgramPipeline *findProgramPipeline(GLMContext ctx, GLuint pipeline)
+{
+    ProgramPipeline *ptr;
+
+    ptr = (ProgramPipeline *)searchSlotMap(&STATE(program_pipeline_table), pipeline);
+
+    return ptr;
+}
+
+#pragma mark combined stages
+static void setPipelineInfoLog(ProgramPipeline *ptr, const char *format, ...)
+{
+    char log[256];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(log, sizeof(log), format, args);
+    va_end(args);
+
+    free(ptr->info_log);
+    ptr->info_log = strdup(log);
+}
+
+// the separately translated stages meet on locations, every input of a stage has to be written by the stage
+// before it
+static bool stageInterfaceMatches(Program *program, int producer, int consumer, GLuint *location)
+{
+    SpirvResource *inputs, *outputs;
+    GLuint input_count, output_count;
+
+    inputs = PROGRAM_RESOURCES(program, consumer, SPVC_RESOURCE_TYPE_STAGE_INPUT);
+    input_count = PROGRAM_RESOURCE_COUNT(program, consumer, SPVC_RESOURCE_TYPE_STAGE_INPUT);
+
+    outputs = PROGRAM_RESOURCES(program, producer, SPVC_RESOURCE_TYPE_STAGE_OUTPUT);
+    output_count = PROGRAM_RESOURCE_COUNT(program, producer, SPVC_RESOURCE_TYPE_STAGE_OUTPUT);
+
+    for (GLuint i = 0; i < input_count; i++)
+    {
+        GLuint j;
+
+        for (j = 0; j < output_count; j++)
+        {
+            if (outputs[j].location == inputs[i].location)
+                break;
+        }
+
+        if (j == output_count)
+        {
+            *location = inputs[i].location;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void validatePipelineStages(ProgramPipeline *ptr)
+{
+    Program *program;
+    bool graphics;
+    int producer;
+
+    program = &ptr->program;
+
+    free(ptr->info_log);
+    ptr->info_log = NULL;
+    ptr->valid = GL_FALSE;
+
+    if (program->linked == GL_FALSE)
+    {
+        setPipelineInfoLog(ptr, "no linked program is used for any stage\n");
+        return;
+    }
+
+    graphics = false;
+    producer = -1;
+
+    for (int stage = _VERTEX_SHADER; stage < _COMPUTE_SHADER; stage++)
+    {
+        GLuint location;
+
+        if (program->shader_slots[stage] == NULL)
+            continue;
+
+        graphics = true;
+
+        if ((producer >= 0) && (stageInterfaceMatches(program, producer, stage, &location) == false))
+        {
+            setPipelineInfoLog(ptr, "%s input at location %u is not written by the %s stage\n",
+                               pipeline_stages[stage].name, location, pipeline_stages[producer].name);
+            return;
+        }
+
+        producer = stage;
+    }
+
+    // the metal pipeline needs both functions
+    if (graphics && ((program->shader_slots[_VERTEX_SHADER] == NULL) ||
+                     (program->shader_slots[_FRAGMENT_SHADER] == NULL)))
+    {
+        setPipelineInfoLog(ptr, "drawing needs both a vertex and a fragment stage\n");
+        return;
+    }
+
+    ptr->valid = GL_TRUE;
+}
+
+static bool pipelineStagesChanged(GLMContext ctx, ProgramPipeline *ptr)
+{
+    if (ptr->dirty)
+        return true;
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        Program *sptr;
+
+        if (ptr->programs[stage] == 0)
+            continue;
+
+        sptr = findProgram(ctx, ptr->programs[stage]);
+
+        // deleted, relinked or waiting to be joined
+        if ((sptr == NULL) || sptr->link_queued || (sptr->link_generation != ptr->link_generations[stage]))
+            return true;
+    }
+
+    return false;
+}
+
+// nothing is translated or copied here, the shaders, msl and reflection all stay with the stage programs
+static void combinePipelineStages(GLMContext ctx, ProgramPipeline *ptr)
+{
+    Program *stages[_MAX_SHADER_TYPES];
+    Program *program;
+
+    program = &ptr->program;
+    program->linked = GL_FALSE;
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        Program *sptr;
+
+        stages[stage] = NULL;
+        program->shader_slots[stage] = NULL;
+        bzero(&program->spirv[stage], sizeof(Spirv));
+        ptr->link_generations[stage] = 0;
+
+        if (ptr->programs[stage] == 0)
+            continue;
+
+        sptr = findProgram(ctx, ptr->programs[stage]);
+
+        if (sptr == NULL)
+        {
+            ptr->programs[stage] = 0;
+            continue;
+        }
+
+        finishProgramLink(ctx, sptr);
+
+        ptr->link_generations[stage] = sptr->link_generation;
+
+        if ((sptr->linked == GL_FALSE) || (sptr->shader_slots[stage] == NULL))
+            continue;
+
+        stages[stage] = sptr;
+
+        program->shader_slots[stage] = sptr->shader_slots[stage];
+        program->spirv[stage] = sptr->spirv[stage];
+        program->spirv[stage].reflection = NULL;
+
+        if (stage == _COMPUTE_SHADER)
+            program->local_workgroup_size = sptr->local_workgroup_size;
+
+        program->linked = GL_TRUE;
+    }
+
+    combineProgramReflection(program, stages);
+
+    // anything keyed on the program, like the vertex layouts, has to see a new one
+    program->link_generation = ++ctx->link_generation;
+
+    ptr->dirty = GL_FALSE;
+
+    validatePipelineStages(ptr);
+}
+
+static void updateProgramPipeline(GLMContext ctx, ProgramPipeline *ptr)
+{
+    if (pipelineStagesChanged(ctx, ptr) == false)
+        return;
+
+    combinePipelineStages(ctx, ptr);
+
+    if (ctx->state.program == &ptr->program)
+        ctx->state.dirty_bits |= DIRTY_PROGRAM;
+}
+
+bool refreshProgramPipeline(GLMContext ctx)
+{
+    ProgramPipeline *ptr;
+
+    ptr = STATE(program_pipeline);
+
+    if ((ptr == NULL) || (ctx->state.program != &ptr->program))
+        return true;
+
+    updateProgramPipeline(ctx, ptr);
+
+    return ptr->valid;
+}
+
+// a stage holds on to its program, a program deleted while a stage uses it is freed when the last stage lets go
+static void setPipelineStageProgram(GLMContext ctx, ProgramPipeline *ptr, int stage, GLuint program)
+{
+    Program *pptr;
+
+    if (ptr->programs[stage] == program)
+        return;
+
+    if (program)
+    {
+        pptr = findProgram(ctx, program);
+        assert(pptr);
+
+        pptr->pipeline_refs++;
+    }
+
+    pptr = ptr->programs[stage] ? findProgram(ctx, ptr->programs[stage]) : NULL;
+
+    ptr->programs[stage] = program;
+
+    if (pptr)
+    {
+        assert(pptr->pipeline_refs);
+
+        pptr->pipeline_refs--;
+        releaseProgram(ctx, pptr);
+    }
+}
+
+#pragma mark program pipelines
+GLboolean mglIsProgramPipeline(GLMContext ctx, GLuint pipeline)
+{
+    if (isProgramPipeline(ctx, pipeline))
+        return GL_TRUE;
+
+    return GL_FALSE;
+}
+
+void mglGenProgramPipelines(GLMContext ctx, GLsizei n, GLuint *pipelines)
+{
+    ERROR_CHECK_RETURN(n >= 0, GL_INVALID_VALUE);
+
+    while (n-- > 0)
+    {
+        *pipelines++ = getNewName(&STATE(program_pipeline_table));
+    }
+}
+
+void mglCreateProgramPipelines(GLMContext ctx, GLsizei n, GLuint *pipelines)
+{
+    ERROR_CHECK_RETURN(n >= 0, GL_INVALID_VALUE);
+
+    while (n-- > 0)
+    {
+        GLuint pipeline;
+
+        pipeline = getNewName(&STATE(program_pipeline_table));
+
+        getProgramPipeline(ctx, pipeline);
+
+        *pipelines++ = pipeline;
+    }
+}
+
+void mglDeleteProgramPipelines(GLMContext ctx, GLsizei n, const GLuint *pipelines)
+{
+    while (n-- > 0)
+    {
+        ProgramPipeline *ptr;
+        GLuint pipeline;
+
+        pipeline = *pipelines++;
+
+        ptr = findProgramPipeline(ctx, pipeline);
+
+        if (ptr == NULL)
+            continue;
+
+        if (STATE(program_pipeline) == ptr)
+        {
+            STATE(program_pipeline) = NULL;
+            STATE_VAR(program_pipeline_binding) = 0;
+
+            if (ctx->state.program == &ptr->program)
+            {
+                ctx->state.program = NULL;
+                ctx->state.dirty_bits |= DIRTY_PROGRAM;
+            }
+        }
+
+        deleteSlotMapElement(&STATE(program_pipeline_table), pipeline);
+
+        for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+        {
+            setPipelineStageProgram(ctx, ptr, stage, 0);
+        }
+
+        free(ptr->program.uniform_constants.data);
+        freeProgramReflection(&ptr->program);
+        free(ptr->info_log);
+        free(ptr);
+    }
+}
+
+void mglBindProgramPipeline(GLMContext ctx, GLuint pipeline)
+{
+    ProgramPipeline *ptr;
+
+    if (pipeline)
+    {
+        ptr = getProgramPipeline(ctx, pipeline);
+
+        if (ptr == NULL)
+            return;
+
+        updateProgramPipeline(ctx, ptr);
+    }
+    else
+    {
+        ptr = NULL;
+    }
+
+    STATE(program_pipeline) = ptr;
+    STATE_VAR(program_pipeline_binding) = pipeline;
+
+    // glUseProgram wins over the pipeline
+    if (STATE_VAR(current_program))
+        return;
+
+    ctx->state.program = ptr ? &ptr->program : NULL;
+    ctx->state.dirty_bits |= DIRTY_PROGRAM;
+}
+
+void mglUseProgramStages(GLMContext ctx, GLuint pipeline, GLbitfield stages, GLuint program)
+{
+    ProgramPipeline *ptr;
+    Program *pptr;
+
+    if ((stages != GL_ALL_SHADER_BITS) && (stages & ~PIPELINE_STAGE_BITS))
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (pipeline == 0)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    ptr = getProgramPipeline(ctx, pipeline);
+    if (ptr == NULL)
+        return;
+
+    pptr = NULL;
+
+    if (program)
+    {
+        pptr = findProgram(ctx, program);
+
+        if (pptr == NULL)
+        {
+            ERROR_RETURN(GL_INVALID_VALUE);
+            return;
+        }
+
+        finishProgramLink(ctx, pptr);
+
+        if ((pptr->separable == GL_FALSE) || (pptr->linked == GL_FALSE))
+        {
+            ERROR_RETURN(GL_INVALID_OPERATION);
+            return;
+        }
+    }
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        if ((stages & pipeline_stages[stage].bit) == 0)
+            continue;
+
+        // a program without the stage leaves it empty
+        if (pptr && pptr->shader_slots[stage])
+        {
+            setPipelineStageProgram(ctx, ptr, stage, program);
+        }
+        else
+        {
+            setPipelineStageProgram(ctx, ptr, stage, 0);
+        }
+    }
+
+    // combined the next time the pipeline is bound or drawn with
+    ptr->dirty = GL_TRUE;
+}
+
+void mglActiveShaderProgram(GLMContext ctx, GLuint pipeline, GLuint program)
+{
+    ProgramPipeline *ptr;
+
+    if (pipeline == 0)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    ptr = getProgramPipeline(ctx, pipeline);
+    if (ptr == NULL)
+        return;
+
+    if (program)
+    {
+        Program *pptr;
+
+        pptr = findProgram(ctx, program);
+
+        if (pptr == NULL)
+        {
+            ERROR_RETURN(GL_INVALID_VALUE);
+            return;
+        }
+
+        finishProgramLink(ctx, pptr);
+
+        if (pptr->linked == GL_FALSE)
+        {
+            ERROR_RETURN(GL_INVALID_OPERATION);
+            return;
+        }
+    }
+
+    ptr->active_program = program;
+}
+
+void mglValidateProgramPipeline(GLMContext ctx, GLuint pipeline)
+{
+    ProgramPipeline *ptr;
+
+    if (pipeline == 0)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    ptr = getProgramPipeline(ctx, pipeline);
+    if (ptr == NULL)
+        return;
+
+    updateProgramPipeline(ctx, ptr);
+}
+
+void mglGetProgramPipelineiv(GLMContext ctx, GLuint pipeline, GLenum pname, GLint *params)
+{
+    ProgramPipeline *ptr;
+
+    ptr = findProgramPipeline(ctx, pipeline);
+
+    if (ptr == NULL)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    switch (pname)
+    {
+    case GL_ACTIVE_PROGRAM:
+        *params = ptr->active_program;
+        break;
+
+    case GL_VALIDATE_STATUS:
+        updateProgramPipeline(ctx, ptr);
+        *params = ptr->valid;
+        break;
+
+    case GL_INFO_LOG_LENGTH:
+        updateProgramPipeline(ctx, ptr);
+        *params = ptr->info_log ? (GLint)strlen(ptr->info_log) + 1 : 0;
+        break;
+
+    default:
+        for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+        {
+            if (pipeline_stages[stage].type == pname)
+            {
+                *params = ptr->programs[stage];
+                return;
+            }
+        }
+
+        ERROR_RETURN(GL_INVALID_ENUM);
+        break;
+    }
+}
+
+void mglGetProgramPipelineInfoLog(GLMContext ctx, GLuint pipeline, GLsizei bufSize, GLsizei *length, GLchar *infoLog)
+{
+    ProgramPipeline *ptr;
+    GLsizei len;
+
+    ptr = findProgramPipeline(ctx, pipeline);
+
+    if (ptr == NULL)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    updateProgramPipeline(ctx, ptr);
+
+    len = 0;
+
+    if (ptr->info_log && infoLog && (bufSize > 0))
+    {
+        len = (GLsizei)strlen(ptr->info_log);
+
+        if (len > bufSize - 1)
+            len = bufSize - 1;
+
+        memcpy(infoLog, ptr->info_log, len);
+    }
+
+    if (infoLog && (bufSize > 0))
+        infoLog[len] = 0;
+
+    if (length)
+        *length = len;
+}
@@ -0,0 +1,515 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * program_resources.c
+ * MGL
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "spirv_cross_c.h"
+
+#include "programs.h"
+#include "spirv_opt.h"
+#include "glm_context.h"
+
+// which reflected resources answer for each program interface, blocks are indexed by their binding like
+// glGetUniformBlockIndex always has, the rest are numbered in the order they are found
+static const struct
+{
+    GLenum interface;
+    int res_type;
+    bool index_is_binding;
+} resource_interfaces[] = {
+    {GL_UNIFORM, SPVC_RESOURCE_TYPE_UNIFORM_CONSTANT, false},
+    {GL_UNIFORM_BLOCK, SPVC_RESOURCE_TYPE_UNIFORM_BUFFER, true},
+    {GL_SHADER_STORAGE_BLOCK, SPVC_RESOURCE_TYPE_STORAGE_BUFFER, true},
+    {GL_PROGRAM_INPUT, SPVC_RESOURCE_TYPE_STAGE_INPUT, false},
+    {GL_PROGRAM_OUTPUT, SPVC_RESOURCE_TYPE_STAGE_OUTPUT, false},
+};
+
+#define NUM_RESOURCE_INTERFACES (int)(sizeof(resource_interfaces) / sizeof(resource_interfaces[0]))
+
+#pragma mark hashing
+// 32 bit FNV-1a
+static GLuint hashName(const char *name)
+{
+    GLuint hash;
+
+    hash = 0x811c9dc5;
+
+    for (const char *c = name; *c; c++)
+    {
+        hash ^= (GLubyte)*c;
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+// the interface is mixed in so the same name can live in more than one interface
+static GLuint hashResourceName(GLenum interface, const char *name)
+{
+    return hashName(name) ^ (interface * 0x9e3779b9);
+}
+
+static ProgramResourceName *findSlot(ProgramResourceIndex *index, GLenum interface, const char *name, GLuint hash)
+{
+    GLuint slot;
+
+    slot = hash & index->mask;
+
+    while (index->slots[slot].name)
+    {
+        ProgramResourceName *entry;
+
+        entry = &index->slots[slot];
+
+        if ((entry->hash == hash) && (entry->interface == interface) && !strcmp(entry->name, name))
+            return entry;
+
+        slot = (slot + 1) & index->mask;
+    }
+
+    // the empty slot the name would go in
+    return &index->slots[slot];
+}
+
+#pragma mark reflection
+SpirvReflection *newStageReflection(const GLuint count[_MAX_SPIRV_RES], size_t names_len)
+{
+    SpirvReflection *reflection;
+    size_t resource_count;
+
+    resource_count = 0;
+    for (int res_type = 0; res_type < _MAX_SPIRV_RES; res_type++)
+        resource_count += count[res_type];
+
+    reflection = (SpirvReflection *)malloc(sizeof(SpirvReflection) + resource_count * sizeof(SpirvResource) +
+                                           names_len);
+    assert(reflection);
+
+    memcpy(reflection->count, count, sizeof(reflection->count));
+    reflection->resources = (SpirvResource *)(reflection + 1);
+    reflection->names = (char *)(reflection->resources + resource_count);
+    reflection->names_len = 0;
+
+    return reflection;
+}
+
+const char *addStageReflectionName(SpirvReflection *reflection, const char *name)
+{
+    char *str;
+    size_t len;
+
+    len = strlen(name) + 1;
+
+    str = reflection->names + reflection->names_len;
+    memcpy(str, name, len);
+    reflection->names_len += len;
+
+    return str;
+}
+
+void freeProgramReflection(Program *ptr)
+{
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        free(ptr->spirv[stage].reflection);
+        ptr->spirv[stage].reflection = NULL;
+    }
+
+    free(ptr->reflection.resources);
+
+    bzero(&ptr->reflection, sizeof(ProgramReflection));
+}
+
+// names repeat between stages, a vertex output is the fragment input, blocks are shared...
+static const char *internName(const char **pool, GLuint mask, char **names, const char *name)
+{
+    GLuint slot;
+    size_t len;
+
+    slot = hashName(name) & mask;
+
+    while (pool[slot])
+    {
+        if (!strcmp(pool[slot], name))
+            return pool[slot];
+
+        slot = (slot + 1) & mask;
+    }
+
+    len = strlen(name) + 1;
+
+    memcpy(*names, name, len);
+    pool[slot] = *names;
+    *names += len;
+
+    return pool[slot];
+}
+
+void commitProgramReflection(Program *ptr)
+{
+    SpirvResource *resources;
+    const char **pool;
+    char *names;
+    size_t names_len;
+    GLuint count, slots, offset;
+
+    count = 0;
+    names_len = 0;
+    ptr->draw_parameters = GL_FALSE;
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        SpirvReflection *reflection;
+
+        if (spirvReadsDrawParameters(ptr->spirv[stage].ir, ptr->spirv[stage].size))
+            ptr->draw_parameters = GL_TRUE;
+
+        reflection = ptr->spirv[stage].reflection;
+
+        if (reflection == NULL)
+            continue;
+
+        for (int res_type = 0; res_type < _MAX_SPIRV_RES; res_type++)
+            count += reflection->count[res_type];
+
+        names_len += reflection->names_len;
+    }
+
+    // one allocation for the program, the names go right after the resources
+    resources = NULL;
+    names = NULL;
+
+    if (count)
+    {
+        resources = (SpirvResource *)malloc(count * sizeof(SpirvResource) + names_len);
+        assert(resources);
+
+        names = (char *)(resources + count);
+    }
+
+    slots = 8;
+    while (slots < count * 2)
+        slots <<= 1;
+
+    pool = (const char **)calloc(slots, sizeof(const char *));
+    assert(pool);
+
+    offset = 0;
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        SpirvReflection *reflection;
+        SpirvResource *src;
+
+        reflection = ptr->spirv[stage].reflection;
+        src = reflection ? reflection->resources : NULL;
+
+        for (int res_type = 0; res_type < _MAX_SPIRV_RES; res_type++)
+        {
+            ptr->reflection.offsets[PROGRAM_RESOURCE_RUN(stage, res_type)] = offset;
+
+            if (reflection == NULL)
+                continue;
+
+            for (GLuint i = 0; i < reflection->count[res_type]; i++)
+            {
+                resources[offset] = *src++;
+                resources[offset].name = internName(pool, slots - 1, &names, resources[offset].name);
+                offset++;
+            }
+        }
+
+        free(reflection);
+        ptr->spirv[stage].reflection = NULL;
+    }
+
+    ptr->reflection.offsets[_MAX_SHADER_TYPES * _MAX_SPIRV_RES] = offset;
+
+    free(pool);
+
+    free(ptr->reflection.resources);
+    ptr->reflection.resources = resources;
+}
+
+// a pipeline's combined program takes each stage's runs from the program used for that stage, the names stay
+// in the stage programs' arenas and the pipeline combines its stages again whenever one of them relinks
+void combineProgramReflection(Program *ptr, Program *const stages[_MAX_SHADER_TYPES])
+{
+    SpirvResource *resources;
+    GLuint count, offset;
+
+    count = 0;
+    ptr->draw_parameters = GL_FALSE;
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        if (stages[stage] == NULL)
+            continue;
+
+        if (stages[stage]->draw_parameters)
+            ptr->draw_parameters = GL_TRUE;
+
+        for (int res_type = 0; res_type < _MAX_SPIRV_RES; res_type++)
+            count += PROGRAM_RESOURCE_COUNT(stages[stage], stage, res_type);
+    }
+
+    resources = NULL;
+
+    if (count)
+    {
+        resources = (SpirvResource *)malloc(count * sizeof(SpirvResource));
+        assert(resources);
+    }
+
+    offset = 0;
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        for (int res_type = 0; res_type < _MAX_SPIRV_RES; res_type++)
+        {
+            GLuint run;
+
+            ptr->reflection.offsets[PROGRAM_RESOURCE_RUN(stage, res_type)] = offset;
+
+            if (stages[stage] == NULL)
+                continue;
+
+            run = PROGRAM_RESOURCE_COUNT(stages[stage], stage, res_type);
+
+            memcpy(&resources[offset], PROGRAM_RESOURCES(stages[stage], stage, res_type), run * sizeof(SpirvResource));
+            offset += run;
+        }
+    }
+
+    ptr->reflection.offsets[_MAX_SHADER_TYPES * _MAX_SPIRV_RES] = offset;
+
+    free(ptr->reflection.resources);
+    ptr->reflection.resources = resources;
+}
+
+#pragma mark resource index
+// the stages whose inputs and outputs face the app, vertex attributes in and fragment outputs out
+static void programInterfaceStages(Program *ptr, GLenum interface, int *first, int *last)
+{
+    *first = _VERTEX_SHADER;
+    *last = _MAX_SHADER_TYPES - 1;
+
+    if ((interface != GL_PROGRAM_INPUT) && (interface != GL_PROGRAM_OUTPUT))
+        return;
+
+    while ((*first < _MAX_SHADER_TYPES) && (ptr->shader_slots[*first] == NULL))
+        (*first)++;
+
+    while ((*last > *first) && (ptr->shader_slots[*last] == NULL))
+        (*last)--;
+
+    if (interface == GL_PROGRAM_INPUT)
+        *last = *first;
+    else
+        *first = *last;
+}
+
+void freeProgramResourceIndex(Program *ptr)
+{
+    free(ptr->resource_index.slots);
+
+    bzero(&ptr->resource_index, sizeof(ProgramResourceIndex));
+}
+
+void buildProgramResourceIndex(Program *ptr)
+{
+    ProgramResourceIndex *index;
+    GLuint count, slots;
+
+    index = &ptr->resource_index;
+
+    freeProgramResourceIndex(ptr);
+
+    count = 0;
+
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        for (int i = 0; i < NUM_RESOURCE_INTERFACES; i++)
+            count += PROGRAM_RESOURCE_COUNT(ptr, stage, resource_interfaces[i].res_type);
+    }
+
+    // at most half full keeps the probes short
+    slots = 8;
+    while (slots < count * 2)
+        slots <<= 1;
+
+    index->mask = slots - 1;
+    index->slots = (ProgramResourceName *)calloc(slots, sizeof(ProgramResourceName));
+    assert(index->slots);
+
+    for (int i = 0; i < NUM_RESOURCE_INTERFACES; i++)
+    {
+        GLenum interface;
+        GLuint next_index;
+        int first, last;
+
+        interface = resource_interfaces[i].interface;
+        next_index = 0;
+
+        programInterfaceStages(ptr, interface, &first, &last);
+
+        // a name used by more than one stage keeps what the first stage reflected
+        for (int stage = first; stage <= last; stage++)
+        {
+            SpirvResource *resources;
+            GLuint run;
+
+            resources = PROGRAM_RESOURCES(ptr, stage, resource_interfaces[i].res_type);
+            run = PROGRAM_RESOURCE_COUNT(ptr, stage, resource_interfaces[i].res_type);
+
+            for (GLuint j = 0; j < run; j++)
+            {
+                SpirvResource *res;
+                ProgramResourceName *entry;
+                GLuint hash;
+
+                res = &resources[j];
+                hash = hashResourceName(interface, res->name);
+                entry = findSlot(index, interface, res->name, hash);
+
+                if (entry->name)
+                    continue;
+
+                entry->name = res->name;
+                entry->hash = hash;
+                entry->interface = interface;
+
+                if (resource_interfaces[i].index_is_binding)
+                {
+                    entry->index = res->binding;
+                    entry->location = -1;
+                }
+                else
+                {
+                    entry->index = next_index++;
+                    entry->location = (interface == GL_UNIFORM) ? res->binding : res->location;
+                }
+            }
+        }
+    }
+}
+
+const ProgramResourceName *findProgramResource(Program *ptr, GLenum interface, const char *name)
+{
+    ProgramResourceName *entry;
+
+    if (ptr->resource_index.slots == NULL)
+        return NULL;
+
+    entry = findSlot(&ptr->resource_index, interface, name, hashResourceName(interface, name));
+
+    if (entry->name == NULL)
+        return NULL;
+
+    return entry;
+}
+
+#pragma mark program interface queries
+static bool isIndexedInterface(GLenum interface)
+{
+    for (int i = 0; i < NUM_RESOURCE_INTERFACES; i++)
+    {
+        if (resource_interfaces[i].interface == interface)
+            return true;
+    }
+
+    return false;
+}
+
+GLuint mglGetProgramResourceIndex(GLMContext ctx, GLuint program, GLenum programInterface, const GLchar *name)
+{
+    const ProgramResourceName *entry;
+    Program *ptr;
+
+    if (isProgram(ctx, program) == GL_FALSE)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return GL_INVALID_INDEX;
+    }
+
+    if (isIndexedInterface(programInterface) == false)
+    {
+        ERROR_RETURN(GL_INVALID_ENUM);
+        return GL_INVALID_INDEX;
+    }
+
+    ptr = getProgram(ctx, program);
+    assert(ptr);
+
+    finishProgramLink(ctx, ptr);
+
+    if (ptr->linked == GL_FALSE)
+        return GL_INVALID_INDEX;
+
+    entry = findProgramResource(ptr, programInterface, name);
+
+    if (entry == NULL)
+        return GL_INVALID_INDEX;
+
+    return entry->index;
+}
+
+GLint mglGetProgramResourceLocation(GLMContext ctx, GLuint program, GLenum programInterface, const GLchar *name)
+{
+    const ProgramResourceName *entry;
+    Program *ptr;
+
+    if (isProgram(ctx, program) == GL_FALSE)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return -1;
+    }
+
+    switch (programInterface)
+    {
+    case GL_UNIFORM:
+    case GL_PROGRAM_INPUT:
+    case GL_PROGRAM_OUTPUT:
+        break;
+
+    default:
+        ERROR_RETURN(GL_INVALID_ENUM);
+        return -1;
+    }
+
+    ptr = getProgram(ctx, program);
+    assert(ptr);
+
+    finishProgramLink(ctx, ptr);
+
+    if (ptr->linked == GL_FALSE)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return -1;
+    }
+
+    entry = findProgramResource(ptr, programInterface, name);
+
+    if (entry == NULL)
+        return -1;
+
+    return entry->location;
+}
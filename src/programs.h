@@ -11,7 +11,36 @@
 #include "glcorearb.h"
 #include "glm_context.h"
 
+// the only format glGetProgramBinary hands out, "MGLB"
+#define MGL_PROGRAM_BINARY_FORMAT 0x42474c4d
+
 int isProgram(GLMContext ctx, GLuint program);
 Program *getProgram(GLMContext ctx, GLuint program);
+Program *findProgram(GLMContext ctx, GLuint program);
+
+// a program deleted while in use is freed when the last use goes away
+void releaseProgram(GLMContext ctx, Program *ptr);
+
+// linkProgram runs on the compile queue, finishProgramLink joins it on the context's thread
+void linkProgram(GLMContext ctx, Program *pptr);
+void finishProgramLink(GLMContext ctx, Program *pptr);
+
+// reflection is staged per stage while a program links and committed to one arena when it's done
+SpirvReflection *newStageReflection(const GLuint count[_MAX_SPIRV_RES], size_t names_len);
+const char *addStageReflectionName(SpirvReflection *reflection, const char *name);
+void commitProgramReflection(Program *ptr);
+void freeProgramReflection(Program *ptr);
+void combineProgramReflection(Program *ptr, Program *const stages[_MAX_SHADER_TYPES]);
+
+// name to index and location lookups, built when a link succeeds
+void buildProgramResourceIndex(Program *ptr);
+void freeProgramResourceIndex(Program *ptr);
+const ProgramResourceName *findProgramResource(Program *ptr, GLenum interface, const char *name);
+
+// a bound pipeline in use combines its stages again before a draw or dispatch if one of them changed, false if
+// the stages don't validate
+bool refreshProgramPipeline(GLMContext ctx);
+
+GLubyte *getUniformConstantStorage(GLMContext ctx, Program *program, GLint location, GLsizei size);
 
 #endif /* programs_h */
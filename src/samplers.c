@@ -71,13 +71,19 @@ Sampler *getSampler(GLMContext ctx, GLuint sampler)
 {
     Sampler *ptr;
 
-    ptr = (Sampler *)searchHashTable(&STATE(sampler_table), sampler);
+    ptr = (Sampler *)searchSlotMap(&STATE(sampler_table), sampler);
 
     if (!ptr)
     {
+        // a deleted name whose slot went to another object
+        if (isStaleSlotMapName(&STATE(sampler_table), sampler))
+        {
+            ERROR_RETURN_VALUE(GL_INVALID_OPERATION, NULL);
+        }
+
         ptr = newSampler(ctx, sampler);
 
-        insertHashElement(&STATE(sampler_table), sampler, ptr);
+        insertSlotMapElement(&STATE(sampler_table), sampler, ptr);
     }
 
     return ptr;
@@ -87,7 +93,7 @@ bool isSampler(GLMContext ctx, GLuint sampler)
 {
     Sampler *ptr;
 
-    ptr = (Sampler *)searchHashTable(&STATE(sampler_table), sampler);
+    ptr = (Sampler *)searchSlotMap(&STATE(sampler_table), sampler);
 
     if (ptr)
         return true;
@@ -99,7 +105,7 @@ Sampler *findSampler(GLMContext ctx, GLuint sampler)
 {
     Sampler *ptr;
 
-    ptr = (Sampler *)searchHashTable(&STATE(sampler_table), sampler);
+    ptr = (Sampler *)searchSlotMap(&STATE(sampler_table), sampler);
 
     return ptr;
 }
@@ -173,7 +179,7 @@ void mglDeleteSamplers(GLMContext ctx, GLsizei count, const GLuint *samplers)
                 }
             }
 
-            deleteHashElement(&ctx->state.sampler_table, sampler);
+            deleteSlotMapElement(&ctx->state.sampler_table, sampler);
 
             if (ptr->mtl_data)
             {
@@ -182,6 +188,11 @@ void mglDeleteSamplers(GLMContext ctx, GLsizei count, const GLuint *samplers)
 
             free(ptr);
         }
+        else
+        {
+            // generated but never bound, release the reserved name
+            deleteSlotMapElement(&ctx->state.sampler_table, sampler);
+        }
     }
 }
 
@@ -251,7 +262,8 @@ void mglSamplerParameteri(GLMContext ctx, GLuint sampler, GLenum pname, GLint pa
 
     ptr = getSampler(ctx, sampler);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_OPERATION);
+    if (ptr == NULL)
+        return;
 
     if (setParam(ctx, &ptr->params, pname, 0, param))
     {
@@ -266,7 +278,8 @@ void mglSamplerParameteriv(GLMContext ctx, GLuint sampler, GLenum pname, const G
 
     ptr = getSampler(ctx, sampler);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_OPERATION);
+    if (ptr == NULL)
+        return;
 
     if (setTexParamsi(ctx, &ptr->params, pname, param))
     {
@@ -288,7 +301,8 @@ void mglSamplerParameterIiv(GLMContext ctx, GLuint sampler, GLenum pname, const
 
     ptr = getSampler(ctx, sampler);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_OPERATION);
+    if (ptr == NULL)
+        return;
 
     if (setTexParamsIiv(ctx, &ptr->params, pname, param))
     {
@@ -317,7 +331,8 @@ void mglSamplerParameterIuiv(GLMContext ctx, GLuint sampler, GLenum pname, const
 
     ptr = getSampler(ctx, sampler);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_OPERATION);
+    if (ptr == NULL)
+        return;
 
     if (setTexParamsIuiv(ctx, &ptr->params, pname, param))
     {
@@ -0,0 +1,840 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * shader_cache.c
+ * MGL
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "spirv_cross_c.h"
+
+#include "glm_context.h"
+#include "shader_cache.h"
+#include "programs.h"
+
+#define SHADER_CACHE_MAGIC 0x5348474d // "MGHS"
+#define SHADER_CACHE_VERSION 1        // bump whenever the layout below or the translation settings change
+#define SHADER_CACHE_FILE "shaders.mglcache"
+#define SHADER_CACHE_DEFAULT_SIZE 64  // megabytes
+#define SHADER_CACHE_DEFAULT_MEMORY 64 // megabytes
+#define SHADER_CACHE_FLUSH_INTERVAL 5 // seconds between flushes requested by swaps
+#define SHADER_CACHE_TOUCH_INTERVAL (24 * 60 * 60)
+
+#define SHADER_CACHE_ALIGN(_size_) (((_size_) + 7) & ~(size_t)7)
+
+// the file is a header followed by entry_count entries, each entry is a ShaderCacheFileEntry followed
+// by its payload padded to 8 bytes
+typedef struct ShaderCacheFileHeader_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t max_spirv_res;
+    uint32_t entry_count;
+} ShaderCacheFileHeader;
+
+typedef struct ShaderCacheFileEntry_t
+{
+    ShaderCacheKey key;
+    uint64_t last_used;
+    uint32_t size;
+    uint32_t pad;
+} ShaderCacheFileEntry;
+
+// payload is followed by the resources, the spirv words, the resource names, the msl and the entry point
+typedef struct ShaderCachePayload_t
+{
+    uint32_t stage;
+    uint32_t spirv_size; // words
+    uint32_t msl_len;    // string lengths include the terminator
+    uint32_t entry_point_len;
+    uint32_t local_workgroup_size[3];
+    uint32_t resource_count[_MAX_SPIRV_RES];
+} ShaderCachePayload;
+
+typedef struct ShaderCacheResource_t
+{
+    uint32_t _id;
+    uint32_t base_type_id;
+    uint32_t type_id;
+    uint32_t set;
+    uint32_t binding;
+    uint32_t location;
+    uint32_t name_len;
+} ShaderCacheResource;
+
+typedef struct ShaderCacheRecord_t
+{
+    ShaderCacheKey key;
+    uint64_t last_used;
+    uint32_t size;
+    bool owned; // payload was built by this process, otherwise it points into a mapped file
+    const ShaderCachePayload *payload;
+} ShaderCacheRecord;
+
+typedef struct ShaderCacheMapping_t
+{
+    void *addr;
+    size_t size;
+} ShaderCacheMapping;
+
+static struct
+{
+    pthread_mutex_t lock;
+
+    bool disk;
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    size_t size_limit;
+    size_t memory_limit;
+
+    // open addressed on the low key word, an empty record has no payload
+    GLuint count;
+    GLuint capacity;
+    ShaderCacheRecord *records;
+    size_t total_size;
+    size_t owned_size; // payload bytes allocated by this process, mapped payloads are backed by the file
+
+    // mapped files stay mapped for the life of the process, records point into them
+    GLuint map_count;
+    ShaderCacheMapping *maps;
+
+    // identity of the file last mapped or written, a different file was written by another process
+    dev_t dev;
+    ino_t ino;
+
+    bool dirty;
+    time_t last_flush;
+} cache;
+
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+#pragma mark Hashing
+// 128 bit FNV-1a
+static const __uint128_t fnv_prime = ((__uint128_t)0x0000000001000000ull << 64) | 0x000000000000013Bull;
+static const __uint128_t fnv_offset = ((__uint128_t)0x6c62272e07bb0142ull << 64) | 0x62b821756295c58dull;
+
+void hashShaderCacheKey(ShaderCacheKey *key, const void *data, size_t size)
+{
+    const uint8_t *bytes;
+    __uint128_t hash;
+
+    bytes = (const uint8_t *)data;
+    hash = ((__uint128_t)key->hash[1] << 64) | key->hash[0];
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= fnv_prime;
+    }
+
+    key->hash[0] = (uint64_t)hash;
+    key->hash[1] = (uint64_t)(hash >> 64);
+}
+
+void initShaderCacheKey(ShaderCacheKey *key)
+{
+    uint32_t version[4];
+
+    key->hash[0] = (uint64_t)fnv_offset;
+    key->hash[1] = (uint64_t)(fnv_offset >> 64);
+
+    // a new spirv-cross can translate the same spirv differently
+    version[0] = SHADER_CACHE_VERSION;
+    spvc_get_version(&version[1], &version[2], &version[3]);
+
+    hashShaderCacheKey(key, version, sizeof(version));
+}
+
+static bool keysEqual(const ShaderCacheKey *a, const ShaderCacheKey *b)
+{
+    return (a->hash[0] == b->hash[0]) && (a->hash[1] == b->hash[1]);
+}
+
+#pragma mark Records
+static ShaderCacheRecord *findRecord(const ShaderCacheKey *key)
+{
+    GLuint index;
+
+    if (cache.capacity == 0)
+        return NULL;
+
+    index = (GLuint)key->hash[0] & (cache.capacity - 1);
+
+    while (cache.records[index].payload)
+    {
+        if (keysEqual(&cache.records[index].key, key))
+            return &cache.records[index];
+
+        index = (index + 1) & (cache.capacity - 1);
+    }
+
+    return NULL;
+}
+
+static void insertRecord(const ShaderCacheRecord *record)
+{
+    GLuint index;
+
+    index = (GLuint)record->key.hash[0] & (cache.capacity - 1);
+
+    while (cache.records[index].payload)
+        index = (index + 1) & (cache.capacity - 1);
+
+    cache.records[index] = *record;
+    cache.count++;
+    cache.total_size += sizeof(ShaderCacheFileEntry) + SHADER_CACHE_ALIGN(record->size);
+
+    if (record->owned)
+        cache.owned_size += record->size;
+}
+
+static void resizeRecords(GLuint capacity)
+{
+    ShaderCacheRecord *old_records;
+    GLuint old_capacity;
+
+    old_records = cache.records;
+    old_capacity = cache.capacity;
+
+    cache.records = (ShaderCacheRecord *)malloc(sizeof(ShaderCacheRecord) * capacity);
+    assert(cache.records);
+    bzero(cache.records, sizeof(ShaderCacheRecord) * capacity);
+
+    cache.capacity = capacity;
+    cache.count = 0;
+    cache.total_size = 0;
+    cache.owned_size = 0;
+
+    for (GLuint i = 0; i < old_capacity; i++)
+    {
+        if (old_records[i].payload)
+            insertRecord(&old_records[i]);
+    }
+
+    free(old_records);
+}
+
+// returns false if the key is already cached, the caller still owns the payload then
+static bool addRecord(const ShaderCacheKey *key, uint64_t last_used, uint32_t size, const void *payload, bool owned)
+{
+    ShaderCacheRecord record;
+
+    if (findRecord(key))
+        return false;
+
+    // keep the load factor under a half
+    if ((cache.count + 1) * 2 > cache.capacity)
+        resizeRecords(cache.capacity ? cache.capacity * 2 : 256);
+
+    record.key = *key;
+    record.last_used = last_used;
+    record.size = size;
+    record.owned = owned;
+    record.payload = (const ShaderCachePayload *)payload;
+
+    insertRecord(&record);
+
+    return true;
+}
+
+#pragma mark Cache File
+static void makeCacheDirectory(char *dir)
+{
+    // mkdir -p
+    for (char *p = dir + 1; *p; p++)
+    {
+        if (*p == '/')
+        {
+            *p = 0;
+            mkdir(dir, 0755);
+            *p = '/';
+        }
+    }
+
+    mkdir(dir, 0755);
+}
+
+static void mapCacheFile(void)
+{
+    int fd;
+    struct stat st;
+    void *addr;
+    const ShaderCacheFileHeader *header;
+    size_t offset;
+
+    fd = open(cache.path, O_RDONLY);
+
+    if (fd < 0)
+        return;
+
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(ShaderCacheFileHeader))
+    {
+        close(fd);
+        return;
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED)
+        return;
+
+    cache.dev = st.st_dev;
+    cache.ino = st.st_ino;
+
+    header = (const ShaderCacheFileHeader *)addr;
+
+    if ((header->magic != SHADER_CACHE_MAGIC) || (header->version != SHADER_CACHE_VERSION) ||
+        (header->max_spirv_res != _MAX_SPIRV_RES))
+    {
+        munmap(addr, st.st_size);
+        return;
+    }
+
+    cache.maps = (ShaderCacheMapping *)realloc(cache.maps, sizeof(ShaderCacheMapping) * (cache.map_count + 1));
+    assert(cache.maps);
+    cache.maps[cache.map_count].addr = addr;
+    cache.maps[cache.map_count].size = st.st_size;
+    cache.map_count++;
+
+    // only the entry headers are touched here, payloads are validated when they are first loaded
+    offset = sizeof(ShaderCacheFileHeader);
+
+    for (GLuint i = 0; i < header->entry_count; i++)
+    {
+        const ShaderCacheFileEntry *entry;
+
+        if (offset + sizeof(ShaderCacheFileEntry) > (size_t)st.st_size)
+            break;
+
+        entry = (const ShaderCacheFileEntry *)((const uint8_t *)addr + offset);
+        offset += sizeof(ShaderCacheFileEntry);
+
+        if ((entry->size < sizeof(ShaderCachePayload)) || (offset + entry->size > (size_t)st.st_size))
+            break;
+
+        addRecord(&entry->key, entry->last_used, entry->size, (const uint8_t *)addr + offset, false);
+
+        offset += SHADER_CACHE_ALIGN(entry->size);
+    }
+}
+
+static void flushShaderCacheAtExit(void)
+{
+    flushShaderCache(true);
+}
+
+static void defaultCacheDirectory(char *dir, size_t size)
+{
+#ifdef __APPLE__
+    if (getenv("HOME"))
+        snprintf(dir, size, "%s/Library/Caches/MGL", getenv("HOME"));
+#else
+    const char *xdg_cache;
+
+    // the xdg base directory spec ignores relative paths
+    xdg_cache = getenv("XDG_CACHE_HOME");
+
+    if (xdg_cache && (xdg_cache[0] == '/'))
+    {
+        snprintf(dir, size, "%s/MGL", xdg_cache);
+    }
+    else if (getenv("HOME"))
+    {
+        snprintf(dir, size, "%s/.cache/MGL", getenv("HOME"));
+    }
+#endif
+}
+
+static void initShaderCache(void)
+{
+    const char *env;
+
+    pthread_mutex_init(&cache.lock, NULL);
+
+    cache.size_limit = (size_t)SHADER_CACHE_DEFAULT_SIZE * 1024 * 1024;
+    cache.memory_limit = (size_t)SHADER_CACHE_DEFAULT_MEMORY * 1024 * 1024;
+
+    env = getenv("MGL_SHADER_CACHE_SIZE");
+    if (env)
+        cache.size_limit = (size_t)strtoul(env, NULL, 10) * 1024 * 1024;
+
+    env = getenv("MGL_SHADER_CACHE_MEMORY");
+    if (env)
+        cache.memory_limit = (size_t)strtoul(env, NULL, 10) * 1024 * 1024;
+
+    env = getenv("MGL_SHADER_CACHE_DIR");
+    if (env)
+    {
+        snprintf(cache.dir, sizeof(cache.dir), "%s", env);
+    }
+    else
+    {
+        defaultCacheDirectory(cache.dir, sizeof(cache.dir));
+    }
+
+    cache.disk = (cache.dir[0] != 0) && (cache.size_limit != 0);
+
+    if (cache.disk == false)
+        return;
+
+    snprintf(cache.path, sizeof(cache.path), "%s/%s", cache.dir, SHADER_CACHE_FILE);
+
+    makeCacheDirectory(cache.dir);
+    mapCacheFile();
+
+    cache.last_flush = time(NULL);
+
+    atexit(flushShaderCacheAtExit);
+}
+
+#pragma mark Serialization
+// payloads can come from disk or from the app, check every length before trusting them
+bool deserializeProgramStage(Program *ptr, int stage, const void *data, size_t size)
+{
+    const ShaderCachePayload *payload;
+    const ShaderCacheResource *resources;
+    SpirvReflection *reflection;
+    const uint8_t *cursor, *end;
+    const unsigned int *spirv;
+    const char *names, *msl_str, *entry_point;
+    size_t resource_count, names_len;
+
+    if (size < sizeof(ShaderCachePayload))
+        return false;
+
+    payload = (const ShaderCachePayload *)data;
+    end = (const uint8_t *)data + size;
+    cursor = (const uint8_t *)(payload + 1);
+
+    if (payload->stage != stage)
+        return false;
+
+    resource_count = 0;
+    for (int res_type = 0; res_type < _MAX_SPIRV_RES; res_type++)
+        resource_count += payload->resource_count[res_type];
+
+    resources = (const ShaderCacheResource *)cursor;
+    if (resource_count > (end - cursor) / sizeof(ShaderCacheResource))
+        return false;
+    cursor += resource_count * sizeof(ShaderCacheResource);
+
+    spirv = (const unsigned int *)cursor;
+    if (payload->spirv_size > (end - cursor) / sizeof(unsigned int))
+        return false;
+    cursor += payload->spirv_size * sizeof(unsigned int);
+
+    names = (const char *)cursor;
+    names_len = 0;
+    for (size_t i = 0; i < resource_count; i++)
+    {
+        if ((resources[i].name_len == 0) || (resources[i].name_len > (size_t)(end - cursor) - names_len) ||
+            names[names_len + resources[i].name_len - 1])
+            return false;
+
+        names_len += resources[i].name_len;
+    }
+    cursor += names_len;
+
+    msl_str = (const char *)cursor;
+    if ((payload->msl_len == 0) || (payload->msl_len > end - cursor) || msl_str[payload->msl_len - 1])
+        return false;
+    cursor += payload->msl_len;
+
+    entry_point = (const char *)cursor;
+    if ((payload->entry_point_len == 0) || (payload->entry_point_len > end - cursor) ||
+        entry_point[payload->entry_point_len - 1])
+        return false;
+
+    // copy out, the program owns its translation the same way it does after a compile
+    ptr->spirv[stage].size = payload->spirv_size;
+    ptr->spirv[stage].ir = (unsigned int *)malloc(payload->spirv_size * sizeof(unsigned int));
+    assert(ptr->spirv[stage].ir);
+    memcpy(ptr->spirv[stage].ir, spirv, payload->spirv_size * sizeof(unsigned int));
+
+    ptr->spirv[stage].msl_str = strdup(msl_str);
+    free(ptr->spirv[stage].entry_point);
+    ptr->spirv[stage].entry_point = strdup(entry_point);
+
+    // staged like a translated stage, the link commits it with the others
+    reflection = newStageReflection(payload->resource_count, names_len);
+
+    for (size_t i = 0; i < resource_count; i++)
+    {
+        SpirvResource *res;
+
+        res = &reflection->resources[i];
+
+        res->_id = resources->_id;
+        res->base_type_id = resources->base_type_id;
+        res->type_id = resources->type_id;
+        res->name = addStageReflectionName(reflection, names);
+        res->set = resources->set;
+        res->binding = resources->binding;
+        res->location = resources->location;
+
+        names += resources->name_len;
+        resources++;
+    }
+
+    free(ptr->spirv[stage].reflection);
+    ptr->spirv[stage].reflection = reflection;
+
+    ptr->local_workgroup_size.x = payload->local_workgroup_size[0];
+    ptr->local_workgroup_size.y = payload->local_workgroup_size[1];
+    ptr->local_workgroup_size.z = payload->local_workgroup_size[2];
+
+    return true;
+}
+
+void *serializeProgramStage(Program *ptr, int stage, size_t *size)
+{
+    ShaderCachePayload *payload;
+    ShaderCacheResource *resources;
+    uint8_t *cursor;
+    const char *entry_point;
+    size_t resource_count, names_len;
+
+    entry_point = ptr->spirv[stage].entry_point;
+
+    assert(ptr->spirv[stage].ir);
+    assert(ptr->spirv[stage].msl_str);
+    assert(entry_point);
+
+    resource_count = 0;
+    names_len = 0;
+    for (int res_type = 0; res_type < _MAX_SPIRV_RES; res_type++)
+    {
+        resource_count += PROGRAM_RESOURCE_COUNT(ptr, stage, res_type);
+
+        for (GLuint i = 0; i < PROGRAM_RESOURCE_COUNT(ptr, stage, res_type); i++)
+            names_len += strlen(PROGRAM_RESOURCES(ptr, stage, res_type)[i].name) + 1;
+    }
+
+    *size = sizeof(ShaderCachePayload) + resource_count * sizeof(ShaderCacheResource) +
+            ptr->spirv[stage].size * sizeof(unsigned int) + names_len + strlen(ptr->spirv[stage].msl_str) + 1 +
+            strlen(entry_point) + 1;
+
+    if (*size > UINT32_MAX)
+        return NULL;
+
+    payload = (ShaderCachePayload *)malloc(*size);
+    assert(payload);
+
+    payload->stage = stage;
+    payload->spirv_size = (uint32_t)ptr->spirv[stage].size;
+    payload->msl_len = (uint32_t)strlen(ptr->spirv[stage].msl_str) + 1;
+    payload->entry_point_len = (uint32_t)strlen(entry_point) + 1;
+    payload->local_workgroup_size[0] = ptr->local_workgroup_size.x;
+    payload->local_workgroup_size[1] = ptr->local_workgroup_size.y;
+    payload->local_workgroup_size[2] = ptr->local_workgroup_size.z;
+
+    resources = (ShaderCacheResource *)(payload + 1);
+    cursor = (uint8_t *)(resources + resource_count) + ptr->spirv[stage].size * sizeof(unsigned int);
+
+    for (int res_type = 0; res_type < _MAX_SPIRV_RES; res_type++)
+    {
+        payload->resource_count[res_type] = PROGRAM_RESOURCE_COUNT(ptr, stage, res_type);
+
+        for (GLuint i = 0; i < payload->resource_count[res_type]; i++)
+        {
+            SpirvResource *res;
+
+            res = &PROGRAM_RESOURCES(ptr, stage, res_type)[i];
+
+            resources->_id = res->_id;
+            resources->base_type_id = res->base_type_id;
+            resources->type_id = res->type_id;
+            resources->set = res->set;
+            resources->binding = res->binding;
+            resources->location = res->location;
+            resources->name_len = (uint32_t)strlen(res->name) + 1;
+
+            memcpy(cursor, res->name, resources->name_len);
+            cursor += resources->name_len;
+            resources++;
+        }
+    }
+
+    memcpy(resources, ptr->spirv[stage].ir, ptr->spirv[stage].size * sizeof(unsigned int));
+
+    memcpy(cursor, ptr->spirv[stage].msl_str, payload->msl_len);
+    cursor += payload->msl_len;
+
+    memcpy(cursor, entry_point, payload->entry_point_len);
+
+    return payload;
+}
+
+#pragma mark Trimming
+static int compareRecordsByUse(const void *a, const void *b)
+{
+    const ShaderCacheRecord *ra = *(const ShaderCacheRecord **)a;
+    const ShaderCacheRecord *rb = *(const ShaderCacheRecord **)b;
+
+    // most recently used first
+    if (ra->last_used != rb->last_used)
+        return (ra->last_used > rb->last_used) ? -1 : 1;
+
+    return 0;
+}
+
+// drops the least recently used records until the rest fit in limit, owned_only counts just the payloads this
+// process allocated and leaves the ones in mapped files alone
+static void dropLeastRecentlyUsed(size_t limit, bool owned_only)
+{
+    ShaderCacheRecord **sorted;
+    size_t kept_size;
+    GLuint n;
+
+    sorted = (ShaderCacheRecord **)malloc(sizeof(ShaderCacheRecord *) * cache.count);
+    assert(sorted);
+
+    n = 0;
+    for (GLuint i = 0; i < cache.capacity; i++)
+    {
+        if (cache.records[i].payload && (!owned_only || cache.records[i].owned))
+            sorted[n++] = &cache.records[i];
+    }
+
+    qsort(sorted, n, sizeof(ShaderCacheRecord *), compareRecordsByUse);
+
+    kept_size = owned_only ? 0 : sizeof(ShaderCacheFileHeader);
+    for (GLuint i = 0; i < n; i++)
+    {
+        size_t entry_size;
+
+        entry_size = owned_only ? sorted[i]->size : sizeof(ShaderCacheFileEntry) + SHADER_CACHE_ALIGN(sorted[i]->size);
+
+        if (kept_size + entry_size <= limit)
+        {
+            kept_size += entry_size;
+            continue;
+        }
+
+        if (sorted[i]->owned)
+            free((void *)sorted[i]->payload);
+
+        sorted[i]->payload = NULL;
+    }
+
+    free(sorted);
+
+    // rehash what is left
+    resizeRecords(cache.capacity);
+}
+
+static void trimShaderCache(void)
+{
+    // drop entries until the file fits
+    if (cache.total_size + sizeof(ShaderCacheFileHeader) > cache.size_limit)
+        dropLeastRecentlyUsed(cache.size_limit, false);
+}
+
+#pragma mark Entries
+bool loadShaderCacheEntry(const ShaderCacheKey *key, Program *ptr, int stage)
+{
+    ShaderCacheRecord *record;
+    time_t now;
+
+    pthread_once(&cache_once, initShaderCache);
+
+    pthread_mutex_lock(&cache.lock);
+
+    record = findRecord(key);
+
+    if (record == NULL)
+    {
+        pthread_mutex_unlock(&cache.lock);
+        return false;
+    }
+
+    if (deserializeProgramStage(ptr, stage, record->payload, record->size) == false)
+    {
+        DEBUG_PRINT("shader cache entry failed validation\n");
+
+        // drop it so the next link stores a good translation under the same key
+        if (record->owned)
+            free((void *)record->payload);
+        record->payload = NULL;
+        resizeRecords(cache.capacity);
+        cache.dirty = true;
+
+        pthread_mutex_unlock(&cache.lock);
+
+        return false;
+    }
+
+    // only rewrite the file for lru bookkeeping once a day
+    now = time(NULL);
+    if (now - (time_t)record->last_used > SHADER_CACHE_TOUCH_INTERVAL)
+        cache.dirty = true;
+    record->last_used = now;
+
+    pthread_mutex_unlock(&cache.lock);
+
+    return true;
+}
+
+void storeShaderCacheEntry(const ShaderCacheKey *key, Program *ptr, int stage)
+{
+    void *payload;
+    size_t size;
+
+    payload = serializeProgramStage(ptr, stage, &size);
+
+    if (payload == NULL)
+        return;
+
+    pthread_once(&cache_once, initShaderCache);
+
+    pthread_mutex_lock(&cache.lock);
+
+    if (addRecord(key, time(NULL), (uint32_t)size, payload, true))
+    {
+        cache.dirty = true;
+
+        // capped apart from the file, with no disk cache or a large one every translation would stay in memory,
+        // trim to three quarters so a busy link doesn't sort the table on every store
+        if (cache.owned_size > cache.memory_limit)
+            dropLeastRecentlyUsed(cache.memory_limit / 4 * 3, true);
+    }
+    else
+    {
+        free(payload);
+    }
+
+    pthread_mutex_unlock(&cache.lock);
+}
+
+#pragma mark Flush
+static bool writeCacheFile(void)
+{
+    char tmp_path[PATH_MAX];
+    ShaderCacheFileHeader header;
+    struct stat st;
+    FILE *fp;
+    int fd;
+    bool ok;
+
+    // written next to the cache and renamed over it, readers only ever see a whole file
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", cache.path, (int)getpid());
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    fp = fdopen(fd, "wb");
+    if (fp == NULL)
+    {
+        close(fd);
+        unlink(tmp_path);
+        return false;
+    }
+
+    header.magic = SHADER_CACHE_MAGIC;
+    header.version = SHADER_CACHE_VERSION;
+    header.max_spirv_res = _MAX_SPIRV_RES;
+    header.entry_count = cache.count;
+
+    ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+
+    for (GLuint i = 0; ok && (i < cache.capacity); i++)
+    {
+        ShaderCacheRecord *record;
+        ShaderCacheFileEntry entry;
+        static const uint8_t zero[8];
+        size_t pad;
+
+        record = &cache.records[i];
+
+        if (record->payload == NULL)
+            continue;
+
+        entry.key = record->key;
+        entry.last_used = record->last_used;
+        entry.size = record->size;
+        entry.pad = 0;
+
+        pad = SHADER_CACHE_ALIGN(record->size) - record->size;
+
+        ok = (fwrite(&entry, sizeof(entry), 1, fp) == 1) && (fwrite(record->payload, record->size, 1, fp) == 1) &&
+             ((pad == 0) || (fwrite(zero, pad, 1, fp) == 1));
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+
+    if (ok && (rename(tmp_path, cache.path) == 0) && (stat(cache.path, &st) == 0))
+    {
+        cache.dev = st.st_dev;
+        cache.ino = st.st_ino;
+
+        return true;
+    }
+
+    unlink(tmp_path);
+
+    return false;
+}
+
+void flushShaderCache(bool force)
+{
+    struct stat st;
+    time_t now;
+
+    pthread_once(&cache_once, initShaderCache);
+
+    pthread_mutex_lock(&cache.lock);
+
+    now = time(NULL);
+
+    if (!cache.disk || !cache.dirty || (!force && (now - cache.last_flush < SHADER_CACHE_FLUSH_INTERVAL)))
+    {
+        pthread_mutex_unlock(&cache.lock);
+        return;
+    }
+
+    // another process replaced the file since we read it, pick up what it added before overwriting it
+    if ((stat(cache.path, &st) == 0) && ((st.st_dev != cache.dev) || (st.st_ino != cache.ino)))
+        mapCacheFile();
+
+    trimShaderCache();
+
+    if (writeCacheFile())
+    {
+        cache.dirty = false;
+    }
+    else
+    {
+        DEBUG_PRINT("shader cache write to %s failed: %s\n", cache.path, strerror(errno));
+    }
+
+    cache.last_flush = now;
+
+    pthread_mutex_unlock(&cache.lock);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * shader_cache.h
+ * MGL
+ *
+ */
+
+#ifndef shader_cache_h
+#define shader_cache_h
+
+#include <stdint.h>
+
+#include "glcorearb.h"
+#include "glm_context.h"
+
+// linked program stages translated to metal are cached on disk keyed by a 128 bit hash of everything
+// that went into the translation, the file lives in MGL_SHADER_CACHE_DIR (default ~/Library/Caches/MGL on
+// macos and $XDG_CACHE_HOME/MGL or ~/.cache/MGL elsewhere, an empty string keeps the cache in memory only) and is
+// trimmed to MGL_SHADER_CACHE_SIZE megabytes, translations held in memory are capped at MGL_SHADER_CACHE_MEMORY
+// megabytes
+typedef struct ShaderCacheKey_t
+{
+    uint64_t hash[2];
+} ShaderCacheKey;
+
+void initShaderCacheKey(ShaderCacheKey *key);
+void hashShaderCacheKey(ShaderCacheKey *key, const void *data, size_t size);
+
+// a linked stage flattened into one allocation, shared by the cache file and program binaries
+void *serializeProgramStage(Program *ptr, int stage, size_t *size);
+bool deserializeProgramStage(Program *ptr, int stage, const void *data, size_t size);
+
+bool loadShaderCacheEntry(const ShaderCacheKey *key, Program *ptr, int stage);
+void storeShaderCacheEntry(const ShaderCacheKey *key, Program *ptr, int stage);
+void flushShaderCache(bool force);
+
+#endif /* shader_cache_h */
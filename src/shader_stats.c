@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * shader_stats.c
+ * MGL
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "shader_stats.h"
+#include "shaders.h"
+#include "programs.h"
+#include "compile_queue.h"
+
+static const char *stage_names[_MAX_SHADER_TYPES] = {
+    "vertex", "tess_control", "tess_evaluation", "geometry", "fragment", "compute",
+};
+
+GLuint64 shaderStatsClock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (GLuint64)now.tv_sec * 1000000000ull + (GLuint64)now.tv_nsec;
+}
+
+void resetProgramStats(Program *ptr)
+{
+    bzero(&ptr->stats, sizeof(ProgramStats));
+}
+
+void recordProgramStageSizes(Program *ptr)
+{
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        ProgramStageStats *stats;
+
+        stats = &ptr->stats.stages[stage];
+
+        stats->spirv_words = (GLuint)ptr->spirv[stage].size;
+        stats->msl_bytes = ptr->spirv[stage].msl_str ? (GLuint)strlen(ptr->spirv[stage].msl_str) : 0;
+    }
+}
+
+#pragma mark queries
+static bool getShaderStat(const ShaderStats *stats, GLenum param, GLuint64 *data)
+{
+    switch (param)
+    {
+    case MGL_STATS_SOURCE_BYTES:
+        *data = stats->source_bytes;
+        break;
+    case MGL_STATS_PREPROCESS_TIME:
+        *data = stats->preprocess_ns;
+        break;
+    case MGL_STATS_PARSE_TIME:
+        *data = stats->parse_ns;
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+static bool getProgramStageStat(const ProgramStageStats *stats, GLenum param, GLuint64 *data)
+{
+    switch (param)
+    {
+    case MGL_STATS_SPIRV_TIME:
+        *data = stats->spirv_ns;
+        break;
+    case MGL_STATS_SPIRV_OPT_TIME:
+        *data = stats->spirv_opt_ns;
+        break;
+    case MGL_STATS_MSL_TIME:
+        *data = stats->msl_ns;
+        break;
+    case MGL_STATS_LIBRARY_TIME:
+        *data = stats->library_ns;
+        break;
+    case MGL_STATS_SPIRV_WORDS:
+        *data = stats->spirv_words;
+        break;
+    case MGL_STATS_MSL_BYTES:
+        *data = stats->msl_bytes;
+        break;
+    case MGL_STATS_SPIRV_INSTRUCTIONS_IN:
+        *data = stats->instructions_in;
+        break;
+    case MGL_STATS_SPIRV_INSTRUCTIONS_OUT:
+        *data = stats->instructions_out;
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+void MGLgetShaderStats(GLMContext ctx, GLuint shader, GLenum param, GLuint64 *data)
+{
+    Shader *ptr;
+
+    if (ctx == NULL)
+        ctx = MGLgetCurrentContext();
+
+    if (ctx == NULL)
+        return;
+
+    ptr = findShader(ctx, shader);
+
+    if (ptr == NULL)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    waitForShaderCompile(ctx, ptr);
+
+    *data = 0;
+
+    ERROR_CHECK_RETURN(getShaderStat(&ptr->stats, param, data), GL_INVALID_ENUM);
+}
+
+void MGLgetProgramStats(GLMContext ctx, GLuint program, GLenum param, GLuint64 *data)
+{
+    Program *ptr;
+    GLuint64 value;
+
+    if (ctx == NULL)
+        ctx = MGLgetCurrentContext();
+
+    if (ctx == NULL)
+        return;
+
+    ptr = findProgram(ctx, program);
+
+    if (ptr == NULL)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (param > MGL_STATS_SPIRV_INSTRUCTIONS_OUT)
+    {
+        ERROR_RETURN(GL_INVALID_ENUM);
+        return;
+    }
+
+    finishProgramLink(ctx, ptr);
+
+    if (param == MGL_STATS_LINK_TIME)
+    {
+        *data = ptr->stats.link_ns;
+        return;
+    }
+
+    *data = 0;
+
+    // the compile phases come from the attached shaders, the rest from the stages
+    for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+    {
+        Shader *sptr;
+
+        if (getProgramStageStat(&ptr->stats.stages[stage], param, &value))
+        {
+            *data += value;
+            continue;
+        }
+
+        sptr = ptr->shader_slots[stage];
+
+        if (sptr == NULL)
+            continue;
+
+        waitForShaderCompile(ctx, sptr);
+
+        if (getShaderStat(&sptr->stats, param, &value))
+            *data += value;
+    }
+}
+
+#pragma mark csv
+static void writeShaderRows(GLMContext ctx, FILE *fp)
+{
+    SlotMap *table;
+
+    table = &STATE(shader_table);
+
+    for (GLuint i = 0; i < table->count; i++)
+    {
+        Shader *ptr;
+
+        ptr = (Shader *)table->dense[i].data;
+
+        if (ptr == NULL)
+            continue;
+
+        waitForShaderCompile(ctx, ptr);
+
+        fprintf(fp, "shader,%u,%s,0,%u,0,0,0,0,%.3f,%.3f,0,0,0,0,0\n", ptr->name, stage_names[ptr->glm_type],
+                ptr->stats.source_bytes, ptr->stats.preprocess_ns / 1e3, ptr->stats.parse_ns / 1e3);
+    }
+}
+
+static void writeProgramRows(GLMContext ctx, FILE *fp)
+{
+    SlotMap *table;
+
+    table = &STATE(program_table);
+
+    for (GLuint i = 0; i < table->count; i++)
+    {
+        Program *ptr;
+        GLuint64 link_ns;
+
+        ptr = (Program *)table->dense[i].data;
+
+        if (ptr == NULL)
+            continue;
+
+        finishProgramLink(ctx, ptr);
+
+        // one glslang link covers every stage, it goes on the program's first row so the column adds up
+        link_ns = ptr->stats.link_ns;
+
+        for (int stage = 0; stage < _MAX_SHADER_TYPES; stage++)
+        {
+            ProgramStageStats *stats;
+
+            if (ptr->shader_slots[stage] == NULL)
+                continue;
+
+            stats = &ptr->stats.stages[stage];
+
+            fprintf(fp, "program,%u,%s,%u,0,%u,%u,%u,%u,0,0,%.3f,%.3f,%.3f,%.3f,%.3f\n", ptr->name,
+                    stage_names[stage], stats->cached, stats->spirv_words, stats->msl_bytes, stats->instructions_in,
+                    stats->instructions_out, link_ns / 1e3, stats->spirv_ns / 1e3, stats->spirv_opt_ns / 1e3,
+                    stats->msl_ns / 1e3, stats->library_ns / 1e3);
+
+            link_ns = 0;
+        }
+    }
+}
+
+bool MGLwriteShaderStats(GLMContext ctx, const char *path)
+{
+    FILE *fp;
+
+    if (ctx == NULL)
+        ctx = MGLgetCurrentContext();
+
+    if (ctx == NULL)
+        return false;
+
+    fp = stdout;
+
+    if (path)
+    {
+        fp = fopen(path, "w");
+
+        if (fp == NULL)
+            return false;
+    }
+
+    // times in microseconds
+    fprintf(fp, "type,name,stage,cached,source_bytes,spirv_words,msl_bytes,spirv_instructions_in,"
+                "spirv_instructions_out,preprocess_us,parse_us,link_us,spirv_us,spirv_opt_us,msl_us,library_us\n");
+
+    writeShaderRows(ctx, fp);
+    writeProgramRows(ctx, fp);
+
+    if (path)
+        fclose(fp);
+    else
+        fflush(fp);
+
+    return true;
+}
@@ -13,34 +13,31 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  *
- * hash_table.h
+ * shader_stats.h
  * MGL
  *
  */
 
-#ifndef hash_table_h
-#define hash_table_h
+#ifndef shader_stats_h
+#define shader_stats_h
 
 #include "glcorearb.h"
+#include "glm_context.h"
 
-typedef struct
+#ifdef __cplusplus
+extern "C"
 {
-    GLuint name;
-    void *data;
-} HashObj;
+#endif
 
-typedef struct
-{
-    unsigned size;
-    GLuint current_name;
-    HashObj *keys;
-} HashTable;
+    // monotonic nanoseconds for the compile and link timings
+    GLuint64 shaderStatsClock(void);
+
+    // a link starts from zero, the sizes are taken from the stages once it's done
+    void resetProgramStats(Program *ptr);
+    void recordProgramStageSizes(Program *ptr);
 
-HashTable *createHashTable(GLuint size);
-void initHashTable(HashTable *ptr, GLuint size);
-GLuint getNewName(HashTable *table);
-void insertHashElement(HashTable *table, GLuint name, void *data);
-void *searchHashTable(HashTable *table, GLuint name);
-void deleteHashElement(HashTable *table, GLuint name);
+#ifdef __cplusplus
+}
+#endif
 
-#endif /* hash_table_h */
+#endif /* shader_stats_h */
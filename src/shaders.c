@@ -22,8 +22,12 @@
 #include <string.h>
 #include <glslang/Include/glslang_c_interface.h>
 #include <glslang/Include/glslang_c_shader_types.h>
+#include "spirv_cross_c.h"
+#include "spirv.h"
 
 #include "shaders.h"
+#include "compile_queue.h"
+#include "shader_stats.h"
 #include "glm_context.h"
 
 const glslang_resource_t *glslang_default_resource(void);
@@ -60,6 +64,29 @@ GLuint glShaderTypeToGLMType(GLuint type)
     }
 }
 
+SpvExecutionModel getSPIRVExecutionModel(GLuint glm_type)
+{
+    switch (glm_type)
+    {
+    case _VERTEX_SHADER:
+        return SpvExecutionModelVertex;
+    case _TESS_CONTROL_SHADER:
+        return SpvExecutionModelTessellationControl;
+    case _TESS_EVALUATION_SHADER:
+        return SpvExecutionModelTessellationEvaluation;
+    case _GEOMETRY_SHADER:
+        return SpvExecutionModelGeometry;
+    case _FRAGMENT_SHADER:
+        return SpvExecutionModelFragment;
+    case _COMPUTE_SHADER:
+        return SpvExecutionModelGLCompute;
+    default:
+        assert(0);
+    }
+
+    return SpvExecutionModelVertex;
+}
+
 glslang_stage_t getGLSLStage(GLuint type)
 {
     switch (type)
@@ -126,13 +153,19 @@ Shader *getShader(GLMContext ctx, GLenum type, GLuint shader)
 {
     Shader *ptr;
 
-    ptr = (Shader *)searchHashTable(&STATE(shader_table), shader);
+    ptr = (Shader *)searchSlotMap(&STATE(shader_table), shader);
 
     if (!ptr)
     {
+        // a deleted name whose slot went to another object
+        if (isStaleSlotMapName(&STATE(shader_table), shader))
+        {
+            ERROR_RETURN_VALUE(GL_INVALID_OPERATION, NULL);
+        }
+
         ptr = newShader(ctx, type, shader);
 
-        insertHashElement(&STATE(shader_table), shader, ptr);
+        insertSlotMapElement(&STATE(shader_table), shader, ptr);
     }
 
     return ptr;
@@ -142,7 +175,7 @@ int isShader(GLMContext ctx, GLuint shader)
 {
     Shader *ptr;
 
-    ptr = (Shader *)searchHashTable(&STATE(shader_table), shader);
+    ptr = (Shader *)searchSlotMap(&STATE(shader_table), shader);
 
     if (ptr)
         return 1;
@@ -154,11 +187,21 @@ Shader *findShader(GLMContext ctx, GLuint shader)
 {
     Shader *ptr;
 
-    ptr = (Shader *)searchHashTable(&STATE(shader_table), shader);
+    ptr = (Shader *)searchSlotMap(&STATE(shader_table), shader);
 
     return ptr;
 }
 
+static void freeSPIRVModule(Shader *ptr)
+{
+    free(ptr->spirv_module.ir);
+    free(ptr->spirv_module.entry_point);
+    free(ptr->spirv_module.constant_ids);
+    free(ptr->spirv_module.constant_values);
+
+    bzero(&ptr->spirv_module, sizeof(ptr->spirv_module));
+}
+
 GLuint mglCreateShader(GLMContext ctx, GLenum type)
 {
     GLuint shader;
@@ -192,13 +235,17 @@ void mglDeleteShader(GLMContext ctx, GLuint shader)
 
     ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
 
-    deleteHashElement(&STATE(shader_table), shader);
+    waitForShaderIdle(ctx, ptr);
+
+    deleteSlotMapElement(&STATE(shader_table), shader);
 
     if (ptr->compiled_glsl_shader)
     {
         glslang_shader_delete(ptr->compiled_glsl_shader);
     }
 
+    freeSPIRVModule(ptr);
+
     if (ptr->mtl_data.library)
     {
         ctx->mtl_funcs.mtlDeleteMTLObj(ctx, ptr->mtl_data.function);
@@ -227,6 +274,11 @@ void mglShaderSource(GLMContext ctx, GLuint shader, GLsizei count, const GLchar
 
     ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
 
+    waitForShaderIdle(ctx, ptr);
+
+    // source turns a spir-v shader back into a glsl one
+    freeSPIRVModule(ptr);
+
     if (count > 1)
     {
         // compute storage requirement
@@ -257,7 +309,7 @@ void mglShaderSource(GLMContext ctx, GLuint shader, GLsizei count, const GLchar
             *src = 0;
             for (int i = 0; i < count; ++i)
             {
-                strlcat(src, string[i], len + 1);
+                strcat(src, string[i]);
             }
             assert(strlen(src) == len);
         }
@@ -288,27 +340,18 @@ void mglShaderSource(GLMContext ctx, GLuint shader, GLsizei count, const GLchar
     ptr->dirty_bits |= DIRTY_SHADER;
 }
 
-void mglCompileShader(GLMContext ctx, GLuint shader)
+// runs on a compile queue worker for background compiles, failures only show up in the info log
+void compileShader(GLMContext ctx, Shader *ptr)
 {
-    Shader *ptr;
     glslang_input_t glsl_input;
     glslang_shader_t *glsl_shader;
+    GLuint64 start;
     int err;
 
-    ERROR_CHECK_RETURN(isShader(ctx, shader), GL_INVALID_VALUE);
-
-    ptr = findShader(ctx, shader);
-
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_OPERATION);
-
     initGLSLInput(ctx, ptr->type, ptr->src, &glsl_input);
 
-    glsl_shader = glslang_shader_create(&glsl_input);
-    if (glsl_shader == NULL)
-    {
-        ERROR_CHECK_RETURN(false, GL_INVALID_OPERATION);
-        return;
-    }
+    bzero(&ptr->stats, sizeof(ShaderStats));
+    ptr->stats.source_bytes = (GLuint)ptr->src_len;
 
     if (ptr->log)
     {
@@ -316,9 +359,19 @@ void mglCompileShader(GLMContext ctx, GLuint shader)
         ptr->log = NULL;
     }
 
+    glsl_shader = glslang_shader_create(&glsl_input);
+    if (glsl_shader == NULL)
+    {
+        ptr->log = strdup("glslang_shader_create failed\n");
+        return;
+    }
+
     glslang_shader_set_options(glsl_shader, GLSLANG_SHADER_VULKAN_RULES_RELAXED);
 
+    start = shaderStatsClock();
     err = glslang_shader_preprocess(glsl_shader, &glsl_input);
+    ptr->stats.preprocess_ns = shaderStatsClock() - start;
+
     if (!err)
     {
         DEBUG_PRINT("glslang_shader_preprocess failed err: %d\n", err);
@@ -348,7 +401,10 @@ void mglCompileShader(GLMContext ctx, GLuint shader)
         return;
     }
 
+    start = shaderStatsClock();
     err = glslang_shader_parse(glsl_shader, &glsl_input);
+    ptr->stats.parse_ns = shaderStatsClock() - start;
+
     if (!err)
     {
         DEBUG_PRINT("glslang_shader_parse failed err: %d\n", err);
@@ -386,6 +442,44 @@ void mglCompileShader(GLMContext ctx, GLuint shader)
     ptr->compiled_glsl_shader = glsl_shader;
 }
 
+void mglCompileShader(GLMContext ctx, GLuint shader)
+{
+    Shader *ptr;
+
+    ERROR_CHECK_RETURN(isShader(ctx, shader), GL_INVALID_VALUE);
+
+    ptr = findShader(ctx, shader);
+
+    ERROR_CHECK_RETURN(ptr, GL_INVALID_OPERATION);
+
+    // a previous compile or a link still reading this shader finishes first
+    waitForShaderIdle(ctx, ptr);
+
+    // spir-v shaders are compiled by glSpecializeShader
+    if (ptr->spirv_module.ir)
+    {
+        free(ptr->log);
+        ptr->log = strdup("glCompileShader on a SPIR-V shader, use glSpecializeShader\n");
+        return;
+    }
+
+    if (queueShaderCompile(ctx, ptr))
+        return;
+
+    compileShader(ctx, ptr);
+}
+
+void mglMaxShaderCompilerThreadsKHR(GLMContext ctx, GLuint count)
+{
+    if (count == STATE_VAR(max_shader_compiler_threads))
+        return;
+
+    // the workers restart with the new count on the next compile or link
+    finishCompileQueue(ctx);
+
+    STATE_VAR(max_shader_compiler_threads) = count;
+}
+
 void mglGetShaderiv(GLMContext ctx, GLuint shader, GLenum pname, GLint *params)
 {
     Shader *ptr;
@@ -394,6 +488,10 @@ void mglGetShaderiv(GLMContext ctx, GLuint shader, GLenum pname, GLint *params)
 
     ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
 
+    // everything but the completion status joins the compile
+    if (pname != GL_COMPLETION_STATUS_KHR)
+        waitForShaderCompile(ctx, ptr);
+
     switch (pname)
     {
     case GL_SHADER_TYPE:
@@ -445,6 +543,14 @@ void mglGetShaderiv(GLMContext ctx, GLuint shader, GLenum pname, GLint *params)
         *params = (GLint)ptr->src_len;
         break;
 
+    case GL_COMPLETION_STATUS_KHR:
+        *params = isShaderCompileComplete(ctx, ptr) ? GL_TRUE : GL_FALSE;
+        break;
+
+    case GL_SPIR_V_BINARY:
+        *params = ptr->spirv_module.ir ? GL_TRUE : GL_FALSE;
+        break;
+
     default:
         ERROR_RETURN(GL_INVALID_ENUM);
         break;
@@ -459,6 +565,8 @@ void mglGetShaderInfoLog(GLMContext ctx, GLuint shader, GLsizei bufSize, GLsizei
 
     ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
 
+    waitForShaderCompile(ctx, ptr);
+
     if (ptr->log)
     {
         if (length)
@@ -500,3 +608,212 @@ void mglGetShaderSource(GLMContext ctx, GLuint shader, GLsizei bufSize, GLsizei
         }
     }
 }
+
+#pragma mark spir-v shaders
+void mglShaderBinary(GLMContext ctx, GLsizei count, const GLuint *shaders, GLenum binaryFormat, const void *binary,
+                     GLsizei length)
+{
+    GLuint stages;
+    uint32_t magic;
+
+    if (count < 0)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if (binaryFormat != GL_SHADER_BINARY_FORMAT_SPIR_V)
+    {
+        ERROR_RETURN(GL_INVALID_ENUM);
+        return;
+    }
+
+    // a module is whole words starting with the magic number in our byte order
+    if ((binary == NULL) || (length < 5 * (GLsizei)sizeof(uint32_t)) || (length % sizeof(uint32_t)))
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    memcpy(&magic, binary, sizeof(magic));
+
+    if (magic != SpvMagicNumber)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    // every shader gets its own copy of the module, at most one shader per stage
+    stages = 0;
+
+    for (GLsizei i = 0; i < count; i++)
+    {
+        Shader *ptr;
+
+        ptr = findShader(ctx, shaders[i]);
+
+        if (ptr == NULL)
+        {
+            ERROR_RETURN(GL_INVALID_VALUE);
+            return;
+        }
+
+        if (stages & SHADER_MASK_BIT(ptr->glm_type))
+        {
+            ERROR_RETURN(GL_INVALID_OPERATION);
+            return;
+        }
+
+        stages |= SHADER_MASK_BIT(ptr->glm_type);
+    }
+
+    for (GLsizei i = 0; i < count; i++)
+    {
+        Shader *ptr;
+
+        ptr = findShader(ctx, shaders[i]);
+
+        waitForShaderIdle(ctx, ptr);
+
+        freeSPIRVModule(ptr);
+
+        if (ptr->compiled_glsl_shader)
+        {
+            glslang_shader_delete(ptr->compiled_glsl_shader);
+            ptr->compiled_glsl_shader = NULL;
+        }
+
+        ptr->spirv_module.size = length / sizeof(uint32_t);
+        ptr->spirv_module.ir = (unsigned int *)malloc(length);
+        assert(ptr->spirv_module.ir);
+        memcpy(ptr->spirv_module.ir, binary, length);
+
+        // the module is the source, there is nothing to preprocess or parse
+        bzero(&ptr->stats, sizeof(ShaderStats));
+        ptr->stats.source_bytes = (GLuint)length;
+
+        // not compiled until it's specialized
+        free(ptr->log);
+        ptr->log = strdup("SPIR-V shader not specialized\n");
+
+        ptr->dirty_bits |= DIRTY_SHADER;
+    }
+}
+
+// looks up the entry point for the shader's stage and the constant ids in the module, spirv-cross reflection
+// only, the translation to msl happens at link time
+static bool validateSpecialization(GLMContext ctx, Shader *ptr, const GLchar *entry_point, GLuint count,
+                                   const GLuint *constant_ids)
+{
+    spvc_context context = NULL;
+    spvc_parsed_ir ir = NULL;
+    spvc_compiler compiler = NULL;
+    const spvc_entry_point *entry_points;
+    const spvc_specialization_constant *constants;
+    size_t num_entry_points, num_constants;
+    SpvExecutionModel model;
+    bool found;
+
+    spvc_context_create(&context);
+    assert(context);
+
+    if ((spvc_context_parse_spirv(context, ptr->spirv_module.ir, ptr->spirv_module.size, &ir) != SPVC_SUCCESS) ||
+        (spvc_context_create_compiler(context, SPVC_BACKEND_NONE, ir, SPVC_CAPTURE_MODE_TAKE_OWNERSHIP, &compiler) !=
+         SPVC_SUCCESS))
+    {
+        spvc_context_destroy(context);
+        return false;
+    }
+
+    model = getSPIRVExecutionModel(ptr->glm_type);
+
+    found = false;
+
+    if (spvc_compiler_get_entry_points(compiler, &entry_points, &num_entry_points) == SPVC_SUCCESS)
+    {
+        for (size_t i = 0; i < num_entry_points; i++)
+        {
+            if ((entry_points[i].execution_model == model) && !strcmp(entry_points[i].name, entry_point))
+                found = true;
+        }
+    }
+
+    if (spvc_compiler_get_specialization_constants(compiler, &constants, &num_constants) != SPVC_SUCCESS)
+        num_constants = 0;
+
+    for (GLuint i = 0; found && (i < count); i++)
+    {
+        size_t j;
+
+        for (j = 0; j < num_constants; j++)
+        {
+            if (constants[j].constant_id == constant_ids[i])
+                break;
+        }
+
+        found = (j < num_constants);
+    }
+
+    spvc_context_destroy(context);
+
+    return found;
+}
+
+void mglSpecializeShader(GLMContext ctx, GLuint shader, const GLchar *pEntryPoint, GLuint numSpecializationConstants,
+                         const GLuint *pConstantIndex, const GLuint *pConstantValue)
+{
+    Shader *ptr;
+    size_t size;
+
+    ptr = findShader(ctx, shader);
+
+    if (ptr == NULL)
+    {
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    if ((ptr->spirv_module.ir == NULL) || ptr->spirv_module.specialized)
+    {
+        ERROR_RETURN(GL_INVALID_OPERATION);
+        return;
+    }
+
+    waitForShaderIdle(ctx, ptr);
+
+    if (pEntryPoint == NULL)
+        pEntryPoint = "main";
+
+    if (validateSpecialization(ctx, ptr, pEntryPoint, numSpecializationConstants, pConstantIndex) == false)
+    {
+        free(ptr->log);
+        ptr->log = strdup("SPIR-V module has no such entry point or specialization constant\n");
+
+        ERROR_RETURN(GL_INVALID_VALUE);
+        return;
+    }
+
+    // constants are applied through spirv-cross when the program links
+    size = numSpecializationConstants * sizeof(GLuint);
+
+    ptr->spirv_module.entry_point = strdup(pEntryPoint);
+    ptr->spirv_module.num_constants = numSpecializationConstants;
+
+    if (numSpecializationConstants)
+    {
+        ptr->spirv_module.constant_ids = (GLuint *)malloc(size);
+        assert(ptr->spirv_module.constant_ids);
+        memcpy(ptr->spirv_module.constant_ids, pConstantIndex, size);
+
+        ptr->spirv_module.constant_values = (GLuint *)malloc(size);
+        assert(ptr->spirv_module.constant_values);
+        memcpy(ptr->spirv_module.constant_values, pConstantValue, size);
+    }
+
+    ptr->spirv_module.specialized = GL_TRUE;
+
+    free(ptr->log);
+    ptr->log = NULL;
+
+    ptr->dirty_bits |= DIRTY_SHADER;
+}
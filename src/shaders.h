@@ -23,7 +23,11 @@
 
 #include "glcorearb.h"
 #include "glm_context.h"
+#include "spirv.h"
 
+Shader *newShader(GLMContext ctx, GLenum type, GLuint shader);
 Shader *findShader(GLMContext ctx, GLuint shader);
+void compileShader(GLMContext ctx, Shader *ptr);
+SpvExecutionModel getSPIRVExecutionModel(GLuint glm_type);
 
 #endif /* shaders_h */
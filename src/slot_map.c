@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * slot_map.c
+ * MGL
+ *
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include <assert.h>
+
+#include "slot_map.h"
+
+#define NAME_INDEX(_name_) ((_name_) & SLOT_MAP_INDEX_MASK)
+#define NAME_GENERATION(_name_) ((_name_) >> SLOT_MAP_INDEX_BITS)
+#define MAKE_NAME(_generation_, _index_) (((_generation_) << SLOT_MAP_INDEX_BITS) | (_index_))
+
+#pragma mark Utility Functions
+static void growSlots(SlotMap *map, GLuint size)
+{
+    if (size <= map->slot_size)
+        return;
+
+    while (map->slot_size < size)
+        map->slot_size *= 2;
+
+    map->slots = (SlotMapSlot *)realloc(map->slots, sizeof(SlotMapSlot) * map->slot_size);
+    assert(map->slots);
+}
+
+static void pushFreeSlot(SlotMap *map, GLuint index)
+{
+    if (map->free_count == map->free_size)
+    {
+        map->free_size *= 2;
+        map->free_list = (GLuint *)realloc(map->free_list, sizeof(GLuint) * map->free_size);
+        assert(map->free_list);
+    }
+
+    map->free_list[map->free_count++] = index;
+}
+
+static void addDenseObj(SlotMap *map, GLuint index, void *data)
+{
+    SlotMapSlot *slot;
+
+    if (map->count == map->dense_size)
+    {
+        map->dense_size *= 2;
+        map->dense = (SlotMapObj *)realloc(map->dense, sizeof(SlotMapObj) * map->dense_size);
+        assert(map->dense);
+    }
+
+    slot = &map->slots[index];
+
+    map->dense[map->count].name = MAKE_NAME(slot->generation, index);
+    map->dense[map->count].data = data;
+
+    slot->dense = map->count++;
+}
+
+static SlotMapSlot *findSlot(SlotMap *map, GLuint name)
+{
+    GLuint index;
+    SlotMapSlot *slot;
+
+    index = NAME_INDEX(name);
+
+    if (index == 0 || index >= map->slot_count)
+        return NULL;
+
+    slot = &map->slots[index];
+
+    if (slot->dense == SLOT_MAP_FREE)
+        return NULL;
+
+    // stale name for a recycled slot
+    if (slot->generation != NAME_GENERATION(name))
+        return NULL;
+
+    return slot;
+}
+
+#pragma mark Slot Map
+void initSlotMap(SlotMap *map, GLuint size)
+{
+    assert(map);
+    assert(size > 1);
+
+    bzero(map, sizeof(SlotMap));
+
+    map->dense_size = size;
+    map->dense = (SlotMapObj *)malloc(sizeof(SlotMapObj) * size);
+    assert(map->dense);
+
+    map->slot_size = size;
+    map->slots = (SlotMapSlot *)malloc(sizeof(SlotMapSlot) * size);
+    assert(map->slots);
+
+    map->free_size = size;
+    map->free_list = (GLuint *)malloc(sizeof(GLuint) * size);
+    assert(map->free_list);
+
+    // slot 0 is name 0, never allocated
+    map->slots[0].generation = 0;
+    map->slots[0].dense = SLOT_MAP_FREE;
+    map->slot_count = 1;
+}
+
+void freeSlotMap(SlotMap *map)
+{
+    assert(map);
+
+    free(map->dense);
+    free(map->slots);
+    free(map->free_list);
+
+    bzero(map, sizeof(SlotMap));
+}
+
+GLuint getNewName(SlotMap *map)
+{
+    GLuint index;
+
+    assert(map);
+
+    index = 0;
+
+    // a recycled index may have been claimed by a user specified name since it was freed
+    while (map->free_count)
+    {
+        GLuint candidate;
+
+        candidate = map->free_list[--map->free_count];
+
+        if (map->slots[candidate].dense == SLOT_MAP_FREE)
+        {
+            index = candidate;
+            break;
+        }
+    }
+
+    if (index == 0)
+    {
+        assert(map->slot_count <= SLOT_MAP_INDEX_MASK);
+
+        growSlots(map, map->slot_count + 1);
+
+        index = map->slot_count++;
+        map->slots[index].generation = 0;
+    }
+
+    // the name is reserved until it is deleted, the object itself is created on first bind
+    addDenseObj(map, index, NULL);
+
+    return MAKE_NAME(map->slots[index].generation, index);
+}
+
+void *searchSlotMap(SlotMap *map, GLuint name)
+{
+    SlotMapSlot *slot;
+
+    assert(map);
+
+    slot = findSlot(map, name);
+
+    if (slot == NULL)
+        return NULL;
+
+    return map->dense[slot->dense].data;
+}
+
+bool isStaleSlotMapName(SlotMap *map, GLuint name)
+{
+    SlotMapSlot *slot;
+
+    assert(map);
+
+    if (NAME_INDEX(name) >= map->slot_count)
+        return false;
+
+    slot = &map->slots[NAME_INDEX(name)];
+
+    // the slot was recycled, the name belongs to a deleted object
+    return (slot->dense != SLOT_MAP_FREE) && (slot->generation != NAME_GENERATION(name));
+}
+
+bool insertSlotMapElement(SlotMap *map, GLuint name, void *data)
+{
+    GLuint index;
+    SlotMapSlot *slot;
+
+    assert(map);
+
+    index = NAME_INDEX(name);
+    assert(index);
+
+    if (isStaleSlotMapName(map, name))
+        return false;
+
+    // some calls allow the user to specifiy a name...
+    if (index >= map->slot_count)
+    {
+        growSlots(map, index + 1);
+
+        // skipped slots become free, pushed in reverse so the lowest gets recycled first
+        for (GLuint i = index; i-- > map->slot_count;)
+        {
+            map->slots[i].generation = 0;
+            map->slots[i].dense = SLOT_MAP_FREE;
+
+            pushFreeSlot(map, i);
+        }
+
+        map->slots[index].dense = SLOT_MAP_FREE;
+        map->slot_count = index + 1;
+    }
+
+    slot = &map->slots[index];
+
+    if (slot->dense == SLOT_MAP_FREE)
+    {
+        slot->generation = NAME_GENERATION(name);
+
+        addDenseObj(map, index, data);
+
+        return true;
+    }
+
+    assert(map->dense[slot->dense].data == NULL);
+
+    map->dense[slot->dense].data = data;
+
+    return true;
+}
+
+void deleteSlotMapElement(SlotMap *map, GLuint name)
+{
+    SlotMapSlot *slot;
+    GLuint dense, last;
+
+    assert(map);
+
+    slot = findSlot(map, name);
+
+    // deleting unused names is silently ignored
+    if (slot == NULL)
+        return;
+
+    // keep dense packed by moving the last object into the hole
+    dense = slot->dense;
+    last = --map->count;
+
+    if (dense != last)
+    {
+        map->dense[dense] = map->dense[last];
+        map->slots[NAME_INDEX(map->dense[dense].name)].dense = dense;
+    }
+
+    slot->dense = SLOT_MAP_FREE;
+    slot->generation = (slot->generation + 1) & SLOT_MAP_GENERATION_MASK;
+
+    pushFreeSlot(map, NAME_INDEX(name));
+}
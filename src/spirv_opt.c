@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * spirv_opt.c
+ * MGL
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spirv-tools/libspirv.h"
+#include "spirv.h"
+
+#include "spirv_opt.h"
+
+#define SPIRV_HEADER_WORDS 5
+
+GLuint defaultSPIRVOptimizer(void)
+{
+    const char *env;
+
+    env = getenv("MGL_SPIRV_OPTIMIZER");
+
+    if (env == NULL)
+        return MGL_SPIRV_OPTIMIZE_NONE;
+
+    if (!strcmp(env, "size"))
+        return MGL_SPIRV_OPTIMIZE_SIZE;
+
+    if (!strcmp(env, "performance"))
+        return MGL_SPIRV_OPTIMIZE_PERFORMANCE;
+
+    return MGL_SPIRV_OPTIMIZE_NONE;
+}
+
+GLuint countSPIRVInstructions(const unsigned int *ir, size_t size)
+{
+    GLuint count;
+    size_t i;
+
+    count = 0;
+
+    // the word count of each instruction is in its high 16 bits
+    for (i = SPIRV_HEADER_WORDS; i < size; i += (ir[i] >> 16))
+    {
+        if ((ir[i] >> 16) == 0)
+            break;
+
+        count++;
+    }
+
+    return count;
+}
+
+bool spirvReadsDrawParameters(const unsigned int *ir, size_t size)
+{
+    size_t i;
+
+    if (ir == NULL)
+        return false;
+
+    for (i = SPIRV_HEADER_WORDS; i < size; i += (ir[i] >> 16))
+    {
+        if ((ir[i] >> 16) == 0)
+            break;
+
+        // OpDecorate target BuiltIn builtin
+        if (((ir[i] & 0xffff) != SpvOpDecorate) || ((ir[i] >> 16) < 4) || (i + 3 >= size))
+            continue;
+
+        if (ir[i + 2] != SpvDecorationBuiltIn)
+            continue;
+
+        switch (ir[i + 3])
+        {
+        case SpvBuiltInBaseVertex:
+        case SpvBuiltInBaseInstance:
+        case SpvBuiltInDrawIndex:
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool optimizeSPIRV(GLuint optimizer, Spirv *spirv)
+{
+    spv_optimizer_t *opt;
+    spv_optimizer_options options;
+    spv_binary binary;
+    spv_result_t result;
+
+    if (optimizer == MGL_SPIRV_OPTIMIZE_NONE)
+        return false;
+
+    // glslang's output for gl and ARB_gl_spirv modules are both at or below 1.5
+    opt = spvOptimizerCreate(SPV_ENV_UNIVERSAL_1_5);
+    assert(opt);
+
+    // both recipes cover dead code elimination, constant folding, inlining, scalar replacement and
+    // local store elimination, size trades some of the loop and branch work for fewer instructions
+    if (optimizer == MGL_SPIRV_OPTIMIZE_SIZE)
+    {
+        spvOptimizerRegisterSizePasses(opt);
+    }
+    else
+    {
+        spvOptimizerRegisterPerformancePasses(opt);
+    }
+
+    // glslang and glSpecializeShader already validated the module
+    options = spvOptimizerOptionsCreate();
+    spvOptimizerOptionsSetRunValidator(options, false);
+
+    binary = NULL;
+    result = spvOptimizerRun(opt, spirv->ir, spirv->size, &binary, options);
+
+    spvOptimizerOptionsDestroy(options);
+    spvOptimizerDestroy(opt);
+
+    if ((result != SPV_SUCCESS) || (binary == NULL))
+    {
+        DEBUG_PRINT("spirv-opt failed: %d, translating the unoptimized module\n", result);
+
+        spvBinaryDestroy(binary);
+        return false;
+    }
+
+    free(spirv->ir);
+
+    spirv->size = binary->wordCount;
+    spirv->ir = (unsigned int *)malloc(spirv->size * sizeof(unsigned));
+    assert(spirv->ir);
+    memcpy(spirv->ir, binary->code, spirv->size * sizeof(unsigned));
+
+    spvBinaryDestroy(binary);
+
+    return true;
+}
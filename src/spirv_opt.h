@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * spirv_opt.h
+ * MGL
+ *
+ */
+
+#ifndef spirv_opt_h
+#define spirv_opt_h
+
+#include "glcorearb.h"
+#include "glm_context.h"
+
+// MGL_SPIRV_OPTIMIZER picks the spirv-opt recipe run on each stage before it goes to spirv-cross,
+// the MGL_SPIRV_OPTIMIZER environment variable sets the default for new contexts
+GLuint defaultSPIRVOptimizer(void);
+
+GLuint countSPIRVInstructions(const unsigned int *ir, size_t size);
+
+// gl_BaseVertex, gl_BaseInstance or gl_DrawID, values that change when draws are merged into one multi-draw
+bool spirvReadsDrawParameters(const unsigned int *ir, size_t size);
+
+// replaces the stage's spirv with the optimized module, a module spirv-opt can't handle is left as it was
+bool optimizeSPIRV(GLuint optimizer, Spirv *spirv);
+
+#endif /* spirv_opt_h */
@@ -22,8 +22,6 @@
 #include <mach/mach_init.h>
 #include <mach/vm_map.h>
 
-#include <Accelerate/Accelerate.h>
-
 #include "pixel_utils.h"
 #include "utils.h"
 #include "glm_context.h"
@@ -144,13 +142,19 @@ static Texture *getTexture(GLMContext ctx, GLenum target, GLuint texture)
 {
     Texture *ptr;
 
-    ptr = (Texture *)searchHashTable(&STATE(texture_table), texture);
+    ptr = (Texture *)searchSlotMap(&STATE(texture_table), texture);
 
     if (!ptr)
     {
+        // a deleted name whose slot went to another object
+        if (isStaleSlotMapName(&STATE(texture_table), texture))
+        {
+            ERROR_RETURN_VALUE(GL_INVALID_OPERATION, NULL);
+        }
+
         ptr = newTexture(ctx, target, texture);
 
-        insertHashElement(&STATE(texture_table), texture, ptr);
+        insertSlotMapElement(&STATE(texture_table), texture, ptr);
     }
 
     return ptr;
@@ -160,7 +164,7 @@ static int isTexture(GLMContext ctx, GLuint texture)
 {
     Texture *ptr;
 
-    ptr = (Texture *)searchHashTable(&STATE(texture_table), texture);
+    ptr = (Texture *)searchSlotMap(&STATE(texture_table), texture);
 
     if (ptr)
         return 1;
@@ -172,7 +176,7 @@ Texture *findTexture(GLMContext ctx, GLuint texture)
 {
     Texture *ptr;
 
-    ptr = (Texture *)searchHashTable(&STATE(texture_table), texture);
+    ptr = (Texture *)searchSlotMap(&STATE(texture_table), texture);
 
     return ptr;
 }
@@ -225,11 +229,15 @@ void mglGenTextures(GLMContext ctx, GLsizei n, GLuint *textures)
 
     while (n--)
     {
-        *textures++ = getNewName(&STATE(texture_table));
+        GLuint name;
+
+        name = getNewName(&STATE(texture_table));
+
+        // TEX_OBJ_RES_NAME has special name.. skip it, the slot stays reserved
+        if (name == TEX_OBJ_RES_NAME)
+            name = getNewName(&STATE(texture_table));
 
-        // TEX_OBJ_RES_NAME has special name.. skip it
-        if (STATE(texture_table.current_name) == TEX_OBJ_RES_NAME)
-            getNewName(&STATE(texture_table));
+        *textures++ = name;
     }
 }
 
@@ -259,7 +267,9 @@ void mglBindTexture(GLMContext ctx, GLenum target, GLuint texture)
     if (texture)
     {
         ptr = getTexture(ctx, target, texture);
-        assert(ptr);
+
+        if (ptr == NULL)
+            return;
     }
     else
     {
@@ -374,8 +384,13 @@ void mglDeleteTextures(GLMContext ctx, GLsizei n, const GLuint *textures)
             if (tex->mtl_data)
             {
                 ctx->mtl_funcs.mtlDeleteMTLObj(ctx, tex->mtl_data);
+
+                tex->mtl_data = NULL;
             }
         }
+
+        // recycles the name, unknown names are ignored
+        deleteSlotMapElement(&STATE(texture_table), name);
     }
 }
 
@@ -825,9 +840,9 @@ void unpackTexture(GLMContext ctx, Texture *tex, GLuint face, GLuint level, void
 
     if (xoffset || yoffset || zoffset)
     {
-        const size_t xbytes = xoffset * pixel_size;                  // num pixels
-        const size_t ybytes = yoffset * pixel_size * width;          // num lines
-        const size_t zbytes = zoffset * pixel_size * width * height; // num planes
+        const size_t xbytes = xoffset * pixel_size;                            // num pixels
+        const size_t ybytes = yoffset * tex->faces[face].levels[level].pitch;  // num lines
+        const size_t zbytes = zoffset * pixel_size * width * height;           // num planes
 
         dst += xbytes;
         dst += ybytes;
@@ -1402,6 +1417,27 @@ bool texSubImage(GLMContext ctx, Texture *tex, GLuint face, GLint level, GLint x
         return true;
     } while (false);
 
+    // stream the region into the live texture instead of recreating it from the level data, only when the
+    // client layout matches the level layout byte for byte
+    do
+    {
+        if ((tex->mtl_data == NULL) || tex->dirty_bits)
+            continue;
+
+        if ((face != 0) || (depth != 1))
+            continue;
+
+        if ((tex->target != GL_TEXTURE_1D) && (tex->target != GL_TEXTURE_2D) && (tex->target != GL_TEXTURE_RECTANGLE))
+            continue;
+
+        if (pixel_size * tex->faces[face].levels[level].width != tex->faces[face].levels[level].pitch)
+            continue;
+
+        ctx->mtl_funcs.mtlTexSubImageData(ctx, tex, pixels, src_pitch, level, width, height, xoffset, yoffset);
+
+        return true;
+    } while (false);
+
     // use process gl to upload texture data
     tex->dirty_bits |= DIRTY_TEXTURE_DATA;
 
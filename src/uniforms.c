@@ -19,7 +19,9 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include "spirv_cross_c.h"
 
 #include "shaders.h"
@@ -43,35 +45,23 @@ GLint mglGetUniformLocation(GLMContext ctx, GLuint program, const GLchar *name)
     ptr = getProgram(ctx, program);
     assert(program);
 
-    if (ptr->linked_glsl_program == NULL)
+    finishProgramLink(ctx, ptr);
+
+    if (ptr->linked == GL_FALSE)
     {
         ERROR_RETURN(GL_INVALID_OPERATION);
 
         return -1;
     }
 
-    for (int stage = _VERTEX_SHADER; stage < _MAX_SHADER_TYPES; stage++)
-    {
-        int count;
-
-        count = ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_UNIFORM_CONSTANT].count;
-
-        for (int i = 0; i < count; i++)
-        {
-            const char *str = ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_UNIFORM_CONSTANT].list[i].name;
-
-            if (!strcmp(str, name))
-            {
-                GLuint binding;
+    const ProgramResourceName *entry;
 
-                binding = ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_UNIFORM_CONSTANT].list[i].binding;
+    entry = findProgramResource(ptr, GL_UNIFORM, name);
 
-                return binding;
-            }
-        }
-    }
+    if (entry == NULL)
+        return -1;
 
-    return -1;
+    return entry->location;
 }
 
 void mglGetUniformfv(GLMContext ctx, GLuint program, GLint location, GLfloat *params)
@@ -121,37 +111,27 @@ GLuint mglGetUniformBlockIndex(GLMContext ctx, GLuint program, const GLchar *uni
     ptr = getProgram(ctx, program);
     assert(program);
 
-    if (ptr->linked_glsl_program == NULL)
+    finishProgramLink(ctx, ptr);
+
+    if (ptr->linked == GL_FALSE)
     {
         ERROR_RETURN(GL_INVALID_OPERATION);
 
         return -1;
     }
 
-    for (int stage = _VERTEX_SHADER; stage < _MAX_SHADER_TYPES; stage++)
-    {
-        int count;
-
-        count = ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_UNIFORM_BUFFER].count;
-
-        for (int i = 0; i < count; i++)
-        {
-            const char *str = ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_UNIFORM_BUFFER].list[i].name;
+    const ProgramResourceName *entry;
 
-            if (!strcmp(str, uniformBlockName))
-            {
-                GLuint binding;
+    entry = findProgramResource(ptr, GL_UNIFORM_BLOCK, uniformBlockName);
 
-                binding = ptr->spirv_resources_list[stage][SPVC_RESOURCE_TYPE_UNIFORM_BUFFER].list[i].binding;
+    if (entry == NULL)
+    {
+        assert(0);
 
-                return binding;
-            }
-        }
+        return 0xFFFFFFFF;
     }
 
-    assert(0);
-
-    return 0xFFFFFFFF;
+    return entry->index;
 }
 
 void mglGetActiveUniformBlockiv(GLMContext ctx, GLuint program, GLuint uniformBlockIndex, GLenum pname, GLint *params)
@@ -186,19 +166,61 @@ bool checkUniformParams(GLMContext ctx, GLint location)
     return true;
 }
 
-void mglUniform(GLMContext ctx, GLint location, void *ptr, GLsizei size)
+GLubyte *getUniformConstantStorage(GLMContext ctx, Program *program, GLint location, GLsizei size)
 {
-    assert(checkUniformParams(ctx, location));
+    UniformConstants *uniforms;
+    GLuint offset, end;
 
-    Buffer *buf = ctx->state.buffer_base[_UNIFORM_CONSTANT].buffers[location].buf;
+    assert(program);
+    assert(location >= 0 && location < MAX_BINDABLE_BUFFERS);
 
-    if (buf == NULL)
+    uniforms = &program->uniform_constants;
+
+    if (uniforms->length[location] >= size)
+        return uniforms->data + uniforms->offset[location];
+
+    // first set or the location grew (arrays set with a larger count), append it to the block
+    offset = (uniforms->size + UNIFORM_CONSTANT_ALIGNMENT - 1) & ~(UNIFORM_CONSTANT_ALIGNMENT - 1);
+    end = (offset + size + UNIFORM_CONSTANT_ALIGNMENT - 1) & ~(UNIFORM_CONSTANT_ALIGNMENT - 1);
+
+    if (end > uniforms->capacity)
     {
-        ctx->state.buffer_base[_UNIFORM_CONSTANT].buffers[location].buf = newBuffer(ctx, GL_UNIFORM_BUFFER, location);
-        buf = ctx->state.buffer_base[_UNIFORM_CONSTANT].buffers[location].buf;
+        GLuint capacity;
+
+        capacity = uniforms->capacity ? uniforms->capacity : 4 * UNIFORM_CONSTANT_ALIGNMENT;
+        while (capacity < end)
+            capacity *= 2;
+
+        uniforms->data = (GLubyte *)realloc(uniforms->data, capacity);
+        assert(uniforms->data);
+
+        bzero(uniforms->data + uniforms->capacity, capacity - uniforms->capacity);
+        uniforms->capacity = capacity;
     }
 
-    initBufferData(ctx, buf, size, ptr, true);
+    // keep what was set before so a grown array keeps its old elements
+    if (uniforms->length[location])
+        memcpy(uniforms->data + offset, uniforms->data + uniforms->offset[location], uniforms->length[location]);
+
+    uniforms->offset[location] = offset;
+    uniforms->length[location] = end - offset;
+    uniforms->size = end;
+    uniforms->dirty = GL_TRUE;
+
+    return uniforms->data + offset;
+}
+
+void mglUniform(GLMContext ctx, GLint location, void *ptr, GLsizei size)
+{
+    GLubyte *data;
+
+    assert(checkUniformParams(ctx, location));
+
+    data = getUniformConstantStorage(ctx, ctx->state.program, location, size);
+
+    memcpy(data, ptr, size);
+
+    ctx->state.program->uniform_constants.dirty = GL_TRUE;
 }
 
 void mglUniform1d(GLMContext ctx, GLint location, GLdouble x)
@@ -94,13 +94,19 @@ VertexArray *getVAO(GLMContext ctx, GLuint vao)
 {
     VertexArray *ptr;
 
-    ptr = (VertexArray *)searchHashTable(&STATE(vao_table), vao);
+    ptr = (VertexArray *)searchSlotMap(&STATE(vao_table), vao);
 
     if (!ptr)
     {
+        // a deleted name whose slot went to another object
+        if (isStaleSlotMapName(&STATE(vao_table), vao))
+        {
+            ERROR_RETURN_VALUE(GL_INVALID_OPERATION, NULL);
+        }
+
         ptr = newVAO(ctx, vao);
 
-        insertHashElement(&STATE(vao_table), vao, ptr);
+        insertSlotMapElement(&STATE(vao_table), vao, ptr);
     }
 
     return ptr;
@@ -110,7 +116,7 @@ int isVAO(GLMContext ctx, GLuint vao)
 {
     VertexArray *ptr;
 
-    ptr = (VertexArray *)searchHashTable(&STATE(vao_table), vao);
+    ptr = (VertexArray *)searchSlotMap(&STATE(vao_table), vao);
 
     if (ptr)
         return 1;
@@ -140,7 +146,8 @@ void mglBindVertexArray(GLMContext ctx, GLuint array)
 
         ptr = getVAO(ctx, array);
 
-        ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
+        if (ptr == NULL)
+            return;
     }
 
     if (STATE(vao) != ptr)
@@ -162,7 +169,7 @@ void mglDeleteVertexArrays(GLMContext ctx, GLsizei n, const GLuint *arrays)
         {
             VertexArray *ptr;
 
-            ptr = (VertexArray *)searchHashTable(&STATE(vao_table), vao);
+            ptr = (VertexArray *)searchSlotMap(&STATE(vao_table), vao);
 
             if (ptr)
             {
@@ -173,9 +180,22 @@ void mglDeleteVertexArrays(GLMContext ctx, GLsizei n, const GLuint *arrays)
                 }
 
                 // delete any mtl_data
+                for (int i = 0; i < VERTEX_LAYOUT_CACHE_SIZE; i++)
+                {
+                    if (ptr->layouts[i].mtl_vertex_descriptor)
+                    {
+                        ctx->mtl_funcs.mtlDeleteMTLObj(ctx, ptr->layouts[i].mtl_vertex_descriptor);
+                        ptr->layouts[i].mtl_vertex_descriptor = NULL;
+                    }
+                }
             }
 
-            deleteHashElement(&STATE(vao_table), vao);
+            deleteSlotMapElement(&STATE(vao_table), vao);
+        }
+        else
+        {
+            // generated but never bound, release the reserved name
+            deleteSlotMapElement(&STATE(vao_table), vao);
         }
     }
 }
@@ -484,7 +504,8 @@ void mglEnableVertexArrayAttrib(GLMContext ctx, GLuint vaobj, GLuint index)
 
     ptr = getVAO(ctx, vaobj);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
+    if (ptr == NULL)
+        return;
 
     ptr->enabled_attribs |= (0x1 << index);
 
@@ -499,7 +520,8 @@ void mglDisableVertexArrayAttrib(GLMContext ctx, GLuint vaobj, GLuint index)
 
     ptr = getVAO(ctx, vaobj);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
+    if (ptr == NULL)
+        return;
 
     ptr->enabled_attribs &= ~(0x1 << index);
 
@@ -560,7 +582,8 @@ void mglVertexArrayElementBuffer(GLMContext ctx, GLuint vaobj, GLuint buffer)
 
     ptr = getVAO(ctx, vaobj);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
+    if (ptr == NULL)
+        return;
 
     if (buffer == 0)
     {
@@ -604,7 +627,8 @@ void mglVertexArrayAttribBinding(GLMContext ctx, GLuint vaobj, GLuint attribinde
 
     ptr = getVAO(ctx, vaobj);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
+    if (ptr == NULL)
+        return;
 
     setVertexBindingIndex(ctx, ptr, attribindex, bindingindex);
 }
@@ -662,7 +686,8 @@ void mglVertexArrayAttribFormat(GLMContext ctx, GLuint vaobj, GLuint attribindex
 
     ptr = getVAO(ctx, vaobj);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
+    if (ptr == NULL)
+        return;
 
     setAttribFormat(ctx, ptr, attribindex, size, type, normalized, relativeoffset);
 }
@@ -708,7 +733,8 @@ void mglVertexArrayAttribIFormat(GLMContext ctx, GLuint vaobj, GLuint attribinde
 
     ptr = getVAO(ctx, vaobj);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
+    if (ptr == NULL)
+        return;
 
     setAttribIFormat(ctx, VAO(), attribindex, size, type, relativeoffset);
 }
@@ -760,7 +786,8 @@ void mglVertexArrayAttribLFormat(GLMContext ctx, GLuint vaobj, GLuint attribinde
 
     ptr = getVAO(ctx, vaobj);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
+    if (ptr == NULL)
+        return;
 
     setAttribLFormat(ctx, ptr, attribindex, size, type, relativeoffset);
 }
@@ -802,7 +829,8 @@ void mglVertexArrayBindingDivisor(GLMContext ctx, GLuint vaobj, GLuint bindingin
 
     ptr = getVAO(ctx, vaobj);
 
-    ERROR_CHECK_RETURN(ptr, GL_INVALID_VALUE);
+    if (ptr == NULL)
+        return;
 
     setBindingDivisor(ctx, ptr, bindingindex, divisor);
 }
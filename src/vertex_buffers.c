@@ -35,8 +35,9 @@ bool bindVertexBuffer(GLMContext ctx, GLuint vaobj, GLuint bindingindex, GLuint
     if (vaobj)
     {
         vao = getVAO(ctx, vaobj);
-        // no such vao
-        ERROR_CHECK_RETURN_VALUE(vao, GL_INVALID_VALUE, false);
+
+        if (vao == NULL)
+            return false;
     }
     else
     {
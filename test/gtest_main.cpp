@@ -18,1238 +18,2707 @@
  *
  */
 
-#include <gtest/gtest.h>
-#include <mach/mach_vm.h>
-#include <mach/mach_init.h>
-#include <mach/vm_map.h>
-
-#include <stdbool.h>
-#include <stdio.h>
-#include <iostream>
-#include <stdlib.h>
-#include <limits.h>
-#include <stdarg.h>
-#include <vector>
-#include <functional>
-
-#define GL_GLEXT_PROTOTYPES 1
-#include <GL/glcorearb.h>
-
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_syswm.h>
-
-extern "C"
+#include "mgl_test.h"
+
+// Test cases
+TEST_F(MGLTest, Clear)
+{
+    int a = 0;
+    int e = 1;
+
+    RunFrames(20, [&]() {
+        float f = (float)a / 100.0f;
+        glClearColor(1.0f - f, 0.2f, f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        a += e;
+        if (a >= 100)
+            e = -1;
+        if (a == 0)
+            e = 1;
+    });
+}
+
+TEST_F(MGLTest, DrawArrays)
+{
+    GLuint vbo = 0, vao = 0;
+
+    const char *vertex_shader =
+        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.5, 0.0, 0.5, 1.0); });
+
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    RunFrames(10, [&]() {
+        glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    });
+
+    // Cleanup
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, CPURendererDrawArrays)
+{
+    if (!headless)
+        GTEST_SKIP() << "CPU reference backend only";
+
+    GLuint vbo = 0, cbo = 0, vao = 0;
+
+    const char *vertex_shader = GLSL(
+        460, layout(location = 0) in vec2 position; layout(location = 1) in vec4 color;
+        layout(location = 0) out vec4 out_color; void main() {
+            gl_Position = vec4(position, 0.0, 1.0);
+            out_color = color;
+        });
+
+    const char *fragment_shader = GLSL(460, layout(location = 0) in vec4 out_color;
+                                       layout(location = 0) out vec4 frag_colour; void main() { frag_colour = out_color; });
+
+    float points[] = {-1.0f, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 1.0f};
+    float colors[] = {1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    cbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 2, GL_FLOAT, false, 0, NULL);
+    bindAttribute(1, GL_ARRAY_BUFFER, cbo, 4, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    CPURendererResetStats(glm_ctx);
+
+    RunFrames(4, [&]() {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    });
+
+    CPURendererStats stats;
+    CPURendererGetStats(glm_ctx, &stats);
+
+    EXPECT_EQ(stats.frames, 4u);
+    EXPECT_EQ(stats.draws, 4u);
+    EXPECT_EQ(stats.triangles, 8u);
+    EXPECT_EQ(stats.pixels_written, 4ull * wscaled * hscaled);
+
+    unsigned w, h, pitch;
+    const unsigned *pixels = (const unsigned *)CPURendererDrawable(glm_ctx, &w, &h, &pitch);
+
+    // drawable is BGRA8, red lands in bits 16..23
+    EXPECT_EQ(pixels[(h / 2) * (pitch / 4) + w / 2], 0xffff0000u);
+
+    // Cleanup
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &cbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, DrawArraysUniformMatrix4fv)
+{
+    GLuint vbo = 0, vao = 0;
+
+    const char *vertex_shader =
+        GLSL(460 core, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader = GLSL(
+        460 core, layout(location = 0) out vec4 frag_colour; layout(location = 1) uniform mat4 mp;
+        void main() { frag_colour = vec4(mp[0][0], mp[0][1], mp[0][2], 1.0f); });
+
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    GLint mp_loc = glGetUniformLocation(shader_program, "mp");
+    GLfloat mp_val[16];
+    int ri = 1;
+    int gi = 0;
+    int bi = 0;
+    mp_val[0] = 0.0f;
+    mp_val[1] = 0.0f;
+    mp_val[2] = 0.0f;
+    mp_val[3] = 1.0f;
+    mp_val[4] = 0.5f;
+    mp_val[5] = 0.5f;
+    mp_val[6] = 0.5f;
+    mp_val[7] = 1.0f;
+    mp_val[8] = 0.0f;
+    mp_val[9] = 0.0f;
+    mp_val[10] = 0.0f;
+    mp_val[11] = 1.0f;
+    mp_val[12] = 0.5f;
+    mp_val[13] = 0.5f;
+    mp_val[14] = 0.5f;
+    mp_val[15] = 1.0f;
+
+    RunFrames(15, [&]() {
+        glBindVertexArray(vao);
+        glUseProgram(shader_program);
+        glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glUniformMatrix4fv(mp_loc, 1, false, mp_val);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        mp_val[0] += ri / 100.0f;
+        mp_val[1] += gi / 100.0f;
+        mp_val[2] += bi / 100.0f;
+
+        if (mp_val[0] > 1.0f)
+        {
+            ri = -1;
+            gi = 1;
+        }
+        if (mp_val[0] < 0.0f)
+        {
+            ri = 0;
+            mp_val[0] = 0.0f;
+        }
+        if (mp_val[1] > 1.0f)
+        {
+            gi = -1;
+            bi = 1;
+        }
+        if (mp_val[1] < 0.0f)
+        {
+            gi = 0;
+            mp_val[1] = 0.0f;
+        }
+        if (mp_val[2] > 1.0f)
+        {
+            bi = -1;
+            ri = 1;
+        }
+        if (mp_val[2] < 0.0f)
+        {
+            bi = 0;
+            mp_val[2] = 0.0f;
+        }
+    });
+
+    // Cleanup
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, UniformConstantUploads)
+{
+    if (headless)
+        GTEST_SKIP() << "uniforms are only uploaded by the metal backend";
+
+    GLuint vbo = 0, vao = 0;
+
+    const char *vertex_shader =
+        GLSL(460 core, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(460 core, layout(location = 0) out vec4 frag_colour; layout(location = 2) uniform vec4 color;
+             void main() { frag_colour = color; });
+
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    GLint color_loc = glGetUniformLocation(shader_program, "color");
+    const int draws_per_frame = 100;
+    const int frames = 4;
+
+    GLuint uploads, new_uploads;
+
+    // a uniform changed before every draw is one upload per draw
+    MGLget(NULL, MGL_UNIFORM_UPLOADS, &uploads);
+
+    RunFrames(frames, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (int i = 0; i < draws_per_frame; i++)
+        {
+            GLfloat color[4] = {i / (float)draws_per_frame, 0.0f, 1.0f, 1.0f};
+
+            glUniform4fv(color_loc, 1, color);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+    });
+
+    MGLget(NULL, MGL_UNIFORM_UPLOADS, &new_uploads);
+    EXPECT_EQ(new_uploads - uploads, (GLuint)(frames * draws_per_frame)) << "one uniform upload per draw";
+
+    // unchanged uniforms stay where the frame's first draw put them
+    MGLget(NULL, MGL_UNIFORM_UPLOADS, &uploads);
+
+    RunFrames(frames, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (int i = 0; i < draws_per_frame; i++)
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+    });
+
+    MGLget(NULL, MGL_UNIFORM_UPLOADS, &new_uploads);
+    EXPECT_EQ(new_uploads - uploads, (GLuint)frames) << "one uniform upload per frame";
+
+    // each draw reads the values set before it, the last one covers the triangle
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glUniform4f(color_loc, 0.0f, 1.0f, 0.0f, 1.0f);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glUniform4f(color_loc, 1.0f, 0.0f, 0.0f, 1.0f);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    std::vector<GLubyte> pixels = readDrawable();
+    SwapBuffers();
+
+    // BGRA
+    const GLubyte *center = &pixels[((size_t)(hscaled / 2) * wscaled + wscaled / 2) * 4];
+    EXPECT_EQ(center[0], 0);
+    EXPECT_EQ(center[1], 0);
+    EXPECT_EQ(center[2], 255);
+
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, DrawElements)
+{
+    GLuint vbo = 0, elem_vbo = 0, vao = 0;
+
+    const char *vertex_shader =
+        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.5, 0.0, 0.5, 1.0); });
+
+    GLfloat points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+    GLuint indices[] = {0, 1, 2};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    elem_vbo = bindDataToVBO(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    vao = bindVAO();
+    glVertexArrayElementBuffer(vao, elem_vbo);
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    RunFrames(10, [&]() {
+        glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, 0);
+    });
+
+    // Cleanup
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &elem_vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, SmallElementBufferUploads)
+{
+    if (headless)
+        GTEST_SKIP() << "element buffers are only uploaded by the metal backend";
+
+    GLuint vbo = 0, elem_vbo = 0, vao = 0;
+
+    const char *vertex_shader =
+        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.0, 1.0, 1.0, 1.0); });
+
+    GLfloat points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+    GLushort indices[] = {0, 1, 2, 2, 1, 0};
+
+    // well under 4k, these never get a metal buffer of their own
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    elem_vbo = bindDataToVBO(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    vao = bindVAO();
+    glVertexArrayElementBuffer(vao, elem_vbo);
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    const int draws_per_frame = 100;
+    const int frames = 10;
+
+    auto drawFrame = [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (int i = 0; i < draws_per_frame; i++)
+        {
+            // odd draws start at the second triangle
+            glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_SHORT, (void *)(uintptr_t)((i & 1) * 3 * sizeof(GLushort)));
+        }
+    };
+
+    // one upload per draw, the batcher would share them
+    MGLset(NULL, MGL_DRAW_BATCHING, GL_FALSE);
+
+    // let the rings grow to what a frame needs
+    RunFrames(3, drawFrame);
+
+    GLuint uploads, allocations;
+    MGLget(NULL, MGL_INDEX_UPLOADS, &uploads);
+    MGLget(NULL, MGL_UPLOAD_RING_ALLOCATIONS, &allocations);
+
+    RunFrames(frames, drawFrame);
+
+    GLuint new_uploads, new_allocations;
+    MGLget(NULL, MGL_INDEX_UPLOADS, &new_uploads);
+    MGLget(NULL, MGL_UPLOAD_RING_ALLOCATIONS, &new_allocations);
+
+    EXPECT_EQ(new_uploads - uploads, (GLuint)(frames * draws_per_frame)) << "every draw goes through the upload ring";
+    EXPECT_LE(new_allocations - allocations, 3u) << "only rings still in flight are replaced";
+
+    // the indices came out of the ring intact, both offsets draw the triangle
+    for (int first = 0; first < 2; first++)
+    {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_SHORT, (void *)(uintptr_t)(first * 3 * sizeof(GLushort)));
+
+        std::vector<GLubyte> pixels = readDrawable();
+        SwapBuffers();
+
+        // BGRA
+        const GLubyte *center = &pixels[((size_t)(hscaled / 2) * wscaled + wscaled / 2) * 4];
+        EXPECT_EQ(center[0], 255);
+        EXPECT_EQ(center[1], 255);
+        EXPECT_EQ(center[2], 0);
+    }
+
+    MGLset(NULL, MGL_DRAW_BATCHING, GL_TRUE);
+
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &elem_vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, DrawBatching)
+{
+    GLuint vbo = 0, vao = 0;
+
+    const char *vertex_shader =
+        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.5, 0.5, 0.0, 1.0); });
+
+    GLfloat points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f,
+                        0.0f, 0.4f, 0.0f, 0.4f, -0.4f, 0.0f, -0.4f, -0.4f, 0.0f};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    const int draws_per_frame = 2000;
+    const int frames = 2;
+
+    // the same triangle over and over, like a ui drawing its quads with nothing in between
+    auto drawFrame = [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (int i = 0; i < draws_per_frame; i++)
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+    };
+
+    GLuint batching;
+    MGLget(NULL, MGL_DRAW_BATCHING, &batching);
+    EXPECT_EQ(batching, (GLuint)GL_TRUE);
+
+    // the counters cover the last frame
+    RunFrames(frames, drawFrame);
+
+    GLuint merged, batches;
+    MGLget(NULL, MGL_MERGED_DRAWS, &merged);
+    MGLget(NULL, MGL_DRAW_BATCHES, &batches);
+
+    const GLuint batch_size = 256; // DRAW_BATCH_SIZE
+    GLuint expected_batches = (draws_per_frame + batch_size - 1) / batch_size;
+
+    EXPECT_EQ(batches, expected_batches);
+    EXPECT_EQ(merged, draws_per_frame - expected_batches) << "every draw after a batch's first should merge";
+
+    // back to back ranges become one draw, a state change in between ends the batch
+    RunFrames(1, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glDrawArrays(GL_TRIANGLES, 3, 3);
+        glDisable(GL_BLEND);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    });
+
+    MGLget(NULL, MGL_MERGED_DRAWS, &merged);
+    MGLget(NULL, MGL_DRAW_BATCHES, &batches);
+
+    EXPECT_EQ(merged, 1u);
+    EXPECT_EQ(batches, 0u) << "the merged ranges went out as a single draw";
+
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, DrawBatchingOutput)
+{
+    GLuint vbo = 0, cbo = 0, vao = 0;
+
+    const char *vertex_shader = GLSL(
+        460, layout(location = 0) in vec3 position; layout(location = 1) in vec4 color;
+        layout(location = 0) out vec4 out_color; void main() {
+            gl_Position = vec4(position, 1.0);
+            out_color = color;
+        });
+
+    const char *base_instance_shader = GLSL(
+        460, layout(location = 0) in vec3 position; layout(location = 1) in vec4 color;
+        layout(location = 0) out vec4 out_color; void main() {
+            gl_Position = vec4(position, 1.0);
+            out_color = color + vec4(float(gl_BaseInstance));
+        });
+
+    const char *fragment_shader =
+        GLSL(460, layout(location = 0) in vec4 out_color; layout(location = 0) out vec4 frag_colour;
+             void main() { frag_colour = out_color; });
+
+    // overlapping triangles back to back in the buffer, later ones cover earlier ones so the order shows
+    const int triangles = 32;
+    std::vector<GLfloat> points, colors;
+
+    for (int i = 0; i < triangles; i++)
+    {
+        GLfloat x = -0.8f + i * 0.04f;
+        GLfloat y = -0.8f + (i % 4) * 0.1f;
+        GLfloat tri[] = {x, y + 0.8f, 0.0f, x + 0.4f, y, 0.0f, x - 0.4f, y, 0.0f};
+
+        points.insert(points.end(), tri, tri + 9);
+
+        for (int v = 0; v < 3; v++)
+        {
+            GLfloat color[] = {(GLfloat)(i % 3 == 0), (GLfloat)(i % 3 == 1), (GLfloat)(i % 3 == 2), 1.0f};
+
+            colors.insert(colors.end(), color, color + 4);
+        }
+    }
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, points.size() * sizeof(GLfloat), points.data(), GL_STATIC_DRAW);
+    cbo = bindDataToVBO(GL_ARRAY_BUFFER, colors.size() * sizeof(GLfloat), colors.data(), GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+    bindAttribute(1, GL_ARRAY_BUFFER, cbo, 4, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    GLuint base_instance_program =
+        compileGLSLProgram(2, GL_VERTEX_SHADER, base_instance_shader, GL_FRAGMENT_SHADER, fragment_shader);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    GLuint batching;
+    MGLget(NULL, MGL_DRAW_BATCHING, &batching);
+
+    auto drawFrame = [&](GLuint program, GLboolean batched) {
+        MGLset(NULL, MGL_DRAW_BATCHING, batched);
+
+        glUseProgram(program);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (int i = 0; i < triangles; i++)
+            glDrawArrays(GL_TRIANGLES, i * 3, 3);
+
+        std::vector<GLubyte> pixels = readDrawable();
+        SwapBuffers();
+
+        return pixels;
+    };
+
+    GLuint merged;
+
+    // merging the draws doesn't change what they draw
+    std::vector<GLubyte> unbatched = drawFrame(shader_program, GL_FALSE);
+    std::vector<GLubyte> batched = drawFrame(shader_program, GL_TRUE);
+
+    MGLget(NULL, MGL_MERGED_DRAWS, &merged);
+    EXPECT_EQ(merged, (GLuint)(triangles - 1));
+    EXPECT_TRUE(unbatched == batched) << "batched draws should match the same draws issued one by one";
+
+    // a program reading the draw parameters would see them change inside a merged draw, its draws go out as is
+    unbatched = drawFrame(base_instance_program, GL_FALSE);
+    batched = drawFrame(base_instance_program, GL_TRUE);
+
+    MGLget(NULL, MGL_MERGED_DRAWS, &merged);
+    EXPECT_EQ(merged, 0u);
+    EXPECT_TRUE(unbatched == batched);
+
+    MGLset(NULL, MGL_DRAW_BATCHING, batching);
+    glUseProgram(0);
+
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &cbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+    glDeleteProgram(base_instance_program);
+}
+
+TEST_F(MGLTest, DrawElementsVertexAttribute)
+{
+    GLuint vbo = 0, elem_vbo = 0, vao = 0;
+
+    const char *vertex_shader = GLSL(
+        460, layout(location = 0) in vec3 position; layout(location = 1) in vec3 col;
+        layout(location = 0) out vec3 col_out; void main() {
+            gl_Position = vec4(position, 1.0);
+            col_out = col;
+        });
+
+    const char *fragment_shader = GLSL(
+        460, layout(location = 0) in vec3 color_in; layout(location = 0) out vec4 frag_colour;
+        void main() { frag_colour = vec4(color_in, 1.0); });
+
+    GLfloat verts[] = {// pos               // col
+                       0.0f, 0.5f, 0.0f, 1.0f,  0.0f,  0.0f, 0.5f, -0.5f, 0.0f,
+                       0.0f, 1.0f, 0.0f, -0.5f, -0.5f, 0.0f, 0.0f, 0.0f,  1.0f};
+
+    GLuint indices[] = {0, 1, 2};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+    elem_vbo = bindDataToVBO(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    vao = bindVAO();
+    glVertexArrayElementBuffer(vao, elem_vbo);
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 6 * sizeof(GLfloat), NULL);
+    bindAttribute(1, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 6 * sizeof(GLfloat), (void *)(3 * sizeof(float)));
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    RunFrames(10, [&]() {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, 0);
+    });
+
+    // Cleanup
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &elem_vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, VertexLayoutCache)
+{
+    if (headless)
+        GTEST_SKIP() << "vertex layouts are only cached by the metal backend";
+
+    GLuint vbo[2], vao[2];
+
+    const char *vertex_shader = GLSL(
+        460, layout(location = 0) in vec3 position; layout(location = 1) in vec3 col;
+        layout(location = 0) out vec3 col_out; void main() {
+            gl_Position = vec4(position, 1.0);
+            col_out = col;
+        });
+
+    const char *fragment_shader = GLSL(
+        460, layout(location = 0) in vec3 color_in; layout(location = 0) out vec4 frag_colour;
+        void main() { frag_colour = vec4(color_in, 1.0); });
+
+    const char *inverted_shader = GLSL(
+        460, layout(location = 0) in vec3 color_in; layout(location = 0) out vec4 frag_colour;
+        void main() { frag_colour = vec4(1.0 - color_in, 1.0); });
+
+    GLfloat verts[] = {// pos               // col
+                       0.0f, 0.5f, 0.0f, 1.0f,  0.0f,  0.0f, 0.5f, -0.5f, 0.0f,
+                       0.0f, 1.0f, 0.0f, -0.5f, -0.5f, 0.0f, 0.0f, 0.0f,  1.0f};
+
+    GLfloat positions[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+    GLfloat colors[] = {1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 1.0f};
+
+    // one buffer shared by both attribs
+    vbo[0] = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+    vao[0] = bindVAO();
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo[0], 3, GL_FLOAT, false, 6 * sizeof(GLfloat), NULL);
+    bindAttribute(1, GL_ARRAY_BUFFER, vbo[0], 3, GL_FLOAT, false, 6 * sizeof(GLfloat), (void *)(3 * sizeof(float)));
+
+    // a buffer each
+    vbo[1] = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
+    GLuint color_vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
+    vao[1] = bindVAO();
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo[1], 3, GL_FLOAT, false, 0, NULL);
+    bindAttribute(1, GL_ARRAY_BUFFER, color_vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint programs[2];
+    programs[0] = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    programs[1] = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, inverted_shader);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    auto drawFrame = [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        // every vao and program pair, twice
+        for (int i = 0; i < 8; i++)
+        {
+            glBindVertexArray(vao[i & 1]);
+            glUseProgram(programs[(i >> 1) & 1]);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+    };
+
+    RunFrames(1, drawFrame);
+
+    GLuint hits, misses;
+    MGLget(NULL, MGL_VERTEX_LAYOUT_HITS, &hits);
+    MGLget(NULL, MGL_VERTEX_LAYOUT_MISSES, &misses);
+
+    RunFrames(10, drawFrame);
+
+    GLuint new_hits, new_misses;
+    MGLget(NULL, MGL_VERTEX_LAYOUT_HITS, &new_hits);
+    MGLget(NULL, MGL_VERTEX_LAYOUT_MISSES, &new_misses);
+
+    EXPECT_EQ(new_misses, misses) << "pairs seen before should reuse their layout";
+    EXPECT_GT(new_hits, hits);
+
+    // changing the vao throws its layouts away
+    glBindVertexArray(vao[1]);
+    glUseProgram(programs[0]);
+    bindAttribute(1, GL_ARRAY_BUFFER, vbo[1], 3, GL_FLOAT, false, 0, NULL);
+
+    RunFrames(1, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    });
+
+    MGLget(NULL, MGL_VERTEX_LAYOUT_MISSES, &misses);
+
+    EXPECT_EQ(misses, new_misses + 1);
+
+    glDeleteBuffers(1, &color_vbo);
+    glDeleteBuffers(2, vbo);
+    glDeleteVertexArrays(2, vao);
+    glDeleteProgram(programs[0]);
+    glDeleteProgram(programs[1]);
+}
+
+TEST_F(MGLTest, DrawRangeElements)
+{
+    GLuint vbo = 0, elem_vbo = 0, vao = 0;
+
+    const char *vertex_shader =
+        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.5, 0.0, 0.5, 1.0); });
+
+    GLfloat points[] = {
+        0.0f, 0.5f,  0.0f, 0.0f,  0.5f,  0.0f, 0.0f, 0.5f, 0.0f, 0.0f, 0.5f, 0.0f, // start @ 3
+        0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f,                                     // end @ 5
+        0.0f, 0.5f,  0.0f, 0.0f,  0.5f,  0.0f, 0.0f, 0.5f, 0.0f,
+    };
+
+    GLuint indices[] = {0, 0, 0, 3, 4, 5, 0, 0};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    elem_vbo = bindDataToVBO(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    vao = bindVAO();
+    glVertexArrayElementBuffer(vao, elem_vbo);
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    RunFrames(10, [&]() {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawRangeElements(GL_TRIANGLES, 3, 5, 3, GL_UNSIGNED_INT, 0);
+    });
+
+    // Cleanup
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &elem_vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, DrawArraysInstanced)
+{
+    GLuint vbo = 0, vao = 0;
+
+    const char *vertex_shader = GLSL(
+        460, layout(location = 0) in vec3 position; layout(location = 0) out vec4 color; void main() {
+            vec3 instance_position = position;
+            if (gl_InstanceID == 1)
+                instance_position.x += 0.1;
+            else if (gl_InstanceID == 2)
+                instance_position.x += 0.2;
+            else if (gl_InstanceID == 3)
+                instance_position.x += 0.3;
+            if (gl_InstanceID == 1)
+                color = vec4(1.0, 0.0, 0.0, 1.0);
+            else if (gl_InstanceID == 2)
+                color = vec4(0.0, 1.0, 0.0, 1.0);
+            else if (gl_InstanceID == 3)
+                color = vec4(0.0, 0.0, 1.0, 1.0);
+            else
+                color = vec4(0.5, 0.0, 0.5, 1.0);
+            gl_Position = vec4(instance_position, 1.0);
+        });
+
+    const char *fragment_shader = GLSL(
+        460, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+        void main() { frag_colour = color; });
+
+    float points[] = {0.0f, 0.0f, 0.0f, 0.5f, 0.0f, 0.0f, 0.0f, -0.5f, 0.0f};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    RunFrames(10, [&]() {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 3, 4);
+    });
+
+    // Cleanup
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, DrawArraysInstancedDivisor)
+{
+    GLuint vbo[2], vao = 0;
+
+    const char *vertex_shader = GLSL(
+        460, layout(location = 0) in vec3 position; layout(location = 1) in vec4 col_in;
+        layout(location = 0) out vec4 col_out; void main() {
+            vec3 instance_position = position;
+            if (gl_InstanceID == 1)
+                instance_position.x += 0.1;
+            else if (gl_InstanceID == 2)
+                instance_position.x += 0.2;
+            else if (gl_InstanceID == 3)
+                instance_position.x += 0.3;
+            gl_Position = vec4(instance_position, 1.0);
+            col_out = col_in;
+        });
+
+    const char *fragment_shader = GLSL(
+        460, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+        void main() { frag_colour = color; });
+
+    float points[] = {0.0f, 0.0f, 0.0f, 0.5f, 0.0f, 0.0f, 0.0f, -0.5f, 0.0f};
+
+    float colors[] = {
+        1.0f, 0.0f, 0.0f, 1.0f, // for a red, green, blue, purple triangle
+        0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 1.0f,
+    };
+
+    vbo[0] = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vbo[1] = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo[0], 3, GL_FLOAT, false, 0, NULL);
+    bindAttribute(1, GL_ARRAY_BUFFER, vbo[1], 4, GL_FLOAT, false, 0, NULL);
+
+    glVertexAttribDivisor(1, 1); // fetch attribute once per instance
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    RunFrames(10, [&]() {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 3, 4);
+    });
+
+    // Cleanup
+    glDeleteBuffers(2, vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, MultiDrawIndirectCount)
+{
+    GLuint vbo = 0, elem_vbo = 0, vao = 0, indirect_vbo[2], parameter_vbo = 0;
+
+    const char *vertex_shader =
+        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.5, 0.5, 0.0, 1.0); });
+
+    GLfloat points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+    GLushort indices[] = {0, 1, 2};
+
+    // count, instanceCount, first, baseInstance
+    GLuint arrays_commands[4][4] = {{3, 1, 0, 0}, {3, 1, 0, 0}, {3, 1, 0, 0}, {3, 1, 0, 0}};
+
+    // count, instanceCount, firstIndex, baseVertex, baseInstance
+    GLuint elements_commands[4][5] = {{3, 1, 0, 0, 0}, {3, 1, 0, 0, 0}, {3, 1, 0, 0, 0}, {3, 1, 0, 0, 0}};
+
+    // the count the gpu uses sits after a word of padding, fewer draws than maxdrawcount
+    GLuint parameters[2] = {0, 2};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    elem_vbo = bindDataToVBO(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    indirect_vbo[0] = bindDataToVBO(GL_DRAW_INDIRECT_BUFFER, sizeof(arrays_commands), arrays_commands, GL_STATIC_DRAW);
+    indirect_vbo[1] =
+        bindDataToVBO(GL_DRAW_INDIRECT_BUFFER, sizeof(elements_commands), elements_commands, GL_STATIC_DRAW);
+    parameter_vbo = bindDataToVBO(GL_PARAMETER_BUFFER, sizeof(parameters), parameters, GL_DYNAMIC_DRAW);
+    vao = bindVAO();
+    glVertexArrayElementBuffer(vao, elem_vbo);
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glBindBuffer(GL_PARAMETER_BUFFER, parameter_vbo);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    RunFrames(10, [&]() {
+        glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        // tightly packed with a zero stride, then the same commands with an explicit one
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_vbo[0]);
+        glMultiDrawArraysIndirectCount(GL_TRIANGLES, NULL, sizeof(GLuint), 4, 0);
+        glMultiDrawArraysIndirectCount(GL_TRIANGLES, NULL, sizeof(GLuint), 4, sizeof(arrays_commands[0]));
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_vbo[1]);
+        glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_SHORT, NULL, sizeof(GLuint), 4, 0);
+
+        // a count past maxdrawcount is clamped to it
+        parameters[1] = 100;
+        glNamedBufferSubData(parameter_vbo, 0, sizeof(parameters), parameters);
+        glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_SHORT, NULL, sizeof(GLuint), 4, 0);
+
+        parameters[1] = 2;
+        glNamedBufferSubData(parameter_vbo, 0, sizeof(parameters), parameters);
+    });
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_PARAMETER_BUFFER, 0);
+
+    // Cleanup
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &elem_vbo);
+    glDeleteBuffers(2, indirect_vbo);
+    glDeleteBuffers(1, &parameter_vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, GeneratedIndices)
+{
+    if (headless)
+        GTEST_SKIP() << "the cpu renderer assembles fans itself";
+
+    GLuint vbo = 0, elem_vbo = 0, vao = 0;
+    GLuint hits, misses, new_hits, new_misses;
+
+    const char *vertex_shader =
+        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.0, 0.5, 0.5, 1.0); });
+
+    GLfloat points[] = {0.0f, 0.0f, 0.0f, 0.5f, 0.0f, 0.0f, 0.5f, 0.5f, 0.0f, 0.0f, 0.5f, 0.0f, -0.5f, 0.5f, 0.0f};
+    GLushort indices[] = {0, 1, 2, 3, 4};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    elem_vbo = bindDataToVBO(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    vao = bindVAO();
+    glVertexArrayElementBuffer(vao, elem_vbo);
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    auto drawFrame = [&]() {
+        glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 5);
+        glDrawElements(GL_TRIANGLE_FAN, 5, GL_UNSIGNED_SHORT, 0);
+        glDrawArrays(GL_LINE_LOOP, 0, 5);
+    };
+
+    MGLget(NULL, MGL_GENERATED_INDEX_HITS, &hits);
+    MGLget(NULL, MGL_GENERATED_INDEX_MISSES, &misses);
+
+    RunFrames(10, drawFrame);
+
+    MGLget(NULL, MGL_GENERATED_INDEX_HITS, &new_hits);
+    MGLget(NULL, MGL_GENERATED_INDEX_MISSES, &new_misses);
+
+    // each of the three draws converts once, every frame after that reuses it
+    EXPECT_EQ(new_misses, misses + 3);
+    EXPECT_EQ(new_hits, hits + 27);
+
+    // new contents in the element buffer are a new key for the elements fan only
+    indices[0] = 4;
+    indices[4] = 0;
+    glNamedBufferSubData(elem_vbo, 0, sizeof(indices), indices);
+
+    RunFrames(1, drawFrame);
+
+    MGLget(NULL, MGL_GENERATED_INDEX_MISSES, &misses);
+    EXPECT_EQ(misses, new_misses + 1);
+
+    // so does a copy into it
+    GLuint copy_vbo;
+    glCreateBuffers(1, &copy_vbo);
+    glNamedBufferData(copy_vbo, sizeof(indices), indices, GL_STATIC_DRAW);
+    glCopyNamedBufferSubData(copy_vbo, elem_vbo, 0, 0, sizeof(indices));
+
+    RunFrames(1, drawFrame);
+
+    MGLget(NULL, MGL_GENERATED_INDEX_MISSES, &new_misses);
+    EXPECT_EQ(new_misses, misses + 1);
+
+    // Cleanup
+    glDeleteBuffers(1, &copy_vbo);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &elem_vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, UniformBuffer)
 {
-#include "MGLContext.h"
+    GLuint vbo = 0, ubo = 0;
+
+    const char *vertex_shader = GLSL(
+        450 core,
+        layout(location = 0) in vec3 position; // attribute 0
+        layout(location = 0) out vec4 color;
+
+        layout(binding = 0) uniform vertex_data // vertex buffer 0
+        { vec4 colors[16]; };
+
+        void main() {
+            gl_Position = vec4(position, 1.0);
+            color = vec4(colors[0].x, colors[0].y, colors[0].z, 1.0);
+        });
+
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+
+        void main() { frag_colour = color; });
+
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+
+    GLuint vao = 0;
+    glCreateVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+
+    struct
+    {
+        float x, y, z, w;
+    } mptr[16];
+
+    for (int i = 0; i < 16; i++)
+    {
+        mptr[i].x = 1.0f;
+        mptr[i].y = mptr[i].z = mptr[i].w = 0.0f;
+    }
+
+    ubo = bindDataToVBO(GL_UNIFORM_BUFFER, sizeof(mptr), mptr, GL_STATIC_DRAW);
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    GLuint matrices_loc = glGetUniformBlockIndex(shader_program, "vertex_data");
+    EXPECT_EQ(matrices_loc, 0u) << "Uniform block index should be 0";
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, matrices_loc, ubo);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    RunFrames(10, [&]() {
+        glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    });
+
+    // Cleanup
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ubo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
 }
-#include "MGLRenderer.h"
-
-// change main.c to main.cpp to use glm...
-#include <glm/glm.hpp>
-
-using glm::mat4;
-using glm::vec3;
-#include <glm/gtc/matrix_transform.hpp>
-
-#define glDeleteBuffers(...)                                                                                           \
-    do                                                                                                                 \
-    {                                                                                                                  \
-    } while (0);
-#define glDeleteVertexArrays(...)                                                                                      \
-    do                                                                                                                 \
-    {                                                                                                                  \
-    } while (0);
-#define glDeleteProgram(...)                                                                                           \
-    do                                                                                                                 \
-    {                                                                                                                  \
-    } while (0);
-#define glDeleteFramebuffers(...)                                                                                      \
-    do                                                                                                                 \
-    {                                                                                                                  \
-    } while (0);
-
-#define GLSL(version, shader) "#version " #version "\n" #shader
-
-#define DEF_PIXEL_FOR_TYPE(_type_) _type_ *pixel = (_type_ *)ptr
-
-#define WR_NORM_PIXELR(_type_, _scale_, _r_)                                                                           \
-    {                                                                                                                  \
-        *pixel++ = (_type_)(_r_ * _scale_);                                                                            \
+
+TEST_F(MGLTest, ProgramResourceLookup)
+{
+    const char *vertex_shader = GLSL(
+        450 core,
+        layout(location = 0) in vec3 position;
+        layout(location = 1) in vec3 normal;
+        layout(location = 0) out vec4 color;
+
+        layout(binding = 0) uniform vertex_data
+        { vec4 colors[16]; };
+
+        layout(binding = 2) uniform light_data
+        { vec4 light; };
+
+        layout(binding = 3) buffer bone_data
+        { vec4 bones[]; };
+
+        layout(location = 4) uniform vec4 scale;
+
+        void main() {
+            gl_Position = vec4(position, 1.0) * scale + bones[0];
+            color = colors[0] * max(dot(normal, light.xyz), 0.0);
+        });
+
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+
+        void main() { frag_colour = color; });
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+
+    EXPECT_EQ(glGetAttribLocation(shader_program, "position"), 0);
+    EXPECT_EQ(glGetAttribLocation(shader_program, "normal"), 1);
+    EXPECT_EQ(glGetAttribLocation(shader_program, "tangent"), -1);
+
+    EXPECT_EQ(glGetProgramResourceLocation(shader_program, GL_PROGRAM_INPUT, "normal"), 1);
+    EXPECT_EQ(glGetProgramResourceLocation(shader_program, GL_PROGRAM_OUTPUT, "frag_colour"), 0);
+
+    // the fragment shader's input isn't an attribute
+    EXPECT_EQ(glGetProgramResourceIndex(shader_program, GL_PROGRAM_INPUT, "color"), GL_INVALID_INDEX);
+
+    EXPECT_EQ(glGetUniformBlockIndex(shader_program, "vertex_data"), 0u);
+    EXPECT_EQ(glGetUniformBlockIndex(shader_program, "light_data"), 2u);
+    EXPECT_EQ(glGetProgramResourceIndex(shader_program, GL_UNIFORM_BLOCK, "light_data"), 2u);
+    EXPECT_EQ(glGetProgramResourceIndex(shader_program, GL_UNIFORM_BLOCK, "normal"), GL_INVALID_INDEX);
+
+    // one index answers every interface, a name is only found under its own
+    EXPECT_EQ(glGetProgramResourceIndex(shader_program, GL_SHADER_STORAGE_BLOCK, "bone_data"), 3u);
+    EXPECT_EQ(glGetProgramResourceIndex(shader_program, GL_SHADER_STORAGE_BLOCK, "light_data"), GL_INVALID_INDEX);
+    EXPECT_EQ(glGetUniformBlockIndex(shader_program, "bone_data"), GL_INVALID_INDEX);
+
+    GLint scale_loc = glGetUniformLocation(shader_program, "scale");
+    EXPECT_NE(scale_loc, -1);
+    EXPECT_EQ(glGetProgramResourceLocation(shader_program, GL_UNIFORM, "scale"), scale_loc);
+    EXPECT_EQ(glGetUniformLocation(shader_program, "scal"), -1);
+    EXPECT_EQ(glGetUniformLocation(shader_program, "scales"), -1);
+
+    // repeated lookups keep answering the same
+    for (int i = 0; i < 4; i++)
+    {
+        EXPECT_EQ(glGetAttribLocation(shader_program, "normal"), 1);
+        EXPECT_EQ(glGetUniformBlockIndex(shader_program, "light_data"), 2u);
+    }
+
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, ProgramReflectionRelink)
+{
+    const char *vertex_shader = GLSL(
+        450 core,
+        layout(location = 0) in vec3 position;
+        layout(location = 1) in vec3 normal;
+        layout(location = 0) out vec3 n;
+
+        layout(binding = 0) uniform shared_data
+        { vec4 tint; };
+
+        void main() {
+            n = normal * tint.xyz;
+            gl_Position = vec4(position, 1.0);
+        });
+
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) in vec3 n; layout(location = 0) out vec4 frag_colour;
+
+        layout(binding = 0) uniform shared_data
+        { vec4 tint; };
+
+        void main() { frag_colour = vec4(normalize(n), tint.w); });
+
+    // the first link translates, relinks are read back from the shader cache and committed again
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+
+    GLint uniforms, attributes;
+    glGetProgramiv(shader_program, GL_ACTIVE_UNIFORMS, &uniforms);
+    glGetProgramiv(shader_program, GL_ACTIVE_ATTRIBUTES, &attributes);
+
+    GLuint hits, new_hits;
+    MGLget(NULL, MGL_SHADER_CACHE_HITS, &hits);
+
+    const int relinks = 8;
+
+    // every relink replaces the reflection, nothing from the previous link is kept or added to
+    for (int i = 0; i < relinks; i++)
+    {
+        glLinkProgram(shader_program);
+
+        GLint status, count;
+        glGetProgramiv(shader_program, GL_LINK_STATUS, &status);
+        EXPECT_EQ(status, GL_TRUE);
+
+        glGetProgramiv(shader_program, GL_ACTIVE_UNIFORMS, &count);
+        EXPECT_EQ(count, uniforms);
+        glGetProgramiv(shader_program, GL_ACTIVE_ATTRIBUTES, &count);
+        EXPECT_EQ(count, attributes);
+
+        EXPECT_EQ(glGetAttribLocation(shader_program, "position"), 0);
+        EXPECT_EQ(glGetAttribLocation(shader_program, "normal"), 1);
+        EXPECT_EQ(glGetUniformBlockIndex(shader_program, "shared_data"), 0u);
     }
-#define WR_NORM_PIXELRG(_type_, _scale_, _r_, _g_)                                                                     \
-    {                                                                                                                  \
-        *pixel++ = (_type_)(_r_ * _scale_);                                                                            \
-        *pixel++ = (_type_)(_g_ * _scale_);                                                                            \
+
+    MGLget(NULL, MGL_SHADER_CACHE_HITS, &new_hits);
+    EXPECT_EQ(new_hits - hits, (GLuint)(relinks * 2)) << "relinks commit the cached stage reflection";
+
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLTest, DeleteProgramInUse)
+{
+    GLuint vbo = 0, vao = 0, pipeline = 0;
+    GLint status;
+
+    const char *vertex_shader =
+        GLSL(450 core, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(450 core, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(1.0); });
+
+    GLfloat points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vao = bindVAO();
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    // glDeleteProgram is stubbed out for the other tests, the parentheses reach the real entry point
+    // the current program is only flagged, drawing keeps using it
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+    (glDeleteProgram)(shader_program);
+
+    EXPECT_EQ(glGetError(), GL_NO_ERROR);
+    EXPECT_EQ(glIsProgram(shader_program), GL_TRUE);
+
+    glGetProgramiv(shader_program, GL_DELETE_STATUS, &status);
+    EXPECT_EQ(status, GL_TRUE);
+
+    RunFrames(1, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    });
+
+    EXPECT_EQ(glGetError(), GL_NO_ERROR);
+
+    // and goes away once it isn't current
+    glUseProgram(0);
+    EXPECT_EQ(glIsProgram(shader_program), GL_FALSE);
+
+    // a pipeline stage holds on to its program the same way
+    GLuint stage_shader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(stage_shader, 1, &vertex_shader, NULL);
+    glCompileShader(stage_shader);
+
+    GLuint stage_program = glCreateProgram();
+    glProgramParameteri(stage_program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+    glAttachShader(stage_program, stage_shader);
+    glLinkProgram(stage_program);
+
+    glGenProgramPipelines(1, &pipeline);
+    glUseProgramStages(pipeline, GL_VERTEX_SHADER_BIT, stage_program);
+    (glDeleteProgram)(stage_program);
+
+    EXPECT_EQ(glIsProgram(stage_program), GL_TRUE);
+
+    glGetProgramiv(stage_program, GL_DELETE_STATUS, &status);
+    EXPECT_EQ(status, GL_TRUE);
+
+    glDeleteProgramPipelines(1, &pipeline);
+    EXPECT_EQ(glIsProgram(stage_program), GL_FALSE);
+
+    // a program nobody uses is deleted right away
+    GLuint unused_program =
+        compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    (glDeleteProgram)(unused_program);
+    EXPECT_EQ(glIsProgram(unused_program), GL_FALSE);
+
+    EXPECT_EQ(glGetError(), GL_NO_ERROR);
+
+    // Cleanup
+    glDeleteShader(stage_shader);
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+}
+
+TEST_F(MGLTest, ProgramPipeline)
+{
+    GLuint vbo = 0, vao = 0;
+
+    const char *vertex_shaders[] = {
+        GLSL(450 core, layout(location = 0) in vec3 position; layout(location = 0) out vec4 color;
+
+             void main() {
+                 color = vec4(1.0);
+                 gl_Position = vec4(position, 1.0);
+             }),
+        GLSL(450 core, layout(location = 0) in vec3 position; layout(location = 0) out vec4 color;
+
+             void main() {
+                 color = vec4(0.5);
+                 gl_Position = vec4(position * 0.5, 1.0);
+             }),
+    };
+
+    const char *fragment_shaders[] = {
+        GLSL(450 core, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+
+             void main() { frag_colour = color * vec4(1.0, 0.0, 0.0, 1.0); }),
+        GLSL(450 core, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+
+             void main() { frag_colour = color * vec4(0.0, 1.0, 0.0, 1.0); }),
+        GLSL(450 core, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+
+             void main() { frag_colour = color * vec4(0.0, 0.0, 1.0, 1.0); }),
+    };
+
+    // reads a location no vertex shader writes
+    const char *unmatched_shader = GLSL(
+        450 core, layout(location = 1) in vec4 normal; layout(location = 0) out vec4 frag_colour;
+
+        void main() { frag_colour = normal; });
+
+    const int vs_count = 2, fs_count = 3;
+
+    // a salt nobody has linked before makes every stage translate once
+    std::string salt = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+
+    auto salted = [&](const char *src, const char *kind, int i) {
+        return std::string(src) + "\n// " + salt + " " + kind + " " + std::to_string(i) + "\n";
+    };
+
+    auto linkSeparable = [&](GLenum type, const std::string &src) {
+        const char *str = src.c_str();
+
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &str, NULL);
+        glCompileShader(shader);
+
+        GLuint program = glCreateProgram();
+        glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+        glAttachShader(program, shader);
+        glLinkProgram(program);
+
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        EXPECT_EQ(status, GL_TRUE);
+
+        glGetProgramiv(program, GL_PROGRAM_SEPARABLE, &status);
+        EXPECT_EQ(status, GL_TRUE);
+
+        return program;
+    };
+
+    GLuint cache_hits, cache_misses;
+    MGLget(NULL, MGL_SHADER_CACHE_HITS, &cache_hits);
+    MGLget(NULL, MGL_SHADER_CACHE_MISSES, &cache_misses);
+
+    // each stage is translated once, on its own
+    GLuint vs[vs_count], fs[fs_count];
+
+    for (int i = 0; i < vs_count; i++)
+        vs[i] = linkSeparable(GL_VERTEX_SHADER, salted(vertex_shaders[i], "separable", i));
+
+    for (int i = 0; i < fs_count; i++)
+        fs[i] = linkSeparable(GL_FRAGMENT_SHADER, salted(fragment_shaders[i], "separable", i));
+
+    GLuint new_cache_hits, new_cache_misses;
+    MGLget(NULL, MGL_SHADER_CACHE_HITS, &new_cache_hits);
+    MGLget(NULL, MGL_SHADER_CACHE_MISSES, &new_cache_misses);
+
+    EXPECT_EQ(new_cache_hits - cache_hits, 0u);
+    EXPECT_EQ(new_cache_misses - cache_misses, (GLuint)(vs_count + fs_count));
+
+    GLuint pipelines[vs_count * fs_count];
+    glGenProgramPipelines(vs_count * fs_count, pipelines);
+
+    for (int v = 0; v < vs_count; v++)
+    {
+        for (int f = 0; f < fs_count; f++)
+        {
+            GLuint pipeline = pipelines[v * fs_count + f];
+
+            glUseProgramStages(pipeline, GL_VERTEX_SHADER_BIT, vs[v]);
+            glUseProgramStages(pipeline, GL_FRAGMENT_SHADER_BIT, fs[f]);
+            glValidateProgramPipeline(pipeline);
+
+            GLint valid;
+            glGetProgramPipelineiv(pipeline, GL_VALIDATE_STATUS, &valid);
+            EXPECT_EQ(valid, GL_TRUE);
+        }
     }
-#define WR_NORM_PIXELRGB(_type_, _scale_, _r_, _g_, _b_)                                                               \
-    {                                                                                                                  \
-        *pixel++ = (_type_)(_r_ * _scale_);                                                                            \
-        *pixel++ = (_type_)(_g_ * _scale_);                                                                            \
-        *pixel++ = (_type_)(_b_ * _scale_);                                                                            \
+
+    GLint stage_program;
+    glGetProgramPipelineiv(pipelines[fs_count + 2], GL_VERTEX_SHADER, &stage_program);
+    EXPECT_EQ((GLuint)stage_program, vs[1]);
+    glGetProgramPipelineiv(pipelines[fs_count + 2], GL_FRAGMENT_SHADER, &stage_program);
+    EXPECT_EQ((GLuint)stage_program, fs[2]);
+
+    // the interfaces are matched on the reflected locations
+    GLuint unmatched_fs = linkSeparable(GL_FRAGMENT_SHADER, unmatched_shader);
+
+    GLuint unmatched;
+    glCreateProgramPipelines(1, &unmatched);
+    EXPECT_EQ(glIsProgramPipeline(unmatched), GL_TRUE);
+
+    glUseProgramStages(unmatched, GL_VERTEX_SHADER_BIT, vs[0]);
+    glUseProgramStages(unmatched, GL_FRAGMENT_SHADER_BIT, unmatched_fs);
+    glValidateProgramPipeline(unmatched);
+
+    GLint valid, log_length;
+    glGetProgramPipelineiv(unmatched, GL_VALIDATE_STATUS, &valid);
+    glGetProgramPipelineiv(unmatched, GL_INFO_LOG_LENGTH, &log_length);
+    EXPECT_EQ(valid, GL_FALSE);
+    EXPECT_GT(log_length, 0);
+
+    std::vector<char> log(log_length);
+    glGetProgramPipelineInfoLog(unmatched, log_length, nullptr, log.data());
+    EXPECT_NE(strstr(log.data(), "location 1"), nullptr) << log.data();
+
+    glDeleteProgramPipelines(1, &unmatched);
+    EXPECT_EQ(glIsProgramPipeline(unmatched), GL_FALSE);
+
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    glViewport(0, 0, wscaled, hscaled);
+    glUseProgram(0);
+
+    GLuint hits, misses;
+    MGLget(NULL, MGL_PIPELINE_CACHE_HITS, &hits);
+    MGLget(NULL, MGL_PIPELINE_CACHE_MISSES, &misses);
+
+    MGLget(NULL, MGL_SHADER_CACHE_HITS, &cache_hits);
+    MGLget(NULL, MGL_SHADER_CACHE_MISSES, &cache_misses);
+
+    RunFrames(10, [&]() {
+        glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (int i = 0; i < vs_count * fs_count; i++)
+        {
+            glBindProgramPipeline(pipelines[i]);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+    });
+
+    GLint binding;
+    glGetIntegerv(GL_PROGRAM_PIPELINE_BINDING, &binding);
+    EXPECT_EQ((GLuint)binding, pipelines[vs_count * fs_count - 1]);
+
+    // binding and drawing the pipelines combined the stages without translating anything again
+    MGLget(NULL, MGL_SHADER_CACHE_HITS, &new_cache_hits);
+    MGLget(NULL, MGL_SHADER_CACHE_MISSES, &new_cache_misses);
+
+    EXPECT_EQ(new_cache_hits, cache_hits);
+    EXPECT_EQ(new_cache_misses, cache_misses);
+
+    // and each pipeline draws with the fragment stage it was given
+    for (int f = 0; f < fs_count; f++)
+    {
+        glBindProgramPipeline(pipelines[f]);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        std::vector<GLubyte> pixels = readDrawable();
+        SwapBuffers();
+
+        if (headless)
+            continue;
+
+        // BGRA, the fragment shaders write red, green and blue
+        const GLubyte *center = &pixels[((size_t)(hscaled / 2) * wscaled + wscaled / 2) * 4];
+        EXPECT_EQ(center[2], f == 0 ? 255 : 0);
+        EXPECT_EQ(center[1], f == 1 ? 255 : 0);
+        EXPECT_EQ(center[0], f == 2 ? 255 : 0);
     }
-#define WR_NORM_PIXELRGBA(_type_, _scale_, _r_, _g_, _b_, _a_)                                                         \
-    {                                                                                                                  \
-        *pixel++ = (_type_)(_r_ * _scale_);                                                                            \
-        *pixel++ = (_type_)(_g_ * _scale_);                                                                            \
-        *pixel++ = (_type_)(_b_ * _scale_);                                                                            \
-        *pixel++ = (_type_)(_a_ * _scale_);                                                                            \
+
+    if (headless == false)
+    {
+        GLuint new_hits, new_misses;
+        MGLget(NULL, MGL_PIPELINE_CACHE_HITS, &new_hits);
+        MGLget(NULL, MGL_PIPELINE_CACHE_MISSES, &new_misses);
+
+        EXPECT_LE(new_misses - misses, (GLuint)(vs_count * fs_count)) << "each stage set should compile once";
+        EXPECT_GE(new_hits - hits, (GLuint)(vs_count * fs_count * 9)) << "rebinding a pipeline should hit the cache";
     }
 
-#define WR_NORM_PIXEL_FORMAT(_format_, _type_, _scale_)                                                                \
-    {                                                                                                                  \
-        DEF_PIXEL_FOR_TYPE(_type_);                                                                                    \
-        switch (_format_)                                                                                              \
-        {                                                                                                              \
-        case GL_RED:                                                                                                   \
-            WR_NORM_PIXELR(_type_, _scale_, r);                                                                        \
-            break;                                                                                                     \
-        case GL_RG:                                                                                                    \
-            WR_NORM_PIXELRG(_type_, _scale_, r, g);                                                                    \
-            break;                                                                                                     \
-        case GL_RGB:                                                                                                   \
-            WR_NORM_PIXELRGB(_type_, _scale_, r, g, b);                                                                \
-            break;                                                                                                     \
-        case GL_RGBA:                                                                                                  \
-            WR_NORM_PIXELRGBA(_type_, _scale_, r, g, b, a);                                                            \
-            break;                                                                                                     \
-        default:                                                                                                       \
-            assert(0);                                                                                                 \
-        }                                                                                                              \
-    }
+    glBindProgramPipeline(0);
+    glDeleteProgramPipelines(vs_count * fs_count, pipelines);
+
+    // Cleanup
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+
+    for (int i = 0; i < vs_count; i++)
+        glDeleteProgram(vs[i]);
+
+    for (int i = 0; i < fs_count; i++)
+        glDeleteProgram(fs[i]);
+
+    glDeleteProgram(unmatched_fs);
+}
+
+TEST_F(MGLTest, ShaderStats)
+{
+    GLuint vbo = 0, vao = 0;
+
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position;
+
+        void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) out vec4 frag_colour;
+
+        void main() { frag_colour = vec4(1.0, 0.0, 0.0, 1.0); });
 
-#define WR_PIXELR(_type_, _r_, _scale_)                                                                                \
-    {                                                                                                                  \
-        *pixel++ = (_type_)_r_;                                                                                        \
-    }
-#define WR_PIXELRG(_type_, _r_, _g_, _scale_)                                                                          \
-    {                                                                                                                  \
-        *pixel++ = (_type_)_r_;                                                                                        \
-        *pixel++ = (_type_)_g_;                                                                                        \
-    }
-#define WR_PIXELRGB(_type_, _r_, _g_, _b_, _scale_)                                                                    \
-    {                                                                                                                  \
-        *pixel++ = (_type_)_r_;                                                                                        \
-        *pixel++ = (_type_)_g_;                                                                                        \
-        *pixel++ = (_type_)_b_;                                                                                        \
+    // a salt nobody has linked before so the first link translates
+    std::string salt = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    std::string vs_src = std::string(vertex_shader) + "\n// " + salt + "\n";
+    const char *sources[] = {vs_src.c_str(), fragment_shader};
+    GLenum types[] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+    GLuint shaders[2];
+
+    GLuint program = glCreateProgram();
+
+    for (int i = 0; i < 2; i++)
+    {
+        shaders[i] = glCreateShader(types[i]);
+        glShaderSource(shaders[i], 1, &sources[i], NULL);
+        glCompileShader(shaders[i]);
+        glAttachShader(program, shaders[i]);
     }
-#define WR_PIXELRGBA(_type_, _r_, _g_, _b_, _a_, _scale_)                                                              \
-    {                                                                                                                  \
-        *pixel++ = (_type_)_r_;                                                                                        \
-        *pixel++ = (_type_)_g_;                                                                                        \
-        *pixel++ = (_type_)_b_;                                                                                        \
-        *pixel++ = (_type_)_a_;                                                                                        \
+
+    glLinkProgram(program);
+
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    ASSERT_EQ(status, GL_TRUE);
+
+    GLuint64 value;
+    MGLgetShaderStats(NULL, shaders[0], MGL_STATS_SOURCE_BYTES, &value);
+    EXPECT_EQ(value, (GLuint64)vs_src.size());
+    MGLgetShaderStats(NULL, shaders[0], MGL_STATS_PARSE_TIME, &value);
+    EXPECT_GT(value, 0u);
+
+    // a program adds up its attached shaders
+    MGLgetProgramStats(NULL, program, MGL_STATS_SOURCE_BYTES, &value);
+    EXPECT_EQ(value, (GLuint64)(vs_src.size() + strlen(fragment_shader)));
+
+    GLuint64 link, spirv, msl, spirv_words, msl_bytes;
+    MGLgetProgramStats(NULL, program, MGL_STATS_LINK_TIME, &link);
+    MGLgetProgramStats(NULL, program, MGL_STATS_SPIRV_TIME, &spirv);
+    MGLgetProgramStats(NULL, program, MGL_STATS_MSL_TIME, &msl);
+    MGLgetProgramStats(NULL, program, MGL_STATS_SPIRV_WORDS, &spirv_words);
+    MGLgetProgramStats(NULL, program, MGL_STATS_MSL_BYTES, &msl_bytes);
+
+    EXPECT_GT(link, 0u);
+    EXPECT_GT(spirv, 0u);
+    EXPECT_GT(msl, 0u);
+    EXPECT_GT(spirv_words, 0u);
+    EXPECT_GT(msl_bytes, 0u);
+
+    // the relink comes out of the shader cache, nothing is translated but the sizes are still there
+    glLinkProgram(program);
+
+    MGLgetProgramStats(NULL, program, MGL_STATS_MSL_TIME, &msl);
+    MGLgetProgramStats(NULL, program, MGL_STATS_MSL_BYTES, &value);
+    EXPECT_EQ(msl, 0u);
+    EXPECT_EQ(value, msl_bytes);
+
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    glUseProgram(program);
+
+    RunFrames(1, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    });
+
+    if (headless == false)
+    {
+        MGLgetProgramStats(NULL, program, MGL_STATS_LIBRARY_TIME, &value);
+        EXPECT_GT(value, 0u) << "the metal library compile should be timed when the program is bound";
     }
 
-#define WR_PIXEL_FORMAT(_format_, _type_, _scale_)                                                                     \
-    {                                                                                                                  \
-        DEF_PIXEL_FOR_TYPE(_type_);                                                                                    \
-        switch (_format_)                                                                                              \
-        {                                                                                                              \
-        case GL_RED:                                                                                                   \
-            WR_PIXELR(int8_t, r, _scale_);                                                                             \
-            break;                                                                                                     \
-        case GL_RG:                                                                                                    \
-            WR_PIXELRG(int8_t, r, g, _scale_);                                                                         \
-            break;                                                                                                     \
-        case GL_RGB:                                                                                                   \
-            WR_PIXELRGB(int8_t, r, g, b, _scale_);                                                                     \
-            break;                                                                                                     \
-        case GL_RGBA:                                                                                                  \
-            WR_PIXELRGBA(int8_t, r, g, b, a, _scale_);                                                                 \
-            break;                                                                                                     \
-        default:                                                                                                       \
-            assert(0);                                                                                                 \
-        }                                                                                                              \
+    char path[] = "/tmp/mgl_shader_stats_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    ASSERT_TRUE(MGLwriteShaderStats(NULL, path));
+
+    FILE *fp = fopen(path, "r");
+    ASSERT_NE(fp, nullptr);
+
+    char line[512];
+    int shader_rows = 0, program_rows = 0;
+
+    ASSERT_NE(fgets(line, sizeof(line), fp), nullptr);
+    EXPECT_EQ(strncmp(line, "type,name,stage,", 16), 0);
+    EXPECT_NE(strstr(line, ",spirv_instructions_in,spirv_instructions_out,"), nullptr);
+
+    std::string program_row = "program," + std::to_string(program) + ",";
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (strncmp(line, "shader,", 7) == 0)
+            shader_rows++;
+
+        if (strncmp(line, program_row.c_str(), program_row.size()) == 0)
+            program_rows++;
     }
 
-void write_pixel(GLenum format, GLenum type, void *ptr, float r, float g, float b, float a)
+    fclose(fp);
+    unlink(path);
+
+    EXPECT_GE(shader_rows, 2);
+    EXPECT_EQ(program_rows, 2) << "one row per stage";
+
+    // Cleanup
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(program);
+}
+
+TEST_F(MGLTest, DeferredRelease)
 {
-    r = glm::clamp(r, 0.0f, 1.0f);
-    g = glm::clamp(g, 0.0f, 1.0f);
-    b = glm::clamp(b, 0.0f, 1.0f);
-    a = glm::clamp(a, 0.0f, 1.0f);
-
-    assert(r <= 1.0f);
-    assert(g <= 1.0f);
-    assert(b <= 1.0f);
-    assert(a <= 1.0f);
-
-    assert(r >= 0.0f);
-    assert(g >= 0.0f);
-    assert(b >= 0.0f);
-    assert(a >= 0.0f);
-
-    switch (type)
+    GLuint tex[16];
+    GLubyte pixels[64 * 64 * 4];
+
+    memset(pixels, 0xff, sizeof(pixels));
+
+    glGenTextures(16, tex);
+    for (int i = 0; i < 16; i++)
     {
-    case GL_UNSIGNED_BYTE: {
-        WR_NORM_PIXEL_FORMAT(format, uint8_t, 255.0);
-        break;
+        glBindTexture(GL_TEXTURE_2D, tex[i]);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 64, 64);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 64, 64, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
     }
 
-    case GL_BYTE: {
-        WR_NORM_PIXEL_FORMAT(format, int8_t, 127.0);
-        break;
-    }
+    // deleting textures must not stall, the backend objects are parked until the gpu is done
+    glDeleteTextures(16, tex);
 
-    case GL_UNSIGNED_SHORT: {
-        WR_NORM_PIXEL_FORMAT(format, uint16_t, (float)(2 ^ 16 - 1));
-        break;
-    }
+    glFinish();
 
-    case GL_SHORT: {
-        WR_NORM_PIXEL_FORMAT(format, int16_t, (float)(2 ^ 15 - 1));
-        break;
-    }
+    GLuint pending = ~0u;
+    MGLget(NULL, MGL_PENDING_RELEASES, &pending);
+    EXPECT_EQ(pending, 0u) << "glFinish should retire every deferred release";
+}
 
-    case GL_UNSIGNED_INT: {
-        WR_NORM_PIXEL_FORMAT(format, uint32_t, (float)(2 ^ 32 - 1));
-        break;
-    }
+TEST_F(MGLTest, SlotMapChurn)
+{
+    const GLuint count = 4096;
+    std::vector<GLuint> names(count);
+    SlotMap map;
 
-    case GL_INT: {
-        WR_NORM_PIXEL_FORMAT(format, int32_t, (float)(2 ^ 31 - 1));
-        break;
-    }
+    initSlotMap(&map, 128);
 
-    case GL_FLOAT: {
-        WR_PIXEL_FORMAT(format, float, 1.0f);
-        break;
-    }
+    for (int round = 0; round < 4; round++)
+    {
+        for (GLuint i = 0; i < count; i++)
+        {
+            names[i] = getNewName(&map);
+            insertSlotMapElement(&map, names[i], &names[i]);
+        }
+
+        // delete in a scrambled order so the dense array gets holes everywhere
+        for (GLuint i = 0; i < count; i++)
+        {
+            GLuint j = (GLuint)(((uint64_t)i * 2654435761u) % count);
+            std::swap(names[i], names[j]);
+        }
+
+        for (GLuint i = 0; i < count / 2; i++)
+            deleteSlotMapElement(&map, names[i]);
 
-    case GL_UNSIGNED_BYTE_3_3_2:
-    case GL_UNSIGNED_BYTE_2_3_3_REV:
-        assert(0);
-
-    case GL_UNSIGNED_SHORT_5_6_5:
-    case GL_UNSIGNED_SHORT_5_6_5_REV:
-    case GL_UNSIGNED_SHORT_4_4_4_4:
-    case GL_UNSIGNED_SHORT_4_4_4_4_REV:
-    case GL_UNSIGNED_SHORT_5_5_5_1:
-    case GL_UNSIGNED_SHORT_1_5_5_5_REV:
-        assert(0);
-        break;
-
-    case GL_UNSIGNED_INT_8_8_8_8:
-        WR_NORM_PIXEL_FORMAT(format, uint8_t, 255.0f);
-        break;
-
-    case GL_UNSIGNED_INT_8_8_8_8_REV:
-    case GL_UNSIGNED_INT_10_10_10_2:
-    case GL_UNSIGNED_INT_2_10_10_10_REV:
-        assert(0);
-        break;
-
-    default:
-        assert(0);
+        // the survivors stay packed and keep answering to their names
+        EXPECT_EQ(map.count, count - count / 2);
+
+        for (GLuint i = 0; i < map.count; i++)
+            EXPECT_EQ(searchSlotMap(&map, map.dense[i].name), map.dense[i].data);
+
+        for (GLuint i = count / 2; i < count; i++)
+            EXPECT_NE(searchSlotMap(&map, names[i]), nullptr);
+
+        for (GLuint i = 0; i < count / 2; i++)
+            EXPECT_EQ(searchSlotMap(&map, names[i]), nullptr);
+
+        for (GLuint i = count / 2; i < count; i++)
+            deleteSlotMapElement(&map, names[i]);
     }
+
+    EXPECT_EQ(map.count, 0u);
+    EXPECT_LE(map.slot_count, count + 1) << "deleted names should be recycled";
+
+    // a recycled slot must not answer to its old name
+    GLuint name = getNewName(&map);
+    insertSlotMapElement(&map, name, &names[0]);
+    EXPECT_EQ(searchSlotMap(&map, name), &names[0]);
+    EXPECT_EQ(searchSlotMap(&map, names[count - 1]), nullptr);
+
+    // nor can the old name be inserted over the live object
+    EXPECT_TRUE(isStaleSlotMapName(&map, names[count - 1]));
+    EXPECT_FALSE(insertSlotMapElement(&map, names[count - 1], &names[1]));
+    EXPECT_EQ(searchSlotMap(&map, name), &names[0]);
+
+    freeSlotMap(&map);
 }
 
-typedef struct RGBA_Pixel_t
+TEST_F(MGLTest, PipelineCache)
 {
-    uint8_t r, g, b, a;
-} RGBA_Pixel;
+    if (headless)
+        GTEST_SKIP() << "pipeline states are only built by the metal backend";
 
-void *gen3DTexturePixels(GLenum format, GLenum type, GLuint repeat, GLuint width, GLuint height, GLint depth)
-{
-    GLuint pixel_size;
-    size_t buffer_size;
-    void *buffer;
-    RGBA_Pixel *ptr;
+    GLuint vbo = 0;
+
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position;
 
-    assert(format == GL_RGBA);
-    assert(type == GL_UNSIGNED_BYTE);
+        void main() { gl_Position = vec4(position, 1.0); });
 
-    pixel_size = sizeForFormatType(format, type); //, 0);
+    const char *red_shader = GLSL(
+        450 core, layout(location = 0) out vec4 frag_colour;
 
-    buffer_size = pixel_size * width;
-    buffer_size *= height;
-    buffer_size *= depth;
+        void main() { frag_colour = vec4(1.0, 0.0, 0.0, 1.0); });
 
-    // Allocate directly from VM because... 3d textures can be big
-    kern_return_t err;
-    vm_address_t buffer_data;
-    err = vm_allocate((vm_map_t)mach_task_self(), (vm_address_t *)&buffer_data, buffer_size, VM_FLAGS_ANYWHERE);
-    assert(err == 0);
-    assert(buffer_data);
+    const char *green_shader = GLSL(
+        450 core, layout(location = 0) out vec4 frag_colour;
 
-    buffer = (void *)buffer_data;
+        void main() { frag_colour = vec4(0.0, 1.0, 0.0, 1.0); });
 
-    ptr = (RGBA_Pixel *)buffer;
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
 
-    float r, g, b;
-    float dr, dg, db;
+    GLuint vao = 0;
+    glCreateVertexArrays(1, &vao);
+    glBindVertexArray(vao);
 
-    dr = 1.0 / width;
-    dg = 1.0 / height;
-    db = 1.0 / depth;
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
 
-    r = 0;
-    g = 0;
-    b = 0;
+    GLuint red = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, red_shader);
+    GLuint green = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, green_shader);
 
-    for (int z = 0; z < depth; z++)
-    {
-        for (int y = 0; y < height; y++)
-        {
-            for (int x = 0; x < width; x++)
-            {
-                ptr->r = r * 255;
-                ptr->g = g * 255;
-                ptr->b = b * 255;
-                ptr->a = 255;
+    glViewport(0, 0, wscaled, hscaled);
 
-                ptr++;
+    GLuint hits, misses;
+    MGLget(NULL, MGL_PIPELINE_CACHE_HITS, &hits);
+    MGLget(NULL, MGL_PIPELINE_CACHE_MISSES, &misses);
 
-                r += dr;
-            }
+    // toggling between two programs should only ever build two pipelines
+    RunFrames(10, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+        glUseProgram(red);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glUseProgram(green);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    });
 
-            r = 0;
-            g += dg;
-        }
+    GLuint new_hits, new_misses;
+    MGLget(NULL, MGL_PIPELINE_CACHE_HITS, &new_hits);
+    MGLget(NULL, MGL_PIPELINE_CACHE_MISSES, &new_misses);
 
-        g = 0;
-        b += db;
-    }
+    EXPECT_LE(new_misses - misses, 2u) << "each program / state combination should compile once";
+    EXPECT_GE(new_hits - hits, 18u) << "later draws should hit the pipeline cache";
 
-    return buffer;
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(red);
+    glDeleteProgram(green);
 }
 
-void HSVtoRGB(float H, float S, float V, float *r, float *g, float *b)
+TEST_F(MGLTest, RenderPassesPerFrame)
 {
-    if (H > 360 || H < 0 || S > 100 || S < 0 || V > 100 || V < 0)
-    {
-        return;
-    }
+    if (headless)
+        GTEST_SKIP() << "render passes are only counted by the metal backend";
 
-    float s = S / 100;
-    float v = V / 100;
-    float C = s * v;
-    float X = C * (1 - abs(fmod(H / 60.0, 2) - 1));
+    GLuint vbo[8], vao[8];
 
-    if (H >= 0 && H < 60)
-    {
-        *r = C;
-        *g = X;
-        *b = 0;
-    }
-    else if (H >= 60 && H < 120)
-    {
-        *r = X;
-        *g = C;
-        *b = 0;
-    }
-    else if (H >= 120 && H < 180)
-    {
-        *r = 0;
-        *g = C;
-        *b = X;
-    }
-    else if (H >= 180 && H < 240)
-    {
-        *r = 0;
-        *g = X;
-        *b = C;
-    }
-    else if (H >= 240 && H < 300)
-    {
-        *r = X;
-        *g = 0;
-        *b = C;
-    }
-    else
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position;
+
+        void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) out vec4 frag_colour;
+
+        void main() { frag_colour = vec4(1.0, 1.0, 0.0, 1.0); });
+
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+
+    glCreateVertexArrays(8, vao);
+    for (int i = 0; i < 8; i++)
     {
-        *r = C;
-        *g = 0;
-        *b = X;
+        glBindVertexArray(vao[i]);
+
+        vbo[i] = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+        bindAttribute(0, GL_ARRAY_BUFFER, vbo[i], 3, GL_FLOAT, false, 0, NULL);
     }
-}
 
-#ifndef MIN
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
-#endif
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
 
-float clamp(float a, float min, float max)
-{
-    a = MAX(a, min);
-    a = MIN(a, max);
+    glViewport(0, 0, wscaled, hscaled);
+
+    // switching vertex arrays must not split the render pass
+    RunFrames(4, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (int i = 0; i < 8; i++)
+        {
+            glBindVertexArray(vao[i]);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+    });
+
+    GLuint passes = 0;
+    MGLget(NULL, MGL_RENDER_PASSES, &passes);
 
-    return a;
+    // the pass opened at swap time plus the one carrying the clear
+    EXPECT_LE(passes, 2u) << "vertex array changes should stay in one render pass";
+
+    glDeleteBuffers(8, vbo);
+    glDeleteVertexArrays(8, vao);
+    glDeleteProgram(shader_program);
 }
 
-void *genTexturePixels(GLenum format, GLenum type, GLuint repeat, GLuint width, GLuint height, GLint depth = 1,
-                       GLboolean is_array = false)
+TEST_F(MGLTest, DirtyBufferRanges)
 {
-    GLuint pixel_size;
-    size_t buffer_size;
-    void *buffer;
-    uint8_t *ptr;
+    if (headless)
+        GTEST_SKIP() << "dirty bytes are only counted by the metal backend";
 
-    pixel_size = sizeForFormatType(format, type); //, 0);
+    GLuint vbo, vao;
 
-    buffer_size = pixel_size * width;
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position;
 
-    buffer_size *= height;
+        void main() { gl_Position = vec4(position, 1.0); });
 
-    if (depth)
-        buffer_size *= depth;
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) out vec4 frag_colour;
 
-    buffer = malloc(buffer_size);
-    assert(buffer);
+        void main() { frag_colour = vec4(0.0, 1.0, 1.0, 1.0); });
 
-    ptr = (uint8_t *)buffer;
+    float triangle[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
 
-    float r, g, b;
-    float dr, dg, db;
+    // big enough to live in a metal buffer instead of going through set*Bytes
+    const int triangle_count = 2048;
+    std::vector<float> points(triangle_count * 9);
+    for (int i = 0; i < triangle_count; i++)
+        memcpy(&points[i * 9], triangle, sizeof(triangle));
 
-    if (is_array)
-    {
-        r = 0.0;
-        g = 0.0;
-        b = 0.0;
-    }
-    else
-    {
-        r = 1.0;
-        g = 1.0;
-        b = 1.0;
-    }
+    glCreateVertexArrays(1, &vao);
+    glBindVertexArray(vao);
 
-    dr = 1.0 / width;
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, points.size() * sizeof(float), points.data(), GL_DYNAMIC_DRAW);
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
 
-    if (height > 1)
-        dg = 1.0 / height;
-    else
-        dg = 0.0;
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
 
-    if (depth > 1)
-        db = 1.0 / depth;
-    else
-        db = 0.0;
+    glViewport(0, 0, wscaled, hscaled);
 
-    for (int z = 0; z < depth; z++)
-    {
-        for (int y = 0; y < height; y++)
-        {
-            for (int x = 0; x < width; x++)
-            {
-                r = clamp(r, 0.0f, 1.0f);
-                g = clamp(g, 0.0f, 1.0f);
-                b = clamp(b, 0.0f, 1.0f);
-
-                if (y & repeat)
-                {
-                    if (x & repeat)
-                    {
-                        write_pixel(format, type, ptr, r, g, b, 1.0);
-                    }
-                    else
-                    {
-                        write_pixel(format, type, ptr, 0.0, 0.0, 0.0, 1.0);
-                    }
-                }
-                else
-                {
-                    if ((x & repeat) == 0)
-                    {
-                        write_pixel(format, type, ptr, r, g, b, 1.0);
-                    }
-                    else
-                    {
-                        write_pixel(format, type, ptr, 0.0, 0.0, 0.0, 1.0);
-                    }
-                }
-
-                if (is_array)
-                {
-                    r += dr;
-                }
-
-                ptr = ptr + pixel_size;
-            }
+    // touch the first and last triangle, only those bytes should be synced
+    float scale = 1.0f;
+    RunFrames(4, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
 
-            if (is_array)
-            {
-                r = 0.0;
-                g += dg;
-            }
-        }
+        scale *= 0.9f;
+        for (int i = 0; i < 9; i++)
+            triangle[i] *= scale;
 
-        if (is_array)
-        {
-            g = 0.0;
-            b += db;
-        }
-    }
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(triangle), triangle);
+        glBufferSubData(GL_ARRAY_BUFFER, (triangle_count - 1) * sizeof(triangle), sizeof(triangle), triangle);
+
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glDrawArrays(GL_TRIANGLES, (triangle_count - 1) * 3, 3);
+    });
 
-    return buffer;
+    GLuint dirty_bytes = 0;
+    MGLget(NULL, MGL_DIRTY_BYTES, &dirty_bytes);
+
+    EXPECT_GT(dirty_bytes, 0u);
+    EXPECT_LE(dirty_bytes, 2 * sizeof(triangle)) << "sub data should not sync the whole buffer";
+
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
 }
 
-// Test fixture class for OpenGL setup
-class MGLTest : public ::testing::Test
+TEST_F(MGLTest, BufferOrphaning)
 {
-  protected:
-    static SDL_Window *window;
-    static GLMContext glm_ctx;
-    static void *renderer;
-    static int width, height;
-    static int wscaled, hscaled;
-    static bool initialized;
-
-    static void SetUpTestSuite()
-    {
-        if (initialized)
-            return;
+    if (headless)
+        GTEST_SKIP() << "buffer renames are only done by the metal backend";
 
-        if (SDL_Init(SDL_INIT_VIDEO) < 0)
-        {
-            FAIL() << "Failed to initialize SDL: " << SDL_GetError();
-        }
+    GLuint vbo, vao;
 
-        SDL_GL_LoadLibrary("/Users/sagar/Documents/MGL/build/libmgl.dylib");
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position;
 
-        window = SDL_CreateWindow("MGL Test", 0, 0, 600, 600,
-                                  SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_METAL);
+        void main() { gl_Position = vec4(position, 1.0); });
 
-        if (window == NULL)
-        {
-            FAIL() << "Window could not be created! SDL_Error: " << SDL_GetError();
-        }
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) out vec4 frag_colour;
 
-        glm_ctx = createGLMContext(GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, GL_DEPTH_COMPONENT, GL_FLOAT, 0, 0);
-        MGLsetCurrentContext(glm_ctx);
+        void main() { frag_colour = vec4(1.0, 0.0, 1.0, 1.0); });
 
-        SDL_SysWMinfo info;
-        SDL_VERSION(&info.version);
-        if (!SDL_GetWindowWMInfo(window, &info))
-        {
-            FAIL() << "Couldn't GetWindowWMInfo: " << SDL_GetError();
-        }
-        ASSERT_EQ(info.subsystem, SDL_SYSWM_COCOA);
+    float triangle[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
 
-        renderer = CppCreateMGLRendererFromContextAndBindToWindow(glm_ctx, info.info.cocoa.window);
-        if (!renderer)
-        {
-            FAIL() << "Couldn't create MGL renderer";
-        }
-        SDL_SetWindowData(window, "MGLRenderer", glm_ctx);
+    const int triangle_count = 2048;
+    std::vector<float> points(triangle_count * 9);
+    for (int i = 0; i < triangle_count; i++)
+        memcpy(&points[i * 9], triangle, sizeof(triangle));
 
-        SDL_GL_SetSwapInterval(0);
-        SDL_GetWindowSize(window, &width, &height);
-        SDL_GL_GetDrawableSize(window, &wscaled, &hscaled);
-        glViewport(0, 0, wscaled, hscaled);
+    glCreateVertexArrays(1, &vao);
+    glBindVertexArray(vao);
 
-        initialized = true;
-    }
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, points.size() * sizeof(float), points.data(), GL_STREAM_DRAW);
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
 
-    static void TearDownTestSuite()
-    {
-        if (window)
-        {
-            SDL_DestroyWindow(window);
-        }
-        SDL_Quit();
-        initialized = false;
-    }
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
 
-    void SetUp() override
-    {
-        // Clear any previous OpenGL errors
-        while (glGetError() != GL_NO_ERROR)
-        {
-        }
+    glViewport(0, 0, wscaled, hscaled);
 
-        // Clear buffers before each test
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    }
+    GLuint renames = 0, allocations = 0;
+    MGLget(NULL, MGL_BUFFER_RENAMES, &renames);
+    MGLget(NULL, MGL_BUFFER_RENAME_ALLOCATIONS, &allocations);
 
-    void TearDown() override
-    {
-        // Check for OpenGL errors after each test
-        GLenum error = glGetError();
-        EXPECT_EQ(GL_NO_ERROR, error) << "OpenGL error: " << error;
-    }
+    // respecify the whole buffer every frame like a streaming vertex buffer
+    const int frames = 32;
+    RunFrames(frames, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
 
-    // Helper function to swap buffers
-    void SwapBuffers()
-    {
-        MGLswapBuffers((GLMContext)SDL_GetWindowData(window, "MGLRenderer"));
-    }
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(float), points.data(), GL_STREAM_DRAW);
+        glDrawArrays(GL_TRIANGLES, 0, triangle_count * 3);
 
-    // Helper function to run test for a few frames
-    void RunFrames(int numFrames, std::function<void()> renderFunc)
-    {
-        for (int frame = 0; frame < numFrames; frame++)
-        {
-            renderFunc();
-            SwapBuffers();
+        glInvalidateBufferData(vbo);
+    });
 
-            // Process any pending events
-            SDL_Event event;
-            while (SDL_PollEvent(&event))
-            {
-                // Just consume events, don't act on them
-            }
-        }
-    }
+    GLuint new_renames = 0, new_allocations = 0;
+    MGLget(NULL, MGL_BUFFER_RENAMES, &new_renames);
+    MGLget(NULL, MGL_BUFFER_RENAME_ALLOCATIONS, &new_allocations);
 
-    // Helper functions from original code
-    GLuint bindDataToVBO(GLenum target, size_t size, void *ptr, GLenum usage)
-    {
-        GLuint vbo = 0;
-        glGenBuffers(1, &vbo);
-        glBindBuffer(target, vbo);
-        glBufferData(target, size, ptr, usage);
-        glBindBuffer(target, 0);
-        return vbo;
-    }
+    // the first respecification happens before the buffer has a metal store
+    EXPECT_GE(new_renames - renames, 2u * frames - 1) << "same size respecification should rename, not reallocate";
 
-    GLuint bindVAO(GLuint vao = 0)
-    {
-        if (vao)
-        {
-            glBindVertexArray(vao);
-        }
-        else
-        {
-            GLuint new_vao;
-            glCreateVertexArrays(1, &new_vao);
-            glBindVertexArray(new_vao);
-            return new_vao;
-        }
-        return vao;
-    }
+    // steady state only needs a store per frame in flight
+    EXPECT_LE(new_allocations - allocations, 8u) << "retired stores should be recycled";
 
-    void bindAttribute(GLuint index, GLuint target, GLuint vbo, GLint size, GLenum type, GLboolean normalized,
-                       GLsizei stride, const void *pointer)
-    {
-        glEnableVertexAttribArray(index);
-        glBindBuffer(target, vbo);
-        glVertexAttribPointer(index, size, type, GL_FALSE, stride, pointer);
-    }
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
 
-    GLuint compileGLSLProgram(GLenum shader_count, ...)
-    {
-        va_list argp;
-        va_start(argp, shader_count);
-        GLuint type;
-        const char *src;
-        GLuint shader;
+TEST_F(MGLTest, CopyBufferSubData)
+{
+    GLuint buffers[2];
 
-        GLuint shader_program = glCreateProgram();
+    const int buffer_size = 16384;
+    const int chunk = 1024;
 
-        for (int i = 0; i < shader_count; i++)
-        {
-            type = va_arg(argp, GLuint);
-            src = va_arg(argp, const char *);
-            EXPECT_NE(src, nullptr);
+    std::vector<GLubyte> pattern(buffer_size), zero(buffer_size, 0), result(buffer_size);
+    for (int i = 0; i < buffer_size; i++)
+        pattern[i] = (GLubyte)(i * 7 + 3);
 
-            shader = glCreateShader(type);
-            glShaderSource(shader, 1, &src, NULL);
-            glCompileShader(shader);
+    glCreateBuffers(2, buffers);
 
-            // Check compilation status
-            GLint status;
-            glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-            if (status == GL_FALSE)
-            {
-                GLint logLength;
-                glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
-                std::vector<char> log(logLength);
-                glGetShaderInfoLog(shader, logLength, nullptr, log.data());
-                ADD_FAILURE() << "Shader compilation failed: " << log.data();
-                return 0;
-            }
+    glBindBuffer(GL_COPY_READ_BUFFER, buffers[0]);
+    glBufferData(GL_COPY_READ_BUFFER, buffer_size, pattern.data(), GL_STATIC_DRAW);
 
-            glAttachShader(shader_program, shader);
-        }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+    glBufferData(GL_COPY_WRITE_BUFFER, buffer_size, zero.data(), GL_STATIC_DRAW);
 
-        glLinkProgram(shader_program);
+    // reverse the chunks, consecutive copies land in one blit encoder
+    for (int i = 0; i < buffer_size / chunk; i++)
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, i * chunk, buffer_size - (i + 1) * chunk,
+                            chunk);
 
-        // Check link status
-        GLint status;
-        glGetProgramiv(shader_program, GL_LINK_STATUS, &status);
-        if (status == GL_FALSE)
-        {
-            GLint logLength;
-            glGetProgramiv(shader_program, GL_INFO_LOG_LENGTH, &logLength);
-            std::vector<char> log(logLength);
-            glGetProgramInfoLog(shader_program, logLength, nullptr, log.data());
-            ADD_FAILURE() << "Program linking failed: " << log.data();
-        }
+    // unaligned copies take the cpu path
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 1, 3, 5);
 
-        va_end(argp);
-        return shader_program;
-    }
+    // no glFinish, the readback has to wait for the queued copies itself
+    glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, buffer_size, result.data());
 
-    GLuint createTexture(GLenum target, GLsizei width, GLsizei height = 1, GLsizei depth = 1, const void *pixels = NULL,
-                         GLint level = 0, GLint internalformat = GL_RGBA8, GLenum format = GL_RGBA,
-                         GLenum type = GL_UNSIGNED_BYTE)
+    for (int i = 0; i < buffer_size / chunk; i++)
     {
-        GLuint tex;
+        int dst = buffer_size - (i + 1) * chunk;
+        int start = (dst == 0) ? 8 : 0;
 
-        glGenTextures(1, &tex);
-        glBindTexture(target, tex);
-        switch (target)
-        {
-        case GL_TEXTURE_1D:
-            glTexImage1D(target, level, internalformat, width, 0, format, type, pixels);
-            break;
+        EXPECT_EQ(memcmp(&result[dst + start], &pattern[i * chunk + start], chunk - start), 0) << "chunk " << i;
+    }
 
-        case GL_TEXTURE_2D:
-            glTexImage2D(target, level, internalformat, width, height, 0, format, type, pixels);
-            break;
+    EXPECT_EQ(memcmp(&result[3], &pattern[1], 5), 0);
 
-        case GL_TEXTURE_3D:
-            glTexImage3D(target, level, internalformat, width, height, depth, 0, format, type, pixels);
-            break;
+    // a subdata after a queued copy into the same range has to win
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, chunk);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, chunk, zero.data());
 
-        case GL_TEXTURE_CUBE_MAP:
-            glTexImage2D(target, level, internalformat, width, height, 0, format, type, pixels);
-            break;
-        }
-        glBindTexture(target, 0);
+    glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, chunk, result.data());
+    EXPECT_EQ(memcmp(result.data(), zero.data(), chunk), 0);
 
-        return tex;
-    }
+    glDeleteBuffers(2, buffers);
+}
+
+TEST_F(MGLTest, ShaderCache)
+{
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position; layout(location = 1) in vec3 normal; out vec3 n;
+
+        void main() {
+            n = normal;
+            gl_Position = vec4(position, 1.0);
+        });
+
+    const char *fragment_shader = GLSL(
+        450 core, in vec3 n; layout(location = 0) out vec4 frag_colour;
+
+        void main() { frag_colour = vec4(normalize(n), 1.0); });
+
+    GLuint shaders[2];
+    GLuint programs[2];
+
+    shaders[0] = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(shaders[0], 1, &vertex_shader, NULL);
+    glCompileShader(shaders[0]);
+
+    shaders[1] = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(shaders[1], 1, &fragment_shader, NULL);
+    glCompileShader(shaders[1]);
+
+    GLuint hits, misses;
+    MGLget(NULL, MGL_SHADER_CACHE_HITS, &hits);
+    MGLget(NULL, MGL_SHADER_CACHE_MISSES, &misses);
 
-    void bufferSubData(GLenum target, GLuint buffer, GLsizei size, const void *ptr)
+    // the first link may already hit if an earlier run left the translation on disk
+    for (int i = 0; i < 2; i++)
     {
-        glBindBuffer(target, buffer);
-        glBufferSubData(target, 0, size, ptr);
-        glBindBuffer(target, 0);
+        programs[i] = glCreateProgram();
+        glAttachShader(programs[i], shaders[0]);
+        glAttachShader(programs[i], shaders[1]);
+        glLinkProgram(programs[i]);
+
+        GLint status;
+        glGetProgramiv(programs[i], GL_LINK_STATUS, &status);
+        EXPECT_EQ(status, GL_TRUE);
     }
 
-    GLuint drawToFramebuffer()
-    {
-        GLuint vbo = 0, vao = 0;
+    GLuint new_hits, new_misses;
+    MGLget(NULL, MGL_SHADER_CACHE_HITS, &new_hits);
+    MGLget(NULL, MGL_SHADER_CACHE_MISSES, &new_misses);
 
-        float points[] = {-1.0f, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 1.0f};
+    EXPECT_EQ((new_hits - hits) + (new_misses - misses), 4u);
+    EXPECT_GE(new_hits - hits, 2u) << "relinking the same sources should come from the cache";
 
-        vbo = bindDataToVBO(GL_ARRAY_BUFFER, 8 * sizeof(float), points, GL_STATIC_DRAW);
+    // reflection comes back with the cached translation
+    EXPECT_EQ(glGetAttribLocation(programs[0], "normal"), 1);
+    EXPECT_EQ(glGetAttribLocation(programs[1], "normal"), 1);
+    EXPECT_EQ(glGetAttribLocation(programs[1], "position"), 0);
+
+    glDeleteProgram(programs[0]);
+    glDeleteProgram(programs[1]);
+}
+
+TEST_F(MGLTest, ProgramBinary)
+{
+    GLint format_count = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+    EXPECT_EQ(format_count, 1);
 
-        const char *vertex_shader = GLSL(
-            450 core, layout(location = 0) in vec2 position; layout(location = 0) out vec2 texCoord;
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position; layout(location = 1) in vec3 normal; out vec3 n;
 
-            void main(void) {
-                gl_Position = vec4(position.xy, 0.0, 1.0);
-                gl_Position = sign(gl_Position);
+        void main() {
+            n = normal;
+            gl_Position = vec4(position, 1.0);
+        });
 
-                texCoord = (vec2(gl_Position.x, gl_Position.y) + vec2(1.0)) / vec2(2.0);
-            });
+    const char *fragment_shader = GLSL(
+        450 core, in vec3 n; layout(location = 0) uniform vec4 tint; layout(location = 0) out vec4 frag_colour;
 
-        const char *fragment_shader = GLSL(
-            450 core, layout(location = 0) in vec2 texCoord; layout(location = 0) out vec4 frag_colour;
+        void main() { frag_colour = vec4(normalize(n), 1.0) * tint; });
 
-            void main(void) {
-                ivec2 size = ivec2(16, 16);
-                float total = floor(texCoord.x * float(size.x)) + floor(texCoord.y * float(size.y));
-                bool isEven = mod(total, 2.0) == 0.0;
+    const int program_count = 4;
+    std::vector<GLuint> programs(program_count), loaded(program_count);
+    std::vector<std::vector<GLubyte>> binaries(program_count);
+    std::vector<GLenum> formats(program_count);
 
-                vec4 col1 = vec4(0.0, 0.0, 0.0, 1.0);
-                vec4 col2 = vec4(1.0, 1.0, 1.0, 1.0);
+    // a salt nobody has linked before keeps the shader cache out of the links
+    std::string salt = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
 
-                frag_colour = (isEven) ? col1 : col2;
-            });
+    for (int i = 0; i < program_count; i++)
+    {
+        std::string src = std::string(vertex_shader) + "\n// " + salt + " " + std::to_string(i) + "\n";
 
-        vao = bindVAO();
-        bindAttribute(0, GL_ARRAY_BUFFER, vbo, 2, GL_FLOAT, false, 0, NULL);
+        programs[i] = compileGLSLProgram(2, GL_VERTEX_SHADER, src.c_str(), GL_FRAGMENT_SHADER, fragment_shader);
+    }
 
-        GLuint shader_program =
-            compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
-        glUseProgram(shader_program);
+    for (int i = 0; i < program_count; i++)
+    {
+        GLint length = 0;
 
-        GLuint fbo;
-        glGenFramebuffers(1, &fbo);
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glGetProgramiv(programs[i], GL_PROGRAM_BINARY_LENGTH, &length);
+        ASSERT_GT(length, 0);
 
-        GLuint tex_attachment = createTexture(GL_TEXTURE_2D, 256, 256);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex_attachment, 0);
+        binaries[i].resize(length);
+        glGetProgramBinary(programs[i], length, &length, &formats[i], binaries[i].data());
+        EXPECT_EQ(length, (GLint)binaries[i].size());
+    }
 
-        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-        EXPECT_EQ(status, GL_FRAMEBUFFER_COMPLETE);
+    for (int i = 0; i < program_count; i++)
+    {
+        loaded[i] = glCreateProgram();
+        glProgramBinary(loaded[i], formats[i], binaries[i].data(), (GLsizei)binaries[i].size());
+    }
 
-        glViewport(0, 0, 256, 256);
-        glDrawBuffer(GL_COLOR_ATTACHMENT0);
-        glClearColor(1.0, 1.0, 1.0, 1.0);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-        glFinish();
+    // a reloaded binary is the same executable, the same interface and locations as the program it came from
+    for (int i = 0; i < program_count; i++)
+    {
+        GLint status;
+        glGetProgramiv(loaded[i], GL_LINK_STATUS, &status);
+        EXPECT_EQ(status, GL_TRUE);
+        EXPECT_EQ(glGetAttribLocation(loaded[i], "position"), glGetAttribLocation(programs[i], "position"));
+        EXPECT_EQ(glGetAttribLocation(loaded[i], "normal"), glGetAttribLocation(programs[i], "normal"));
+        EXPECT_EQ(glGetUniformLocation(loaded[i], "tint"), glGetUniformLocation(programs[i], "tint"));
+        EXPECT_NE(glGetUniformLocation(loaded[i], "tint"), -1);
+    }
 
-        glDrawBuffer(GL_FRONT);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glBindVertexArray(0);
-        glUseProgram(0);
+    // and draws the same thing
+    float points[] = {-1.0f, -1.0f, 0.0f, -1.0f, 1.0f, 0.0f, 1.0f, -1.0f, 0.0f, 1.0f, 1.0f, 0.0f};
+    float normals[] = {0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f};
 
-        // Cleanup
-        glDeleteBuffers(1, &vbo);
-        glDeleteVertexArrays(1, &vao);
-        glDeleteProgram(shader_program);
-        glDeleteFramebuffers(1, &fbo);
+    GLuint vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    GLuint nbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(normals), normals, GL_STATIC_DRAW);
+    GLuint vao = bindVAO();
 
-        return tex_attachment;
-    }
-};
-
-// Static member definitions
-SDL_Window *MGLTest::window = nullptr;
-GLMContext MGLTest::glm_ctx = nullptr;
-void *MGLTest::renderer = nullptr;
-int MGLTest::width = 0;
-int MGLTest::height = 0;
-int MGLTest::wscaled = 0;
-int MGLTest::hscaled = 0;
-bool MGLTest::initialized = false;
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+    bindAttribute(1, GL_ARRAY_BUFFER, nbo, 3, GL_FLOAT, false, 0, NULL);
 
-// Test cases
-TEST_F(MGLTest, Clear)
-{
-    int a = 0;
-    int e = 1;
+    glViewport(0, 0, wscaled, hscaled);
 
-    RunFrames(20, [&]() {
-        float f = (float)a / 100.0f;
-        glClearColor(1.0f - f, 0.2f, f, 1.0f);
+    auto draw = [&](GLuint program) {
+        glUseProgram(program);
+        glUniform4f(glGetUniformLocation(program, "tint"), 1.0f, 0.5f, 1.0f, 1.0f);
+        glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-        a += e;
-        if (a >= 100)
-            e = -1;
-        if (a == 0)
-            e = 1;
-    });
-}
+        std::vector<GLubyte> pixels = readDrawable();
+        SwapBuffers();
 
-TEST_F(MGLTest, DrawArrays)
-{
-    GLuint vbo = 0, vao = 0;
+        return pixels;
+    };
 
-    const char *vertex_shader =
-        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+    std::vector<GLubyte> linked_pixels = draw(programs[0]);
+    std::vector<GLubyte> loaded_pixels = draw(loaded[0]);
 
-    const char *fragment_shader =
-        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.5, 0.0, 0.5, 1.0); });
+    EXPECT_TRUE(linked_pixels == loaded_pixels) << "a reloaded binary should draw what the linked program drew";
 
-    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+    glUseProgram(0);
 
-    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
-    vao = bindVAO();
+    // a binary from another build hash links as a failure, not an error
+    std::vector<GLubyte> stale = binaries[0];
+    stale[8] ^= 0xff;
 
-    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+    GLuint stale_program = glCreateProgram();
+    glProgramBinary(stale_program, formats[0], stale.data(), (GLsizei)stale.size());
 
-    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
-    glUseProgram(shader_program);
+    GLint status;
+    glGetProgramiv(stale_program, GL_LINK_STATUS, &status);
+    EXPECT_EQ(status, GL_FALSE);
 
-    glViewport(0, 0, wscaled, hscaled);
+    // loading a binary keeps the attached shaders, a rejected one leaves them to link from source
+    GLint attached = 0;
+    glProgramBinary(programs[1], formats[2], binaries[2].data(), (GLsizei)binaries[2].size());
+    glGetProgramiv(programs[1], GL_ATTACHED_SHADERS, &attached);
+    EXPECT_EQ(attached, 2);
 
-    RunFrames(10, [&]() {
-        glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDrawArrays(GL_TRIANGLES, 0, 3);
-    });
+    glProgramBinary(programs[1], formats[0], stale.data(), (GLsizei)stale.size());
+    glGetProgramiv(programs[1], GL_LINK_STATUS, &status);
+    EXPECT_EQ(status, GL_FALSE);
+
+    glLinkProgram(programs[1]);
+    glGetProgramiv(programs[1], GL_LINK_STATUS, &status);
+    EXPECT_EQ(status, GL_TRUE);
 
-    // Cleanup
     glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &nbo);
     glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shader_program);
+
+    for (int i = 0; i < program_count; i++)
+    {
+        glDeleteProgram(programs[i]);
+        glDeleteProgram(loaded[i]);
+    }
+    glDeleteProgram(stale_program);
 }
 
-TEST_F(MGLTest, DrawArraysUniformMatrix4fv)
+TEST_F(MGLTest, LinkProgramStages)
 {
-    GLuint vbo = 0, vao = 0;
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position; layout(location = 1) in vec3 normal; out vec3 n;
 
-    const char *vertex_shader =
-        GLSL(460 core, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+        void main() {
+            n = normal;
+            gl_Position = vec4(position, 1.0);
+        });
 
-    const char *fragment_shader = GLSL(
-        460 core, layout(location = 0) out vec4 frag_colour; layout(location = 1) uniform mat4 mp;
-        void main() { frag_colour = vec4(mp[0][0], mp[0][1], mp[0][2], 1.0f); });
+    const char *tess_evaluation_shader = GLSL(
+        450 core, layout(triangles, equal_spacing, ccw) in; in vec3 n[]; out vec3 te_n;
 
-    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+        void main() {
+            te_n = gl_TessCoord.x * n[0] + gl_TessCoord.y * n[1] + gl_TessCoord.z * n[2];
+            gl_Position = gl_TessCoord.x * gl_in[0].gl_Position + gl_TessCoord.y * gl_in[1].gl_Position +
+                          gl_TessCoord.z * gl_in[2].gl_Position;
+        });
 
-    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
-    vao = bindVAO();
+    const char *fragment_shader = GLSL(
+        450 core, in vec3 n; layout(location = 0) out vec4 frag_colour;
 
-    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+        void main() { frag_colour = vec4(normalize(n), 1.0); });
 
-    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
-    glUseProgram(shader_program);
+    const char *tess_fragment_shader = GLSL(
+        450 core, in vec3 te_n; layout(location = 0) out vec4 frag_colour;
 
-    glViewport(0, 0, wscaled, hscaled);
+        void main() { frag_colour = vec4(normalize(te_n), 1.0); });
 
-    GLint mp_loc = glGetUniformLocation(shader_program, "mp");
-    GLfloat mp_val[16];
-    int ri = 1;
-    int gi = 0;
-    int bi = 0;
-    mp_val[0] = 0.0f;
-    mp_val[1] = 0.0f;
-    mp_val[2] = 0.0f;
-    mp_val[3] = 1.0f;
-    mp_val[4] = 0.5f;
-    mp_val[5] = 0.5f;
-    mp_val[6] = 0.5f;
-    mp_val[7] = 1.0f;
-    mp_val[8] = 0.0f;
-    mp_val[9] = 0.0f;
-    mp_val[10] = 0.0f;
-    mp_val[11] = 1.0f;
-    mp_val[12] = 0.5f;
-    mp_val[13] = 0.5f;
-    mp_val[14] = 0.5f;
-    mp_val[15] = 1.0f;
+    const int program_count = 4;
 
-    RunFrames(15, [&]() {
-        glBindVertexArray(vao);
-        glUseProgram(shader_program);
-        glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glUniformMatrix4fv(mp_loc, 1, false, mp_val);
-        glDrawArrays(GL_TRIANGLES, 0, 3);
+    // a salt nobody has linked before makes every stage translate
+    std::string salt = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
 
-        mp_val[0] += ri / 100.0f;
-        mp_val[1] += gi / 100.0f;
-        mp_val[2] += bi / 100.0f;
+    auto link = [&](int stages) {
+        GLuint misses;
+        MGLget(NULL, MGL_SHADER_CACHE_MISSES, &misses);
 
-        if (mp_val[0] > 1.0f)
-        {
-            ri = -1;
-            gi = 1;
-        }
-        if (mp_val[0] < 0.0f)
-        {
-            ri = 0;
-            mp_val[0] = 0.0f;
-        }
-        if (mp_val[1] > 1.0f)
-        {
-            gi = -1;
-            bi = 1;
-        }
-        if (mp_val[1] < 0.0f)
-        {
-            gi = 0;
-            mp_val[1] = 0.0f;
-        }
-        if (mp_val[2] > 1.0f)
-        {
-            bi = -1;
-            ri = 1;
-        }
-        if (mp_val[2] < 0.0f)
+        for (int i = 0; i < program_count; i++)
         {
-            bi = 0;
-            mp_val[2] = 0.0f;
-        }
-    });
+            std::string src = std::string(vertex_shader) + "\n// " + salt + " " + std::to_string(stages) + " " +
+                              std::to_string(i) + "\n";
 
-    // Cleanup
-    glDeleteBuffers(1, &vbo);
-    glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shader_program);
-}
-
-TEST_F(MGLTest, DrawElements)
-{
-    GLuint vbo = 0, elem_vbo = 0, vao = 0;
-
-    const char *vertex_shader =
-        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
-
-    const char *fragment_shader =
-        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.5, 0.0, 0.5, 1.0); });
+            GLuint program;
+            if (stages == 2)
+                program = compileGLSLProgram(2, GL_VERTEX_SHADER, src.c_str(), GL_FRAGMENT_SHADER, fragment_shader);
+            else
+                program = compileGLSLProgram(3, GL_VERTEX_SHADER, src.c_str(), GL_TESS_EVALUATION_SHADER,
+                                             tess_evaluation_shader, GL_FRAGMENT_SHADER, tess_fragment_shader);
 
-    GLfloat points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
-    GLuint indices[] = {0, 1, 2};
+            GLint status;
+            glGetProgramiv(program, GL_LINK_STATUS, &status);
+            EXPECT_EQ(status, GL_TRUE);
 
-    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
-    elem_vbo = bindDataToVBO(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-    vao = bindVAO();
-    glVertexArrayElementBuffer(vao, elem_vbo);
+            // one link made the spir-v of every stage
+            GLuint64 words;
+            MGLgetProgramStats(NULL, program, MGL_STATS_SPIRV_WORDS, &words);
+            EXPECT_GT(words, 0u);
+            EXPECT_EQ(glGetAttribLocation(program, "normal"), 1);
 
-    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+            glDeleteProgram(program);
+        }
 
-    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
-    glUseProgram(shader_program);
+        GLuint new_misses;
+        MGLget(NULL, MGL_SHADER_CACHE_MISSES, &new_misses);
 
-    glViewport(0, 0, wscaled, hscaled);
+        EXPECT_EQ(new_misses - misses, (GLuint)(program_count * stages)) << "every stage should be translated once";
+    };
 
-    RunFrames(10, [&]() {
-        glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, 0);
-    });
+    link(2);
 
-    // Cleanup
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &elem_vbo);
-    glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shader_program);
+    // the metal backend has no tessellation stages, only the translation can be checked there
+    if (headless)
+        link(3);
 }
 
-TEST_F(MGLTest, DrawElementsVertexAttribute)
+TEST_F(MGLTest, ParallelShaderCompile)
 {
-    GLuint vbo = 0, elem_vbo = 0, vao = 0;
-
     const char *vertex_shader = GLSL(
-        460, layout(location = 0) in vec3 position; layout(location = 1) in vec3 col;
-        layout(location = 0) out vec3 col_out; void main() {
+        450 core, layout(location = 0) in vec3 position; layout(location = 1) in vec3 normal; out vec3 n;
+
+        void main() {
+            n = normal;
             gl_Position = vec4(position, 1.0);
-            col_out = col;
         });
 
     const char *fragment_shader = GLSL(
-        460, layout(location = 0) in vec3 color_in; layout(location = 0) out vec4 frag_colour;
-        void main() { frag_colour = vec4(color_in, 1.0); });
+        450 core, in vec3 n; layout(location = 0) out vec4 frag_colour;
 
-    GLfloat verts[] = {// pos               // col
-                       0.0f, 0.5f, 0.0f, 1.0f,  0.0f,  0.0f, 0.5f, -0.5f, 0.0f,
-                       0.0f, 1.0f, 0.0f, -0.5f, -0.5f, 0.0f, 0.0f, 0.0f,  1.0f};
+        void main() { frag_colour = vec4(normalize(n), 1.0); });
 
-    GLuint indices[] = {0, 1, 2};
+    const int program_count = 8;
 
-    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
-    elem_vbo = bindDataToVBO(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-    vao = bindVAO();
-    glVertexArrayElementBuffer(vao, elem_vbo);
+    GLint max_threads;
+    glGetIntegerv(GL_MAX_SHADER_COMPILER_THREADS_KHR, &max_threads);
+    EXPECT_NE(max_threads, 0) << "compiles should go to the workers by default";
 
-    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 6 * sizeof(GLfloat), NULL);
-    bindAttribute(1, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 6 * sizeof(GLfloat), (void *)(3 * sizeof(float)));
+    // a salt nobody has linked before so every link does the work
+    std::string salt = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
 
-    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
-    glUseProgram(shader_program);
+    auto build = [&](GLuint threads, int batch) {
+        std::vector<GLuint> programs(program_count);
 
-    glViewport(0, 0, wscaled, hscaled);
+        glMaxShaderCompilerThreadsKHR(threads);
 
-    RunFrames(10, [&]() {
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, 0);
-    });
+        GLint limit;
+        glGetIntegerv(GL_MAX_SHADER_COMPILER_THREADS_KHR, &limit);
+        EXPECT_EQ((GLuint)limit, threads);
 
-    // Cleanup
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &elem_vbo);
-    glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shader_program);
-}
+        for (int i = 0; i < program_count; i++)
+        {
+            std::string src = std::string(vertex_shader) + "\n// " + salt + " " + std::to_string(batch) + " " +
+                              std::to_string(i) + "\n";
+            const char *vs = src.c_str();
 
-TEST_F(MGLTest, DrawRangeElements)
-{
-    GLuint vbo = 0, elem_vbo = 0, vao = 0;
+            GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
+            glShaderSource(vertex, 1, &vs, NULL);
+            glCompileShader(vertex);
 
-    const char *vertex_shader =
-        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+            GLuint fragment = glCreateShader(GL_FRAGMENT_SHADER);
+            glShaderSource(fragment, 1, &fragment_shader, NULL);
+            glCompileShader(fragment);
 
-    const char *fragment_shader =
-        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.5, 0.0, 0.5, 1.0); });
+            programs[i] = glCreateProgram();
+            glAttachShader(programs[i], vertex);
+            glAttachShader(programs[i], fragment);
+            glLinkProgram(programs[i]);
 
-    GLfloat points[] = {
-        0.0f, 0.5f,  0.0f, 0.0f,  0.5f,  0.0f, 0.0f, 0.5f, 0.0f, 0.0f, 0.5f, 0.0f, // start @ 3
-        0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f,                                     // end @ 5
-        0.0f, 0.5f,  0.0f, 0.0f,  0.5f,  0.0f, 0.0f, 0.5f, 0.0f,
+            // without workers the link is done before glLinkProgram returns
+            if (threads == 0)
+            {
+                GLint status;
+                glGetShaderiv(vertex, GL_COMPLETION_STATUS_KHR, &status);
+                EXPECT_EQ(status, GL_TRUE);
+                glGetProgramiv(programs[i], GL_COMPLETION_STATUS_KHR, &status);
+                EXPECT_EQ(status, GL_TRUE);
+            }
+        }
+
+        return programs;
     };
 
-    GLuint indices[] = {0, 0, 0, 3, 4, 5, 0, 0};
+    // the completion status doesn't join, poll it the way a loading screen would until every link is done
+    std::vector<GLuint> programs = build(max_threads, 0);
 
-    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
-    elem_vbo = bindDataToVBO(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-    vao = bindVAO();
-    glVertexArrayElementBuffer(vao, elem_vbo);
+    for (bool complete = false; complete == false;)
+    {
+        complete = true;
 
-    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+        for (GLuint program : programs)
+        {
+            GLint status;
+            glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &status);
+            complete &= (status == GL_TRUE);
+        }
+    }
+
+    for (GLuint program : programs)
+    {
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        EXPECT_EQ(status, GL_TRUE);
+
+        glDeleteProgram(program);
+    }
+
+    // a query that needs the result joins the link on its own
+    programs = build(max_threads, 1);
+
+    for (GLuint program : programs)
+    {
+        EXPECT_EQ(glGetAttribLocation(program, "normal"), 1);
+
+        GLint status;
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &status);
+        EXPECT_EQ(status, GL_TRUE);
+
+        glDeleteProgram(program);
+    }
 
-    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
-    glUseProgram(shader_program);
+    // and with no workers everything happens on the calling thread
+    programs = build(0, 2);
 
-    glViewport(0, 0, wscaled, hscaled);
+    for (GLuint program : programs)
+    {
+        EXPECT_EQ(glGetAttribLocation(program, "normal"), 1);
 
-    RunFrames(10, [&]() {
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDrawRangeElements(GL_TRIANGLES, 3, 5, 3, GL_UNSIGNED_INT, 0);
-    });
+        glDeleteProgram(program);
+    }
 
-    // Cleanup
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &elem_vbo);
-    glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shader_program);
+    glMaxShaderCompilerThreadsKHR(max_threads);
 }
 
-TEST_F(MGLTest, DrawArraysInstanced)
+TEST_F(MGLTest, ShaderBinarySPIRV)
 {
     GLuint vbo = 0, vao = 0;
 
-    const char *vertex_shader = GLSL(
-        460, layout(location = 0) in vec3 position; layout(location = 0) out vec4 color; void main() {
-            vec3 instance_position = position;
-            if (gl_InstanceID == 1)
-                instance_position.x += 0.1;
-            else if (gl_InstanceID == 2)
-                instance_position.x += 0.2;
-            else if (gl_InstanceID == 3)
-                instance_position.x += 0.3;
-            if (gl_InstanceID == 1)
-                color = vec4(1.0, 0.0, 0.0, 1.0);
-            else if (gl_InstanceID == 2)
-                color = vec4(0.0, 1.0, 0.0, 1.0);
-            else if (gl_InstanceID == 3)
-                color = vec4(0.0, 0.0, 1.0, 1.0);
-            else
-                color = vec4(0.5, 0.0, 0.5, 1.0);
-            gl_Position = vec4(instance_position, 1.0);
-        });
+    GLint format_count = 0, format = 0;
+    glGetIntegerv(GL_NUM_SHADER_BINARY_FORMATS, &format_count);
+    glGetIntegerv(GL_SHADER_BINARY_FORMATS, &format);
+    EXPECT_EQ(format_count, 1);
+    EXPECT_EQ(format, GL_SHADER_BINARY_FORMAT_SPIR_V);
 
-    const char *fragment_shader = GLSL(
-        460, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
-        void main() { frag_colour = color; });
+    // hand assembled so the test doesn't need a spir-v toolchain, ids are numbered in order of definition
+    auto op = [](std::vector<GLuint> &words, GLuint opcode, std::initializer_list<GLuint> operands) {
+        words.push_back((GLuint)((operands.size() + 1) << 16) | opcode);
+        words.insert(words.end(), operands);
+    };
 
-    float points[] = {0.0f, 0.0f, 0.0f, 0.5f, 0.0f, 0.0f, 0.0f, -0.5f, 0.0f};
+    const GLuint main_name[] = {0x6e69616d, 0}; // "main"
+    const GLuint one = 0x3f800000;              // 1.0f
+
+    // layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); }
+    std::vector<GLuint> vertex_module = {0x07230203, 0x00010000, 0, 18, 0};
+    op(vertex_module, 17, {1});                                       // OpCapability Shader
+    op(vertex_module, 14, {0, 1});                                    // OpMemoryModel Logical GLSL450
+    op(vertex_module, 15, {0, 11, main_name[0], main_name[1], 7, 9}); // OpEntryPoint Vertex %11 "main" %7 %9
+    op(vertex_module, 71, {7, 30, 0});                                // OpDecorate %7 Location 0
+    op(vertex_module, 71, {9, 11, 0});                                // OpDecorate %9 BuiltIn Position
+    op(vertex_module, 19, {1});                                       // %1 = OpTypeVoid
+    op(vertex_module, 33, {2, 1});                                    // %2 = OpTypeFunction %1
+    op(vertex_module, 22, {3, 32});                                   // %3 = OpTypeFloat 32
+    op(vertex_module, 23, {4, 3, 4});                                 // %4 = OpTypeVector %3 4
+    op(vertex_module, 23, {5, 3, 3});                                 // %5 = OpTypeVector %3 3
+    op(vertex_module, 32, {6, 1, 5});                                 // %6 = OpTypePointer Input %5
+    op(vertex_module, 59, {6, 7, 1});                                 // %7 = OpVariable %6 Input
+    op(vertex_module, 32, {8, 3, 4});                                 // %8 = OpTypePointer Output %4
+    op(vertex_module, 59, {8, 9, 3});                                 // %9 = OpVariable %8 Output
+    op(vertex_module, 43, {3, 10, one});                              // %10 = OpConstant %3 1.0
+    op(vertex_module, 54, {1, 11, 0, 2});                             // %11 = OpFunction %1 None %2
+    op(vertex_module, 248, {12});                                     // %12 = OpLabel
+    op(vertex_module, 61, {5, 13, 7});                                // %13 = OpLoad %5 %7
+    op(vertex_module, 81, {3, 14, 13, 0});                            // %14 = OpCompositeExtract %3 %13 0
+    op(vertex_module, 81, {3, 15, 13, 1});                            // %15 = OpCompositeExtract %3 %13 1
+    op(vertex_module, 81, {3, 16, 13, 2});                            // %16 = OpCompositeExtract %3 %13 2
+    op(vertex_module, 80, {4, 17, 14, 15, 16, 10});                   // %17 = OpCompositeConstruct %4 ...
+    op(vertex_module, 62, {9, 17});                                   // OpStore %9 %17
+    op(vertex_module, 253, {});                                       // OpReturn
+    op(vertex_module, 56, {});                                        // OpFunctionEnd
+
+    // layout(constant_id = 0) const float red = 0.0; layout(location = 0) out vec4 frag_colour;
+    // void main() { frag_colour = vec4(red, 0.0, 0.0, 1.0); }
+    std::vector<GLuint> fragment_module = {0x07230203, 0x00010000, 0, 13, 0};
+    op(fragment_module, 17, {1});                                    // OpCapability Shader
+    op(fragment_module, 14, {0, 1});                                 // OpMemoryModel Logical GLSL450
+    op(fragment_module, 15, {4, 10, main_name[0], main_name[1], 6}); // OpEntryPoint Fragment %10 "main" %6
+    op(fragment_module, 16, {10, 7});                                // OpExecutionMode %10 OriginUpperLeft
+    op(fragment_module, 71, {6, 30, 0});                             // OpDecorate %6 Location 0
+    op(fragment_module, 71, {7, 1, 0});                              // OpDecorate %7 SpecId 0
+    op(fragment_module, 19, {1});                                    // %1 = OpTypeVoid
+    op(fragment_module, 33, {2, 1});                                 // %2 = OpTypeFunction %1
+    op(fragment_module, 22, {3, 32});                                // %3 = OpTypeFloat 32
+    op(fragment_module, 23, {4, 3, 4});                              // %4 = OpTypeVector %3 4
+    op(fragment_module, 32, {5, 3, 4});                              // %5 = OpTypePointer Output %4
+    op(fragment_module, 59, {5, 6, 3});                              // %6 = OpVariable %5 Output
+    op(fragment_module, 50, {3, 7, 0});                              // %7 = OpSpecConstant %3 0.0
+    op(fragment_module, 43, {3, 8, one});                            // %8 = OpConstant %3 1.0
+    op(fragment_module, 43, {3, 9, 0});                              // %9 = OpConstant %3 0.0
+    op(fragment_module, 54, {1, 10, 0, 2});                          // %10 = OpFunction %1 None %2
+    op(fragment_module, 248, {11});                                  // %11 = OpLabel
+    op(fragment_module, 80, {4, 12, 7, 9, 9, 8});                    // %12 = OpCompositeConstruct %4 ...
+    op(fragment_module, 62, {6, 12});                                // OpStore %6 %12
+    op(fragment_module, 253, {});                                    // OpReturn
+    op(fragment_module, 56, {});                                     // OpFunctionEnd
+
+    auto loadModule = [](GLenum type, const std::vector<GLuint> &module, GLuint red) {
+        GLuint shader = glCreateShader(type);
+        glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, module.data(),
+                       (GLsizei)(module.size() * sizeof(GLuint)));
+
+        GLint status;
+        glGetShaderiv(shader, GL_SPIR_V_BINARY, &status);
+        EXPECT_EQ(status, GL_TRUE);
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        EXPECT_EQ(status, GL_FALSE) << "a module isn't compiled until it's specialized";
+
+        GLuint constant_id = 0;
+        glSpecializeShader(shader, "main", type == GL_FRAGMENT_SHADER ? 1 : 0, &constant_id, &red);
+
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        EXPECT_EQ(status, GL_TRUE);
+
+        return shader;
+    };
+
+    // the same modules specialized two ways, the constant has to reach the translated fragment stage
+    const GLfloat reds[] = {1.0f, 0.0f};
+    const int program_count = 2;
+    GLuint programs[program_count];
+
+    for (int i = 0; i < program_count; i++)
+    {
+        GLuint bits;
+        memcpy(&bits, &reds[i], sizeof(bits));
+
+        programs[i] = glCreateProgram();
+        glAttachShader(programs[i], loadModule(GL_VERTEX_SHADER, vertex_module, 0));
+        glAttachShader(programs[i], loadModule(GL_FRAGMENT_SHADER, fragment_module, bits));
+        glLinkProgram(programs[i]);
+
+        GLint status;
+        glGetProgramiv(programs[i], GL_LINK_STATUS, &status);
+        EXPECT_EQ(status, GL_TRUE);
+    }
+
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
 
     vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
     vao = bindVAO();
 
     bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
 
-    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
-    glUseProgram(shader_program);
-
-    glViewport(0, 0, wscaled, hscaled);
-
-    RunFrames(10, [&]() {
+    for (int i = 0; i < program_count; i++)
+    {
+        glUseProgram(programs[i]);
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
-        glDrawArraysInstanced(GL_TRIANGLES, 0, 3, 4);
-    });
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        std::vector<GLubyte> pixels = readDrawable();
+        SwapBuffers();
+
+        if (headless)
+            continue;
+
+        // BGRA, red comes from the specialization constant
+        const GLubyte *center = &pixels[((size_t)(hscaled / 2) * wscaled + wscaled / 2) * 4];
+        EXPECT_EQ(center[2], (GLubyte)(reds[i] * 255.0f));
+        EXPECT_EQ(center[1], 0);
+        EXPECT_EQ(center[0], 0);
+    }
 
     // Cleanup
     glDeleteBuffers(1, &vbo);
     glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shader_program);
+    for (GLuint program : programs)
+        glDeleteProgram(program);
 }
 
-TEST_F(MGLTest, DrawArraysInstancedDivisor)
+TEST_F(MGLTest, SPIRVOptimizer)
 {
-    GLuint vbo[2], vao = 0;
+    GLuint vbo = 0, vao = 0;
 
+    // helpers to inline, a local array to scalarize, constants to fold and a branch that is never taken
     const char *vertex_shader = GLSL(
-        460, layout(location = 0) in vec3 position; layout(location = 1) in vec4 col_in;
-        layout(location = 0) out vec4 col_out; void main() {
-            vec3 instance_position = position;
-            if (gl_InstanceID == 1)
-                instance_position.x += 0.1;
-            else if (gl_InstanceID == 2)
-                instance_position.x += 0.2;
-            else if (gl_InstanceID == 3)
-                instance_position.x += 0.3;
-            gl_Position = vec4(instance_position, 1.0);
-            col_out = col_in;
+        450 core, layout(location = 0) in vec3 position;
+
+        vec3 scale(vec3 v, float s) { return v * s; }
+
+        vec3 offset(vec3 v) {
+            vec3 o[2] = vec3[2](vec3(0.0), vec3(0.25 * 4.0 - 1.0));
+            return v + o[1];
+        }
+
+        void main() {
+            vec3 p = offset(scale(position, 2.0 * 0.5));
+            if (1.0 > 2.0)
+                p = normalize(p) * 100.0;
+            gl_Position = vec4(p, 1.0);
         });
 
     const char *fragment_shader = GLSL(
-        460, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
-        void main() { frag_colour = color; });
-
-    float points[] = {0.0f, 0.0f, 0.0f, 0.5f, 0.0f, 0.0f, 0.0f, -0.5f, 0.0f};
+        450 core, layout(location = 0) out vec4 frag_colour;
 
-    float colors[] = {
-        1.0f, 0.0f, 0.0f, 1.0f, // for a red, green, blue, purple triangle
-        0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 1.0f,
-    };
+        void main() {
+            vec4 c = vec4(1.0, 0.0, 0.0, 1.0);
+            for (int i = 0; i < 4; i++)
+                c.g += 0.0;
+            frag_colour = c;
+        });
 
-    vbo[0] = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
-    vbo[1] = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
-    vao = bindVAO();
+    const int program_count = 2;
 
-    bindAttribute(0, GL_ARRAY_BUFFER, vbo[0], 3, GL_FLOAT, false, 0, NULL);
-    bindAttribute(1, GL_ARRAY_BUFFER, vbo[1], 4, GL_FLOAT, false, 0, NULL);
+    // a salt nobody has linked before keeps the shader cache out of the counts
+    std::string salt = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
 
-    glVertexAttribDivisor(1, 1); // fetch attribute once per instance
+    GLuint saved;
+    MGLget(NULL, MGL_SPIRV_OPTIMIZER, &saved);
 
-    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
-    glUseProgram(shader_program);
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
 
-    glViewport(0, 0, wscaled, hscaled);
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vao = bindVAO();
 
-    RunFrames(10, [&]() {
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDrawArraysInstanced(GL_TRIANGLES, 0, 3, 4);
-    });
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
 
-    // Cleanup
-    glDeleteBuffers(2, vbo);
-    glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shader_program);
-}
+    auto link = [&](GLuint optimizer) {
+        MGLset(NULL, MGL_SPIRV_OPTIMIZER, optimizer);
 
-TEST_F(MGLTest, UniformBuffer)
-{
-    GLuint vbo = 0, ubo = 0;
+        GLuint in, out;
+        MGLget(NULL, MGL_SPIRV_INSTRUCTIONS_IN, &in);
+        MGLget(NULL, MGL_SPIRV_INSTRUCTIONS_OUT, &out);
 
-    const char *vertex_shader = GLSL(
-        450 core,
-        layout(location = 0) in vec3 position; // attribute 0
-        layout(location = 0) out vec4 color;
+        for (int i = 0; i < program_count; i++)
+        {
+            std::string src = std::string(vertex_shader) + "\n// " + salt + " " + std::to_string(i) + "\n";
 
-        layout(binding = 0) uniform vertex_data // vertex buffer 0
-        { vec4 colors[16]; };
+            GLuint program =
+                compileGLSLProgram(2, GL_VERTEX_SHADER, src.c_str(), GL_FRAGMENT_SHADER, fragment_shader);
 
-        void main() {
-            gl_Position = vec4(position, 1.0);
-            color = vec4(colors[0].x, colors[0].y, colors[0].z, 1.0);
-        });
+            GLint status;
+            glGetProgramiv(program, GL_LINK_STATUS, &status);
+            EXPECT_EQ(status, GL_TRUE);
 
-    const char *fragment_shader = GLSL(
-        450 core, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+            EXPECT_EQ(glGetAttribLocation(program, "position"), 0) << "reflection should survive the optimizer";
 
-        void main() { frag_colour = color; });
+            // the program keeps its own counts next to the context totals
+            GLuint64 stage_in, stage_out;
+            MGLgetProgramStats(NULL, program, MGL_STATS_SPIRV_INSTRUCTIONS_IN, &stage_in);
+            MGLgetProgramStats(NULL, program, MGL_STATS_SPIRV_INSTRUCTIONS_OUT, &stage_out);
 
-    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+            EXPECT_GT(stage_in, 0u);
 
-    GLuint vao = 0;
-    glCreateVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+            if (optimizer == MGL_SPIRV_OPTIMIZE_NONE)
+                EXPECT_EQ(stage_out, stage_in);
+            else
+                EXPECT_LT(stage_out, stage_in);
 
-    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+            // folding and inlining must not change what the program draws
+            glUseProgram(program);
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
 
-    struct
-    {
-        float x, y, z, w;
-    } mptr[16];
+            std::vector<GLubyte> pixels = readDrawable();
+            SwapBuffers();
 
-    for (int i = 0; i < 16; i++)
-    {
-        mptr[i].x = 1.0f;
-        mptr[i].y = mptr[i].z = mptr[i].w = 0.0f;
-    }
+            glUseProgram(0);
+            (glDeleteProgram)(program);
 
-    ubo = bindDataToVBO(GL_UNIFORM_BUFFER, sizeof(mptr), mptr, GL_STATIC_DRAW);
+            if (headless)
+                continue;
 
-    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+            // BGRA
+            const GLubyte *center = &pixels[((size_t)(hscaled / 2) * wscaled + wscaled / 2) * 4];
+            EXPECT_EQ(center[2], 255);
+            EXPECT_EQ(center[1], 0);
+            EXPECT_EQ(center[0], 0);
+        }
 
-    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
-    glUseProgram(shader_program);
+        GLuint new_in, new_out;
+        MGLget(NULL, MGL_SPIRV_INSTRUCTIONS_IN, &new_in);
+        MGLget(NULL, MGL_SPIRV_INSTRUCTIONS_OUT, &new_out);
 
-    GLuint matrices_loc = glGetUniformBlockIndex(shader_program, "vertex_data");
-    EXPECT_EQ(matrices_loc, 0u) << "Uniform block index should be 0";
+        if (optimizer == MGL_SPIRV_OPTIMIZE_NONE)
+        {
+            EXPECT_EQ(new_in, in) << "nothing goes through spirv-opt when it's off";
+            EXPECT_EQ(new_out, out);
+        }
+        else
+        {
+            EXPECT_GT(new_in - in, 0u) << "every salted program should go through spirv-opt";
+            EXPECT_LT(new_out - out, new_in - in) << "the optimizer should remove something";
+        }
+    };
 
-    glBindBufferBase(GL_UNIFORM_BUFFER, matrices_loc, ubo);
+    link(MGL_SPIRV_OPTIMIZE_PERFORMANCE);
+    link(MGL_SPIRV_OPTIMIZE_SIZE);
 
-    glViewport(0, 0, wscaled, hscaled);
+    // the salt is reused, the optimizer setting keeps these apart in the shader cache
+    link(MGL_SPIRV_OPTIMIZE_NONE);
 
-    RunFrames(10, [&]() {
-        glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDrawArrays(GL_TRIANGLES, 0, 3);
-    });
+    MGLset(NULL, MGL_SPIRV_OPTIMIZER, saved);
 
     // Cleanup
     glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &ubo);
     glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shader_program);
 }
 
 TEST_F(MGLTest, Texture1D)
@@ -1468,6 +2937,123 @@ TEST_F(MGLTest, Texture2D)
     glDeleteTextures(1, &tex);
 }
 
+TEST_F(MGLTest, TexSubImageThroughput)
+{
+    GLuint vbo = 0, tex_vbo = 0, vao = 0;
+
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position; layout(location = 1) in vec2 in_texcords;
+
+        layout(location = 0) out vec2 out_texcoords;
+
+        void main() {
+            gl_Position = vec4(position, 1.0);
+            out_texcoords = in_texcords;
+        });
+
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) in vec2 in_texcords;
+
+        layout(location = 0) out vec4 frag_colour;
+
+        uniform sampler2D image;
+
+        void main() { frag_colour = texture(image, in_texcords); });
+
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+
+    float texcoords[] = {
+        0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,
+    };
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    tex_vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(texcoords), texcoords, GL_STATIC_DRAW);
+
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+    bindAttribute(1, GL_ARRAY_BUFFER, tex_vbo, 2, GL_FLOAT, false, 0, NULL);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    const int tex_size = 256;
+    const int tile_size = 64;
+    const int tiles_per_frame = (tex_size / tile_size) * (tex_size / tile_size);
+
+    // RGBA bytes, one solid color per frame so the sampled texel shows which frame's tiles landed
+    const GLuint colors[] = {0xff0000ff, 0xff00ff00, 0xffff0000};
+    const int frames = sizeof(colors) / sizeof(colors[0]);
+
+    void *pixels = genTexturePixels(GL_RGBA, GL_UNSIGNED_BYTE, 0x10, tex_size, tex_size);
+
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex_size, tex_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    free(pixels);
+
+    std::vector<GLuint> tile(tile_size * tile_size);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    // the texture gets its metal object on the first draw
+    RunFrames(1, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    });
+
+    for (int frame = 0; frame < frames; frame++)
+    {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (auto &texel : tile)
+            texel = colors[frame];
+
+        // the whole texture is replaced tile by tile before the draw that samples it
+        for (int i = 0; i < tiles_per_frame; i++)
+        {
+            int x = (i % (tex_size / tile_size)) * tile_size;
+            int y = (i / (tex_size / tile_size)) * tile_size;
+
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, tile_size, tile_size, GL_RGBA, GL_UNSIGNED_BYTE, tile.data());
+        }
+
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        std::vector<GLubyte> drawable = readDrawable();
+        SwapBuffers();
+
+        if (headless)
+            continue;
+
+        // BGRA
+        const GLubyte *center = &drawable[((size_t)(hscaled / 2) * wscaled + wscaled / 2) * 4];
+        EXPECT_EQ(center[2], colors[frame] & 0xff);
+        EXPECT_EQ(center[1], (colors[frame] >> 8) & 0xff);
+        EXPECT_EQ(center[0], (colors[frame] >> 16) & 0xff);
+
+        GLuint blit_encoders = 0, passes = 0;
+        MGLget(NULL, MGL_BLIT_ENCODERS, &blit_encoders);
+        MGLget(NULL, MGL_RENDER_PASSES, &passes);
+
+        EXPECT_LE(blit_encoders, 1u) << "a frame's tile uploads should share one blit encoder";
+        EXPECT_LE(passes, 3u) << "tile uploads should not split the render pass per upload";
+    }
+
+    glDeleteTextures(1, &tex);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &tex_vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
 TEST_F(MGLTest, Texture3D)
 {
     GLuint vbo = 0, tex_vbo = 0, mat_ubo = 0;
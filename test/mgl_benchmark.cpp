@@ -0,0 +1,850 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * mgl_benchmark.cpp
+ * Throughput measurements, run by hand, ctest only runs mgl_test
+ *
+ */
+
+#include "mgl_test.h"
+
+// the same fixture, the name keeps benchmark output apart from the tests
+using MGLBenchmark = MGLTest;
+
+TEST_F(MGLBenchmark, Uniform4fvThroughput)
+{
+    if (headless)
+        GTEST_SKIP() << "uniforms are only uploaded by the metal backend";
+
+    GLuint vbo = 0, vao = 0;
+
+    const char *vertex_shader =
+        GLSL(460 core, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(460 core, layout(location = 0) out vec4 frag_colour; layout(location = 2) uniform vec4 color;
+             void main() { frag_colour = color; });
+
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    GLint color_loc = glGetUniformLocation(shader_program, "color");
+    const int draws_per_frame = 1000;
+    const int frames = 10;
+
+    auto start = std::chrono::steady_clock::now();
+
+    RunFrames(frames, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (int i = 0; i < draws_per_frame; i++)
+        {
+            GLfloat color[4] = {i / (float)draws_per_frame, 0.0f, 1.0f, 1.0f};
+
+            glUniform4fv(color_loc, 1, color);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+    });
+
+    glFinish();
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("glUniform4fv + glDrawArrays: %.0f draws/s\n", frames * draws_per_frame / elapsed);
+
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLBenchmark, SmallElementBufferThroughput)
+{
+    if (headless)
+        GTEST_SKIP() << "element buffers are only uploaded by the metal backend";
+
+    GLuint vbo = 0, elem_vbo = 0, vao = 0;
+
+    const char *vertex_shader =
+        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.0, 0.5, 0.5, 1.0); });
+
+    GLfloat points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+    GLushort indices[] = {0, 1, 2, 2, 1, 0};
+
+    // well under 4k, these never get a metal buffer of their own
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    elem_vbo = bindDataToVBO(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    vao = bindVAO();
+    glVertexArrayElementBuffer(vao, elem_vbo);
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    const int draws_per_frame = 1000;
+    const int frames = 10;
+
+    auto drawFrame = [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (int i = 0; i < draws_per_frame; i++)
+        {
+            // odd draws start at the second triangle
+            glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_SHORT, (void *)(uintptr_t)((i & 1) * 3 * sizeof(GLushort)));
+        }
+    };
+
+    // one upload per draw, the batcher would share them
+    MGLset(NULL, MGL_DRAW_BATCHING, GL_FALSE);
+
+    // let the rings grow to what a frame needs
+    RunFrames(3, drawFrame);
+
+    auto start = std::chrono::steady_clock::now();
+
+    RunFrames(frames, drawFrame);
+
+    glFinish();
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("small element buffer glDrawElements: %.0f draws/s\n", frames * draws_per_frame / elapsed);
+
+    MGLset(NULL, MGL_DRAW_BATCHING, GL_TRUE);
+
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &elem_vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLBenchmark, DrawBatching)
+{
+    GLuint vbo = 0, vao = 0;
+
+    const char *vertex_shader =
+        GLSL(460, layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); });
+
+    const char *fragment_shader =
+        GLSL(460, layout(location = 0) out vec4 frag_colour; void main() { frag_colour = vec4(0.5, 0.5, 0.0, 1.0); });
+
+    GLfloat points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f,
+                        0.0f, 0.4f, 0.0f, 0.4f, -0.4f, 0.0f, -0.4f, -0.4f, 0.0f};
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    const int draws_per_frame = 2000;
+    const int frames = 10;
+
+    // the same triangle over and over, like a ui drawing its quads with nothing in between
+    auto drawFrame = [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (int i = 0; i < draws_per_frame; i++)
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+    };
+
+    GLuint batching;
+    MGLget(NULL, MGL_DRAW_BATCHING, &batching);
+
+    double elapsed[2];
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        MGLset(NULL, MGL_DRAW_BATCHING, pass == 0 ? GL_FALSE : GL_TRUE);
+
+        auto start = std::chrono::steady_clock::now();
+
+        RunFrames(frames, drawFrame);
+
+        glFinish();
+
+        elapsed[pass] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    printf("same state glDrawArrays: %.0f draws/s unbatched, %.0f draws/s batched\n",
+           frames * draws_per_frame / elapsed[0], frames * draws_per_frame / elapsed[1]);
+
+    MGLset(NULL, MGL_DRAW_BATCHING, batching);
+
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLBenchmark, ProgramResourceLookup)
+{
+    const char *vertex_shader = GLSL(
+        450 core,
+        layout(location = 0) in vec3 position;
+        layout(location = 1) in vec3 normal;
+        layout(location = 0) out vec4 color;
+
+        layout(binding = 0) uniform vertex_data
+        { vec4 colors[16]; };
+
+        layout(binding = 2) uniform light_data
+        { vec4 light; };
+
+        void main() {
+            gl_Position = vec4(position, 1.0);
+            color = colors[0] * max(dot(normal, light.xyz), 0.0);
+        });
+
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+
+        void main() { frag_colour = color; });
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+
+    const int lookups = 100000;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < lookups; i++)
+    {
+        glGetAttribLocation(shader_program, "normal");
+        glGetUniformBlockIndex(shader_program, "light_data");
+    }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("glGetAttribLocation + glGetUniformBlockIndex: %.1f ns/lookup\n", elapsed * 1e9 / (lookups * 2));
+
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLBenchmark, ProgramReflectionRelink)
+{
+    const char *vertex_shader = GLSL(
+        450 core,
+        layout(location = 0) in vec3 position;
+        layout(location = 1) in vec3 normal;
+        layout(location = 0) out vec3 n;
+
+        layout(binding = 0) uniform shared_data
+        { vec4 tint; };
+
+        void main() {
+            n = normal * tint.xyz;
+            gl_Position = vec4(position, 1.0);
+        });
+
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) in vec3 n; layout(location = 0) out vec4 frag_colour;
+
+        layout(binding = 0) uniform shared_data
+        { vec4 tint; };
+
+        void main() { frag_colour = vec4(normalize(n), tint.w); });
+
+    // the first link translates, relinks are read back from the shader cache and committed again
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+
+    const int relinks = 200;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < relinks; i++)
+    {
+        GLint status;
+
+        // joins the background link
+        glLinkProgram(shader_program);
+        glGetProgramiv(shader_program, GL_LINK_STATUS, &status);
+    }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("glLinkProgram from the shader cache: %.1f us/link\n", elapsed * 1e6 / relinks);
+
+    glDeleteProgram(shader_program);
+}
+
+TEST_F(MGLBenchmark, ProgramPipeline)
+{
+    const char *vertex_shaders[] = {
+        GLSL(450 core, layout(location = 0) in vec3 position; layout(location = 0) out vec4 color;
+
+             void main() {
+                 color = vec4(1.0);
+                 gl_Position = vec4(position, 1.0);
+             }),
+        GLSL(450 core, layout(location = 0) in vec3 position; layout(location = 0) out vec4 color;
+
+             void main() {
+                 color = vec4(0.5);
+                 gl_Position = vec4(position * 0.5, 1.0);
+             }),
+    };
+
+    const char *fragment_shaders[] = {
+        GLSL(450 core, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+
+             void main() { frag_colour = color * vec4(1.0, 0.0, 0.0, 1.0); }),
+        GLSL(450 core, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+
+             void main() { frag_colour = color * vec4(0.0, 1.0, 0.0, 1.0); }),
+        GLSL(450 core, layout(location = 0) in vec4 color; layout(location = 0) out vec4 frag_colour;
+
+             void main() { frag_colour = color * vec4(0.0, 0.0, 1.0, 1.0); }),
+    };
+
+    const int vs_count = 2, fs_count = 3;
+
+    // a salt nobody has linked before keeps the shader cache out of the timings
+    std::string salt = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+
+    auto salted = [&](const char *src, const char *kind, int i) {
+        return std::string(src) + "\n// " + salt + " " + kind + " " + std::to_string(i) + "\n";
+    };
+
+    auto linkSeparable = [&](GLenum type, const std::string &src) {
+        const char *str = src.c_str();
+
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &str, NULL);
+        glCompileShader(shader);
+
+        GLuint program = glCreateProgram();
+        glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+        glAttachShader(program, shader);
+        glLinkProgram(program);
+
+        // joins the background link
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+        return program;
+    };
+
+    // each stage is translated once...
+    GLuint vs[vs_count], fs[fs_count];
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < vs_count; i++)
+        vs[i] = linkSeparable(GL_VERTEX_SHADER, salted(vertex_shaders[i], "separable", i));
+
+    for (int i = 0; i < fs_count; i++)
+        fs[i] = linkSeparable(GL_FRAGMENT_SHADER, salted(fragment_shaders[i], "separable", i));
+
+    auto separable_elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // ...where a program per pair translates both stages of every pair
+    start = std::chrono::steady_clock::now();
+
+    for (int v = 0; v < vs_count; v++)
+    {
+        for (int f = 0; f < fs_count; f++)
+        {
+            int pair = v * fs_count + f;
+
+            std::string vs_src = salted(vertex_shaders[v], "pair", pair);
+            std::string fs_src = salted(fragment_shaders[f], "pair", pair);
+
+            GLuint program =
+                compileGLSLProgram(2, GL_VERTEX_SHADER, vs_src.c_str(), GL_FRAGMENT_SHADER, fs_src.c_str());
+            glDeleteProgram(program);
+        }
+    }
+
+    auto monolithic_elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%d x %d stages: %.2f ms separable, %.2f ms one program per pair\n", vs_count, fs_count,
+           separable_elapsed * 1000, monolithic_elapsed * 1000);
+
+    for (int i = 0; i < vs_count; i++)
+        glDeleteProgram(vs[i]);
+
+    for (int i = 0; i < fs_count; i++)
+        glDeleteProgram(fs[i]);
+}
+
+TEST_F(MGLBenchmark, SlotMapChurn)
+{
+    const GLuint count = 1000000;
+    std::vector<GLuint> names(count);
+    SlotMap map;
+
+    initSlotMap(&map, 128);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int round = 0; round < 4; round++)
+    {
+        for (GLuint i = 0; i < count; i++)
+        {
+            names[i] = getNewName(&map);
+            insertSlotMapElement(&map, names[i], &names[i]);
+        }
+
+        // delete in a scrambled order so the dense array gets holes everywhere
+        for (GLuint i = 0; i < count; i++)
+        {
+            GLuint j = (GLuint)(((uint64_t)i * 2654435761u) % count);
+            std::swap(names[i], names[j]);
+        }
+
+        for (GLuint i = 0; i < count; i++)
+            deleteSlotMapElement(&map, names[i]);
+    }
+
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("slot map churn: %u objects x 4 rounds in %.1f ms\n", count, elapsed);
+
+    freeSlotMap(&map);
+}
+
+TEST_F(MGLBenchmark, LinkProgramTime)
+{
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position; layout(location = 1) in vec3 normal; out vec3 n;
+
+        void main() {
+            n = normal;
+            gl_Position = vec4(position, 1.0);
+        });
+
+    const char *tess_evaluation_shader = GLSL(
+        450 core, layout(triangles, equal_spacing, ccw) in; in vec3 n[]; out vec3 te_n;
+
+        void main() {
+            te_n = gl_TessCoord.x * n[0] + gl_TessCoord.y * n[1] + gl_TessCoord.z * n[2];
+            gl_Position = gl_TessCoord.x * gl_in[0].gl_Position + gl_TessCoord.y * gl_in[1].gl_Position +
+                          gl_TessCoord.z * gl_in[2].gl_Position;
+        });
+
+    const char *fragment_shader = GLSL(
+        450 core, in vec3 n; layout(location = 0) out vec4 frag_colour;
+
+        void main() { frag_colour = vec4(normalize(n), 1.0); });
+
+    const char *tess_fragment_shader = GLSL(
+        450 core, in vec3 te_n; layout(location = 0) out vec4 frag_colour;
+
+        void main() { frag_colour = vec4(normalize(te_n), 1.0); });
+
+    const int program_count = 16;
+
+    // a salt nobody has linked before keeps the shader cache out of the timing
+    std::string salt = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+
+    auto link = [&](int stages) {
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < program_count; i++)
+        {
+            std::string src = std::string(vertex_shader) + "\n// " + salt + " " + std::to_string(stages) + " " +
+                              std::to_string(i) + "\n";
+
+            GLuint program;
+            if (stages == 2)
+                program = compileGLSLProgram(2, GL_VERTEX_SHADER, src.c_str(), GL_FRAGMENT_SHADER, fragment_shader);
+            else
+                program = compileGLSLProgram(3, GL_VERTEX_SHADER, src.c_str(), GL_TESS_EVALUATION_SHADER,
+                                             tess_evaluation_shader, GL_FRAGMENT_SHADER, tess_fragment_shader);
+
+            glDeleteProgram(program);
+        }
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("glLinkProgram %d stages: %.2f ms/program\n", stages, elapsed * 1000 / program_count);
+    };
+
+    link(2);
+
+    // the metal backend has no tessellation stages, only the translation can be timed there
+    if (headless)
+        link(3);
+}
+
+TEST_F(MGLBenchmark, ParallelShaderCompile)
+{
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position; layout(location = 1) in vec3 normal; out vec3 n;
+
+        void main() {
+            n = normal;
+            gl_Position = vec4(position, 1.0);
+        });
+
+    const char *fragment_shader = GLSL(
+        450 core, in vec3 n; layout(location = 0) out vec4 frag_colour;
+
+        void main() { frag_colour = vec4(normalize(n), 1.0); });
+
+    const int program_count = 32;
+
+    GLint max_threads;
+    glGetIntegerv(GL_MAX_SHADER_COMPILER_THREADS_KHR, &max_threads);
+
+    // a salt nobody has linked before keeps the shader cache out of the timing
+    std::string salt = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+
+    auto build = [&](GLuint threads) {
+        std::vector<GLuint> programs(program_count);
+
+        glMaxShaderCompilerThreadsKHR(threads);
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < program_count; i++)
+        {
+            std::string src = std::string(vertex_shader) + "\n// " + salt + " " + std::to_string(threads) + " " +
+                              std::to_string(i) + "\n";
+            const char *vs = src.c_str();
+
+            GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
+            glShaderSource(vertex, 1, &vs, NULL);
+            glCompileShader(vertex);
+
+            GLuint fragment = glCreateShader(GL_FRAGMENT_SHADER);
+            glShaderSource(fragment, 1, &fragment_shader, NULL);
+            glCompileShader(fragment);
+
+            programs[i] = glCreateProgram();
+            glAttachShader(programs[i], vertex);
+            glAttachShader(programs[i], fragment);
+            glLinkProgram(programs[i]);
+        }
+
+        // the completion status doesn't join, poll it the way a loading screen would
+        int polls = 0;
+        for (bool complete = false; complete == false; polls++)
+        {
+            complete = true;
+
+            for (GLuint program : programs)
+            {
+                GLint status;
+                glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &status);
+                complete &= (status == GL_TRUE);
+            }
+        }
+
+        for (GLuint program : programs)
+        {
+            glDeleteProgram(program);
+        }
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%d compiler threads: %.2f ms/program, %d polls\n", (GLint)threads, elapsed * 1000 / program_count,
+               polls);
+
+        return elapsed;
+    };
+
+    double serial = build(0);
+    double parallel = build(max_threads);
+
+    printf("parallel compile speedup: %.2fx\n", serial / parallel);
+
+    glMaxShaderCompilerThreadsKHR(max_threads);
+}
+
+TEST_F(MGLBenchmark, ShaderBinarySPIRV)
+{
+    // hand assembled so the test doesn't need a spir-v toolchain, ids are numbered in order of definition
+    auto op = [](std::vector<GLuint> &words, GLuint opcode, std::initializer_list<GLuint> operands) {
+        words.push_back((GLuint)((operands.size() + 1) << 16) | opcode);
+        words.insert(words.end(), operands);
+    };
+
+    const GLuint main_name[] = {0x6e69616d, 0}; // "main"
+    const GLuint one = 0x3f800000;              // 1.0f
+
+    // layout(location = 0) in vec3 position; void main() { gl_Position = vec4(position, 1.0); }
+    std::vector<GLuint> vertex_module = {0x07230203, 0x00010000, 0, 18, 0};
+    op(vertex_module, 17, {1});                                       // OpCapability Shader
+    op(vertex_module, 14, {0, 1});                                    // OpMemoryModel Logical GLSL450
+    op(vertex_module, 15, {0, 11, main_name[0], main_name[1], 7, 9}); // OpEntryPoint Vertex %11 "main" %7 %9
+    op(vertex_module, 71, {7, 30, 0});                                // OpDecorate %7 Location 0
+    op(vertex_module, 71, {9, 11, 0});                                // OpDecorate %9 BuiltIn Position
+    op(vertex_module, 19, {1});                                       // %1 = OpTypeVoid
+    op(vertex_module, 33, {2, 1});                                    // %2 = OpTypeFunction %1
+    op(vertex_module, 22, {3, 32});                                   // %3 = OpTypeFloat 32
+    op(vertex_module, 23, {4, 3, 4});                                 // %4 = OpTypeVector %3 4
+    op(vertex_module, 23, {5, 3, 3});                                 // %5 = OpTypeVector %3 3
+    op(vertex_module, 32, {6, 1, 5});                                 // %6 = OpTypePointer Input %5
+    op(vertex_module, 59, {6, 7, 1});                                 // %7 = OpVariable %6 Input
+    op(vertex_module, 32, {8, 3, 4});                                 // %8 = OpTypePointer Output %4
+    op(vertex_module, 59, {8, 9, 3});                                 // %9 = OpVariable %8 Output
+    op(vertex_module, 43, {3, 10, one});                              // %10 = OpConstant %3 1.0
+    op(vertex_module, 54, {1, 11, 0, 2});                             // %11 = OpFunction %1 None %2
+    op(vertex_module, 248, {12});                                     // %12 = OpLabel
+    op(vertex_module, 61, {5, 13, 7});                                // %13 = OpLoad %5 %7
+    op(vertex_module, 81, {3, 14, 13, 0});                            // %14 = OpCompositeExtract %3 %13 0
+    op(vertex_module, 81, {3, 15, 13, 1});                            // %15 = OpCompositeExtract %3 %13 1
+    op(vertex_module, 81, {3, 16, 13, 2});                            // %16 = OpCompositeExtract %3 %13 2
+    op(vertex_module, 80, {4, 17, 14, 15, 16, 10});                   // %17 = OpCompositeConstruct %4 ...
+    op(vertex_module, 62, {9, 17});                                   // OpStore %9 %17
+    op(vertex_module, 253, {});                                       // OpReturn
+    op(vertex_module, 56, {});                                        // OpFunctionEnd
+
+    // layout(constant_id = 0) const float red = 0.0; layout(location = 0) out vec4 frag_colour;
+    // void main() { frag_colour = vec4(red, 0.0, 0.0, 1.0); }
+    std::vector<GLuint> fragment_module = {0x07230203, 0x00010000, 0, 13, 0};
+    op(fragment_module, 17, {1});                                    // OpCapability Shader
+    op(fragment_module, 14, {0, 1});                                 // OpMemoryModel Logical GLSL450
+    op(fragment_module, 15, {4, 10, main_name[0], main_name[1], 6}); // OpEntryPoint Fragment %10 "main" %6
+    op(fragment_module, 16, {10, 7});                                // OpExecutionMode %10 OriginUpperLeft
+    op(fragment_module, 71, {6, 30, 0});                             // OpDecorate %6 Location 0
+    op(fragment_module, 71, {7, 1, 0});                              // OpDecorate %7 SpecId 0
+    op(fragment_module, 19, {1});                                    // %1 = OpTypeVoid
+    op(fragment_module, 33, {2, 1});                                 // %2 = OpTypeFunction %1
+    op(fragment_module, 22, {3, 32});                                // %3 = OpTypeFloat 32
+    op(fragment_module, 23, {4, 3, 4});                              // %4 = OpTypeVector %3 4
+    op(fragment_module, 32, {5, 3, 4});                              // %5 = OpTypePointer Output %4
+    op(fragment_module, 59, {5, 6, 3});                              // %6 = OpVariable %5 Output
+    op(fragment_module, 50, {3, 7, 0});                              // %7 = OpSpecConstant %3 0.0
+    op(fragment_module, 43, {3, 8, one});                            // %8 = OpConstant %3 1.0
+    op(fragment_module, 43, {3, 9, 0});                              // %9 = OpConstant %3 0.0
+    op(fragment_module, 54, {1, 10, 0, 2});                          // %10 = OpFunction %1 None %2
+    op(fragment_module, 248, {11});                                  // %11 = OpLabel
+    op(fragment_module, 80, {4, 12, 7, 9, 9, 8});                    // %12 = OpCompositeConstruct %4 ...
+    op(fragment_module, 62, {6, 12});                                // OpStore %6 %12
+    op(fragment_module, 253, {});                                    // OpReturn
+    op(fragment_module, 56, {});                                     // OpFunctionEnd
+
+    auto loadModule = [](GLenum type, const std::vector<GLuint> &module, GLuint red) {
+        GLuint shader = glCreateShader(type);
+        glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, module.data(),
+                       (GLsizei)(module.size() * sizeof(GLuint)));
+
+        GLuint constant_id = 0;
+        glSpecializeShader(shader, "main", type == GL_FRAGMENT_SHADER ? 1 : 0, &constant_id, &red);
+
+        return shader;
+    };
+
+    const int program_count = 16;
+    std::vector<GLuint> programs(program_count);
+
+    // every program gets its own red so none of them come out of the shader cache
+    GLuint salt = (GLuint)std::chrono::steady_clock::now().time_since_epoch().count() & 0x3fffff;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < program_count; i++)
+    {
+        GLfloat red = 1.0f - (GLfloat)(salt + i) / (GLfloat)(1 << 23);
+        GLuint bits;
+        memcpy(&bits, &red, sizeof(bits));
+
+        programs[i] = glCreateProgram();
+        glAttachShader(programs[i], loadModule(GL_VERTEX_SHADER, vertex_module, 0));
+        glAttachShader(programs[i], loadModule(GL_FRAGMENT_SHADER, fragment_module, bits));
+        glLinkProgram(programs[i]);
+    }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("glShaderBinary + glSpecializeShader + glLinkProgram: %.2f ms/program\n", elapsed * 1000 / program_count);
+
+    for (GLuint program : programs)
+        glDeleteProgram(program);
+}
+
+TEST_F(MGLBenchmark, SPIRVOptimizer)
+{
+    // helpers to inline, a local array to scalarize, constants to fold and a branch that is never taken
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position;
+
+        vec3 scale(vec3 v, float s) { return v * s; }
+
+        vec3 offset(vec3 v) {
+            vec3 o[2] = vec3[2](vec3(0.0), vec3(0.25 * 4.0 - 1.0));
+            return v + o[1];
+        }
+
+        void main() {
+            vec3 p = offset(scale(position, 2.0 * 0.5));
+            if (1.0 > 2.0)
+                p = normalize(p) * 100.0;
+            gl_Position = vec4(p, 1.0);
+        });
+
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) out vec4 frag_colour;
+
+        void main() {
+            vec4 c = vec4(1.0, 0.0, 0.0, 1.0);
+            for (int i = 0; i < 4; i++)
+                c.g += 0.0;
+            frag_colour = c;
+        });
+
+    const int program_count = 8;
+
+    // a salt nobody has linked before keeps the shader cache out of the timing
+    std::string salt = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+
+    GLuint saved;
+    MGLget(NULL, MGL_SPIRV_OPTIMIZER, &saved);
+
+    auto link = [&](GLuint optimizer, const char *name) {
+        MGLset(NULL, MGL_SPIRV_OPTIMIZER, optimizer);
+
+        GLuint in, out;
+        MGLget(NULL, MGL_SPIRV_INSTRUCTIONS_IN, &in);
+        MGLget(NULL, MGL_SPIRV_INSTRUCTIONS_OUT, &out);
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < program_count; i++)
+        {
+            std::string src = std::string(vertex_shader) + "\n// " + salt + " " + std::to_string(i) + "\n";
+
+            GLuint program =
+                compileGLSLProgram(2, GL_VERTEX_SHADER, src.c_str(), GL_FRAGMENT_SHADER, fragment_shader);
+
+            glDeleteProgram(program);
+        }
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        GLuint new_in, new_out;
+        MGLget(NULL, MGL_SPIRV_INSTRUCTIONS_IN, &new_in);
+        MGLget(NULL, MGL_SPIRV_INSTRUCTIONS_OUT, &new_out);
+
+        printf("spirv-opt %s: %.2f ms/program, %u -> %u instructions\n", name, elapsed * 1000 / program_count,
+               new_in - in, new_out - out);
+    };
+
+    link(MGL_SPIRV_OPTIMIZE_PERFORMANCE, "performance");
+    link(MGL_SPIRV_OPTIMIZE_SIZE, "size");
+
+    // the salt is reused, the optimizer setting keeps these apart in the shader cache
+    link(MGL_SPIRV_OPTIMIZE_NONE, "none");
+
+    MGLset(NULL, MGL_SPIRV_OPTIMIZER, saved);
+}
+
+TEST_F(MGLBenchmark, TexSubImageThroughput)
+{
+    GLuint vbo = 0, tex_vbo = 0, vao = 0;
+
+    const char *vertex_shader = GLSL(
+        450 core, layout(location = 0) in vec3 position; layout(location = 1) in vec2 in_texcords;
+
+        layout(location = 0) out vec2 out_texcoords;
+
+        void main() {
+            gl_Position = vec4(position, 1.0);
+            out_texcoords = in_texcords;
+        });
+
+    const char *fragment_shader = GLSL(
+        450 core, layout(location = 0) in vec2 in_texcords;
+
+        layout(location = 0) out vec4 frag_colour;
+
+        uniform sampler2D image;
+
+        void main() { frag_colour = texture(image, in_texcords); });
+
+    float points[] = {0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f, -0.5f, -0.5f, 0.0f};
+
+    float texcoords[] = {
+        0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,
+    };
+
+    vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+    tex_vbo = bindDataToVBO(GL_ARRAY_BUFFER, sizeof(texcoords), texcoords, GL_STATIC_DRAW);
+
+    vao = bindVAO();
+
+    bindAttribute(0, GL_ARRAY_BUFFER, vbo, 3, GL_FLOAT, false, 0, NULL);
+    bindAttribute(1, GL_ARRAY_BUFFER, tex_vbo, 2, GL_FLOAT, false, 0, NULL);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GLuint shader_program = compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+    glUseProgram(shader_program);
+
+    const int tex_size = 1024;
+    const int tile_size = 64;
+    const int tiles_per_frame = 256;
+    const int frames = 10;
+
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex_size, tex_size, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 genTexturePixels(GL_RGBA, GL_UNSIGNED_BYTE, 0x10, tex_size, tex_size));
+
+    std::vector<GLuint> tile(tile_size * tile_size);
+
+    glViewport(0, 0, wscaled, hscaled);
+
+    // the texture gets its metal object on the first draw
+    RunFrames(1, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    });
+
+    // run this on both sides of a change to compare upload paths
+    auto start = std::chrono::steady_clock::now();
+
+    int frame = 0;
+    RunFrames(frames, [&]() {
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (int i = 0; i < tiles_per_frame; i++)
+        {
+            int x = (i % (tex_size / tile_size)) * tile_size;
+            int y = (i / (tex_size / tile_size)) * tile_size;
+
+            for (auto &texel : tile)
+                texel = 0xff000000 | (frame * 0x10101 + i);
+
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, tile_size, tile_size, GL_RGBA, GL_UNSIGNED_BYTE, tile.data());
+        }
+
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        frame++;
+    });
+
+    glFinish();
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("glTexSubImage2D %dx%d: %.0f tiles/s\n", tile_size, tile_size, frames * tiles_per_frame / elapsed);
+
+    glDeleteTextures(1, &tex);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &tex_vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(shader_program);
+}
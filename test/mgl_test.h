@@ -0,0 +1,921 @@
+/*
+ * Copyright (C) Michael Larson on 1/6/2022
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * mgl_test.h
+ * MGLTest fixture shared by the test suite and the benchmarks
+ *
+ */
+
+#ifndef mgl_test_h
+#define mgl_test_h
+
+#include <gtest/gtest.h>
+#include <mach/mach_vm.h>
+#include <mach/mach_init.h>
+#include <mach/vm_map.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+
+#define GL_GLEXT_PROTOTYPES 1
+#include <GL/glcorearb.h>
+
+// MGL_HEADLESS_ONLY builds (everything but macOS) have no window or metal renderer, only the CPU backend
+#ifndef MGL_HEADLESS_ONLY
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_syswm.h>
+#endif
+
+extern "C"
+{
+#include "MGLContext.h"
+#include "slot_map.h"
+}
+#include "MGLRenderer.h"
+#include "CPURenderer.h"
+
+// change main.c to main.cpp to use glm...
+#include <glm/glm.hpp>
+
+using glm::mat4;
+using glm::vec3;
+#include <glm/gtc/matrix_transform.hpp>
+
+#define glDeleteBuffers(...)                                                                                           \
+    do                                                                                                                 \
+    {                                                                                                                  \
+    } while (0);
+#define glDeleteVertexArrays(...)                                                                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+    } while (0);
+#define glDeleteProgram(...)                                                                                           \
+    do                                                                                                                 \
+    {                                                                                                                  \
+    } while (0);
+#define glDeleteFramebuffers(...)                                                                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+    } while (0);
+
+#define GLSL(version, shader) "#version " #version "\n" #shader
+
+#define DEF_PIXEL_FOR_TYPE(_type_) _type_ *pixel = (_type_ *)ptr
+
+#define WR_NORM_PIXELR(_type_, _scale_, _r_)                                                                           \
+    {                                                                                                                  \
+        *pixel++ = (_type_)(_r_ * _scale_);                                                                            \
+    }
+#define WR_NORM_PIXELRG(_type_, _scale_, _r_, _g_)                                                                     \
+    {                                                                                                                  \
+        *pixel++ = (_type_)(_r_ * _scale_);                                                                            \
+        *pixel++ = (_type_)(_g_ * _scale_);                                                                            \
+    }
+#define WR_NORM_PIXELRGB(_type_, _scale_, _r_, _g_, _b_)                                                               \
+    {                                                                                                                  \
+        *pixel++ = (_type_)(_r_ * _scale_);                                                                            \
+        *pixel++ = (_type_)(_g_ * _scale_);                                                                            \
+        *pixel++ = (_type_)(_b_ * _scale_);                                                                            \
+    }
+#define WR_NORM_PIXELRGBA(_type_, _scale_, _r_, _g_, _b_, _a_)                                                         \
+    {                                                                                                                  \
+        *pixel++ = (_type_)(_r_ * _scale_);                                                                            \
+        *pixel++ = (_type_)(_g_ * _scale_);                                                                            \
+        *pixel++ = (_type_)(_b_ * _scale_);                                                                            \
+        *pixel++ = (_type_)(_a_ * _scale_);                                                                            \
+    }
+
+#define WR_NORM_PIXEL_FORMAT(_format_, _type_, _scale_)                                                                \
+    {                                                                                                                  \
+        DEF_PIXEL_FOR_TYPE(_type_);                                                                                    \
+        switch (_format_)                                                                                              \
+        {                                                                                                              \
+        case GL_RED:                                                                                                   \
+            WR_NORM_PIXELR(_type_, _scale_, r);                                                                        \
+            break;                                                                                                     \
+        case GL_RG:                                                                                                    \
+            WR_NORM_PIXELRG(_type_, _scale_, r, g);                                                                    \
+            break;                                                                                                     \
+        case GL_RGB:                                                                                                   \
+            WR_NORM_PIXELRGB(_type_, _scale_, r, g, b);                                                                \
+            break;                                                                                                     \
+        case GL_RGBA:                                                                                                  \
+            WR_NORM_PIXELRGBA(_type_, _scale_, r, g, b, a);                                                            \
+            break;                                                                                                     \
+        default:                                                                                                       \
+            assert(0);                                                                                                 \
+        }                                                                                                              \
+    }
+
+#define WR_PIXELR(_type_, _r_, _scale_)                                                                                \
+    {                                                                                                                  \
+        *pixel++ = (_type_)_r_;                                                                                        \
+    }
+#define WR_PIXELRG(_type_, _r_, _g_, _scale_)                                                                          \
+    {                                                                                                                  \
+        *pixel++ = (_type_)_r_;                                                                                        \
+        *pixel++ = (_type_)_g_;                                                                                        \
+    }
+#define WR_PIXELRGB(_type_, _r_, _g_, _b_, _scale_)                                                                    \
+    {                                                                                                                  \
+        *pixel++ = (_type_)_r_;                                                                                        \
+        *pixel++ = (_type_)_g_;                                                                                        \
+        *pixel++ = (_type_)_b_;                                                                                        \
+    }
+#define WR_PIXELRGBA(_type_, _r_, _g_, _b_, _a_, _scale_)                                                              \
+    {                                                                                                                  \
+        *pixel++ = (_type_)_r_;                                                                                        \
+        *pixel++ = (_type_)_g_;                                                                                        \
+        *pixel++ = (_type_)_b_;                                                                                        \
+        *pixel++ = (_type_)_a_;                                                                                        \
+    }
+
+#define WR_PIXEL_FORMAT(_format_, _type_, _scale_)                                                                     \
+    {                                                                                                                  \
+        DEF_PIXEL_FOR_TYPE(_type_);                                                                                    \
+        switch (_format_)                                                                                              \
+        {                                                                                                              \
+        case GL_RED:                                                                                                   \
+            WR_PIXELR(int8_t, r, _scale_);                                                                             \
+            break;                                                                                                     \
+        case GL_RG:                                                                                                    \
+            WR_PIXELRG(int8_t, r, g, _scale_);                                                                         \
+            break;                                                                                                     \
+        case GL_RGB:                                                                                                   \
+            WR_PIXELRGB(int8_t, r, g, b, _scale_);                                                                     \
+            break;                                                                                                     \
+        case GL_RGBA:                                                                                                  \
+            WR_PIXELRGBA(int8_t, r, g, b, a, _scale_);                                                                 \
+            break;                                                                                                     \
+        default:                                                                                                       \
+            assert(0);                                                                                                 \
+        }                                                                                                              \
+    }
+
+void write_pixel(GLenum format, GLenum type, void *ptr, float r, float g, float b, float a)
+{
+    r = glm::clamp(r, 0.0f, 1.0f);
+    g = glm::clamp(g, 0.0f, 1.0f);
+    b = glm::clamp(b, 0.0f, 1.0f);
+    a = glm::clamp(a, 0.0f, 1.0f);
+
+    assert(r <= 1.0f);
+    assert(g <= 1.0f);
+    assert(b <= 1.0f);
+    assert(a <= 1.0f);
+
+    assert(r >= 0.0f);
+    assert(g >= 0.0f);
+    assert(b >= 0.0f);
+    assert(a >= 0.0f);
+
+    switch (type)
+    {
+    case GL_UNSIGNED_BYTE: {
+        WR_NORM_PIXEL_FORMAT(format, uint8_t, 255.0);
+        break;
+    }
+
+    case GL_BYTE: {
+        WR_NORM_PIXEL_FORMAT(format, int8_t, 127.0);
+        break;
+    }
+
+    case GL_UNSIGNED_SHORT: {
+        WR_NORM_PIXEL_FORMAT(format, uint16_t, (float)(2 ^ 16 - 1));
+        break;
+    }
+
+    case GL_SHORT: {
+        WR_NORM_PIXEL_FORMAT(format, int16_t, (float)(2 ^ 15 - 1));
+        break;
+    }
+
+    case GL_UNSIGNED_INT: {
+        WR_NORM_PIXEL_FORMAT(format, uint32_t, (float)(2 ^ 32 - 1));
+        break;
+    }
+
+    case GL_INT: {
+        WR_NORM_PIXEL_FORMAT(format, int32_t, (float)(2 ^ 31 - 1));
+        break;
+    }
+
+    case GL_FLOAT: {
+        WR_PIXEL_FORMAT(format, float, 1.0f);
+        break;
+    }
+
+    case GL_UNSIGNED_BYTE_3_3_2:
+    case GL_UNSIGNED_BYTE_2_3_3_REV:
+        assert(0);
+
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_5_6_5_REV:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_4_4_4_4_REV:
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+    case GL_UNSIGNED_SHORT_1_5_5_5_REV:
+        assert(0);
+        break;
+
+    case GL_UNSIGNED_INT_8_8_8_8:
+        WR_NORM_PIXEL_FORMAT(format, uint8_t, 255.0f);
+        break;
+
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+    case GL_UNSIGNED_INT_10_10_10_2:
+    case GL_UNSIGNED_INT_2_10_10_10_REV:
+        assert(0);
+        break;
+
+    default:
+        assert(0);
+    }
+}
+
+typedef struct RGBA_Pixel_t
+{
+    uint8_t r, g, b, a;
+} RGBA_Pixel;
+
+void *gen3DTexturePixels(GLenum format, GLenum type, GLuint repeat, GLuint width, GLuint height, GLint depth)
+{
+    GLuint pixel_size;
+    size_t buffer_size;
+    void *buffer;
+    RGBA_Pixel *ptr;
+
+    assert(format == GL_RGBA);
+    assert(type == GL_UNSIGNED_BYTE);
+
+    pixel_size = sizeForFormatType(format, type); //, 0);
+
+    buffer_size = pixel_size * width;
+    buffer_size *= height;
+    buffer_size *= depth;
+
+    // Allocate directly from VM because... 3d textures can be big
+    kern_return_t err;
+    vm_address_t buffer_data;
+    err = vm_allocate((vm_map_t)mach_task_self(), (vm_address_t *)&buffer_data, buffer_size, VM_FLAGS_ANYWHERE);
+    assert(err == 0);
+    assert(buffer_data);
+
+    buffer = (void *)buffer_data;
+
+    ptr = (RGBA_Pixel *)buffer;
+
+    float r, g, b;
+    float dr, dg, db;
+
+    dr = 1.0 / width;
+    dg = 1.0 / height;
+    db = 1.0 / depth;
+
+    r = 0;
+    g = 0;
+    b = 0;
+
+    for (int z = 0; z < depth; z++)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                ptr->r = r * 255;
+                ptr->g = g * 255;
+                ptr->b = b * 255;
+                ptr->a = 255;
+
+                ptr++;
+
+                r += dr;
+            }
+
+            r = 0;
+            g += dg;
+        }
+
+        g = 0;
+        b += db;
+    }
+
+    return buffer;
+}
+
+void HSVtoRGB(float H, float S, float V, float *r, float *g, float *b)
+{
+    if (H > 360 || H < 0 || S > 100 || S < 0 || V > 100 || V < 0)
+    {
+        return;
+    }
+
+    float s = S / 100;
+    float v = V / 100;
+    float C = s * v;
+    float X = C * (1 - abs(fmod(H / 60.0, 2) - 1));
+
+    if (H >= 0 && H < 60)
+    {
+        *r = C;
+        *g = X;
+        *b = 0;
+    }
+    else if (H >= 60 && H < 120)
+    {
+        *r = X;
+        *g = C;
+        *b = 0;
+    }
+    else if (H >= 120 && H < 180)
+    {
+        *r = 0;
+        *g = C;
+        *b = X;
+    }
+    else if (H >= 180 && H < 240)
+    {
+        *r = 0;
+        *g = X;
+        *b = C;
+    }
+    else if (H >= 240 && H < 300)
+    {
+        *r = X;
+        *g = 0;
+        *b = C;
+    }
+    else
+    {
+        *r = C;
+        *g = 0;
+        *b = X;
+    }
+}
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+float clamp(float a, float min, float max)
+{
+    a = MAX(a, min);
+    a = MIN(a, max);
+
+    return a;
+}
+
+void *genTexturePixels(GLenum format, GLenum type, GLuint repeat, GLuint width, GLuint height, GLint depth = 1,
+                       GLboolean is_array = false)
+{
+    GLuint pixel_size;
+    size_t buffer_size;
+    void *buffer;
+    uint8_t *ptr;
+
+    pixel_size = sizeForFormatType(format, type); //, 0);
+
+    buffer_size = pixel_size * width;
+
+    buffer_size *= height;
+
+    if (depth)
+        buffer_size *= depth;
+
+    buffer = malloc(buffer_size);
+    assert(buffer);
+
+    ptr = (uint8_t *)buffer;
+
+    float r, g, b;
+    float dr, dg, db;
+
+    if (is_array)
+    {
+        r = 0.0;
+        g = 0.0;
+        b = 0.0;
+    }
+    else
+    {
+        r = 1.0;
+        g = 1.0;
+        b = 1.0;
+    }
+
+    dr = 1.0 / width;
+
+    if (height > 1)
+        dg = 1.0 / height;
+    else
+        dg = 0.0;
+
+    if (depth > 1)
+        db = 1.0 / depth;
+    else
+        db = 0.0;
+
+    for (int z = 0; z < depth; z++)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                r = clamp(r, 0.0f, 1.0f);
+                g = clamp(g, 0.0f, 1.0f);
+                b = clamp(b, 0.0f, 1.0f);
+
+                if (y & repeat)
+                {
+                    if (x & repeat)
+                    {
+                        write_pixel(format, type, ptr, r, g, b, 1.0);
+                    }
+                    else
+                    {
+                        write_pixel(format, type, ptr, 0.0, 0.0, 0.0, 1.0);
+                    }
+                }
+                else
+                {
+                    if ((x & repeat) == 0)
+                    {
+                        write_pixel(format, type, ptr, r, g, b, 1.0);
+                    }
+                    else
+                    {
+                        write_pixel(format, type, ptr, 0.0, 0.0, 0.0, 1.0);
+                    }
+                }
+
+                if (is_array)
+                {
+                    r += dr;
+                }
+
+                ptr = ptr + pixel_size;
+            }
+
+            if (is_array)
+            {
+                r = 0.0;
+                g += dg;
+            }
+        }
+
+        if (is_array)
+        {
+            g = 0.0;
+            b += db;
+        }
+    }
+
+    return buffer;
+}
+
+// the shader cache tests write cache files, keep them out of the user's cache directory
+static char shader_cache_dir[PATH_MAX];
+
+static void removeShaderCacheDir(void)
+{
+    DIR *dir;
+    struct dirent *entry;
+
+    dir = opendir(shader_cache_dir);
+    if (dir == NULL)
+        return;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        std::string path;
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        path = std::string(shader_cache_dir) + "/" + entry->d_name;
+        unlink(path.c_str());
+    }
+
+    closedir(dir);
+    rmdir(shader_cache_dir);
+}
+
+// Test fixture class for OpenGL setup
+class MGLTest : public ::testing::Test
+{
+  protected:
+#ifndef MGL_HEADLESS_ONLY
+    static SDL_Window *window;
+#endif
+    static GLMContext glm_ctx;
+    static void *renderer;
+    static int width, height;
+    static int wscaled, hscaled;
+    static bool initialized;
+    static bool headless;
+
+    static void SetUpTestSuite()
+    {
+        if (initialized)
+            return;
+
+        // the cache reads its directory once, on first use
+        if (shader_cache_dir[0] == 0)
+        {
+            snprintf(shader_cache_dir, sizeof(shader_cache_dir), "%s/mgl_test_XXXXXX",
+                     getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+            ASSERT_NE(mkdtemp(shader_cache_dir), nullptr);
+            setenv("MGL_SHADER_CACHE_DIR", shader_cache_dir, 1);
+
+            // registered before the cache's own exit flush, so it runs after it
+            atexit(removeShaderCacheDir);
+        }
+
+        // MGL_HEADLESS=1 runs the suite on the CPU reference backend, no window or GPU needed
+#ifdef MGL_HEADLESS_ONLY
+        headless = true;
+#else
+        headless = (getenv("MGL_HEADLESS") != NULL);
+#endif
+        if (headless)
+        {
+            width = height = wscaled = hscaled = 600;
+
+            glm_ctx = createGLMContext(GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, GL_DEPTH_COMPONENT, GL_FLOAT, 0, 0);
+            MGLsetCurrentContext(glm_ctx);
+
+            renderer = createCPURendererAndBindToContext(glm_ctx, wscaled, hscaled);
+            if (!renderer)
+            {
+                FAIL() << "Couldn't create CPU renderer";
+            }
+            glViewport(0, 0, wscaled, hscaled);
+
+            initialized = true;
+            return;
+        }
+
+#ifndef MGL_HEADLESS_ONLY
+        if (SDL_Init(SDL_INIT_VIDEO) < 0)
+        {
+            FAIL() << "Failed to initialize SDL: " << SDL_GetError();
+        }
+
+        SDL_GL_LoadLibrary("/Users/sagar/Documents/MGL/build/libmgl.dylib");
+
+        window = SDL_CreateWindow("MGL Test", 0, 0, 600, 600,
+                                  SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_METAL);
+
+        if (window == NULL)
+        {
+            FAIL() << "Window could not be created! SDL_Error: " << SDL_GetError();
+        }
+
+        glm_ctx = createGLMContext(GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, GL_DEPTH_COMPONENT, GL_FLOAT, 0, 0);
+        MGLsetCurrentContext(glm_ctx);
+
+        SDL_SysWMinfo info;
+        SDL_VERSION(&info.version);
+        if (!SDL_GetWindowWMInfo(window, &info))
+        {
+            FAIL() << "Couldn't GetWindowWMInfo: " << SDL_GetError();
+        }
+        ASSERT_EQ(info.subsystem, SDL_SYSWM_COCOA);
+
+        renderer = CppCreateMGLRendererFromContextAndBindToWindow(glm_ctx, info.info.cocoa.window);
+        if (!renderer)
+        {
+            FAIL() << "Couldn't create MGL renderer";
+        }
+        SDL_SetWindowData(window, "MGLRenderer", glm_ctx);
+
+        SDL_GL_SetSwapInterval(0);
+        SDL_GetWindowSize(window, &width, &height);
+        SDL_GL_GetDrawableSize(window, &wscaled, &hscaled);
+        glViewport(0, 0, wscaled, hscaled);
+
+        initialized = true;
+#endif
+    }
+
+    static void TearDownTestSuite()
+    {
+        if (headless)
+        {
+            destroyCPURenderer(glm_ctx);
+            initialized = false;
+            return;
+        }
+
+#ifndef MGL_HEADLESS_ONLY
+        if (window)
+        {
+            SDL_DestroyWindow(window);
+        }
+        SDL_Quit();
+        initialized = false;
+#endif
+    }
+
+    void SetUp() override
+    {
+        // Clear any previous OpenGL errors
+        while (glGetError() != GL_NO_ERROR)
+        {
+        }
+
+        // Clear buffers before each test
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    void TearDown() override
+    {
+        // Check for OpenGL errors after each test
+        GLenum error = glGetError();
+        EXPECT_EQ(GL_NO_ERROR, error) << "OpenGL error: " << error;
+    }
+
+    // Helper function to swap buffers
+    void SwapBuffers()
+    {
+        if (headless)
+        {
+            MGLswapBuffers(glm_ctx);
+            return;
+        }
+
+#ifndef MGL_HEADLESS_ONLY
+        MGLswapBuffers((GLMContext)SDL_GetWindowData(window, "MGLRenderer"));
+#endif
+    }
+
+    // Helper function to run test for a few frames
+    void RunFrames(int numFrames, std::function<void()> renderFunc)
+    {
+        for (int frame = 0; frame < numFrames; frame++)
+        {
+            renderFunc();
+            SwapBuffers();
+
+            if (headless)
+                continue;
+
+#ifndef MGL_HEADLESS_ONLY
+            // Process any pending events
+            SDL_Event event;
+            while (SDL_PollEvent(&event))
+            {
+                // Just consume events, don't act on them
+            }
+#endif
+        }
+    }
+
+    // Helper functions from original code
+    GLuint bindDataToVBO(GLenum target, size_t size, void *ptr, GLenum usage)
+    {
+        GLuint vbo = 0;
+        glGenBuffers(1, &vbo);
+        glBindBuffer(target, vbo);
+        glBufferData(target, size, ptr, usage);
+        glBindBuffer(target, 0);
+        return vbo;
+    }
+
+    GLuint bindVAO(GLuint vao = 0)
+    {
+        if (vao)
+        {
+            glBindVertexArray(vao);
+        }
+        else
+        {
+            GLuint new_vao;
+            glCreateVertexArrays(1, &new_vao);
+            glBindVertexArray(new_vao);
+            return new_vao;
+        }
+        return vao;
+    }
+
+    void bindAttribute(GLuint index, GLuint target, GLuint vbo, GLint size, GLenum type, GLboolean normalized,
+                       GLsizei stride, const void *pointer)
+    {
+        glEnableVertexAttribArray(index);
+        glBindBuffer(target, vbo);
+        glVertexAttribPointer(index, size, type, GL_FALSE, stride, pointer);
+    }
+
+    GLuint compileGLSLProgram(GLenum shader_count, ...)
+    {
+        va_list argp;
+        va_start(argp, shader_count);
+        GLuint type;
+        const char *src;
+        GLuint shader;
+
+        GLuint shader_program = glCreateProgram();
+
+        for (int i = 0; i < shader_count; i++)
+        {
+            type = va_arg(argp, GLuint);
+            src = va_arg(argp, const char *);
+            EXPECT_NE(src, nullptr);
+
+            shader = glCreateShader(type);
+            glShaderSource(shader, 1, &src, NULL);
+            glCompileShader(shader);
+
+            // Check compilation status
+            GLint status;
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+            if (status == GL_FALSE)
+            {
+                GLint logLength;
+                glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+                std::vector<char> log(logLength);
+                glGetShaderInfoLog(shader, logLength, nullptr, log.data());
+                ADD_FAILURE() << "Shader compilation failed: " << log.data();
+                return 0;
+            }
+
+            glAttachShader(shader_program, shader);
+        }
+
+        glLinkProgram(shader_program);
+
+        // Check link status
+        GLint status;
+        glGetProgramiv(shader_program, GL_LINK_STATUS, &status);
+        if (status == GL_FALSE)
+        {
+            GLint logLength;
+            glGetProgramiv(shader_program, GL_INFO_LOG_LENGTH, &logLength);
+            std::vector<char> log(logLength);
+            glGetProgramInfoLog(shader_program, logLength, nullptr, log.data());
+            ADD_FAILURE() << "Program linking failed: " << log.data();
+        }
+
+        va_end(argp);
+        return shader_program;
+    }
+
+    GLuint createTexture(GLenum target, GLsizei width, GLsizei height = 1, GLsizei depth = 1, const void *pixels = NULL,
+                         GLint level = 0, GLint internalformat = GL_RGBA8, GLenum format = GL_RGBA,
+                         GLenum type = GL_UNSIGNED_BYTE)
+    {
+        GLuint tex;
+
+        glGenTextures(1, &tex);
+        glBindTexture(target, tex);
+        switch (target)
+        {
+        case GL_TEXTURE_1D:
+            glTexImage1D(target, level, internalformat, width, 0, format, type, pixels);
+            break;
+
+        case GL_TEXTURE_2D:
+            glTexImage2D(target, level, internalformat, width, height, 0, format, type, pixels);
+            break;
+
+        case GL_TEXTURE_3D:
+            glTexImage3D(target, level, internalformat, width, height, depth, 0, format, type, pixels);
+            break;
+
+        case GL_TEXTURE_CUBE_MAP:
+            glTexImage2D(target, level, internalformat, width, height, 0, format, type, pixels);
+            break;
+        }
+        glBindTexture(target, 0);
+
+        return tex;
+    }
+
+    void bufferSubData(GLenum target, GLuint buffer, GLsizei size, const void *ptr)
+    {
+        glBindBuffer(target, buffer);
+        glBufferSubData(target, 0, size, ptr);
+        glBindBuffer(target, 0);
+    }
+
+    // reads back what the last draws left in the drawable, taken before the frame is swapped
+    std::vector<GLubyte> readDrawable()
+    {
+        std::vector<GLubyte> pixels((size_t)wscaled * hscaled * 4);
+
+        glFinish();
+        glReadPixels(0, 0, wscaled, hscaled, GL_BGRA, GL_UNSIGNED_BYTE, pixels.data());
+
+        return pixels;
+    }
+
+    GLuint drawToFramebuffer()
+    {
+        GLuint vbo = 0, vao = 0;
+
+        float points[] = {-1.0f, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 1.0f};
+
+        vbo = bindDataToVBO(GL_ARRAY_BUFFER, 8 * sizeof(float), points, GL_STATIC_DRAW);
+
+        const char *vertex_shader = GLSL(
+            450 core, layout(location = 0) in vec2 position; layout(location = 0) out vec2 texCoord;
+
+            void main(void) {
+                gl_Position = vec4(position.xy, 0.0, 1.0);
+                gl_Position = sign(gl_Position);
+
+                texCoord = (vec2(gl_Position.x, gl_Position.y) + vec2(1.0)) / vec2(2.0);
+            });
+
+        const char *fragment_shader = GLSL(
+            450 core, layout(location = 0) in vec2 texCoord; layout(location = 0) out vec4 frag_colour;
+
+            void main(void) {
+                ivec2 size = ivec2(16, 16);
+                float total = floor(texCoord.x * float(size.x)) + floor(texCoord.y * float(size.y));
+                bool isEven = mod(total, 2.0) == 0.0;
+
+                vec4 col1 = vec4(0.0, 0.0, 0.0, 1.0);
+                vec4 col2 = vec4(1.0, 1.0, 1.0, 1.0);
+
+                frag_colour = (isEven) ? col1 : col2;
+            });
+
+        vao = bindVAO();
+        bindAttribute(0, GL_ARRAY_BUFFER, vbo, 2, GL_FLOAT, false, 0, NULL);
+
+        GLuint shader_program =
+            compileGLSLProgram(2, GL_VERTEX_SHADER, vertex_shader, GL_FRAGMENT_SHADER, fragment_shader);
+        glUseProgram(shader_program);
+
+        GLuint fbo;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+        GLuint tex_attachment = createTexture(GL_TEXTURE_2D, 256, 256);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex_attachment, 0);
+
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        EXPECT_EQ(status, GL_FRAMEBUFFER_COMPLETE);
+
+        glViewport(0, 0, 256, 256);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        glClearColor(1.0, 1.0, 1.0, 1.0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glFinish();
+
+        glDrawBuffer(GL_FRONT);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindVertexArray(0);
+        glUseProgram(0);
+
+        // Cleanup
+        glDeleteBuffers(1, &vbo);
+        glDeleteVertexArrays(1, &vao);
+        glDeleteProgram(shader_program);
+        glDeleteFramebuffers(1, &fbo);
+
+        return tex_attachment;
+    }
+};
+
+// Static member definitions, each executable includes this from its one source file
+#ifndef MGL_HEADLESS_ONLY
+SDL_Window *MGLTest::window = nullptr;
+#endif
+GLMContext MGLTest::glm_ctx = nullptr;
+void *MGLTest::renderer = nullptr;
+int MGLTest::width = 0;
+int MGLTest::height = 0;
+int MGLTest::wscaled = 0;
+int MGLTest::hscaled = 0;
+bool MGLTest::initialized = false;
+bool MGLTest::headless = false;
+
+#endif /* mgl_test_h */